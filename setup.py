@@ -48,6 +48,8 @@ def libraries(filename):
         l.append('usb')
     if hasconfig(filename, 'BLUEZ'):
         l.append('bluetooth')
+    if hasconfig(filename, 'PTHREAD'):
+        l.append('pthread')
     return l
 
 # it is a lot easier to just compile in the lothar sources than to link against them
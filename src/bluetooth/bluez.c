@@ -1,4 +1,6 @@
 #include "utils.h"
+#include "connection.h"
+#include "../btcache.h"
 
 /* Backend for the Linux bluez bluetooth stack */
 
@@ -6,9 +8,12 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/rfcomm.h>
 #include <bluetooth/hci.h>
@@ -34,6 +39,8 @@ static int is_address(char const *address)
   return 1;
 }
 
+#define MAX_RESPONSES 255 // devices an inquiry reports at most
+
 static int find_address(char const *name, char address[18])
 {
   int sock;
@@ -51,8 +58,8 @@ static int find_address(char const *name, char address[18])
   if(sock < 0)
     return -1;
 
-  info = (inquiry_info *)malloc(255 * sizeof(inquiry_info ));
-  count = hci_inquiry(devid, 8, sizeof(info) / sizeof(inquiry_info), NULL, &info, IREQ_CACHE_FLUSH);
+  info = (inquiry_info *)malloc(MAX_RESPONSES * sizeof(inquiry_info ));
+  count = hci_inquiry(devid, 8, MAX_RESPONSES, NULL, &info, IREQ_CACHE_FLUSH);
   if(count < 0)
   {
     LOTHAR_DEBUG("Why does this keep failing? %d %d %s\n", count, errno, strerror(errno));
@@ -80,29 +87,14 @@ static int find_address(char const *name, char address[18])
   return -1; 
 }
 
-void *lothar_bt_new(char const *a_address)
+// open the rfcomm channel of the brick at address
+static int *connect_to(char const *address)
 {
   struct sockaddr_rc addr = {0};
   int status;
+  int yes = 1;
 
   int *sock = (int *)lothar_malloc(sizeof(int));
-  char address[18];
-
-  LOTHAR_DEBUG("connecting to %s\n", a_address);
-
-  if(!is_address(a_address))
-  {
-    LOTHAR_DEBUG("address is probably a friendly name, looking it up\n");
-    if(find_address(a_address, address) < 0)
-    {
-      LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
-      free(sock);
-      return NULL;
-    }
-    LOTHAR_DEBUG("found address %s\n", address);
-  }
-  else
-    strcpy(address, a_address);
 
   *sock = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
 
@@ -113,7 +105,6 @@ void *lothar_bt_new(char const *a_address)
     return NULL;
   }
  
-  int yes = 1;
   setsockopt(*sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
 
   addr.rc_family = AF_BLUETOOTH;
@@ -132,13 +123,97 @@ void *lothar_bt_new(char const *a_address)
   return sock;
 }
 
+// whether the caller stopped waiting for the connection (cancelled is set by another thread, and may be NULL)
+static int given_up(int const volatile *cancelled)
+{
+  if(!cancelled || !*cancelled)
+    return 0;
+
+  LOTHAR_DEBUG("no longer wanted, not connecting\n");
+  return 1;
+}
+
+void *lothar_bt_new(char const *a_address, int const volatile *cancelled)
+{
+  int *sock;
+  char address[18];
+  char buf[256];
+  char const *cache;
+
+  LOTHAR_DEBUG("connecting to %s\n", a_address);
+
+  if(is_address(a_address))
+    return given_up(cancelled) ? NULL : connect_to(a_address);
+
+  // the inquiry takes seconds, try where the brick was last time first
+  cache = lothar_btcache_path(buf, sizeof(buf));
+  if(lothar_btcache_lookup(cache, a_address, address) == 0)
+  {
+    LOTHAR_DEBUG("cached address %s\n", address);
+    if(given_up(cancelled))
+      return NULL;
+    if((sock = connect_to(address)))
+      return sock;
+  }
+
+  LOTHAR_DEBUG("address is probably a friendly name, looking it up\n");
+  if(find_address(a_address, address) < 0)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+    return NULL;
+  }
+  LOTHAR_DEBUG("found address %s\n", address);
+
+  if(given_up(cancelled))
+    return NULL;
+
+  if((sock = connect_to(address)))
+    lothar_btcache_store(cache, a_address, address);
+
+  return sock;
+}
+
+// raise the error for a failed send or recv, a timeout set with lothar_bt_set_timeout() shows up as EAGAIN
+static void failed(void)
+{
+  if(errno == EAGAIN || errno == EWOULDBLOCK)
+    LOTHAR_ERROR(LOTHAR_ERROR_TIMEOUT)
+  else
+    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR)
+}
+
 int lothar_bt_backend_write(void *connection, uint8_t const *data, size_t len)
 {
   int *sock = (int *)connection;
   int status = send(*sock, data, len, 0);
 
   if(status <= 0)
-    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+    failed();
+
+  return status;
+}
+
+// the length prefix comes in as an extra buffer, hence LOTHAR_MAX_IOV + 1
+int lothar_bt_backend_writev(void *connection, lothar_iovec_t const *iov, size_t iovcount)
+{
+  int *sock = (int *)connection;
+  struct iovec buf[LOTHAR_MAX_IOV + 1];
+  size_t i;
+  int status;
+
+  if(iovcount > LOTHAR_MAX_IOV + 1)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  for(i = 0; i < iovcount; ++i)
+  {
+    buf[i].iov_base = (void *)iov[i].data;
+    buf[i].iov_len = iov[i].len;
+  }
+
+  status = writev(*sock, buf, iovcount);
+
+  if(status <= 0)
+    failed();
 
   return status;
 }
@@ -149,11 +224,26 @@ int lothar_bt_backend_read(void *connection, uint8_t *data, size_t len)
   int status = recv(*sock, data, len, 0);
   
   if(status <= 0)
-    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+    failed();
   
   return status;
 }
 
+int lothar_bt_set_timeout(void *connection, uint32_t ms)
+{
+  int *sock = (int *)connection;
+  struct timeval timeout;
+
+  timeout.tv_sec = ms / 1000;
+  timeout.tv_usec = (ms % 1000) * 1000;
+
+  if(setsockopt(*sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+     setsockopt(*sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+
+  return 0;
+}
+
 int lothar_bt_close(void *connection)
 {
   int *sock = (int *)connection;
@@ -1,10 +1,11 @@
 #include "utils.h"
+#include "connection.h"
 
 #ifdef DUMMY_BLUETOOTH
 
 // no bluetooth, using dummies
 
-void *lothar_bt_new(char const *address)
+void *lothar_bt_new(char const *address, int const volatile *cancelled)
 {
   LOTHAR_ERROR(LOTHAR_ERROR_BLUETOOTH_NOT_AVAILABLE);
   return NULL;
@@ -16,12 +17,24 @@ int lothar_bt_backend_write(void *connection, uint8_t const *data, size_t len)
   return -1;
 }
 
+int lothar_bt_backend_writev(void *connection, lothar_iovec_t const *iov, size_t iovcount)
+{
+  LOTHAR_ERROR(LOTHAR_ERROR_BLUETOOTH_NOT_AVAILABLE);
+  return -1;
+}
+
 int lothar_bt_backend_read(void *connection, uint8_t *data, size_t len)
 {
   LOTHAR_ERROR(LOTHAR_ERROR_BLUETOOTH_NOT_AVAILABLE);
   return -1;
 }
 
+int lothar_bt_set_timeout(void *connection, uint32_t ms)
+{
+  LOTHAR_ERROR(LOTHAR_ERROR_BLUETOOTH_NOT_AVAILABLE);
+  return -1;
+}
+
 int lothar_bt_close(void *connection)
 {
   LOTHAR_ERROR(LOTHAR_ERROR_BLUETOOTH_NOT_AVAILABLE);
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "connection.h"
 
 /* Backend for windows bluetooth stack */
 
@@ -14,7 +15,7 @@
 
 #define LOTHAR_WSA_ERROR { LOTHAR_DEBUG("last wsa error %d\n", WSAGetLastError()); LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR); }
 
-void *lothar_bt_new(char const *address)
+void *lothar_bt_new(char const *address, int const volatile *cancelled)
 {
   static int firstcall = 1;
   static WSADATA wsadata;
@@ -44,11 +45,18 @@ void *lothar_bt_new(char const *address)
     return NULL;
   }
   // todo: lookup
+  if(cancelled && *cancelled)
+  {
+    closesocket(*sock);
+    free(sock);
+    return NULL;
+  }
+
   status = connect(*sock, (struct sockaddr *)&addr, sizeof(addr) );
   if (status < 0)
   {
     LOTHAR_WSA_ERROR;
-    shutdown(*sock, SD_BOTH);
+    closesocket(*sock);
     free(sock);
     return NULL;
   }
@@ -67,21 +75,67 @@ int lothar_bt_backend_write(void *connection, uint8_t const *data, size_t len)
   return status;
 }
 
+// the length prefix comes in as an extra buffer, hence LOTHAR_MAX_IOV + 1
+int lothar_bt_backend_writev(void *connection, lothar_iovec_t const *iov, size_t iovcount)
+{
+  SOCKET *sock = (SOCKET *)connection;
+  WSABUF buf[LOTHAR_MAX_IOV + 1];
+  DWORD sent = 0;
+  size_t i;
+
+  if(iovcount > LOTHAR_MAX_IOV + 1)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  for(i = 0; i < iovcount; ++i)
+  {
+    buf[i].buf = (char *)iov[i].data;
+    buf[i].len = (ULONG)iov[i].len;
+  }
+
+  if(WSASend(*sock, buf, (DWORD)iovcount, &sent, 0, NULL, NULL))
+  {
+    LOTHAR_WSA_ERROR;
+    return -1;
+  }
+
+  return (int)sent;
+}
+
 int lothar_bt_backend_read(void *connection, uint8_t *data, size_t len)
 {
   SOCKET *sock = (int *)connection;
   int status = recv(*sock, data, len, 0);
   
-  if(status <= 0)
+  if(status < 0 && WSAGetLastError() == WSAETIMEDOUT)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_TIMEOUT);
+  }
+  else if(status <= 0)
     LOTHAR_WSA_ERROR;
   
   return status;
 }
 
+int lothar_bt_set_timeout(void *connection, uint32_t ms)
+{
+  SOCKET *sock = (SOCKET *)connection;
+  DWORD timeout = ms;
+
+  if(setsockopt(*sock, SOL_SOCKET, SO_RCVTIMEO, (char const *)&timeout, sizeof(timeout)) ||
+     setsockopt(*sock, SOL_SOCKET, SO_SNDTIMEO, (char const *)&timeout, sizeof(timeout)))
+  {
+    LOTHAR_WSA_ERROR;
+    return -1;
+  }
+
+  return 0;
+}
+
 int lothar_bt_close(void *connection)
 {
   SOCKET *sock = (int *)connection;
   int status = shutdown(*sock, SD_BOTH);
+  closesocket(*sock);
   free(sock);
 
   if(status < 0)
@@ -0,0 +1,140 @@
+#include "btcache.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ADDRESS 17  // the length of an address, as in 00:16:53:12:5C:67
+#define LINE    300 // an address, a name (at most 248 bytes for bluetooth) and some slack
+#define ENTRIES 64  // more bricks than anyone has, older entries beyond this are dropped
+
+char const *lothar_btcache_path(char *path, size_t len)
+{
+  char const *env = getenv("LOTHAR_BLUETOOTH_CACHE");
+  char const *home;
+
+  if(env)
+  {
+    if(!*env || strlen(env) >= len)
+      return NULL;
+
+    strcpy(path, env);
+    return path;
+  }
+
+#ifdef _WIN32
+  home = getenv("USERPROFILE");
+#else
+  home = getenv("HOME");
+#endif
+
+  if(!home || strlen(home) + sizeof("/.lothar-bluetooth") > len)
+    return NULL;
+
+  sprintf(path, "%s/.lothar-bluetooth", home);
+  return path;
+}
+
+// split a line of the cache in address and name, returns the name or NULL if the line makes no sense
+static char *parse(char *line)
+{
+  size_t n = strlen(line);
+
+  while(n && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+    line[--n] = '\0';
+
+  if(n < ADDRESS + 2 || line[ADDRESS] != ' ')
+    return NULL;
+
+  line[ADDRESS] = '\0';
+  return line + ADDRESS + 1;
+}
+
+int lothar_btcache_lookup(char const *path, char const *name, char address[18])
+{
+  FILE *file;
+  char line[LINE];
+  char *n;
+  int result = -1;
+
+  if(!path || !(file = fopen(path, "r")))
+    return -1;
+
+  while(result < 0 && fgets(line, sizeof(line), file))
+  {
+    if((n = parse(line)) && !strcmp(n, name))
+    {
+      strcpy(address, line);
+      result = 0;
+    }
+  }
+
+  fclose(file);
+
+  return result;
+}
+
+int lothar_btcache_store(char const *path, char const *name, char const *address)
+{
+  FILE *file;
+  char tmp[LINE + 32];
+  char (*lines)[LINE];
+  size_t count = 0;
+  size_t i;
+  char *n;
+
+  if(!path || strlen(address) != ADDRESS || strlen(name) >= LINE - ADDRESS - 2 || strlen(path) + 24 > sizeof(tmp))
+    return -1;
+
+  lines = (char (*)[LINE])lothar_malloc(ENTRIES * LINE);
+
+  // the other entries, newest first
+  strcpy(lines[count++], address);
+  strcpy(lines[0] + ADDRESS + 1, name);
+  lines[0][ADDRESS] = ' ';
+
+  if((file = fopen(path, "r")))
+  {
+    while(count < ENTRIES && fgets(lines[count], LINE, file))
+    {
+      if((n = parse(lines[count])) && strcmp(n, name))
+      {
+        n[-1] = ' ';
+        ++count;
+      }
+    }
+    fclose(file);
+  }
+
+  // written aside and moved in place, so that nobody ever reads half a cache
+  sprintf(tmp, "%s.%llu", path, (unsigned long long)lothar_time_us());
+
+  if(!(file = fopen(tmp, "w")))
+  {
+    free(lines);
+    return -1;
+  }
+
+  for(i = 0; i < count; ++i)
+    fprintf(file, "%s\n", lines[i]);
+
+  free(lines);
+
+  if(fclose(file))
+  {
+    remove(tmp);
+    return -1;
+  }
+
+#ifdef _WIN32
+  remove(path); // rename does not replace on windows
+#endif
+
+  if(rename(tmp, path))
+  {
+    remove(tmp);
+    return -1;
+  }
+
+  return 0;
+}
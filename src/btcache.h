@@ -0,0 +1,21 @@
+#ifndef BTCACHE_H
+#define BTCACHE_H
+
+#include <stddef.h>
+
+/* a cache of the bluetooth addresses of bricks by name, so that opening one by name does not take an inquiry scan
+ *
+ * The cache is a text file with a line "00:16:53:12:5C:67 NXT" per brick. It is only a hint: a stale address just
+ * fails to connect, after which the name is looked up again. */
+
+// where the cache lives: $LOTHAR_BLUETOOTH_CACHE if set (to an empty string to not cache at all), or .lothar-bluetooth
+// in the home directory. returns path, or NULL if there is no cache
+char const *lothar_btcache_path(char *path, size_t len);
+
+// the address of the brick called name, returns 0 if it is in the cache at path, -1 if not
+int lothar_btcache_lookup(char const *path, char const *name, char address[18]);
+
+// remember the address of the brick called name, replacing any address it had, returns 0 on success, -1 on failure
+int lothar_btcache_store(char const *path, char const *name, char const *address);
+
+#endif // BTCACHE_H
@@ -0,0 +1,38 @@
+#include "codec.h"
+
+// in the order of the table (a table indexed by opcode would need designated initializers, which not every C compiler has)
+#define COMMAND(NAME, opcode, type, request, reply, flags) {#NAME, opcode, type, request, reply, flags},
+
+static lothar_codec_command_t const commands[] =
+{
+  LOTHAR_CODEC_COMMANDS(COMMAND)
+};
+
+#undef COMMAND
+
+// the position of every command in commands
+#define POSITION(NAME, opcode, type, request, reply, flags) POSITION_##NAME,
+
+enum position
+{
+  LOTHAR_CODEC_COMMANDS(POSITION)
+  COMMANDS
+};
+
+#undef POSITION
+
+static lothar_codec_command_t const unknown = {NULL, 0, 0, 0, 0, 0};
+
+lothar_codec_command_t const *lothar_codec_command(uint8_t opcode)
+{
+#define CASE(NAME, opcode, type, request, reply, flags) case opcode: return commands + POSITION_##NAME;
+
+  switch(opcode)
+  {
+    LOTHAR_CODEC_COMMANDS(CASE)
+  default:
+    return &unknown;
+  }
+
+#undef CASE
+}
@@ -1,499 +1,2399 @@
 #include "commands.h"
+#include "replies.h"
+#include "codec.h"
+#include "system.h"
 #include "connection.h"
+#include "connection_private.h"
+#include "thread.h"
 #include "utils.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 
-/* command definitions */
-
-#define STARTPROGRAM          0x00
-#define STOPPROGRAM           0x01
-#define PLAYSOUNDFILE         0x02
-#define PLAYTONE              0x03
-#define SETOUTPUTSTATE        0x04
-#define SETINPUTMODE          0x05
-#define GETOUTPUTSTATE        0x06
-#define GETINPUTVALUES        0x07
-#define RESETINPUTSCALEDVALUE 0x08
-#define MESSAGEWRITE          0x09
-#define RESETMOTORPOSITION    0x0A
-#define GETBATTERYLEVEL       0x0B
-#define STOPSOUNDPLAYBACK     0x0C
-#define KEEPALIVE             0x0D
-#define LSGETSTATUS           0x0E
-#define LSWRITE               0x0F
-#define LSREAD                0x10
-#define GETCURRENTPROGRAMNAME 0x11
-#define MESSAGEREAD           0x13
+/* utilities */
+
+// the largest reply the brick sends to a direct command
+#define MAX_REPLY 64
+
+// from here, everything returns 0 on success, lothar_errno on failure
+
+/* requests are built in place, in the frame storage of the connection (or in threaded mode, in a slot of the
+ * submission ring). So sending a command does not need to allocate or copy anything. */
+
+// the number of requests still waiting for their reply
+static inline size_t outstanding(lothar_connection_t const *connection)
+{
+  return connection->sent - connection->received;
+}
+
+static void keep(lothar_connection_t *connection, int status);
+static int receive(lothar_connection_t *connection);
+
+// attribute the last error raised on this thread to a request (port is ignored if the command has none)
+static void blame(lothar_connection_t const *connection, uint8_t command, uint8_t port)
+{
+  lothar_error_blame(connection, command, lothar_codec_command(command)->flags & LOTHAR_CODEC_PORT ? port : -1);
+}
+
+/* threaded mode
+ *
+ * Commands claim a slot in the ring of the connection, build their request in it, and hand it to the I/O thread. The
+ * I/O thread is the only one to read or write the connection, it uses the same pending queue as the other modes, and
+ * reports the result of every request through the completion of its submitter.
+ */
+
+// the slot a request was built in, buf as returned by frame()
+static lothar_slot_t *slot_of(uint8_t *buf)
+{
+  return (lothar_slot_t *)(buf - offsetof(lothar_slot_t, frame));
+}
+
+// claim the next slot of a ring, waits while the ring is full
+static lothar_slot_t *claim(lothar_lane_t *lane)
+{
+  size_t pos = lothar_atomic_load(&lane->head);
+
+  for(;;)
+  {
+    lothar_slot_t *slot = lane->ring + pos % LOTHAR_RING_SIZE;
+    ptrdiff_t diff = (ptrdiff_t)(lothar_atomic_load(&slot->sequence) - pos);
+
+    if(diff == 0 && lothar_atomic_cas(&lane->head, pos, pos + 1))
+      return slot;
+
+    if(diff < 0) // the I/O thread has not written the request that was here a round ago
+      lothar_thread_yield();
+
+    pos = lothar_atomic_load(&lane->head);
+  }
+}
+
+// the request at the tail of a ring, or NULL if it is not ready for the I/O thread
+static lothar_slot_t *ready(lothar_lane_t *lane)
+{
+  lothar_slot_t *slot = lane->ring + lane->tail % LOTHAR_RING_SIZE;
+
+  return lothar_atomic_load(&slot->sequence) == lane->tail + 1 ? slot : NULL;
+}
+
+// hand a claimed slot to the I/O thread
+static void publish(lothar_io_t *io, lothar_slot_t *slot)
+{
+  lothar_atomic_store(&slot->sequence, slot->sequence + 1);
+
+  if(lothar_atomic_load(&io->sleeping))
+  {
+    lothar_mutex_lock(&io->mutex);
+    lothar_cond_signal(&io->work);
+    lothar_mutex_unlock(&io->mutex);
+  }
+}
+
+// wait until the I/O thread reports the result of a request
+static int await(lothar_io_t *io, lothar_completion_t *completion)
+{
+  lothar_mutex_lock(&io->mutex);
+  while(!completion->done)
+    lothar_cond_wait(&io->done, &io->mutex);
+  lothar_mutex_unlock(&io->mutex);
+
+  if(completion->status < 0)
+    lothar_error_raise(-completion->status); // it was raised on the I/O thread
+
+  return completion->status;
+}
+
+// report the result of a request to its submitter, counted if it expected a reply
+static void finish(lothar_io_t *io, lothar_pending_t const *pending, int status, int counted)
+{
+  lothar_mutex_lock(&io->mutex);
+
+  if(pending->completion)
+  {
+    pending->completion->status = status;
+    pending->completion->done = 1;
+  }
+  else if(status < 0 && !io->status) // an asynchronous command, the error was passed to its callback
+  {
+    io->status = status;
+    lothar_error_record(&io->failure);
+  }
+
+  if(counted)
+    lothar_atomic_add(&io->completed, 1);
+
+  lothar_cond_broadcast(&io->done);
+  lothar_mutex_unlock(&io->mutex);
+}
+
+// wait until no more than pending requests that expect a reply are outstanding
+static int io_dispatch(lothar_io_t *io, size_t pending)
+{
+  lothar_error_record_t failure;
+  int status;
+
+  lothar_mutex_lock(&io->mutex);
+
+  while(lothar_atomic_load(&io->submitted) - lothar_atomic_load(&io->completed) > pending)
+    lothar_cond_wait(&io->done, &io->mutex);
+
+  status = io->status;
+  io->status = 0;
+  failure = io->failure;
+
+  lothar_mutex_unlock(&io->mutex);
+
+  if(status < 0)
+    lothar_error_restore(&failure); // it was raised on the I/O thread
+
+  return status;
+}
+
+// write the requests held back while combining
+static int flush(lothar_connection_t *connection)
+{
+  size_t count = connection->batched;
+  size_t i;
+  int status;
+
+  if(!count)
+    return 0;
+
+  connection->batched = 0;
+  connection->transmitted = lothar_time_us();
+
+  if((status = lothar_connection_writebatch(connection, connection->batch, count)) >= 0)
+    return 0;
+
+  for(i = 0; i < count; ++i)
+  {
+    lothar_opcode_stats_t *stats = lothar_stats_of(connection, connection->combined[i][1]);
+
+    if(stats)
+      ++stats->errors;
+  }
+
+  return -lothar_errno;
+}
+
+/* coalescing
+ *
+ * A setoutputstate that waits on the host to be written is replaced by a newer one for its port, see
+ * lothar_coalesce_begin(). One for OUTPUT_ALL replaces those for any port. */
+
+// the index of the output a setoutputstate is for (OUTPUT_ALL last), or -1 if the frame cannot be coalesced
+static int output_of(uint8_t const *frame)
+{
+  uint8_t port;
+
+  if(frame[1] != LOTHAR_OPCODE_SETOUTPUTSTATE)
+    return -1;
+
+  port = lothar_setoutputstate_request_port(frame);
+  if(port <= OUTPUT_C)
+    return port;
+
+  return port == OUTPUT_ALL ? LOTHAR_OUTPUTS - 1 : -1;
+}
+
+// whether a command for output newer replaces the one for output older
+static int supersedes(int newer, int older)
+{
+  return newer == older || newer == LOTHAR_OUTPUTS - 1;
+}
+
+// (while combining) drop the held back commands a new frame replaces, they were counted as written when held
+// only those after the last other command are replaced, the new frame goes at the end and must not overtake it
+static void supersede(lothar_connection_t *connection, uint8_t const *frame)
+{
+  int output = output_of(frame);
+  size_t kept;
+  size_t i;
+
+  if(output < 0)
+    return;
+
+  for(kept = connection->batched; kept && output_of(connection->combined[kept - 1]) >= 0; --kept)
+    ;
+
+  for(i = kept; i < connection->batched; ++i)
+  {
+    int older = output_of(connection->combined[i]);
+
+    if(older >= 0 && supersedes(output, older))
+    {
+      lothar_opcode_stats_t *stats = lothar_stats_of(connection, LOTHAR_OPCODE_SETOUTPUTSTATE);
+
+      if(stats)
+      {
+	--stats->requests;
+	stats->bytes_written -= connection->batch[i].len;
+      }
+
+      ++connection->dropped[older];
+    }
+    else
+    {
+      // the data of every entry points to its own frame storage
+      if(kept != i)
+      {
+	memcpy(connection->combined[kept], connection->combined[i], connection->batch[i].len);
+	connection->batch[kept].len = connection->batch[i].len;
+      }
+      ++kept;
+    }
+  }
+
+  connection->batched = kept;
+}
+
+// write a frame to the connection, or hold it back if it expects no reply while combining
+static int transmit(lothar_connection_t *connection, uint8_t const *frame, size_t len)
+{
+  lothar_opcode_stats_t *stats = lothar_stats_of(connection, frame[1]);
+  int status;
+
+  if(connection->combining && frame[0] == LOTHAR_CODEC_NO_REPLY)
+  {
+    if(connection->coalescing)
+      supersede(connection, frame);
+
+    if(connection->batched == LOTHAR_MAX_BATCH && (status = flush(connection)) < 0)
+      return status;
+
+    memcpy(connection->combined[connection->batched], frame, len);
+    connection->batch[connection->batched].data = connection->combined[connection->batched];
+    connection->batch[connection->batched].len = len;
+    ++connection->batched;
+
+    if(stats)
+    {
+      ++stats->requests;
+      stats->bytes_written += len;
+    }
+
+    return 0;
+  }
+
+  // the brick has to see the requests in the order they were made
+  if((status = flush(connection)) < 0)
+    return status;
+
+  connection->transmitted = lothar_time_us();
+  status = lothar_connection_write(connection, frame, len);
+
+  if(stats)
+  {
+    ++stats->requests;
+    stats->bytes_written += len;
+    if(status != len)
+      ++stats->errors;
+  }
+
+  if(status == len)
+    return 0;
+
+  // a custom backend may fail without raising an error
+  if(status >= 0 || !lothar_errno)
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_WRITE_ERROR);
+  return -lothar_errno;
+}
+
+static int complete(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *reply);
+
+// (on the I/O thread) write the request in a slot, and queue it if it expects a reply
+static void io_write(lothar_connection_t *connection, lothar_slot_t *slot)
+{
+  int status = transmit(connection, slot->frame, slot->len);
+
+  if(slot->frame[0] == LOTHAR_CODEC_NO_REPLY)
+    finish(connection->io, &slot->pending, status, 0);
+  else if(status < 0)
+    complete(connection, &slot->pending, status, NULL);
+  else
+  {
+    slot->pending.sent = connection->transmitted;
+    connection->pending[connection->sent++ % LOTHAR_MAX_PENDING] = slot->pending;
+  }
+}
+
+// (on the I/O thread) hand the slot at the tail of a ring back to the submitters
+static void release(lothar_lane_t *lane, lothar_slot_t *slot)
+{
+  lothar_atomic_store(&slot->sequence, lane->tail + LOTHAR_RING_SIZE);
+  lothar_atomic_store(&lane->tail, lane->tail + 1);
+}
+
+// (on the I/O thread) take a setoutputstate to coalesce from its ring, it replaces the held ones it supersedes
+static void hold(lothar_connection_t *connection, lothar_slot_t *slot)
+{
+  lothar_io_t *io = connection->io;
+  int output = output_of(slot->frame);
+  int i;
+
+  for(i = 0; i < LOTHAR_OUTPUTS; ++i)
+  {
+    if(io->held[i].order && supersedes(output, i))
+    {
+      io->held[i].order = 0;
+      ++connection->dropped[i];
+    }
+  }
+
+  memcpy(io->held[output].frame, slot->frame, LOTHAR_REQUEST_SIZE_SETOUTPUTSTATE);
+  io->held[output].order = ++io->holds;
+}
+
+// (on the I/O thread) the held setoutputstate that was taken first, NULL if none is held
+static lothar_held_t *oldest(lothar_io_t *io)
+{
+  lothar_held_t *held = NULL;
+  int i;
+
+  for(i = 0; i < LOTHAR_OUTPUTS; ++i)
+  {
+    if(io->held[i].order && (!held || io->held[i].order < held->order))
+      held = io->held + i;
+  }
+
+  return held;
+}
+
+// (on the I/O thread) write a held setoutputstate, nobody waits for it so an error goes to lothar_async_dispatch()
+static void io_write_held(lothar_connection_t *connection, lothar_held_t *held)
+{
+  lothar_pending_t none;
+  int status;
+
+  held->order = 0;
+
+  if((status = transmit(connection, held->frame, LOTHAR_REQUEST_SIZE_SETOUTPUTSTATE)) < 0)
+  {
+    blame(connection, LOTHAR_OPCODE_SETOUTPUTSTATE, lothar_setoutputstate_request_port(held->frame));
+
+    memset(&none, 0, sizeof(none));
+    finish(connection->io, &none, status, 0);
+  }
+}
+
+// (on the I/O thread) the ring of the most urgent request that is ready, NULL if there is none
+static lothar_lane_t *next(lothar_io_t *io, lothar_slot_t **slot)
+{
+  size_t p;
+
+  for(p = LOTHAR_PRIORITIES; p--; )
+  {
+    if((*slot = ready(io->lanes + p)))
+      return io->lanes + p;
+  }
+
+  return NULL;
+}
+
+// (on the I/O thread) wait for a request, or for being stopped
+static void io_sleep(lothar_io_t *io)
+{
+  lothar_slot_t *slot;
+
+  lothar_mutex_lock(&io->mutex);
+  lothar_atomic_store(&io->sleeping, 1);
+
+  while(!next(io, &slot) && !lothar_atomic_load(&io->stopping))
+    lothar_cond_wait(&io->work, &io->mutex);
+
+  lothar_atomic_store(&io->sleeping, 0);
+  lothar_mutex_unlock(&io->mutex);
+}
+
+static void io_run(void *data)
+{
+  lothar_connection_t *connection = (lothar_connection_t *)data;
+  lothar_io_t *io = connection->io;
+  lothar_lane_t *lane;
+  lothar_slot_t *slot;
+  lothar_held_t *held;
+
+  for(;;)
+  {
+    lane = next(io, &slot);
+
+    // a setoutputstate to coalesce is held until the rings have no newer ones, and then goes before anything else
+    if(lane && slot->coalesce)
+    {
+      hold(connection, slot);
+      release(lane, slot);
+    }
+    else if((held = oldest(io)))
+      io_write_held(connection, held);
+    // write all there is (the most urgent first) before waiting for a reply, as long as there is room to keep track
+    // of the replies, a request without one can always go
+    else if(lane && (slot->frame[0] == LOTHAR_CODEC_NO_REPLY || outstanding(connection) < LOTHAR_MAX_PENDING))
+    {
+      io_write(connection, slot);
+      release(lane, slot);
+    }
+    else if(outstanding(connection))
+      receive(connection); // errors are reported through the completions
+    else if(lothar_atomic_load(&io->stopping))
+      break;
+    else
+      io_sleep(io);
+  }
+}
+
+static void io_free(lothar_io_t *io)
+{
+  lothar_cond_destroy(&io->done);
+  lothar_cond_destroy(&io->work);
+  lothar_mutex_destroy(&io->mutex);
+  free(io);
+}
+
+/* sending requests */
+
+// start a request, returns the frame to write its fields in (or NULL if there is no connection)
+static uint8_t *frame(lothar_connection_t *connection, uint8_t command)
+{
+  uint8_t type = lothar_codec_command(command)->type;
+  lothar_slot_t *slot;
+  uint8_t *buf;
+
+  if(!connection)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+    return NULL;
+  }
+
+  if(connection->io)
+  {
+    // callbacks run on the I/O thread, which cannot wait for itself
+    if(lothar_thread_is_self(&connection->io->thread))
+    {
+      LOTHAR_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+      return NULL;
+    }
+
+    slot = claim(connection->io->lanes + connection->priority[command]);
+    slot->coalesce = 0;
+    buf = slot->frame;
+  }
+  else
+  {
+    // make room for the reply before building, the callback of an asynchronous command may send commands of its own
+    if(type != LOTHAR_CODEC_NO_REPLY && outstanding(connection) == LOTHAR_MAX_PENDING)
+      keep(connection, receive(connection));
+
+    buf = connection->frame;
+  }
+
+  buf[0] = type;
+  buf[1] = command;
+  
+  return buf;
+}
+
+// send the request started with frame(), len bytes in all
+static int send(lothar_connection_t *connection, uint8_t *buf, size_t len)
+{
+  uint8_t command = buf[1];
+  uint8_t port = buf[2];
+  int status;
+
+  if(connection->io)
+  {
+    lothar_slot_t *slot = slot_of(buf);
+    lothar_completion_t completion = {0, 0};
+
+    slot->len = len;
+
+    // a command a newer one may replace is not waited for
+    if(connection->coalescing && output_of(buf) >= 0)
+    {
+      slot->coalesce = 1;
+      slot->pending.completion = NULL;
+
+      publish(connection->io, slot);
+      return 0;
+    }
+
+    slot->pending.completion = &completion;
+
+    publish(connection->io, slot);
+    status = await(connection->io, &completion);
+  }
+  else
+    status = transmit(connection, connection->frame, len);
+
+  if(status < 0)
+    blame(connection, command, port);
+
+  return status;
+}
+
+// check the header and status byte of a reply
+static int check(lothar_pending_t const *pending, uint8_t *buf, size_t len)
+{
+  uint8_t command = pending->command;
+
+  if(len < 3 || buf[0] != 0x02 || buf[1] != command)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+  
+  /* explicitly ignore a pending communication error on lsgetstatus */
+  if(command == LOTHAR_OPCODE_LSGETSTATUS && buf[2] == LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS && !pending->busy)
+  {
+    lothar_lsgetstatus_reply_set_bytesready(buf, 0);
+    return 0;
+  }
+
+  /* an empty mailbox or a busy bus is what polling usually finds, it is reported without the warning */
+  if((command == LOTHAR_OPCODE_MESSAGEREAD && buf[2] == LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY) ||
+     ((command == LOTHAR_OPCODE_LSREAD || command == LOTHAR_OPCODE_LSGETSTATUS) && buf[2] == LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS))
+  {
+    lothar_error_raise(buf[2]);
+    return -lothar_errno;
+  }
+
+  if (buf[2])
+  {
+    int e = buf[2]; // this is only to surpress a compiler warning (comparison always true due to range of data type)
+    LOTHAR_RETURN_ERROR(e);
+  }
+  return 0;
+}
+
+/* pipelining 
+ *
+ * The brick answers requests in the order it received them, so every request that expects a reply is queued on the
+ * connection. Replies are read in that same order, and handed to the decoder of the request at the front of the queue.
+ * Requests are numbered in the order they were sent, so a command can tell when its own reply has been read.
+ */
+
+// remember the first error that could not be returned directly
+static void keep(lothar_connection_t *connection, int status)
+{
+  if(status < 0 && !connection->pipeline_status)
+    connection->pipeline_status = status;
+}
+
+// hand the reply (or the error, in which case reply is NULL) to the decoder of the request
+static int complete(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *reply)
+{
+  ++connection->dispatching;
+  status = pending->decode(connection, pending, status, reply);
+  --connection->dispatching;
+
+  if(status < 0)
+    blame(connection, pending->command, pending->port);
+
+  if(connection->io)
+    finish(connection->io, pending, status, 1);
+
+  return status;
+}
+
+// count a reply (of len bytes, 0 if none was read) in the statistics of its opcode
+static void account(lothar_connection_t *connection, lothar_pending_t const *pending, size_t len, int status)
+{
+  lothar_opcode_stats_t *stats = lothar_stats_of(connection, pending->command);
+  uint64_t rtt;
+
+  if(!stats)
+    return;
+
+  if(len)
+  {
+    rtt = lothar_time_us() - pending->sent;
+
+    ++stats->replies;
+    stats->bytes_read += len;
+    stats->rtt_total += rtt;
+    ++stats->rtt[lothar_stats_bucket(rtt)];
+  }
+
+  if(status < 0)
+    ++stats->errors;
+}
+
+// read the reply to the oldest outstanding request, and pass it on to that requests decoder
+static int receive(lothar_connection_t *connection)
+{
+  lothar_pending_t pending = connection->pending[connection->received++ % LOTHAR_MAX_PENDING];
+  uint8_t buf[MAX_REPLY];
+  uint8_t found = 0;
+  int status = 0;
+
+  // the replies to requests that timed out arrive first, if at all: a lost request is never answered, so the
+  // first reply to the command of this request is taken as its own, and ends the wait for the late ones
+  while(connection->late && (status = lothar_connection_read(connection, buf, MAX_REPLY)) >= 0)
+  {
+    if(status >= 2 && buf[1] == pending.command)
+    {
+      connection->late = 0;
+      found = 1;
+      break;
+    }
+
+    --connection->late;
+  }
+
+  if(status >= 0 && !found)
+    status = lothar_connection_read(connection, buf, pending.size);
+
+  // a reply that reports an error may be cut short (i.e. a system command leaves out the data it could not read)
+  if(status >= 3 && buf[1] == pending.command && (status == (int)pending.size || (status < (int)pending.size && buf[2])))
+  {
+    size_t len = status;
+
+    status = check(&pending, buf, len);
+    account(connection, &pending, len, status);
+    return complete(connection, &pending, status, buf);
+  }
+
+  // the replies no longer line up with the requests, none of the outstanding requests can be trusted 
+  if(status >= 0 || !lothar_errno)
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+  status = -lothar_errno;
+
+  // a slow brick still answers these, a lost one does not (and then it does not matter)
+  if(status == -LOTHAR_ERROR_TIMEOUT)
+    connection->late += 1 + outstanding(connection);
+
+  account(connection, &pending, 0, status);
+  complete(connection, &pending, status, NULL);
+
+  while(outstanding(connection))
+  {
+    pending = connection->pending[connection->received++ % LOTHAR_MAX_PENDING];
+    account(connection, &pending, 0, status);
+    complete(connection, &pending, status, NULL);
+  }
+
+  return status;
+}
+
+// send the request started with frame() and queue it, then wait for its reply (unless pipelining or asynchronous)
+static int request(lothar_connection_t *connection, lothar_pending_t const *pending, uint8_t *buf, size_t len)
+{
+  size_t ticket;
+  int status;
+
+  if(connection->io)
+  {
+    lothar_slot_t *slot = slot_of(buf);
+    lothar_completion_t completion = {0, 0};
+
+    slot->len = len;
+    slot->pending = *pending;
+    slot->pending.completion = pending->callback ? NULL : &completion;
+
+    lothar_atomic_add(&connection->io->submitted, 1);
+    publish(connection->io, slot);
+
+    if(pending->callback)
+      return 0;
+
+    if((status = await(connection->io, &completion)) < 0)
+      blame(connection, pending->command, pending->port);
+
+    return status;
+  }
+
+  // waiting for a reply from a callback would have the reply of the command we are called from read by us
+  if(connection->dispatching && (!connection->pipelined || pending->wait) && !pending->callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if((status = send(connection, buf, len)) < 0)
+    return status;
+
+  ticket = connection->sent++;
+  connection->pending[ticket % LOTHAR_MAX_PENDING] = *pending;
+  connection->pending[ticket % LOTHAR_MAX_PENDING].sent = connection->transmitted;
+
+  if((connection->pipelined && !pending->wait) || pending->callback)
+    return 0;
+
+  while(connection->received < ticket) // earlier requests first
+    keep(connection, receive(connection));
+
+  if(connection->received == ticket)
+    return receive(connection);
+
+  // our request was lost together with an earlier one
+  LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+}
+
+int lothar_pipeline_begin(lothar_connection_t *connection)
+{
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  // in threaded mode, every thread has its own requests in flight already
+  if(connection->io)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  connection->pipelined = 1;
+  return 0;
+}
+
+int lothar_pipeline_sync(lothar_connection_t *connection)
+{
+  int status;
+
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(connection->io)
+    return lothar_async_dispatch(connection, 0);
+
+  while(outstanding(connection))
+    keep(connection, receive(connection));
+
+  status = connection->pipeline_status;
+  connection->pipeline_status = 0;
+
+  return status;
+}
+
+int lothar_pipeline_end(lothar_connection_t *connection)
+{
+  int status = lothar_pipeline_sync(connection);
+
+  if(connection)
+    connection->pipelined = 0;
+
+  return status;
+}
+
+int lothar_combine_begin(lothar_connection_t *connection)
+{
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  // the I/O thread writes whatever is submitted, there is no window to combine in
+  if(connection->io)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  connection->combining = 1;
+  return 0;
+}
+
+int lothar_combine_flush(lothar_connection_t *connection)
+{
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  return flush(connection);
+}
+
+int lothar_combine_end(lothar_connection_t *connection)
+{
+  int status = lothar_combine_flush(connection);
+
+  if(connection)
+    connection->combining = 0;
+
+  return status;
+}
+
+int lothar_coalesce_begin(lothar_connection_t *connection)
+{
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  connection->coalescing = 1;
+  return 0;
+}
+
+int lothar_coalesce_end(lothar_connection_t *connection)
+{
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  connection->coalescing = 0;
+  return 0;
+}
+
+int lothar_coalesce_dropped(lothar_connection_t const *connection, enum lothar_output_port port, size_t *dropped)
+{
+  int output;
+
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(port <= OUTPUT_C)
+    output = port;
+  else if(port == OUTPUT_ALL)
+    output = LOTHAR_OUTPUTS - 1;
+  else
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(dropped)
+    *dropped = connection->dropped[output];
+
+  return 0;
+}
+
+int lothar_pipeline_pending(lothar_connection_t const *connection, size_t *pending)
+{
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(pending)
+  {
+    if(connection->io)
+      *pending = lothar_atomic_load(&connection->io->submitted) - lothar_atomic_load(&connection->io->completed);
+    else
+      *pending = outstanding(connection);
+  }
+
+  return 0;
+}
+
+int lothar_async_dispatch(lothar_connection_t *connection, size_t pending)
+{
+  int status = 0;
+
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(connection->io)
+  {
+    if(lothar_thread_is_self(&connection->io->thread))
+      LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+    return io_dispatch(connection->io, pending);
+  }
+
+  while(outstanding(connection) > pending)
+  {
+    int s = receive(connection);
+
+    keep(connection, s);
+    if(s < 0 && !status)
+      status = s;
+  }
+
+  return status;
+}
+
+int lothar_io_thread_start(lothar_connection_t *connection)
+{
+  lothar_io_t *io;
+  size_t p;
+  size_t i;
+  int status;
+
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(connection->io)
+    return 0;
+
+  // the I/O thread takes over reading the replies, it cannot know about the ones already outstanding
+  if(connection->pipelined || connection->combining || outstanding(connection))
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  io = (lothar_io_t *)lothar_malloc(sizeof(lothar_io_t));
+  memset(io, 0, sizeof(lothar_io_t));
+
+  for(p = 0; p < LOTHAR_PRIORITIES; ++p)
+  {
+    for(i = 0; i < LOTHAR_RING_SIZE; ++i)
+      io->lanes[p].ring[i].sequence = i;
+  }
+
+  lothar_mutex_init(&io->mutex);
+  lothar_cond_init(&io->work);
+  lothar_cond_init(&io->done);
+
+  connection->io = io;
+
+  if((status = lothar_thread_create(&io->thread, io_run, connection)) < 0)
+  {
+    connection->io = NULL;
+    io_free(io);
+  }
+
+  return status;
+}
+
+int lothar_io_thread_stop(lothar_connection_t *connection)
+{
+  lothar_io_t *io;
+  int status;
+
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(!(io = connection->io))
+    return 0;
+
+  if(lothar_thread_is_self(&io->thread))
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  // the I/O thread finishes everything submitted before it exits
+  lothar_atomic_store(&io->stopping, 1);
+
+  lothar_mutex_lock(&io->mutex);
+  lothar_cond_signal(&io->work);
+  lothar_mutex_unlock(&io->mutex);
+
+  status = lothar_thread_join(&io->thread);
+
+  connection->io = NULL;
+  io_free(io);
+
+  return status;
+}
+
+int lothar_set_priority(lothar_connection_t *connection, uint8_t opcode, enum lothar_priority priority)
+{
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(priority < LOTHAR_PRIORITY_NORMAL || priority >= LOTHAR_PRIORITIES)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  connection->priority[opcode] = priority;
+  return 0;
+}
+
+int lothar_io_queue_depth(lothar_connection_t const *connection, enum lothar_priority priority, size_t *depth)
+{
+  lothar_lane_t *lane;
+
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(priority < LOTHAR_PRIORITY_NORMAL || priority >= LOTHAR_PRIORITIES)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(depth)
+  {
+    if(connection->io)
+    {
+      lane = connection->io->lanes + priority;
+      *depth = lothar_atomic_load(&lane->head) - lothar_atomic_load(&lane->tail);
+    }
+    else
+      *depth = 0;
+  }
+
+  return 0;
+}
+
+/* commands: */
+
+/* transact, any command from its frame */
+
+static int decode_transact(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  (void)connection;
+
+  if(status >= 0 && pending->out[0])
+    memcpy(pending->out[0], buf, pending->size);
+
+  return status < 0 ? status : 0;
+}
+
+int lothar_transact(lothar_connection_t *connection, uint8_t const *telegram, size_t len, uint8_t *reply, size_t bufsize)
+{
+  lothar_codec_command_t const *command;
+  lothar_pending_t pending = {0, 0, decode_transact};
+  uint8_t *buf;
+
+  if(!telegram || len < 2 || len > LOTHAR_MAX_TELEGRAM)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  command = lothar_codec_command(telegram[1]);
+
+  if(!command->name || telegram[0] != command->type || (command->flags & LOTHAR_CODEC_VARIABLE_REPLY))
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(command->flags & LOTHAR_CODEC_VARIABLE_REQUEST ? len < command->request : len != command->request)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(command->flags & LOTHAR_CODEC_PORT)
+    pending.port = telegram[2];
+
+  if(command->type != LOTHAR_CODEC_NO_REPLY && reply && bufsize < command->reply)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_BUFFER_TOO_SMALL);
+
+  if(!(buf = frame(connection, command->opcode)))
+    return -lothar_errno;
+
+  memcpy(buf + 2, telegram + 2, len - 2);
+
+  if(command->type == LOTHAR_CODEC_NO_REPLY)
+    return send(connection, buf, len);
+
+  pending.command = command->opcode;
+  pending.size    = command->reply;
+  pending.out[0]  = reply;
+  pending.wait    = 1; // the reply is returned, not filled in later
+
+  return request(connection, &pending, buf, len);
+}
+
+/* startprogram */
+
+int lothar_startprogram(lothar_connection_t *connection, char const *filename)
+{
+  size_t fs;
+  uint8_t *buf;
+
+  if(!filename)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+ 
+  fs = strlen(filename);
+
+  if(fs > 18) // this is the maximum file name size
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_FILENAME_TOO_LONG);
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_STARTPROGRAM)))
+    return -lothar_errno;
+
+  memcpy(lothar_startprogram_request_filename(buf), filename, fs + 1);
+  
+  return send(connection, buf, LOTHAR_REQUEST_SIZE_STARTPROGRAM + fs + 1);
+}
+
+/* stopprogram */
+
+int lothar_stopprogram(lothar_connection_t *connection)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_STOPPROGRAM)))
+    return -lothar_errno;
+
+  return send(connection, buf, LOTHAR_REQUEST_SIZE_STOPPROGRAM);
+}
+
+/* playsoundfile */
+
+int lothar_playsoundfile(lothar_connection_t *connection, uint8_t loop, char const *filename)
+{
+  size_t fs;
+  uint8_t *buf;
+
+  if(!filename)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  fs = strlen(filename) + 1; // include terminating \0
+  
+  if(fs > 19) // this is the maximum file name size
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_FILENAME_TOO_LONG);
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_PLAYSOUNDFILE)))
+    return -lothar_errno;
+
+  lothar_playsoundfile_request_set_loop(buf, loop ? 0x01 : 0x00);
+  memcpy(lothar_playsoundfile_request_filename(buf), filename, fs);
+
+  return send(connection, buf, LOTHAR_REQUEST_SIZE_PLAYSOUNDFILE + fs);
+}
+
+/* playtone */
+
+int lothar_playtone(lothar_connection_t *connection, uint16_t frequency, uint16_t duration)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_PLAYTONE)))
+    return -lothar_errno;
+
+  lothar_playtone_request_set_frequency(buf, CLAMP(frequency, 200, 14000));
+  lothar_playtone_request_set_duration(buf, duration);
+
+  return send(connection, buf, LOTHAR_REQUEST_SIZE_PLAYTONE);
+}
+
+/* setoutputstate */
+
+int lothar_setoutputstate(lothar_connection_t *connection, 
+			  enum lothar_output_port port, 
+			  int8_t power, 
+			  enum lothar_output_motor_mode mode, 
+			  enum lothar_output_regulation_mode rmode, 
+			  int8_t turn_ratio, 
+			  enum lothar_output_runstate rstate, 
+			  uint32_t tacholimit)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_SETOUTPUTSTATE)))
+    return -lothar_errno;
+
+  lothar_setoutputstate_request_set_port(buf, port);
+  lothar_setoutputstate_request_set_power(buf, CLAMP(power, -100, 100));
+  lothar_setoutputstate_request_set_motormode(buf, mode);
+  lothar_setoutputstate_request_set_regulationmode(buf, rmode);
+  lothar_setoutputstate_request_set_turnratio(buf, CLAMP(turn_ratio, -100, 100));
+  lothar_setoutputstate_request_set_runstate(buf, rstate);
+  lothar_setoutputstate_request_set_tacholimit(buf, tacholimit);
+  
+  return send(connection, buf, LOTHAR_REQUEST_SIZE_SETOUTPUTSTATE);
+}
+
+/* setinputmode */
+
+int lothar_setinputmode(lothar_connection_t *connection,
+			enum lothar_input_port port,
+			enum lothar_sensor_type stype,
+			enum lothar_sensor_mode smode)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_SETINPUTMODE)))
+    return -lothar_errno;
+
+  lothar_setinputmode_request_set_port(buf, port);
+  lothar_setinputmode_request_set_type(buf, stype);
+  lothar_setinputmode_request_set_mode(buf, smode);
+
+  return send(connection, buf, LOTHAR_REQUEST_SIZE_SETINPUTMODE);
+}
+
+/* getoutputstate */
+
+// check a reply frame without touching it (check() may patch the payload of lsgetstatus)
+static int view(uint8_t command, size_t size, uint8_t const *reply, size_t len)
+{
+  if(!reply || len < size || reply[0] != 0x02 || reply[1] != command)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+
+  if(reply[2])
+  {
+    int e = reply[2];
+    LOTHAR_RETURN_ERROR(e);
+  }
+  return 0;
+}
+
+static void parse_outputstate(uint8_t const *buf, lothar_outputstate_t *state)
+{
+  state->port            = lothar_outputstate_view_port(buf);
+  state->power           = lothar_outputstate_view_power(buf);
+  state->motormode       = lothar_outputstate_view_motormode(buf);
+  state->regulationmode  = lothar_outputstate_view_regulationmode(buf);
+  state->turnratio       = lothar_outputstate_view_turnratio(buf);
+  state->runstate        = lothar_outputstate_view_runstate(buf);
+  state->tacholimit      = lothar_outputstate_view_tacholimit(buf);
+  state->tachocount      = lothar_outputstate_view_tachocount(buf);
+  state->blocktachocount = lothar_outputstate_view_blocktachocount(buf);
+  state->rotationcount   = lothar_outputstate_view_rotationcount(buf);
+}
+
+int lothar_outputstate_view(uint8_t const *reply, size_t len)
+{
+  return view(LOTHAR_OPCODE_GETOUTPUTSTATE, LOTHAR_REPLY_SIZE_GETOUTPUTSTATE, reply, len);
+}
+
+int lothar_outputstate_decode(uint8_t const *reply, size_t len, lothar_outputstate_t *state)
+{
+  int status;
+
+  if(!state)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if((status = lothar_outputstate_view(reply, len)) < 0)
+    return status;
+
+  parse_outputstate(reply, state);
+  return 0;
+}
+
+// the brick answers for the port it was asked about (the same field in the replies of getoutputstate and getinputvalues)
+static int check_port(uint8_t port, uint8_t const *buf)
+{
+  if(lothar_getoutputstate_reply_port(buf) != port) // huh???
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_UNKOWN_ERROR);
+
+  return 0;
+}
+
+// straight into the struct of lothar_readoutputstate()
+static int decode_readoutputstate(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  (void)connection;
+
+  if(status >= 0 && (status = check_port(pending->port, buf)) >= 0)
+    parse_outputstate(buf, (lothar_outputstate_t *)pending->out[0]);
+
+  return status;
+}
+
+static int decode_getoutputstate(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  void * const *out = pending->out;
+  lothar_outputstate_t state;
+
+  if(status >= 0)
+    status = check_port(pending->port, buf);
+
+  if(pending->callback)
+  {
+    if(status >= 0)
+      parse_outputstate(buf, &state);
+
+    ((lothar_getoutputstate_callback)pending->callback)(connection, status, status < 0 ? NULL : &state, pending->user);
+    return status;
+  }
+
+  if(status < 0)
+    return status;
+
+  // only what was asked for, straight from the frame
+  if(out[0]) 
+    *(int8_t *)out[0] = lothar_outputstate_view_power(buf);
+  if(out[1])  
+    *(enum lothar_output_motor_mode *)out[1] = lothar_outputstate_view_motormode(buf);
+  if(out[2])
+    *(enum lothar_output_regulation_mode *)out[2] = lothar_outputstate_view_regulationmode(buf);
+  if(out[3])
+    *(uint8_t *)out[3] = lothar_outputstate_view_turnratio(buf);
+  if(out[4])
+    *(enum lothar_output_runstate *)out[4] = lothar_outputstate_view_runstate(buf);
+  if(out[5])
+    *(uint32_t *)out[5] = lothar_outputstate_view_tacholimit(buf);
+  if(out[6])
+    *(int32_t *)out[6] = lothar_outputstate_view_tachocount(buf);
+  if(out[7])
+    *(int32_t *)out[7] = lothar_outputstate_view_blocktachocount(buf);
+  if(out[8])
+    *(int32_t *)out[8] = lothar_outputstate_view_rotationcount(buf);
+
+  return 0;
+}
+static int getoutputstate(lothar_connection_t *connection, lothar_pending_t *pending, enum lothar_output_port port)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_GETOUTPUTSTATE)))
+    return -lothar_errno;
+
+  lothar_getoutputstate_request_set_port(buf, port);
+
+  pending->port = port;
+
+  return request(connection, pending, buf, LOTHAR_REQUEST_SIZE_GETOUTPUTSTATE);
+}
+
+int lothar_getoutputstate(lothar_connection_t *connection,
+			  enum lothar_output_port port,
+			  int8_t *power,
+			  enum lothar_output_motor_mode *mode,
+			  enum lothar_output_regulation_mode *rmode,
+			  uint8_t *turn_ratio,
+			  enum lothar_output_runstate *runstate,
+			  uint32_t *tacholimit,
+			  int32_t *tachocount,
+			  int32_t *blocktachocount,
+			  int32_t *rotationcount)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_GETOUTPUTSTATE, LOTHAR_REPLY_SIZE_GETOUTPUTSTATE, decode_getoutputstate};
+
+  pending.out[0] = power;
+  pending.out[1] = mode;
+  pending.out[2] = rmode;
+  pending.out[3] = turn_ratio;
+  pending.out[4] = runstate;
+  pending.out[5] = tacholimit;
+  pending.out[6] = tachocount;
+  pending.out[7] = blocktachocount;
+  pending.out[8] = rotationcount;
+
+  return getoutputstate(connection, &pending, port);
+}
+
+int lothar_readoutputstate(lothar_connection_t *connection, enum lothar_output_port port, lothar_outputstate_t *state)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_GETOUTPUTSTATE, LOTHAR_REPLY_SIZE_GETOUTPUTSTATE, decode_readoutputstate};
+
+  if(!state)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.out[0] = state;
+
+  return getoutputstate(connection, &pending, port);
+}
+
+int lothar_getoutputstate_async(lothar_connection_t *connection,
+				enum lothar_output_port port,
+				lothar_getoutputstate_callback callback,
+				void *user)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_GETOUTPUTSTATE, LOTHAR_REPLY_SIZE_GETOUTPUTSTATE, decode_getoutputstate};
+
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
+
+  return getoutputstate(connection, &pending, port);
+}
+
+/* getinputvalues */
+
+static void parse_inputvalues(uint8_t const *buf, lothar_inputvalues_t *values)
+{
+  values->port            = lothar_inputvalues_view_port(buf);
+  values->valid           = lothar_inputvalues_view_valid(buf);
+  values->calibrated      = lothar_inputvalues_view_calibrated(buf);
+  values->type            = lothar_inputvalues_view_type(buf);
+  values->mode            = lothar_inputvalues_view_mode(buf);
+  values->rawvalue        = lothar_inputvalues_view_rawvalue(buf);
+  values->normvalue       = lothar_inputvalues_view_normvalue(buf);
+  values->scaledvalue     = lothar_inputvalues_view_scaledvalue(buf);
+  values->calibratedvalue = lothar_inputvalues_view_calibratedvalue(buf);
+}
+
+int lothar_inputvalues_view(uint8_t const *reply, size_t len)
+{
+  return view(LOTHAR_OPCODE_GETINPUTVALUES, LOTHAR_REPLY_SIZE_GETINPUTVALUES, reply, len);
+}
+
+int lothar_inputvalues_decode(uint8_t const *reply, size_t len, lothar_inputvalues_t *values)
+{
+  int status;
+
+  if(!values)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if((status = lothar_inputvalues_view(reply, len)) < 0)
+    return status;
+
+  parse_inputvalues(reply, values);
+  return 0;
+}
+
+// straight into the struct of lothar_readinputvalues()
+static int decode_readinputvalues(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  (void)connection;
+
+  if(status >= 0 && (status = check_port(pending->port, buf)) >= 0)
+    parse_inputvalues(buf, (lothar_inputvalues_t *)pending->out[0]);
+
+  return status;
+}
+
+static int decode_getinputvalues(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  void * const *out = pending->out;
+  lothar_inputvalues_t values;
+
+  if(status >= 0)
+    status = check_port(pending->port, buf);
+
+  if(pending->callback)
+  {
+    if(status >= 0)
+      parse_inputvalues(buf, &values);
+
+    ((lothar_getinputvalues_callback)pending->callback)(connection, status, status < 0 ? NULL : &values, pending->user);
+    return status;
+  }
+
+  if(status < 0)
+    return status;
+
+  // only what was asked for, straight from the frame
+  if(out[0])
+    *(uint8_t *)out[0] = lothar_inputvalues_view_valid(buf);
+  if(out[1])
+    *(uint8_t *)out[1] = lothar_inputvalues_view_calibrated(buf);
+  if(out[2])
+    *(enum lothar_sensor_type *)out[2] = lothar_inputvalues_view_type(buf);
+  if(out[3])
+    *(enum lothar_sensor_mode *)out[3] = lothar_inputvalues_view_mode(buf);
+  if(out[4])
+    *(uint16_t *)out[4] = lothar_inputvalues_view_rawvalue(buf);
+  if(out[5])
+    *(uint16_t *)out[5] = lothar_inputvalues_view_normvalue(buf);
+  if(out[6])
+    *(int16_t *)out[6] = lothar_inputvalues_view_scaledvalue(buf);
+  if(out[7])
+    *(int16_t *)out[7] = lothar_inputvalues_view_calibratedvalue(buf);
+    
+  return 0;
+}
+
+static int getinputvalues(lothar_connection_t *connection, lothar_pending_t *pending, enum lothar_input_port port)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_GETINPUTVALUES)))
+    return -lothar_errno;
+
+  lothar_getinputvalues_request_set_port(buf, port);
+
+  pending->port = port;
+
+  return request(connection, pending, buf, LOTHAR_REQUEST_SIZE_GETINPUTVALUES);
+}
+
+int lothar_getinputvalues(lothar_connection_t *connection,
+			  enum lothar_input_port port,
+			  uint8_t *valid,
+			  uint8_t *calibrated,
+			  enum lothar_sensor_type *type,
+			  enum lothar_sensor_mode *mode,
+			  uint16_t *raw_value,
+			  uint16_t *norm_value,
+			  int16_t *scaled_value,
+			  int16_t *calibrated_value)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_GETINPUTVALUES, LOTHAR_REPLY_SIZE_GETINPUTVALUES, decode_getinputvalues};
+
+  pending.out[0] = valid;
+  pending.out[1] = calibrated;
+  pending.out[2] = type;
+  pending.out[3] = mode;
+  pending.out[4] = raw_value;
+  pending.out[5] = norm_value;
+  pending.out[6] = scaled_value;
+  pending.out[7] = calibrated_value;
+
+  return getinputvalues(connection, &pending, port);
+}
+
+int lothar_readinputvalues(lothar_connection_t *connection, enum lothar_input_port port, lothar_inputvalues_t *values)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_GETINPUTVALUES, LOTHAR_REPLY_SIZE_GETINPUTVALUES, decode_readinputvalues};
+
+  if(!values)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.out[0] = values;
+
+  return getinputvalues(connection, &pending, port);
+}
+
+int lothar_getinputvalues_async(lothar_connection_t *connection,
+				enum lothar_input_port port,
+				lothar_getinputvalues_callback callback,
+				void *user)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_GETINPUTVALUES, LOTHAR_REPLY_SIZE_GETINPUTVALUES, decode_getinputvalues};
+
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
+
+  return getinputvalues(connection, &pending, port);
+}
+
+/* resetinputscaledvalue */
+
+int lothar_resetinputscaledvalue(lothar_connection_t *connection, enum lothar_input_port port)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_RESETINPUTSCALEDVALUE)))
+    return -lothar_errno;
+
+  lothar_resetinputscaledvalue_request_set_port(buf, port);
+
+  return send(connection, buf, LOTHAR_REQUEST_SIZE_RESETINPUTSCALEDVALUE);
+}
+
+/* messagewrite */
+
+int lothar_messagewrite(lothar_connection_t *connection, uint8_t inbox, uint8_t const *data, size_t len)
+{
+  uint8_t *buf;
+
+  if(inbox > 9 || len > 59)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_MESSAGEWRITE)))
+    return -lothar_errno;
+
+  lothar_messagewrite_request_set_inbox(buf, inbox);
+  lothar_messagewrite_request_set_size(buf, len);
+  if(len)
+    memcpy(lothar_messagewrite_request_data(buf), data, len);
+
+  return send(connection, buf, LOTHAR_REQUEST_SIZE_MESSAGEWRITE + len);
+}
+
+/* resetmotorposition */
+
+int lothar_resetmotorposition(lothar_connection_t *connection, enum lothar_output_port port, uint8_t relative)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_RESETMOTORPOSITION)))
+    return -lothar_errno;
+
+  lothar_resetmotorposition_request_set_port(buf, port);
+  lothar_resetmotorposition_request_set_relative(buf, relative ? 1 : 0);
+
+  return send(connection, buf, LOTHAR_REQUEST_SIZE_RESETMOTORPOSITION);
+}
+
+/* getbatterylevel */
+
+static int decode_getbatterylevel(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  uint16_t batterylevel = status < 0 ? 0 : lothar_getbatterylevel_reply_voltage(buf);
+
+  if(pending->callback)
+    ((lothar_getbatterylevel_callback)pending->callback)(connection, status, batterylevel, pending->user);
+  else if(status >= 0 && pending->out[0])
+    *(uint16_t *)pending->out[0] = batterylevel;
+  
+  return status < 0 ? status : 0;
+}
+
+static int getbatterylevel(lothar_connection_t *connection, lothar_pending_t *pending)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_GETBATTERYLEVEL)))
+    return -lothar_errno;
+
+  return request(connection, pending, buf, LOTHAR_REQUEST_SIZE_GETBATTERYLEVEL);
+}
+
+int lothar_getbatterylevel(lothar_connection_t *connection, uint16_t *batterylevel)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_GETBATTERYLEVEL, LOTHAR_REPLY_SIZE_GETBATTERYLEVEL, decode_getbatterylevel};
+
+  pending.out[0] = batterylevel;
+
+  return getbatterylevel(connection, &pending);
+}
+
+int lothar_getbatterylevel_async(lothar_connection_t *connection, lothar_getbatterylevel_callback callback, void *user)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_GETBATTERYLEVEL, LOTHAR_REPLY_SIZE_GETBATTERYLEVEL, decode_getbatterylevel};
+
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
+
+  return getbatterylevel(connection, &pending);
+}
+
+/* stopsoundplayback */
+
+int lothar_stopsoundplayback(lothar_connection_t *connection)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_STOPSOUNDPLAYBACK)))
+    return -lothar_errno;
+
+  return send(connection, buf, LOTHAR_REQUEST_SIZE_STOPSOUNDPLAYBACK);
+}
+
+/* keepalive */
+
+static int decode_keepalive(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  uint32_t sleeptime = status < 0 ? 0 : lothar_keepalive_reply_sleeptime(buf);
+
+  if(pending->callback)
+    ((lothar_keepalive_callback)pending->callback)(connection, status, sleeptime, pending->user);
+  else if(status >= 0 && pending->out[0])
+    *(uint32_t *)pending->out[0] = sleeptime;
+
+  return status < 0 ? status : 0;
+}
+
+static int keepalive(lothar_connection_t *connection, lothar_pending_t *pending)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_KEEPALIVE)))
+    return -lothar_errno;
+
+  return request(connection, pending, buf, LOTHAR_REQUEST_SIZE_KEEPALIVE);
+}
+
+int lothar_keepalive(lothar_connection_t *connection, uint32_t *sleeptime)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_KEEPALIVE, LOTHAR_REPLY_SIZE_KEEPALIVE, decode_keepalive};
+
+  pending.out[0] = sleeptime;
+
+  return keepalive(connection, &pending);
+}
+
+int lothar_keepalive_async(lothar_connection_t *connection, lothar_keepalive_callback callback, void *user)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_KEEPALIVE, LOTHAR_REPLY_SIZE_KEEPALIVE, decode_keepalive};
+
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
+
+  return keepalive(connection, &pending);
+}
+
+/* lsgetstatus */
+
+static int decode_lsgetstatus(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  uint8_t bytesready = status < 0 ? 0 : lothar_lsgetstatus_reply_bytesready(buf);
+
+  if(pending->callback)
+    ((lothar_lsgetstatus_callback)pending->callback)(connection, status, pending->port, bytesready, pending->user);
+  else if(status >= 0 && pending->out[0])
+    *(uint8_t *)pending->out[0] = bytesready;
+
+  return status < 0 ? status : 0;  
+}
+
+static int lsgetstatus(lothar_connection_t *connection, lothar_pending_t *pending, enum lothar_input_port port)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_LSGETSTATUS)))
+    return -lothar_errno;
+
+  lothar_lsgetstatus_request_set_port(buf, port);
+
+  pending->port = port;
+
+  return request(connection, pending, buf, LOTHAR_REQUEST_SIZE_LSGETSTATUS);
+}
+
+int lothar_lsgetstatus(lothar_connection_t *connection, enum lothar_input_port port, uint8_t *bytesready)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_LSGETSTATUS, LOTHAR_REPLY_SIZE_LSGETSTATUS, decode_lsgetstatus};
+
+  pending.out[0] = bytesready;
+
+  return lsgetstatus(connection, &pending, port);
+}
+
+int lothar_lsgetstatus_async(lothar_connection_t *connection, enum lothar_input_port port, lothar_lsgetstatus_callback callback, void *user)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_LSGETSTATUS, LOTHAR_REPLY_SIZE_LSGETSTATUS, decode_lsgetstatus};
+
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
+
+  return lsgetstatus(connection, &pending, port);
+}
+
+int lothar_lsgetstatus_poll(lothar_connection_t *connection, enum lothar_input_port port, lothar_lsgetstatus_callback callback, void *user)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_LSGETSTATUS, LOTHAR_REPLY_SIZE_LSGETSTATUS, decode_lsgetstatus};
+
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.busy     = 1;
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
+
+  return lsgetstatus(connection, &pending, port);
+}
+
+/* lswrite */
+
+int lothar_lswrite(lothar_connection_t *connection, enum lothar_input_port port, uint8_t const *txdata, uint8_t txlen, uint8_t rxlen)
+{
+  uint8_t *buf;
+
+  if(txlen > 16 || rxlen > 16)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_LSWRITE)))
+    return -lothar_errno;
+
+  lothar_lswrite_request_set_port(buf, port);
+  lothar_lswrite_request_set_txlen(buf, txlen);
+  lothar_lswrite_request_set_rxlen(buf, rxlen);
+  if(txlen)
+    memcpy(lothar_lswrite_request_txdata(buf), txdata, txlen);
+
+  return send(connection, buf, LOTHAR_REQUEST_SIZE_LSWRITE + txlen);
+}
+
+/* lsread */
+
+static int decode_lsread(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  uint8_t *rxdata = (uint8_t *)pending->out[0];
+  uint8_t rxlen = status < 0 ? 0 : lothar_lsread_reply_rxlen(buf);
+
+  if(rxlen > 16) // the reply only has room for 16 bytes
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+    status = -lothar_errno;
+  }
+
+  if(pending->callback)
+  {
+    ((lothar_lsread_callback)pending->callback)(connection, 
+						status, 
+						pending->port, 
+						status < 0 ? NULL : lothar_lsread_reply_rxdata(buf), 
+						status < 0 ? 0 : rxlen, 
+						pending->user);
+    return status;
+  }
+
+  if(status < 0)
+    return status;
+  
+  if(pending->out[1])
+    *(uint8_t *)pending->out[1] = rxlen;
+
+  if(rxdata)
+  {
+    if(pending->bufsize < rxlen)
+    {
+      memcpy(rxdata, lothar_lsread_reply_rxdata(buf), pending->bufsize);
+      LOTHAR_DEBUG("%d vs %d\n", (int)pending->bufsize, (int)rxlen);
+      LOTHAR_RETURN_ERROR(LOTHAR_ERROR_BUFFER_TOO_SMALL);
+    }
+    else
+      memcpy(rxdata, lothar_lsread_reply_rxdata(buf), rxlen);
+  }
+
+  return 0;
+}
+
+static int lsread(lothar_connection_t *connection, lothar_pending_t *pending, enum lothar_input_port port)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_LSREAD)))
+    return -lothar_errno;
+
+  lothar_lsread_request_set_port(buf, port);
+
+  pending->port = port;
+
+  return request(connection, pending, buf, LOTHAR_REQUEST_SIZE_LSREAD);
+}
+
+int lothar_lsread(lothar_connection_t *connection, enum lothar_input_port port, uint8_t *rxdata, size_t bufsize, uint8_t *rxlen)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_LSREAD, LOTHAR_REPLY_SIZE_LSREAD, decode_lsread};
+
+  pending.bufsize = bufsize;
+  pending.out[0]  = rxdata;
+  pending.out[1]  = rxlen;
+
+  return lsread(connection, &pending, port);
+}
+
+int lothar_lsread_async(lothar_connection_t *connection, enum lothar_input_port port, lothar_lsread_callback callback, void *user)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_LSREAD, LOTHAR_REPLY_SIZE_LSREAD, decode_lsread};
+
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
+
+  return lsread(connection, &pending, port);
+}
+
+/* getcurrentprogramname */
+
+static int decode_getcurrentprogramname(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  char filename[20];
+
+  if(status >= 0)
+  {
+    memcpy(filename, lothar_getcurrentprogramname_reply_filename(buf), 19);
+    filename[19] = '\0'; // the brick should terminate it, but don't hand out an unterminated string
+  }
+
+  if(pending->callback)
+    ((lothar_getcurrentprogramname_callback)pending->callback)(connection, status, status < 0 ? NULL : filename, pending->user);
+  else if(status >= 0 && pending->out[0])
+    memcpy(pending->out[0], lothar_getcurrentprogramname_reply_filename(buf), 19);
+
+  return status < 0 ? status : 0;
+}
+
+static int getcurrentprogramname(lothar_connection_t *connection, lothar_pending_t *pending)
+{
+  uint8_t *buf;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_GETCURRENTPROGRAMNAME)))
+    return -lothar_errno;
+
+  return request(connection, pending, buf, LOTHAR_REQUEST_SIZE_GETCURRENTPROGRAMNAME);
+}
+
+int lothar_getcurrentprogramname(lothar_connection_t *connection, char filename[19])
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_GETCURRENTPROGRAMNAME, LOTHAR_REPLY_SIZE_GETCURRENTPROGRAMNAME, decode_getcurrentprogramname};
+
+  pending.out[0] = filename;
+
+  return getcurrentprogramname(connection, &pending);
+}
+
+int lothar_getcurrentprogramname_async(lothar_connection_t *connection, lothar_getcurrentprogramname_callback callback, void *user)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_GETCURRENTPROGRAMNAME, LOTHAR_REPLY_SIZE_GETCURRENTPROGRAMNAME, decode_getcurrentprogramname};
+
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
+
+  return getcurrentprogramname(connection, &pending);
+}
+
+/* messageread */
+
+static int decode_messageread(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  uint8_t *data = (uint8_t *)pending->out[0];
+  uint8_t size = status < 0 ? 0 : lothar_messageread_reply_size(buf);
+
+  if(pending->callback && size > 59) // should never happen
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_BUFFER_TOO_SMALL);
+    status = -lothar_errno;
+  }
+
+  if(pending->callback)
+  {
+    ((lothar_messageread_callback)pending->callback)(connection,
+						     status,
+						     pending->port,
+						     status < 0 ? NULL : lothar_messageread_reply_data(buf),
+						     status < 0 ? 0 : size,
+						     pending->user);
+    return status;
+  }
+
+  if(status < 0)
+    return status;
+
+  if(pending->out[1])
+    *(uint8_t *)pending->out[1] = size;
+
+  if(data)
+  {
+    if(size > 59) // should never happen
+    {
+      memcpy(data, lothar_messageread_reply_data(buf), 59);
+      LOTHAR_RETURN_ERROR(LOTHAR_ERROR_BUFFER_TOO_SMALL);
+    }
+    else
+      memcpy(data, lothar_messageread_reply_data(buf), size);
+  }
+
+  return 0;
+}
+
+static int messageread(lothar_connection_t *connection, lothar_pending_t *pending, uint8_t remote_inbox, uint8_t local_inbox, uint8_t remove)
+{
+  uint8_t *buf;
+
+  if(remote_inbox > 19 || local_inbox > 9)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_MESSAGEREAD)))
+    return -lothar_errno;
+
+  lothar_messageread_request_set_remoteinbox(buf, remote_inbox);
+  lothar_messageread_request_set_localinbox(buf, local_inbox);
+  lothar_messageread_request_set_remove(buf, remove);
+
+  pending->port = local_inbox;
+
+  return request(connection, pending, buf, LOTHAR_REQUEST_SIZE_MESSAGEREAD);
+}
+
+int lothar_messageread(lothar_connection_t *connection, uint8_t remote_inbox, uint8_t local_inbox, uint8_t remove, uint8_t data[59], uint8_t *len)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_MESSAGEREAD, LOTHAR_REPLY_SIZE_MESSAGEREAD, decode_messageread};
+
+  pending.out[0] = data;
+  pending.out[1] = len;
+
+  return messageread(connection, &pending, remote_inbox, local_inbox, remove);
+}
+
+int lothar_messageread_async(lothar_connection_t *connection, 
+			     uint8_t remote_inbox, 
+			     uint8_t local_inbox, 
+			     uint8_t remove, 
+			     lothar_messageread_callback callback, 
+			     void *user)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_MESSAGEREAD, LOTHAR_REPLY_SIZE_MESSAGEREAD, decode_messageread};
+
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
+
+  return messageread(connection, &pending, remote_inbox, local_inbox, remove);
+}
+
+/* system commands */
+
+// check a file name before building the request (in threaded mode, a frame that was started must be sent)
+static int valid_filename(char const *name)
+{
+  if(!name)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(strlen(name) > LOTHAR_MAX_FILENAME)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_FILENAME_TOO_LONG);
+
+  return 0;
+}
+
+// write a (valid) file name into the 20 byte field of a request
+static void put_filename(uint8_t *buf, char const *name)
+{
+  memset(buf, 0, LOTHAR_MAX_FILENAME + 1);
+  memcpy(buf, name, strlen(name));
+}
+
+// read a file name from the 20 byte field of a reply
+static void copy_filename(char *name, uint8_t const *buf)
+{
+  memcpy(name, buf, LOTHAR_MAX_FILENAME);
+  name[LOTHAR_MAX_FILENAME] = '\0';
+}
+
+/* openread */
+
+static int decode_openread(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  if(status < 0)
+    return status;
+
+  if(pending->out[0])
+    *(uint8_t *)pending->out[0] = lothar_openread_reply_handle(buf);
+  if(pending->out[1])
+    *(uint32_t *)pending->out[1] = lothar_openread_reply_size(buf);
+
+  return 0;
+}
+
+int lothar_openread(lothar_connection_t *connection, char const *name, uint8_t *handle, uint32_t *size)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_OPENREAD, LOTHAR_REPLY_SIZE_OPENREAD, decode_openread};
+  uint8_t *buf;
+
+  if(valid_filename(name) < 0)
+    return -lothar_errno;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_OPENREAD)))
+    return -lothar_errno;
 
-/* utilities */
+  put_filename(lothar_openread_request_filename(buf), name);
 
-#define RESPONSE    0x00
-#define NO_RESPONSE 0x80
+  pending.out[0] = handle;
+  pending.out[1] = size;
 
-// from here, everything returns 0 on success, lothar_errno on failure
+  return request(connection, &pending, buf, LOTHAR_REQUEST_SIZE_OPENREAD);
+}
 
-static int send(lothar_connection_t *connection, uint8_t response_required, uint8_t command, uint8_t const *arguments, size_t len)
-{
-  uint8_t *buf = (uint8_t *)lothar_malloc(len + 2);
-  int status;
-  
-  buf[0] = response_required;
-  buf[1] = command;
+/* openwrite */
 
-  if(arguments && len)
-    memcpy(buf + 2, arguments, len);
+// the replies that only carry a handle (the same field in those of openwrite and close)
+static int decode_handle(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
+  if(status < 0)
+    return status;
 
-  status = lothar_connection_write(connection, buf, len + 2);
-  free(buf);
+  if(pending->out[0])
+    *(uint8_t *)pending->out[0] = lothar_openwrite_reply_handle(buf);
 
-  return status == len + 2 ? 0 : -lothar_errno;
+  return 0;
 }
 
-static int recv(lothar_connection_t *connection, uint8_t command, uint8_t *buf, size_t len)
+int lothar_openwrite(lothar_connection_t *connection, char const *name, uint32_t size, uint8_t *handle)
 {
-  int r = lothar_connection_read(connection, buf, len);
-  if(r != len)
+  lothar_pending_t pending = {LOTHAR_OPCODE_OPENWRITE, LOTHAR_REPLY_SIZE_OPENWRITE, decode_handle};
+  uint8_t *buf;
+
+  if(valid_filename(name) < 0)
     return -lothar_errno;
 
-  if(len < 3 || buf[0] != 0x02 || buf[1] != command)
-    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
-  
-  /* explicitly ignore a pending communication error on lsgetstatus */
-  if(command == LSGETSTATUS && buf[2] == LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS)
-  {
-    buf[3] = 0;
-    return 0;
-  }
+  if(!(buf = frame(connection, LOTHAR_OPCODE_OPENWRITE)))
+    return -lothar_errno;
 
-  if (buf[2])
-  {
-    int e = buf[2]; // this is only to surpress a compiler warning (comparison always true due to range of data type)
-    LOTHAR_RETURN_ERROR(e);
-  }
-  return 0;
-}
+  put_filename(lothar_openwrite_request_filename(buf), name);
+  lothar_openwrite_request_set_size(buf, size);
 
-/* commands: */
+  pending.out[0] = handle;
 
-/* startprogram */
+  return request(connection, &pending, buf, LOTHAR_REQUEST_SIZE_OPENWRITE);
+}
 
-int lothar_startprogram(lothar_connection_t *connection, char const *filename)
+/* fileread */
+
+static int decode_fileread(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
 {
-  size_t fs;
+  size_t len = 0;
 
-  if(!filename)
-    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
- 
-  fs = strlen(filename);
+  if(status >= 0 && (len = lothar_read_reply_size(buf)) > pending->bufsize) // should never happen
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+    status = -lothar_errno;
+  }
 
-  if(fs > 18) // this is the maximum file name size
-    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_FILENAME_TOO_LONG);
-  
-  return send(connection, NO_RESPONSE, STARTPROGRAM, (uint8_t const *)filename, fs + 1);
-}
+  if(pending->callback)
+  {
+    ((lothar_fileread_callback)pending->callback)(connection,
+						  status,
+						  pending->port,
+						  status < 0 ? NULL : lothar_read_reply_data(buf),
+						  status < 0 ? 0 : len,
+						  pending->user);
+    return status;
+  }
 
-/* stopprogram */
+  if(status < 0)
+    return status;
 
-int lothar_stopprogram(lothar_connection_t *connection)
-{
-  return -send(connection, NO_RESPONSE, STOPPROGRAM, NULL, 0);
-}
+  if(pending->out[0])
+    memcpy(pending->out[0], lothar_read_reply_data(buf), len);
+  if(pending->out[1])
+    *(size_t *)pending->out[1] = len;
 
-/* playsoundfile */
+  return 0;
+}
 
-int lothar_playsoundfile(lothar_connection_t *connection, uint8_t loop, char const *filename)
+static int fileread(lothar_connection_t *connection, lothar_pending_t *pending, uint8_t handle, size_t len)
 {
-  int status;
-  size_t fs;
   uint8_t *buf;
 
-  if(!filename)
+  if(!len || len > LOTHAR_MAX_FILEREAD)
     LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
 
-  fs = strlen(filename) + 1; // include terminating \0
-  
-  if(fs > 19) // this is the maximum file name size
-    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_FILENAME_TOO_LONG);
+  if(!(buf = frame(connection, LOTHAR_OPCODE_READ)))
+    return -lothar_errno;
 
-  buf = (uint8_t *)lothar_malloc(fs + 2);
-  buf[0] = loop ? 0x01 : 0x00;
-  memcpy(buf + 1, filename, fs + 1);
+  lothar_read_request_set_handle(buf, handle);
+  lothar_read_request_set_size(buf, len);
 
-  status = send(connection, NO_RESPONSE, PLAYSOUNDFILE, buf, fs + 1);
-  
-  free(buf);
+  pending->size    = LOTHAR_REPLY_SIZE_READ + len;
+  pending->port    = handle;
+  pending->bufsize = len;
 
-  return status;
+  return request(connection, pending, buf, LOTHAR_REQUEST_SIZE_READ);
 }
 
-/* playtone */
-
-int lothar_playtone(lothar_connection_t *connection, uint16_t frequency, uint16_t duration)
+int lothar_fileread(lothar_connection_t *connection, uint8_t handle, uint8_t *data, size_t len, size_t *read)
 {
-  uint8_t buf[4];
+  lothar_pending_t pending = {LOTHAR_OPCODE_READ, 0, decode_fileread};
 
-  lothar_htonxts(CLAMP(frequency, 200, 14000), buf);
-  lothar_htonxts(duration, (buf + 2));
+  pending.out[0] = data;
+  pending.out[1] = read;
 
-  return send(connection, NO_RESPONSE, PLAYTONE, buf, 4);
+  return fileread(connection, &pending, handle, len);
 }
 
-/* setoutputstate */
-
-int lothar_setoutputstate(lothar_connection_t *connection, 
-			  enum lothar_output_port port, 
-			  int8_t power, 
-			  enum lothar_output_motor_mode mode, 
-			  enum lothar_output_regulation_mode rmode, 
-			  int8_t turn_ratio, 
-			  enum lothar_output_runstate rstate, 
-			  uint32_t tacholimit)
+int lothar_fileread_async(lothar_connection_t *connection, uint8_t handle, size_t len, lothar_fileread_callback callback, void *user)
 {
-  uint8_t buf[10];
+  lothar_pending_t pending = {LOTHAR_OPCODE_READ, 0, decode_fileread};
 
-  buf[0] = port;
-  buf[1] = CLAMP(power, -100, 100);
-  buf[2] = mode;
-  buf[3] = rmode;
-  buf[4] = CLAMP(turn_ratio, -100, 100);
-  buf[5] = rstate;
-  lothar_htonxtl(tacholimit, (buf + 6));
-  
-  return send(connection, NO_RESPONSE, SETOUTPUTSTATE, buf, 10);
-}
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
 
-/* setinputmode */
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
 
-int lothar_setinputmode(lothar_connection_t *connection,
-			enum lothar_input_port port,
-			enum lothar_sensor_type stype,
-			enum lothar_sensor_mode smode)
-{
-  uint8_t buf[3] = {port, stype, smode};
-  return send(connection, NO_RESPONSE, SETINPUTMODE, buf, 3);
+  return fileread(connection, &pending, handle, len);
 }
 
-/* getoutputstate */
+/* filewrite */
 
-int lothar_getoutputstate(lothar_connection_t *connection,
-			  enum lothar_output_port port,
-			  int8_t *power,
-			  enum lothar_output_motor_mode *mode,
-			  enum lothar_output_regulation_mode *rmode,
-			  uint8_t *turn_ratio,
-			  enum lothar_output_runstate *runstate,
-			  uint32_t *tacholimit,
-			  int32_t *tachocount,
-			  int32_t *blocktachocount,
-			  int32_t *rotationcount)
+static int decode_filewrite(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
 {
-  int status;
-  uint8_t buf[25];
-
-  buf[0] = port; // quick n dirty
-
-  if((status = send(connection, RESPONSE, GETOUTPUTSTATE, buf, 1)) < 0)
-    return status;
-  
-  if((status = recv(connection, GETOUTPUTSTATE, buf, 25)) < 0)
+  if(pending->callback)
+  {
+    ((lothar_filewrite_callback)pending->callback)(connection,
+						   status,
+						   pending->port,
+						   status < 0 ? 0 : lothar_write_reply_size(buf),
+						   pending->user);
     return status;
+  }
 
-  if(buf[3] != port) // huh???
-    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_UNKOWN_ERROR);
+  if(status < 0)
+    return status;
 
-  if(power) 
-    *power = buf[4];
-  if(mode)  
-    *mode = buf[5];
-  if(rmode)
-    *rmode = buf[6];
-  if(turn_ratio)
-    *turn_ratio = buf[7];
-  if(runstate)
-    *runstate = buf[8];
-  if(tacholimit)
-    *tacholimit = lothar_nxttohl((buf + 9));
-  if(tachocount)
-    *tachocount = lothar_nxttohl((buf + 13));
-  if(blocktachocount)
-    *blocktachocount = lothar_nxttohl((buf + 17));
-  if(rotationcount)
-    *rotationcount = lothar_nxttohl((buf + 21));
+  if(pending->out[0])
+    *(size_t *)pending->out[0] = lothar_write_reply_size(buf);
 
-  return status;
+  return 0;
 }
 
-/* getinputvalues */
-
-int lothar_getinputvalues(lothar_connection_t *connection,
-			  enum lothar_input_port port,
-			  uint8_t *valid,
-			  uint8_t *calibrated,
-			  enum lothar_sensor_type *type,
-			  enum lothar_sensor_mode *mode,
-			  uint16_t *raw_value,
-			  uint16_t *norm_value,
-			  int16_t *scaled_value,
-			  int16_t *calibrated_value)
+static int filewrite(lothar_connection_t *connection, lothar_pending_t *pending, uint8_t handle, uint8_t const *data, size_t len)
 {
-  int status;
-  uint8_t buf[16];
+  uint8_t *buf;
 
-  buf[0] = port;
+  if(!data || !len || len > LOTHAR_MAX_FILEWRITE)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
 
-  if((status = send(connection, RESPONSE, GETINPUTVALUES, buf, 1)) < 0)
-    return status;
+  if(!(buf = frame(connection, LOTHAR_OPCODE_WRITE)))
+    return -lothar_errno;
 
-  if((status = recv(connection, GETINPUTVALUES, buf, 16)) < 0)
-    return status;
+  lothar_write_request_set_handle(buf, handle);
+  memcpy(lothar_write_request_data(buf), data, len);
 
-  if(buf[3] != port) // ???
-    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_UNKOWN_ERROR);
+  pending->port = handle;
 
-  if(valid)
-    *valid = buf[4];
-  if(calibrated)
-    *calibrated = buf[5];
-  if(type)
-    *type = buf[6];
-  if(mode)
-    *mode = buf[7];
-  if(raw_value)
-    *raw_value = lothar_nxttohs((buf + 8));
-  if(norm_value)
-    *norm_value = lothar_nxttohs((buf + 10));
-  if(scaled_value)
-    *scaled_value = lothar_nxttohs((buf + 12));
-  if(calibrated_value)
-    *calibrated_value = lothar_nxttohs((buf + 14));
-    
-  return status;
+  return request(connection, pending, buf, LOTHAR_REQUEST_SIZE_WRITE + len);
 }
 
-/* resetinputscaledvalue */
+int lothar_filewrite(lothar_connection_t *connection, uint8_t handle, uint8_t const *data, size_t len, size_t *written)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_WRITE, LOTHAR_REPLY_SIZE_WRITE, decode_filewrite};
 
-int lothar_resetinputscaledvalue(lothar_connection_t *connection, enum lothar_input_port port)
+  pending.out[0] = written;
+
+  return filewrite(connection, &pending, handle, data, len);
+}
+
+int lothar_filewrite_async(lothar_connection_t *connection,
+			   uint8_t handle,
+			   uint8_t const *data,
+			   size_t len,
+			   lothar_filewrite_callback callback,
+			   void *user)
 {
-  uint8_t p = port;
-  return send(connection, NO_RESPONSE, RESETINPUTSCALEDVALUE, &p, 1);
+  lothar_pending_t pending = {LOTHAR_OPCODE_WRITE, LOTHAR_REPLY_SIZE_WRITE, decode_filewrite};
+
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
+
+  return filewrite(connection, &pending, handle, data, len);
 }
 
-/* messagewrite */
+/* fileclose */
 
-int lothar_messagewrite(lothar_connection_t *connection, uint8_t inbox, uint8_t const *data, size_t len)
+int lothar_fileclose(lothar_connection_t *connection, uint8_t handle)
 {
+  lothar_pending_t pending = {LOTHAR_OPCODE_CLOSE, LOTHAR_REPLY_SIZE_CLOSE, decode_handle};
   uint8_t *buf;
-  int status;
 
-  if(inbox > 9 || len > 59)
-    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+  if(!(buf = frame(connection, LOTHAR_OPCODE_CLOSE)))
+    return -lothar_errno;
 
-  buf = (uint8_t *)lothar_malloc(len + 2);
+  lothar_close_request_set_handle(buf, handle);
 
-  buf[0] = inbox;
-  buf[1] = len;
-  memcpy(buf + 2, data, len);
+  return request(connection, &pending, buf, LOTHAR_REQUEST_SIZE_CLOSE);
+}
 
-  status = send(connection, NO_RESPONSE, MESSAGEWRITE, buf, len + 2);
-  free(buf);
+/* filedelete */
 
+static int decode_filedelete(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
+{
   return status;
 }
 
-/* resetmotorposition */
-
-int lothar_resetmotorposition(lothar_connection_t *connection, enum lothar_output_port port, uint8_t relative)
+int lothar_filedelete(lothar_connection_t *connection, char const *name)
 {
-  uint8_t buf[2] = {port, relative ? 1 : 0};
-  return -send(connection, NO_RESPONSE, RESETMOTORPOSITION, buf, 2);
+  lothar_pending_t pending = {LOTHAR_OPCODE_DELETE, LOTHAR_REPLY_SIZE_DELETE, decode_filedelete};
+  uint8_t *buf;
+
+  if(valid_filename(name) < 0)
+    return -lothar_errno;
+
+  if(!(buf = frame(connection, LOTHAR_OPCODE_DELETE)))
+    return -lothar_errno;
+
+  put_filename(lothar_delete_request_filename(buf), name);
+
+  return request(connection, &pending, buf, LOTHAR_REQUEST_SIZE_DELETE);
 }
 
-/* getbatterylevel */
+/* findfirst, findnext */
 
-int lothar_getbatterylevel(lothar_connection_t *connection, uint16_t *batterylevel)
+static int decode_find(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
 {
-  int status;
-  uint8_t buf[5];
-
-  if((status = send(connection, RESPONSE, GETBATTERYLEVEL, NULL, 0)) < 0)
+  if(status < 0)
     return status;
 
-  if((status = recv(connection, GETBATTERYLEVEL, buf, 5)) < 0)
-    return status;
-  
-  if(buf[2])
-    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+  if(pending->out[0])
+    *(uint8_t *)pending->out[0] = lothar_findfirst_reply_handle(buf);
+  if(pending->out[1])
+    copy_filename((char *)pending->out[1], lothar_findfirst_reply_filename(buf));
+  if(pending->out[2])
+    *(uint32_t *)pending->out[2] = lothar_findfirst_reply_size(buf);
 
-  if(batterylevel)
-    *batterylevel = lothar_nxttohs(buf + 3);
-  
-  return status;
+  return 0;
 }
 
-/* stopsoundplayback */
-
-int lothar_stopsoundplayback(lothar_connection_t *connection)
+int lothar_findfirst(lothar_connection_t *connection, char const *pattern, uint8_t *handle, char *name, uint32_t *size)
 {
-  return send(connection, NO_RESPONSE, STOPSOUNDPLAYBACK, NULL, 0);
-}
+  lothar_pending_t pending = {LOTHAR_OPCODE_FINDFIRST, LOTHAR_REPLY_SIZE_FINDFIRST, decode_find};
+  uint8_t *buf;
 
-/* keepalive */
+  if(valid_filename(pattern) < 0)
+    return -lothar_errno;
 
-int lothar_keepalive(lothar_connection_t *connection, uint32_t *sleeptime)
-{
-  int status;
-  uint8_t buf[7];
+  if(!(buf = frame(connection, LOTHAR_OPCODE_FINDFIRST)))
+    return -lothar_errno;
 
-  if((status = send(connection, RESPONSE, KEEPALIVE, NULL, 0)) < 0)
-    return status;
+  put_filename(lothar_findfirst_request_filename(buf), pattern);
 
-  if((status = recv(connection, KEEPALIVE, buf, 7)) < 0)
-    return status;
+  pending.out[0] = handle;
+  pending.out[1] = name;
+  pending.out[2] = size;
 
-  if(buf[2])
-    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+  return request(connection, &pending, buf, LOTHAR_REQUEST_SIZE_FINDFIRST);
+}
 
-  if(sleeptime)
-    *sleeptime = lothar_nxttohl(buf + 3);
+int lothar_findnext(lothar_connection_t *connection, uint8_t handle, char *name, uint32_t *size)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_FINDNEXT, LOTHAR_REPLY_SIZE_FINDNEXT, decode_find};
+  uint8_t *buf;
 
-  return 0;
+  if(!(buf = frame(connection, LOTHAR_OPCODE_FINDNEXT)))
+    return -lothar_errno;
+
+  lothar_findnext_request_set_handle(buf, handle);
+
+  pending.out[1] = name;
+  pending.out[2] = size;
+
+  return request(connection, &pending, buf, LOTHAR_REQUEST_SIZE_FINDNEXT);
 }
 
-/* lsgetstatus */
+/* readiomap */
 
-int lothar_lsgetstatus(lothar_connection_t *connection, enum lothar_input_port port, uint8_t *bytesready)
+static int decode_readiomap(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
 {
-  int status;
-  uint8_t buf[4];
-  buf[0] = port;
+  size_t len = 0;
+
+  if(status >= 0 && (len = lothar_readiomap_reply_size(buf)) > pending->bufsize) // should never happen
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+    status = -lothar_errno;
+  }
 
-  if((status = send(connection, RESPONSE, LSGETSTATUS, buf, 1)) < 0)
+  if(pending->callback)
+  {
+    ((lothar_readiomap_callback)pending->callback)(connection,
+						   status,
+						   status < 0 ? NULL : lothar_readiomap_reply_data(buf),
+						   status < 0 ? 0 : len,
+						   pending->user);
     return status;
+  }
 
-  if((status = recv(connection, LSGETSTATUS, buf, 4)) < 0)
+  if(status < 0)
     return status;
 
-  if(bytesready)
-    *bytesready = buf[3];
+  if(pending->out[0])
+    memcpy(pending->out[0], lothar_readiomap_reply_data(buf), len);
+  if(pending->out[1])
+    *(size_t *)pending->out[1] = len;
 
-  return 0;  
+  return 0;
 }
 
-/* lswrite */
-
-int lothar_lswrite(lothar_connection_t *connection, enum lothar_input_port port, uint8_t const *txdata, uint8_t txlen, uint8_t rxlen)
+static int readiomap(lothar_connection_t *connection, lothar_pending_t *pending, uint32_t module, uint16_t offset, size_t len)
 {
-  int status;
   uint8_t *buf;
 
-  if(txlen > 16 || rxlen > 16)
+  if(!len || len > LOTHAR_MAX_IOMAPREAD)
     LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
 
-  buf = (uint8_t *)lothar_malloc(3 + txlen);
-  buf[0] = port;
-  buf[1] = txlen;
-  buf[2] = rxlen;
-  memcpy(buf + 3, txdata, txlen);
+  if(!(buf = frame(connection, LOTHAR_OPCODE_READIOMAP)))
+    return -lothar_errno;
 
-  status = send(connection, NO_RESPONSE, LSWRITE, buf, txlen + 3);
+  lothar_readiomap_request_set_module(buf, module);
+  lothar_readiomap_request_set_offset(buf, offset);
+  lothar_readiomap_request_set_size(buf, len);
 
-  free(buf);
-  
-  return status;  
-}
+  pending->size    = LOTHAR_REPLY_SIZE_READIOMAP + len;
+  pending->bufsize = len;
 
-/* lsread */
+  return request(connection, pending, buf, LOTHAR_REQUEST_SIZE_READIOMAP);
+}
 
-int lothar_lsread(lothar_connection_t *connection, enum lothar_input_port port, uint8_t *rxdata, size_t bufsize, uint8_t *rxlen)
+int lothar_readiomap(lothar_connection_t *connection, uint32_t module, uint16_t offset, uint8_t *data, size_t len, size_t *read)
 {
-  int status;
-  uint8_t buf[20];
+  lothar_pending_t pending = {LOTHAR_OPCODE_READIOMAP, 0, decode_readiomap};
 
-  buf[0] = port;
+  pending.out[0] = data;
+  pending.out[1] = read;
 
-  if((status = send(connection, RESPONSE, LSREAD, buf, 1)) < 0)
-    return status;
+  return readiomap(connection, &pending, module, offset, len);
+}
 
-  if((status = recv(connection, LSREAD, buf, 20)) < 0)
-    return status;
-  
-  if(rxlen)
-    *rxlen = buf[3];
+int lothar_readiomap_async(lothar_connection_t *connection,
+			   uint32_t module,
+			   uint16_t offset,
+			   size_t len,
+			   lothar_readiomap_callback callback,
+			   void *user)
+{
+  lothar_pending_t pending = {LOTHAR_OPCODE_READIOMAP, 0, decode_readiomap};
 
-  if(rxdata)
-  {
-    if(bufsize < buf[3])
-    {
-      memcpy(rxdata, buf + 4, bufsize);
-      LOTHAR_DEBUG("%d vs %d\n", (int)bufsize, (int)buf[3]);
-      LOTHAR_RETURN_ERROR(LOTHAR_ERROR_BUFFER_TOO_SMALL);
-    }
-    else
-    {
-      memcpy(rxdata, buf + 4, buf[3]);
-      status = 0;
-    }
-  }
+  if(!callback)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
 
-  return status;
+  pending.callback = (void (*)(void))callback;
+  pending.user     = user;
+
+  return readiomap(connection, &pending, module, offset, len);
 }
 
-/* getcurrentprogramname */
+/* writeiomap */
 
-int lothar_getcurrentprogramname(lothar_connection_t *connection, char filename[19])
+static int decode_writeiomap(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *buf)
 {
-  int status;
-  uint8_t buf[22];
-
-  if((status = send(connection, RESPONSE, GETCURRENTPROGRAMNAME, NULL, 0)) < 0)
-    return status;
-
-  if((status = recv(connection, GETCURRENTPROGRAMNAME, buf, 22)) < 0)
+  if(status < 0)
     return status;
 
-  if(filename)
-    memcpy(filename, buf + 3, 19);
+  if(pending->out[0])
+    *(size_t *)pending->out[0] = lothar_writeiomap_reply_size(buf);
 
   return 0;
 }
 
-/* messageread */
-
-int lothar_messageread(lothar_connection_t *connection, uint8_t remote_inbox, uint8_t local_inbox, uint8_t remove, uint8_t data[59], uint8_t *len)
+int lothar_writeiomap(lothar_connection_t *connection, uint32_t module, uint16_t offset, uint8_t const *data, size_t len, size_t *written)
 {
-  int status;
-  uint8_t buf[64];
+  lothar_pending_t pending = {LOTHAR_OPCODE_WRITEIOMAP, LOTHAR_REPLY_SIZE_WRITEIOMAP, decode_writeiomap};
+  uint8_t *buf;
 
-  if(remote_inbox > 16 || local_inbox > 9)
+  if(!data || !len || len > LOTHAR_MAX_IOMAPWRITE)
     LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
 
-  buf[0] = remote_inbox;
-  buf[1] = local_inbox;
-  buf[2] = remove;
-
-  if((status = send(connection, RESPONSE, MESSAGEREAD, buf, 3)) < 0)
-    return status;
-
-  if((status = recv(connection, MESSAGEREAD, buf, 64)) < 0)
-    return status;
+  if(!(buf = frame(connection, LOTHAR_OPCODE_WRITEIOMAP)))
+    return -lothar_errno;
 
-  if(len)
-    *len = buf[4];
+  lothar_writeiomap_request_set_module(buf, module);
+  lothar_writeiomap_request_set_offset(buf, offset);
+  lothar_writeiomap_request_set_size(buf, len);
+  memcpy(lothar_writeiomap_request_data(buf), data, len);
 
-  if(data)
-  {
-    if(buf[4] > 59) // should never happen
-    {
-      memcpy(data, buf + 5, 59);
-      LOTHAR_RETURN_ERROR(LOTHAR_ERROR_BUFFER_TOO_SMALL);
-    }
-    else
-    {
-      memcpy(data, buf + 5, buf[4]);
-      status = 0;
-    }
-  }
+  pending.out[0] = written;
 
-  return status;
+  return request(connection, &pending, buf, LOTHAR_REQUEST_SIZE_WRITEIOMAP + len);
 }
@@ -1,123 +1,180 @@
 #include "connection.h"
+#include "connection_private.h"
+#include "framing.h"
+#include "commands.h"
+#include "codec.h"
 #include "error_handling.h"
+#include "thread.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
 // defined in bluetooth backend
 
-extern void *lothar_bt_new(char const *address);
+extern void *lothar_bt_new(char const *address, int const volatile *cancelled);
 extern int lothar_bt_backend_write(void *connection, uint8_t const *data, size_t len);
+extern int lothar_bt_backend_writev(void *connection, lothar_iovec_t const *iov, size_t iovcount);
 extern int lothar_bt_backend_read(void *connection, uint8_t *data, size_t len);
 extern int lothar_bt_close(void *connection);
+extern int lothar_bt_set_timeout(void *connection, uint32_t ms);
 
 // defined in usb backend
 
 extern void *lothar_usb_new(uint16_t vendor, uint16_t product);
+extern int lothar_usb_enumerate(uint16_t vendor, uint16_t product, void (*found)(void *connection, char const *serial, void *user), void *user);
 extern int lothar_usb_write(void *connection, uint8_t const *data, size_t len);
 extern int lothar_usb_read(void *connection, uint8_t *data, size_t len);
 extern int lothar_usb_close(void *connection);
+extern int lothar_usb_set_timeout(void *connection, uint32_t ms);
 
 // useful for any kind of bluetooth backend
 
-static int lothar_bt_write(void *connection, uint8_t const *data, size_t len)
+typedef struct
+{
+  void *backend; // as returned by lothar_bt_new
+  lothar_framer_t framer;
+} bt_t;
+
+static int lothar_bt_writev(void *connection, lothar_iovec_t const *iov, size_t iovcount)
 {
-  // copying instead of sending two messages is probably better, since buffering and bandwith is probalby more a limitation then cpu and memory
-  uint8_t *buf = (uint8_t *)lothar_malloc(len + 2);
-  size_t w = 0;
+  bt_t *bt = (bt_t *)connection;
+  // the size goes in front, as a buffer of its own, so the message can go out in one go without copying
+  lothar_iovec_t buf[LOTHAR_MAX_IOV + 1];
+  uint8_t size[2];
+  size_t len = 0;
+  size_t i;
+
+  if(iovcount > LOTHAR_MAX_IOV)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  for(i = 0; i < iovcount; ++i)
+    len += iov[i].len;
 
   // set the size, the nxt expects little endian
-  buf[0] = len;
-  buf[1] = len >> 8;
+  lothar_htonxts(len, size);
 
-  memcpy(buf + 2, data, len);
+  buf[0].data = size;
+  buf[0].len = 2;
+  memcpy(buf + 1, iov, iovcount * sizeof(lothar_iovec_t));
 
-  while(w < len + 2)
+  i = 0;
+  while(i < iovcount + 1)
   {
-    int _w = lothar_bt_backend_write(connection, buf + w, len + 2 - w);
+    int w = lothar_bt_backend_writev(bt->backend, buf + i, iovcount + 1 - i);
     
-    if(_w <= 0)
-    {
-      free(buf);
+    if(w <= 0)
       return -1;
+
+    // skip what was written, the backend is allowed to send only part of it
+    while(i < iovcount + 1 && (size_t)w >= buf[i].len)
+    {
+      w -= buf[i].len;
+      ++i;
+    }
+
+    if(i < iovcount + 1)
+    {
+      buf[i].data += w;
+      buf[i].len -= w;
     }
-    
-    w += _w;
   }
   
-  free(buf);
-  
   return len;
 }
 
-static int lothar_bt_read(void *connection, uint8_t *data, size_t len)
+static int lothar_bt_write(void *connection, uint8_t const *data, size_t len)
 {
-  uint8_t buf[2];
-  uint16_t size;
-  int status;
-  int tr;
+  lothar_iovec_t iov;
 
-  if((status = lothar_bt_backend_read(connection, buf, 2)) && status != 2)
-  {
-    if(status > 0) // _some_ reading was done
-      LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
-    return -1;
-  }
-  
-  // nxt gives us little endian
-  size = lothar_nxttohs(buf);
+  iov.data = data;
+  iov.len = len;
 
-  if(size > len)
-  {
-    tr = lothar_bt_backend_read(connection, data, size);
+  return lothar_bt_writev(connection, &iov, 1);
+}
 
-    // lets try to be robust and read what we can, i.e. don't leave it in the buffer
-    size -= tr;
-    while(size)
-    {
-      tr = lothar_bt_backend_read(connection, buf, 2);
-      if(tr <= 0)
-	break;
+// all telegrams in one write, so several of them can share a radio packet
+static int lothar_bt_writebatch(void *connection, lothar_iovec_t const *telegrams, size_t count)
+{
+  bt_t *bt = (bt_t *)connection;
+  uint8_t buf[LOTHAR_FRAMER_PACKED(LOTHAR_MAX_BATCH)];
+  int len;
+  int i;
 
-      size -= tr;
-    }
+  if((len = lothar_framer_pack(telegrams, count, buf)) < 0)
+    return len;
 
-    status = len; // well, in a way, it _did_ succeed
-  }
-  else if(len > size)
+  // the backend is allowed to send only part of it
+  for(i = 0; i < len; )
   {
-    status = lothar_bt_backend_read(connection, data, size);
+    int w = lothar_bt_backend_write(bt->backend, buf + i, len - i);
+
+    if(w <= 0)
+      return -1;
+
+    i += w;
   }
-  else
-    status = lothar_bt_backend_read(connection, data, len);
+
+  return len - 2 * count;
+}
+
+// replies are taken from the receive buffer, which is refilled with whatever the backend has in one go
+static int lothar_bt_read(void *connection, uint8_t *data, size_t len)
+{
+  return lothar_framer_read(&((bt_t *)connection)->framer, data, len);
+}
+
+static int bt_close(void *connection)
+{
+  bt_t *bt = (bt_t *)connection;
+  int status = lothar_bt_close(bt->backend);
+
+  free(bt);
 
   return status;
 }
 
-struct lothar_connection_t
+static int bt_set_timeout(void *connection, uint32_t ms)
 {
-  lothar_connection_vtable const *vtable;
-  void *connection;
-};
+  return lothar_bt_set_timeout(((bt_t *)connection)->backend, ms);
+}
 
 static lothar_connection_vtable usb_vtable = 
 {
   lothar_usb_read,
   lothar_usb_write,
-  lothar_usb_close
+  lothar_usb_close,
+  NULL, // every bulk transfer is a message, buffers need to be contiguous
+  lothar_usb_set_timeout
 };
 
 static lothar_connection_vtable bt_vtable = 
 {
   lothar_bt_read,
   lothar_bt_write,
-  lothar_bt_close
+  bt_close,
+  lothar_bt_writev,
+  bt_set_timeout,
+  lothar_bt_writebatch
 };
 
-lothar_connection_t *lothar_connection_open_usb_vid_pid(uint16_t vendor, uint16_t product)
+// allocate a connection, with no outstanding requests
+static lothar_connection_t *connection_new(void)
 {
   lothar_connection_t *connection = (lothar_connection_t *)lothar_malloc(sizeof(lothar_connection_t));
 
+  memset(connection, 0, sizeof(lothar_connection_t));
+
+  // stopping the motors should not wait for queries
+  connection->priority[LOTHAR_OPCODE_SETOUTPUTSTATE] = LOTHAR_PRIORITY_URGENT;
+  connection->priority[LOTHAR_OPCODE_STOPPROGRAM]    = LOTHAR_PRIORITY_URGENT;
+
+  return connection;
+}
+
+lothar_connection_t *lothar_connection_open_usb_vid_pid(uint16_t vendor, uint16_t product)
+{
+  lothar_connection_t *connection = connection_new();
+
   connection->connection = lothar_usb_new(vendor, product);
 
   if(!connection->connection)
@@ -136,50 +193,174 @@ lothar_connection_t *lothar_connection_open_usb()
   return lothar_connection_open_usb_vid_pid(USB_VENDOR_LEGO, USB_PRODUCT_NXT);
 }
 
-lothar_connection_t *lothar_connection_open_bluetooth_address(char const *address)
+typedef struct
 {
-  lothar_connection_t *connection = (lothar_connection_t *)lothar_malloc(sizeof(lothar_connection_t));
+  lothar_connection_found found;
+  void *user;
+} enumerate_t;
+
+// wrap a device opened by the backend in a connection
+static void usb_found(void *handle, char const *serial, void *user)
+{
+  enumerate_t *e = (enumerate_t *)user;
+  lothar_connection_t *connection = connection_new();
+
+  connection->connection = handle;
+  connection->vtable = &usb_vtable;
+
+  e->found(connection, serial, e->user);
+}
+
+int lothar_connection_open_usb_all(uint16_t vendor, uint16_t product, lothar_connection_found found, void *user)
+{
+  enumerate_t e;
+
+  if(!found)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  e.found = found;
+  e.user = user;
+
+  return lothar_usb_enumerate(vendor, product, usb_found, &e);
+}
+
+// open the brick at address, unless cancelled (if not NULL) is set before connecting
+static lothar_connection_t *open_bluetooth_address(char const *address, int const volatile *cancelled)
+{
+  lothar_connection_t *connection;
+  bt_t *bt;
+  void *backend;
 
   assert(address);
 
-  connection->connection = lothar_bt_new(address);
-  if(!connection->connection)
-  {
-    free(connection);
+  if(!(backend = lothar_bt_new(address, cancelled)))
     return NULL;
-  }
 
+  bt = (bt_t *)lothar_malloc(sizeof(bt_t));
+  bt->backend = backend;
+  lothar_framer_init(&bt->framer, lothar_bt_backend_read, backend);
+
+  connection = connection_new();
+  connection->connection = bt;
   connection->vtable = &bt_vtable;
 
   return connection;
 }
 
+lothar_connection_t *lothar_connection_open_bluetooth_address(char const *address)
+{
+  return open_bluetooth_address(address, NULL);
+}
+
 lothar_connection_t *lothar_connection_open_bluetooth()
 {
   return lothar_connection_open_bluetooth_address(BLUETOOTH_NXT_ADDRESS);
 }
 
+// bluetooth opened on a thread of its own, while usb is tried
+typedef struct
+{
+  lothar_mutex_t mutex;
+  lothar_cond_t cond;
+
+  lothar_connection_t *bluetooth;
+  lothar_error_record_t failure; // why the bluetooth attempt failed, as recorded on its thread
+  int done;    // (boolean) the bluetooth attempt is over
+  int volatile cancelled; // (boolean) usb won, bluetooth should not connect
+  size_t refs; // the thread and the opener, the last one to let go cleans up
+} race_t;
+
+static void release(race_t *race)
+{
+  size_t refs;
+
+  lothar_mutex_lock(&race->mutex);
+  refs = --race->refs;
+  lothar_mutex_unlock(&race->mutex);
+
+  if(refs)
+    return;
+
+  // nobody wanted it
+  if(race->bluetooth)
+    lothar_connection_close(&race->bluetooth);
+
+  lothar_cond_destroy(&race->cond);
+  lothar_mutex_destroy(&race->mutex);
+  free(race);
+}
+
+static void open_bluetooth(void *data)
+{
+  race_t *race = (race_t *)data;
+  lothar_connection_t *connection = open_bluetooth_address(BLUETOOTH_NXT_ADDRESS, &race->cancelled);
+
+  lothar_mutex_lock(&race->mutex);
+  race->bluetooth = connection;
+  lothar_error_record(&race->failure);
+  race->done = 1;
+  lothar_cond_signal(&race->cond);
+  lothar_mutex_unlock(&race->mutex);
+
+  release(race);
+}
+
 lothar_connection_t *lothar_connection_open()
 {
   lothar_connection_t *connection;
-  
-  LOTHAR_INFO("attempting bluetooth connection...\n");
+  lothar_thread_t thread;
+  race_t *race;
+  int racing;
+
+  LOTHAR_INFO("attempting bluetooth and usb connection...\n");
+
+  race = (race_t *)lothar_malloc(sizeof(race_t));
+  lothar_mutex_init(&race->mutex);
+  lothar_cond_init(&race->cond);
+  race->bluetooth = NULL;
+  race->done = 0;
+  race->cancelled = 0;
+  race->refs = 2;
+
+  if((racing = lothar_thread_create(&thread, open_bluetooth, race) == 0))
+    lothar_thread_detach(&thread);
+  else
+    race->refs = 1; // then bluetooth is tried after usb
 
-  connection = lothar_connection_open_bluetooth();
-  if(!connection)
+  // an attached brick answers in milliseconds, a bluetooth lookup can take seconds which are not waited for
+  if((connection = lothar_connection_open_usb()))
   {
-    LOTHAR_INFO("failed, attempting usb connection...\n");
+    race->cancelled = 1;
+    release(race);
+    LOTHAR_INFO("success (usb)!\n");
+    return connection;
+  }
 
-    LOTHAR_ERROR(LOTHAR_ERROR_OKAY); // clear errno
-    connection = lothar_connection_open_usb();
+  if(!racing)
+  {
+    ++race->refs;
+    open_bluetooth(race);
+  }
 
-    if(!connection)
-    {
-      LOTHAR_INFO("failed!\n");
-      return NULL;
-    }
+  lothar_mutex_lock(&race->mutex);
+  while(!race->done)
+    lothar_cond_wait(&race->cond, &race->mutex);
+  connection = race->bluetooth;
+  race->bluetooth = NULL;
+  if(!connection)
+    lothar_error_restore(&race->failure);
+  lothar_mutex_unlock(&race->mutex);
+
+  release(race);
+
+  if(!connection)
+  {
+    LOTHAR_INFO("failed!\n");
+    return NULL;
   }
-  LOTHAR_INFO("success!\n");
+
+  lothar_clear_error(); // of the usb attempt
+  LOTHAR_INFO("success (bluetooth)!\n");
 
   return connection;
 }
@@ -187,7 +368,7 @@ lothar_connection_t *lothar_connection_open()
 lothar_connection_t *lothar_connection_open_custom(lothar_connection_vtable const *vtable,
                                                    void *private_data)
 {
-  lothar_connection_t *connection = (lothar_connection_t *)lothar_malloc(sizeof(lothar_connection_t));
+  lothar_connection_t *connection = connection_new();
 
   assert(vtable);
 
@@ -204,6 +385,9 @@ int lothar_connection_close(lothar_connection_t **connection)
   if(!connection || !(*connection))
     return 0;
 
+  lothar_io_thread_stop(*connection);
+  lothar_combine_end(*connection);
+
   ret = (*connection)->vtable->close((*connection)->connection);
 
   free(*connection);
@@ -212,18 +396,156 @@ int lothar_connection_close(lothar_connection_t **connection)
   return ret;
 }
 
+int lothar_connection_set_timeout(lothar_connection_t *c, uint32_t ms)
+{
+  if(!c)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  c->timeout = ms;
+  return 0;
+}
+
+int lothar_connection_set_deadline(lothar_connection_t *c, uint64_t deadline)
+{
+  if(!c)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  c->deadline = deadline;
+  return 0;
+}
+
+// pass the time left for the next read or write on to the backend, fails if the deadline has passed
+static int arm(lothar_connection_t *c)
+{
+  uint32_t ms = c->timeout;
+  uint64_t deadline = c->deadline;
+  int status;
+
+  if(deadline)
+  {
+    uint64_t now = lothar_time_us();
+    uint64_t left;
+
+    if(now >= deadline)
+      LOTHAR_RETURN_ERROR(LOTHAR_ERROR_TIMEOUT);
+
+    // rounded up, a timeout of 0 would mean no timeout at all
+    left = (deadline - now + 999) / 1000;
+    if(!ms || left < ms)
+      ms = (uint32_t)left;
+  }
+
+  // only when it changes, to save the backend (a system call, usually) the trouble
+  if(ms != c->armed && c->vtable->set_timeout)
+  {
+    if((status = c->vtable->set_timeout(c->connection, ms)) < 0)
+      return status;
+
+    c->armed = ms;
+  }
+
+  return 0;
+}
+
 int lothar_connection_write(lothar_connection_t *c, uint8_t const *data, size_t len)
 {
+  int status;
+
   if(!c)
     LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
 
+  if((status = arm(c)) < 0)
+    return status;
+
   return c->vtable->write(c->connection, data, len);
 }
 
+int lothar_connection_writev(lothar_connection_t *c, lothar_iovec_t const *iov, size_t iovcount)
+{
+  uint8_t stackbuf[LOTHAR_MAX_TELEGRAM];
+  uint8_t *buf = stackbuf;
+  size_t len = 0;
+  size_t i;
+  int status;
+
+  if(!c)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(iovcount > LOTHAR_MAX_IOV)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if((status = arm(c)) < 0)
+    return status;
+
+  if(c->vtable->writev)
+    return c->vtable->writev(c->connection, iov, iovcount);
+
+  if(iovcount == 1)
+    return c->vtable->write(c->connection, iov[0].data, iov[0].len);
+
+  // the connection can only write contiguous data, gather it
+  for(i = 0; i < iovcount; ++i)
+    len += iov[i].len;
+
+  if(len > sizeof(stackbuf))
+    buf = (uint8_t *)lothar_malloc(len);
+
+  for(len = 0, i = 0; i < iovcount; ++i)
+  {
+    memcpy(buf + len, iov[i].data, iov[i].len);
+    len += iov[i].len;
+  }
+
+  status = c->vtable->write(c->connection, buf, len);
+
+  if(buf != stackbuf)
+    free(buf);
+
+  return status;
+}
+
+int lothar_connection_writebatch(lothar_connection_t *c, lothar_iovec_t const *telegrams, size_t count)
+{
+  size_t len = 0;
+  size_t i;
+  int status;
+
+  if(!c)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(count > LOTHAR_MAX_BATCH)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if((status = arm(c)) < 0)
+    return status;
+
+  if(c->vtable->writebatch)
+    return c->vtable->writebatch(c->connection, telegrams, count);
+
+  // one at a time then
+  for(i = 0; i < count; ++i)
+  {
+    if((status = c->vtable->write(c->connection, telegrams[i].data, telegrams[i].len)) < 0)
+      return status;
+
+    if(status != (int)telegrams[i].len)
+      LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_WRITE_ERROR);
+
+    len += status;
+  }
+
+  return len;
+}
+
 int lothar_connection_read(lothar_connection_t *c, uint8_t *data, size_t len)
 {
+  int status;
+
   if(!c)
     LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
 
+  if((status = arm(c)) < 0)
+    return status;
+
   return c->vtable->read(c->connection, data, len);
 }
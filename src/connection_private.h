@@ -0,0 +1,172 @@
+#ifndef CONNECTION_PRIVATE_H
+#define CONNECTION_PRIVATE_H
+
+#include "connection.h"
+#include "commands.h"
+#include "codec.h"
+#include "stats.h"
+#include "thread.h"
+
+/* internals of lothar_connection_t, shared between the connection and the commands layer */
+
+typedef struct lothar_pending_t lothar_pending_t;
+
+/* where the I/O thread reports the result of a request to the thread that waits for it */
+typedef struct
+{
+  int status;
+  int done;
+} lothar_completion_t;
+
+/* bookkeeping for a request that still awaits its reply */
+struct lothar_pending_t
+{
+  uint8_t command; // the opcode the reply should carry
+  size_t size;     // the size of the reply
+
+  // translate the reply into the output parameters (or pass it to the callback), returns 0 or a negative error code
+  // status is the result of checking the reply, reply is NULL if no (valid) reply was received
+  int (*decode)(lothar_connection_t *connection, lothar_pending_t const *pending, int status, uint8_t const *reply);
+
+  uint8_t port;    // the port the request was addressed to (where applicable)
+  uint8_t wait;    // (boolean) wait for the reply even when pipelining, the output parameters do not outlive the call
+  uint8_t busy;    // (boolean) lsgetstatus reports a bus that is still busy as an error, not as no bytes ready
+  size_t bufsize;  // the size of the callers output buffer (where applicable)
+  void *out[10];   // the output parameters, as passed to the command
+
+  void (*callback)(void); // the completion callback of an asynchronous command (cast to its actual type), or NULL
+  void *user;             // passed to the callback as is
+
+  lothar_completion_t *completion; // in threaded mode, the submitter waiting for this request (or NULL)
+
+  uint64_t sent; // when the request was written (lothar_time_us()), for the round trip time
+};
+
+/* the size of the submission ring of the I/O thread, a power of 2 */
+#define LOTHAR_RING_SIZE 32
+
+/* a request, as submitted to the I/O thread */
+typedef struct
+{
+  size_t sequence; // position in the ring this slot is ready for, see lothar_io_t
+
+  uint8_t frame[LOTHAR_MAX_TELEGRAM];
+  size_t len;
+
+  lothar_pending_t pending; // if the frame asks for a reply, otherwise only the completion is used
+
+  uint8_t coalesce; // (boolean) a setoutputstate nobody waits for, a newer one for its port may replace it
+} lothar_slot_t;
+
+/* a submission ring of the I/O thread, there is one for every priority (see lothar_set_priority())
+ * 
+ * The ring is a bounded multi-producer, single-consumer queue. A slot is free for the producer that claims position pos
+ * when its sequence equals pos, it is ready for the consumer when its sequence equals pos + 1. Having written the
+ * request, the consumer releases the slot for position pos + LOTHAR_RING_SIZE. Producers never take a lock.
+ */
+typedef struct
+{
+  lothar_slot_t ring[LOTHAR_RING_SIZE];
+  size_t volatile head; // the next position to claim by a producer
+  size_t volatile tail; // the next position to take by the consumer (only changed by the I/O thread)
+} lothar_lane_t;
+
+/* the output ports coalesced commands are kept apart for: A, B, C and all of them */
+#define LOTHAR_OUTPUTS 4
+
+/* a setoutputstate held by the I/O thread while coalescing, until it is written or replaced */
+typedef struct
+{
+  uint8_t frame[LOTHAR_REQUEST_SIZE_SETOUTPUTSTATE];
+  size_t order; // the order it was taken from the ring in, 0 if nothing is held
+} lothar_held_t;
+
+/* state of the I/O thread of a connection */
+typedef struct
+{
+  lothar_lane_t lanes[LOTHAR_PRIORITIES];
+
+  lothar_thread_t thread;
+  size_t volatile sleeping; // (boolean) the I/O thread waits for work, producers must wake it
+  size_t volatile stopping; // (boolean) the I/O thread should exit when all work is done
+
+  lothar_mutex_t mutex;
+  lothar_cond_t work; // signaled when a request is submitted to a sleeping I/O thread
+  lothar_cond_t done; // broadcast when a request completes
+
+  // requests that expect a reply, submitted and completed
+  size_t volatile submitted;
+  size_t volatile completed;
+  int status; // the first error reported to a callback, protected by mutex
+  lothar_error_record_t failure; // the context of that error, as recorded on the I/O thread
+
+  // the newest setoutputstate of every output, see lothar_coalesce_begin() (only used by the I/O thread)
+  lothar_held_t held[LOTHAR_OUTPUTS];
+  size_t holds;
+} lothar_io_t;
+
+
+/* statistics are kept for the opcodes of direct commands (0x00 to 0x3f) and system commands (0x80 to 0xbf) */
+#define LOTHAR_STATS_SLOTS 128
+
+struct lothar_connection_t
+{
+  lothar_connection_vtable const *vtable;
+  void *connection;
+
+  // storage to build requests in, so sending a command does not need to allocate
+  uint8_t frame[LOTHAR_MAX_TELEGRAM];
+
+  // outstanding replies, in the order the requests were sent
+  lothar_pending_t pending[LOTHAR_MAX_PENDING];
+  size_t sent;     // the number of requests that expect a reply sent so far
+  size_t received; // the number of those that have been answered (or given up on)
+
+  uint8_t pipelined;   // (boolean) in pipelined mode, requests do not wait for their reply
+  int pipeline_status; // the first error encountered while pipelining
+  int dispatching;     // nonzero while a reply is being decoded (i.e. from within callbacks)
+
+  lothar_io_t *io;     // the I/O thread in threaded mode, NULL otherwise
+  uint8_t priority[256]; // the lane of the requests by opcode, an enum lothar_priority
+
+  // requests that expect no reply, held back while combining to be written together (see lothar_combine_begin())
+  uint8_t combining; // (boolean)
+  uint8_t combined[LOTHAR_MAX_BATCH][LOTHAR_MAX_TELEGRAM];
+  lothar_iovec_t batch[LOTHAR_MAX_BATCH];
+  size_t batched;
+
+  // setoutputstate commands that wait to be written are replaced by newer ones for their port (see lothar_coalesce_begin())
+  uint8_t coalescing;                     // (boolean)
+  size_t volatile dropped[LOTHAR_OUTPUTS]; // the commands replaced, by output (only updated by the thread doing the I/O)
+
+  uint32_t timeout;           // of every read and write in milliseconds, 0 for none
+  uint64_t volatile deadline; // of all I/O (lothar_time_us()), 0 for none
+  uint32_t armed;             // the timeout the backend was last given
+  size_t late;                // replies to requests that timed out, which may still arrive
+
+  uint64_t transmitted; // when the last request was written
+  lothar_opcode_stats_t stats[LOTHAR_STATS_SLOTS]; // only updated by the thread doing the I/O, see stats.h
+};
+
+// keep the first error reported to the callbacks of a burst of asynchronous requests (see lothar_async_dispatch())
+static inline void lothar_first_error(int *first, int status)
+{
+  if(status < 0 && !*first)
+    *first = status;
+}
+
+// as lothar_lsgetstatus_async(), but the callback gets -LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS while the bus is
+// busy, where lothar_lsgetstatus() reports no bytes ready (see i2c.c)
+int lothar_lsgetstatus_poll(lothar_connection_t *connection, enum lothar_input_port port, lothar_lsgetstatus_callback callback, void *user);
+
+// the statistics of an opcode, or NULL if none are kept for it
+static inline lothar_opcode_stats_t *lothar_stats_of(lothar_connection_t *connection, uint8_t opcode)
+{
+  if(opcode < 0x40)
+    return connection->stats + opcode;
+  if(opcode >= 0x80 && opcode < 0xc0)
+    return connection->stats + 0x40 + (opcode - 0x80);
+  return NULL;
+}
+
+#endif
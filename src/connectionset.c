@@ -0,0 +1,219 @@
+#include "connectionset.h"
+#include "error_handling.h"
+#include "thread.h"
+#include "vector.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define MAX_NAME 32
+
+typedef struct
+{
+  lothar_connection_t *connection;
+  char name[MAX_NAME];
+} entry_t;
+
+struct lothar_connectionset_t
+{
+  vector_t *entries;
+};
+
+// a function running on one of the connections
+typedef struct
+{
+  lothar_connection_t *connection;
+  size_t index;
+  lothar_connectionset_function function;
+  void *user;
+  int status;
+  lothar_error_record_t failure; // the error the function failed with, as recorded on its thread
+
+  lothar_thread_t thread;
+  int started; // (boolean) it runs on a thread of its own
+} job_t;
+
+lothar_connectionset_t *lothar_connectionset_create(void)
+{
+  lothar_connectionset_t *set = (lothar_connectionset_t *)lothar_malloc(sizeof(lothar_connectionset_t));
+
+  set->entries = vector_new(0);
+
+  return set;
+}
+
+static void found(lothar_connection_t *connection, char const *serial, void *user)
+{
+  lothar_connectionset_add((lothar_connectionset_t *)user, connection, serial);
+}
+
+lothar_connectionset_t *lothar_connectionset_open_usb_vid_pid(uint16_t vendor, uint16_t product)
+{
+  lothar_connectionset_t *set = lothar_connectionset_create();
+
+  if(lothar_connection_open_usb_all(vendor, product, found, set) < 0)
+  {
+    lothar_connectionset_destroy(&set);
+    return NULL;
+  }
+
+  return set;
+}
+
+lothar_connectionset_t *lothar_connectionset_open_usb(void)
+{
+  return lothar_connectionset_open_usb_vid_pid(USB_VENDOR_LEGO, USB_PRODUCT_NXT);
+}
+
+int lothar_connectionset_destroy(lothar_connectionset_t **set)
+{
+  int ret = 0;
+  size_t i;
+
+  if(!set || !(*set))
+    return 0;
+
+  for(i = 0; i < vector_size((*set)->entries); ++i)
+  {
+    entry_t *entry = (entry_t *)vector_get((*set)->entries, i);
+    int status = lothar_connection_close(&entry->connection);
+
+    if(status < 0 && !ret)
+      ret = status;
+  }
+
+  vector_free(&(*set)->entries, 1);
+  free(*set);
+  *set = NULL;
+
+  return ret;
+}
+
+int lothar_connectionset_add(lothar_connectionset_t *set, lothar_connection_t *connection, char const *name)
+{
+  entry_t *entry;
+
+  if(!set)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(!connection || (name && strlen(name) >= MAX_NAME))
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  entry = (entry_t *)lothar_malloc(sizeof(entry_t));
+  entry->connection = connection;
+
+  if(name)
+    strcpy(entry->name, name);
+  else
+    sprintf(entry->name, "%u", (unsigned)vector_size(set->entries));
+
+  vector_push_back(set->entries, entry);
+
+  return 0;
+}
+
+size_t lothar_connectionset_size(lothar_connectionset_t const *set)
+{
+  return set ? vector_size(set->entries) : 0;
+}
+
+lothar_connection_t *lothar_connectionset_get(lothar_connectionset_t *set, size_t index)
+{
+  if(index >= lothar_connectionset_size(set))
+    return NULL;
+
+  return ((entry_t *)vector_get(set->entries, index))->connection;
+}
+
+char const *lothar_connectionset_name(lothar_connectionset_t const *set, size_t index)
+{
+  if(index >= lothar_connectionset_size(set))
+    return NULL;
+
+  return ((entry_t const *)set->entries->data[index])->name;
+}
+
+lothar_connection_t *lothar_connectionset_find(lothar_connectionset_t *set, char const *name)
+{
+  size_t i;
+
+  if(!name)
+    return NULL;
+
+  for(i = 0; i < lothar_connectionset_size(set); ++i)
+  {
+    entry_t *entry = (entry_t *)vector_get(set->entries, i);
+
+    if(!strcmp(entry->name, name))
+      return entry->connection;
+  }
+
+  return NULL;
+}
+
+static void run(void *data)
+{
+  job_t *job = (job_t *)data;
+
+  job->status = job->function(job->connection, job->index, job->user);
+
+  if(job->status < 0)
+    lothar_error_record(&job->failure);
+}
+
+int lothar_connectionset_parallel(lothar_connectionset_t *set, lothar_connectionset_function function, void *user, int *status)
+{
+  size_t size = lothar_connectionset_size(set);
+  job_t *jobs;
+  job_t const *failed = NULL;
+  int ret = 0;
+  size_t i;
+
+  if(!set)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(!function)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(!size)
+    return 0;
+
+  jobs = (job_t *)lothar_malloc(size * sizeof(job_t));
+
+  // the last one runs on the calling thread, which would otherwise only wait
+  for(i = 0; i < size; ++i)
+  {
+    jobs[i].connection = lothar_connectionset_get(set, i);
+    jobs[i].index = i;
+    jobs[i].function = function;
+    jobs[i].user = user;
+    jobs[i].status = 0;
+    jobs[i].started = i + 1 < size && lothar_thread_create(&jobs[i].thread, run, jobs + i) == 0;
+
+    if(!jobs[i].started) // no thread to be had, do it ourselves
+      run(jobs + i);
+  }
+
+  for(i = 0; i < size; ++i)
+  {
+    if(jobs[i].started)
+      lothar_thread_join(&jobs[i].thread);
+
+    if(status)
+      status[i] = jobs[i].status;
+
+    if(jobs[i].status < 0 && !ret)
+    {
+      ret = jobs[i].status;
+      failed = jobs + i;
+    }
+  }
+
+  // every thread has an error state of its own
+  if(failed)
+    lothar_error_restore(&failed->failure);
+
+  free(jobs);
+
+  return ret;
+}
@@ -0,0 +1,444 @@
+#include "sockets.h"
+#include "daemon.h"
+#include "codec.h"
+#include "error_handling.h"
+#include "framing.h"
+#include "thread.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+/* no unix domain sockets */
+
+lothar_connection_t *lothar_connection_open_daemon(char const *path)
+{
+  LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+  return NULL;
+}
+
+lothar_daemon_t *lothar_daemon_open(lothar_connection_t *brick, char const *path)
+{
+  LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+  return NULL;
+}
+
+int lothar_daemon_coalesced(lothar_daemon_t const *daemon, size_t *requests)
+{
+  LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+}
+
+int lothar_daemon_close(lothar_daemon_t **daemon)
+{
+  LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+}
+
+#else
+
+#include <sys/un.h>
+#include <fcntl.h>
+
+#define MAX_CLIENTS 32 // one bit each, see entry_t
+#define POLL_MS     50 // how often the daemon checks whether it should stop
+
+typedef struct
+{
+  lothar_socket_t sock; // INVALID_SOCKET for a free slot
+  lothar_framer_t framer;
+  size_t last; // the write (in the current batch) that answers the latest request of this client, 0 for none
+} client_t;
+
+/* a request in the current batch that awaits its reply */
+typedef struct
+{
+  uint8_t request[LOTHAR_MAX_TELEGRAM];
+  size_t len;
+  size_t write;     // the position of the request among the writes of the batch, from 1
+  uint32_t waiting; // the clients that get the reply, a bit each
+} entry_t;
+
+struct lothar_daemon_t
+{
+  lothar_connection_t *brick;
+
+  char *path;
+  lothar_socket_t listener;
+
+  client_t clients[MAX_CLIENTS];
+  entry_t batch[LOTHAR_MAX_PENDING];
+
+  lothar_thread_t thread;
+  size_t volatile stopping;  // (boolean)
+  size_t volatile coalesced; // the number of requests answered with the reply to another
+};
+
+static int address(struct sockaddr_un *addr, char const *path)
+{
+  if(!path || strlen(path) >= sizeof(addr->sun_path))
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+
+  return 0;
+}
+
+static lothar_socket_t connect_to(struct sockaddr_un const *addr)
+{
+  lothar_socket_t sock;
+
+  if((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET)
+    return INVALID_SOCKET;
+
+  if(connect(sock, (struct sockaddr const *)addr, sizeof(*addr)) < 0)
+  {
+    lothar_socket_close(sock);
+    return INVALID_SOCKET;
+  }
+
+  return sock;
+}
+
+lothar_connection_t *lothar_connection_open_daemon(char const *path)
+{
+  struct sockaddr_un addr;
+  lothar_socket_t sock;
+
+  if(address(&addr, path) < 0)
+    return NULL;
+
+  if((sock = connect_to(&addr)) == INVALID_SOCKET)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+    return NULL;
+  }
+
+  return lothar_socket_connection(sock);
+}
+
+/* the daemon */
+
+// (boolean) can the reply to this request be shared with others that ask the same?
+static int coalescable(uint8_t const *request, size_t len)
+{
+  lothar_codec_command_t const *command;
+
+  if(len < 2 || request[0] != LOTHAR_CODEC_REPLY)
+    return 0;
+
+  command = lothar_codec_command(request[1]);
+
+  return command->type == LOTHAR_CODEC_REPLY && (command->flags & LOTHAR_CODEC_QUERY);
+}
+
+static void drop(client_t *client)
+{
+  lothar_socket_close(client->sock);
+  client->sock = INVALID_SOCKET;
+}
+
+// the first of n entries with the same request, written after the given write, n if there is none
+static size_t find(lothar_daemon_t const *daemon, size_t n, uint8_t const *request, size_t len, size_t after)
+{
+  size_t i;
+
+  for(i = 0; i < n; ++i)
+  {
+    entry_t const *entry = daemon->batch + i;
+
+    if(entry->write > after && entry->len == len && !memcmp(entry->request, request, len))
+      break;
+  }
+
+  return i;
+}
+
+/* Pass on the requests the clients have sent, and send back the replies.
+ *
+ * A request joins an identical one in the batch only if that is written after the latest request of the same client,
+ * so every client still gets its replies in the order of its requests.
+ */
+static void serve_batch(lothar_daemon_t *daemon)
+{
+  uint8_t request[LOTHAR_MAX_TELEGRAM];
+  uint8_t reply[2 + LOTHAR_MAX_TELEGRAM];
+  size_t n = 0;
+  size_t writes = 0;
+  size_t c, i;
+  int more = 1;
+  int len;
+
+  for(c = 0; c < MAX_CLIENTS; ++c)
+    daemon->clients[c].last = 0;
+
+  // a request of each client in turn, so a busy client does not hold up the others
+  while(more && n < LOTHAR_MAX_PENDING)
+  {
+    more = 0;
+
+    for(c = 0; c < MAX_CLIENTS && n < LOTHAR_MAX_PENDING; ++c)
+    {
+      client_t *client = daemon->clients + c;
+
+      if(client->sock == INVALID_SOCKET || !lothar_framer_ready(&client->framer))
+        continue;
+
+      more = 1;
+
+      if((len = lothar_framer_read(&client->framer, request, sizeof(request))) <= 0)
+      {
+        if(len < 0)
+          drop(client);
+        continue;
+      }
+
+      if(coalescable(request, len) && (i = find(daemon, n, request, len, client->last)) < n)
+      {
+        daemon->batch[i].waiting |= (uint32_t)1 << c;
+        client->last = daemon->batch[i].write;
+        lothar_atomic_add(&daemon->coalesced, 1);
+        continue;
+      }
+
+      if(lothar_connection_write(daemon->brick, request, len) < 0)
+      {
+        drop(client);
+        continue;
+      }
+
+      client->last = ++writes;
+
+      if(!(request[0] & LOTHAR_CODEC_NO_REPLY))
+      {
+        entry_t *entry = daemon->batch + n++;
+
+        memcpy(entry->request, request, len);
+        entry->len = len;
+        entry->write = writes;
+        entry->waiting = (uint32_t)1 << c;
+      }
+    }
+  }
+
+  for(i = 0; i < n; ++i)
+  {
+    entry_t const *entry = daemon->batch + i;
+
+    if((len = lothar_connection_read(daemon->brick, reply + 2, LOTHAR_MAX_TELEGRAM)) < 0)
+      break;
+
+    lothar_htonxts(len, reply);
+
+    for(c = 0; c < MAX_CLIENTS; ++c)
+    {
+      client_t *client = daemon->clients + c;
+
+      if((entry->waiting & ((uint32_t)1 << c)) && client->sock != INVALID_SOCKET &&
+         lothar_socket_send(client->sock, reply, len + 2) < 0)
+        drop(client);
+    }
+  }
+
+  // without their replies these clients can no longer tell which reply belongs to which request, give up on them
+  for(; i < n; ++i)
+    for(c = 0; c < MAX_CLIENTS; ++c)
+      if((daemon->batch[i].waiting & ((uint32_t)1 << c)) && daemon->clients[c].sock != INVALID_SOCKET)
+        drop(daemon->clients + c);
+}
+
+// accept all clients that are waiting, the listener does not block
+static void accept_clients(lothar_daemon_t *daemon)
+{
+  lothar_socket_t sock;
+  size_t c;
+
+  while((sock = accept(daemon->listener, NULL, NULL)) != INVALID_SOCKET)
+  {
+    // some systems pass on the flags of the listener
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+
+    // a client that stops taking its replies is dropped, rather than holding up the brick and the other clients
+    if(lothar_socket_set_timeout(sock, POLL_MS) < 0)
+    {
+      lothar_socket_close(sock);
+      continue;
+    }
+
+    for(c = 0; c < MAX_CLIENTS && daemon->clients[c].sock != INVALID_SOCKET; ++c)
+      ;
+
+    if(c == MAX_CLIENTS)
+    {
+      LOTHAR_WARN("too many clients, refusing one\n");
+      lothar_socket_close(sock);
+      continue;
+    }
+
+    daemon->clients[c].sock = sock;
+    lothar_framer_init(&daemon->clients[c].framer, lothar_socket_recv, &daemon->clients[c].sock);
+  }
+}
+
+static void serve(void *data)
+{
+  lothar_daemon_t *daemon = (lothar_daemon_t *)data;
+  fd_set set;
+  struct timeval timeout;
+  lothar_socket_t max;
+  size_t c;
+  int ready;
+
+  while(!lothar_atomic_load(&daemon->stopping))
+  {
+    FD_ZERO(&set);
+    FD_SET(daemon->listener, &set);
+    max = daemon->listener;
+    ready = 0;
+
+    for(c = 0; c < MAX_CLIENTS; ++c)
+    {
+      client_t *client = daemon->clients + c;
+
+      if(client->sock == INVALID_SOCKET)
+        continue;
+
+      ready |= lothar_framer_ready(&client->framer);
+
+      // a client that is ahead of the brick waits until its requests are passed on, unless no request fits at all
+      if(lothar_framer_full(&client->framer))
+      {
+        if(!lothar_framer_ready(&client->framer))
+          drop(client);
+        continue;
+      }
+
+      FD_SET(client->sock, &set);
+      if(client->sock > max)
+        max = client->sock;
+    }
+
+    // requests left over from a full batch are served right away
+    timeout.tv_sec = 0;
+    timeout.tv_usec = ready ? 0 : POLL_MS * 1000;
+
+    if(select(max + 1, &set, NULL, NULL, &timeout) < 0)
+      continue;
+
+    // everything that has arrived, from all clients, before passing any of it on
+    for(c = 0; c < MAX_CLIENTS; ++c)
+    {
+      client_t *client = daemon->clients + c;
+
+      if(client->sock != INVALID_SOCKET && FD_ISSET(client->sock, &set) && lothar_framer_receive(&client->framer) < 0)
+        drop(client);
+    }
+
+    // new clients are served from the next round on
+    if(FD_ISSET(daemon->listener, &set))
+      accept_clients(daemon);
+
+    serve_batch(daemon);
+  }
+}
+
+lothar_daemon_t *lothar_daemon_open(lothar_connection_t *brick, char const *path)
+{
+  lothar_daemon_t *daemon;
+  struct sockaddr_un addr;
+  lothar_socket_t sock;
+  size_t c;
+
+  if(!brick)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+    return NULL;
+  }
+
+  if(address(&addr, path) < 0)
+    return NULL;
+
+  // a daemon serving there already keeps its socket, a stale socket file is replaced
+  if((sock = connect_to(&addr)) != INVALID_SOCKET)
+  {
+    lothar_socket_close(sock);
+    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+    return NULL;
+  }
+  unlink(path);
+
+  daemon = (lothar_daemon_t *)lothar_malloc(sizeof(lothar_daemon_t));
+  daemon->brick = brick;
+  daemon->stopping = 0;
+  daemon->coalesced = 0;
+
+  for(c = 0; c < MAX_CLIENTS; ++c)
+    daemon->clients[c].sock = INVALID_SOCKET;
+
+  if((daemon->listener = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+    free(daemon);
+    return NULL;
+  }
+
+  if(bind(daemon->listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(daemon->listener, 8) < 0 ||
+     fcntl(daemon->listener, F_SETFL, O_NONBLOCK) < 0)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+    lothar_socket_close(daemon->listener);
+    free(daemon);
+    return NULL;
+  }
+
+  daemon->path = (char *)lothar_malloc(strlen(path) + 1);
+  strcpy(daemon->path, path);
+
+  if(lothar_thread_create(&daemon->thread, serve, daemon) < 0)
+  {
+    lothar_socket_close(daemon->listener);
+    unlink(daemon->path);
+    free(daemon->path);
+    free(daemon);
+    return NULL;
+  }
+
+  return daemon;
+}
+
+int lothar_daemon_coalesced(lothar_daemon_t const *daemon, size_t *requests)
+{
+  if(!daemon)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(requests)
+    *requests = lothar_atomic_load((size_t volatile *)&daemon->coalesced);
+
+  return 0;
+}
+
+int lothar_daemon_close(lothar_daemon_t **daemon)
+{
+  size_t c;
+
+  if(!daemon || !*daemon)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  lothar_atomic_store(&(*daemon)->stopping, 1);
+  lothar_thread_join(&(*daemon)->thread);
+
+  for(c = 0; c < MAX_CLIENTS; ++c)
+    if((*daemon)->clients[c].sock != INVALID_SOCKET)
+      drop((*daemon)->clients + c);
+
+  lothar_socket_close((*daemon)->listener);
+  unlink((*daemon)->path);
+
+  free((*daemon)->path);
+  free(*daemon);
+  *daemon = NULL;
+
+  return 0;
+}
+
+#endif // _WIN32
@@ -1,7 +1,47 @@
 #include "error_handling.h"
+#include "utils.h"
 #include <string.h>
 
-int lothar_errno = LOTHAR_ERROR_OKAY;
+LOTHAR_THREAD_LOCAL int lothar_errno = LOTHAR_ERROR_OKAY;
+
+static LOTHAR_THREAD_LOCAL lothar_error_record_t last = {0, -1, -1, NULL, 0};
+
+void lothar_error_raise(int error)
+{
+  lothar_errno = error < 0 ? -error : error;
+
+  last.error = lothar_errno;
+  last.opcode = -1;
+  last.port = -1;
+  last.connection = NULL;
+  last.time = lothar_errno ? lothar_time_us() : 0;
+}
+
+void lothar_error_blame(struct lothar_connection_t const *connection, int opcode, int port)
+{
+  // the first command to fail is the cause, the ones after it fail because of it
+  if(!last.error || last.opcode >= 0)
+    return;
+
+  last.opcode = opcode;
+  last.port = port;
+  last.connection = connection;
+}
+
+void lothar_error_record(lothar_error_record_t *record)
+{
+  if(record)
+    *record = last;
+}
+
+void lothar_error_restore(lothar_error_record_t const *record)
+{
+  if(!record)
+    return;
+
+  lothar_errno = record->error;
+  last = *record;
+}
 
 char const *lothar_strerror(int error)
 {
@@ -58,6 +98,63 @@ char const *lothar_strerror(int error)
   case LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY:
     return "specified mailbox queue is empty";
 
+  case LOTHAR_ERROR_NO_MORE_HANDLES:
+    return "no more handles";
+
+  case LOTHAR_ERROR_NO_SPACE:
+    return "no space";
+
+  case LOTHAR_ERROR_NO_MORE_FILES:
+    return "no more files";
+
+  case LOTHAR_ERROR_END_OF_FILE_EXPECTED:
+    return "end of file expected";
+
+  case LOTHAR_ERROR_END_OF_FILE:
+    return "end of file";
+
+  case LOTHAR_ERROR_NOT_A_LINEAR_FILE:
+    return "not a linear file";
+
+  case LOTHAR_ERROR_FILE_NOT_FOUND:
+    return "file not found";
+
+  case LOTHAR_ERROR_HANDLE_ALREADY_CLOSED:
+    return "handle already closed";
+
+  case LOTHAR_ERROR_NO_LINEAR_SPACE:
+    return "no linear space";
+
+  case LOTHAR_ERROR_UNDEFINED_ERROR:
+    return "undefined error";
+
+  case LOTHAR_ERROR_FILE_IS_BUSY:
+    return "file is busy";
+
+  case LOTHAR_ERROR_NO_WRITE_BUFFERS:
+    return "no write buffers";
+
+  case LOTHAR_ERROR_APPEND_NOT_POSSIBLE:
+    return "append not possible";
+
+  case LOTHAR_ERROR_FILE_IS_FULL:
+    return "file is full";
+
+  case LOTHAR_ERROR_FILE_EXISTS:
+    return "file exists";
+
+  case LOTHAR_ERROR_MODULE_NOT_FOUND:
+    return "module not found";
+
+  case LOTHAR_ERROR_OUT_OF_BOUNDARY:
+    return "out of boundary";
+
+  case LOTHAR_ERROR_ILLEGAL_FILE_NAME:
+    return "illegal file name";
+
+  case LOTHAR_ERROR_ILLEGAL_HANDLE:
+    return "illegal handle";
+
   case LOTHAR_ERROR_REQUEST_FAILED:  
     return "request failed (i.e. specified file not found)";
     
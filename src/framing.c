@@ -0,0 +1,150 @@
+#include "framing.h"
+#include "error_handling.h"
+#include <string.h>
+
+void lothar_framer_init(lothar_framer_t *framer, int (*recv)(void *stream, uint8_t *buf, size_t len), void *stream)
+{
+  framer->recv = recv;
+  framer->stream = stream;
+  framer->begin = 0;
+  framer->end = 0;
+}
+
+// the error for a failed recv, which raised it already unless the stream was closed
+static int failed(int r)
+{
+  if(!r || !lothar_errno)
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+
+  return -lothar_errno;
+}
+
+// make sure at least need (at most LOTHAR_FRAMER_SIZE) bytes are buffered, receiving as much as there is room for
+static int fill(lothar_framer_t *framer, size_t need)
+{
+  if(framer->begin == framer->end)
+    framer->begin = framer->end = 0;
+  else if(LOTHAR_FRAMER_SIZE - framer->begin < need) // make room at the end
+  {
+    memmove(framer->buf, framer->buf + framer->begin, framer->end - framer->begin);
+    framer->end -= framer->begin;
+    framer->begin = 0;
+  }
+
+  while(framer->end - framer->begin < need)
+  {
+    int r = framer->recv(framer->stream, framer->buf + framer->end, LOTHAR_FRAMER_SIZE - framer->end);
+
+    if(r <= 0)
+      return failed(r);
+
+    framer->end += r;
+  }
+
+  return 0;
+}
+
+int lothar_framer_read(lothar_framer_t *framer, uint8_t *data, size_t len)
+{
+  size_t size;
+  size_t copied = 0;
+  int status;
+
+  if((status = fill(framer, 2)) < 0)
+    return status;
+
+  // nxt gives us little endian
+  size = lothar_nxttohs(framer->buf + framer->begin);
+
+  // nothing is consumed before the whole frame is in, a read that fails halfway can be tried again
+  if(2 + size <= LOTHAR_FRAMER_SIZE)
+  {
+    if((status = fill(framer, 2 + size)) < 0)
+      return status;
+
+    copied = MIN(size, len);
+    memcpy(data, framer->buf + framer->begin + 2, copied);
+    framer->begin += 2 + size;
+
+    return copied;
+  }
+
+  // a frame larger than the buffer is passed through in pieces, copying what fits and skipping the rest
+  framer->begin += 2;
+
+  while(size)
+  {
+    size_t chunk;
+
+    if(framer->begin == framer->end && (status = fill(framer, 1)) < 0)
+      return status;
+
+    chunk = MIN(size, framer->end - framer->begin);
+
+    if(copied < len)
+    {
+      size_t n = MIN(chunk, len - copied);
+      memcpy(data + copied, framer->buf + framer->begin, n);
+      copied += n;
+    }
+
+    framer->begin += chunk;
+    size -= chunk;
+  }
+
+  return copied;
+}
+
+int lothar_framer_receive(lothar_framer_t *framer)
+{
+  int r;
+
+  if(framer->begin == framer->end)
+    framer->begin = framer->end = 0;
+  else if(framer->begin) // make room at the end
+  {
+    memmove(framer->buf, framer->buf + framer->begin, framer->end - framer->begin);
+    framer->end -= framer->begin;
+    framer->begin = 0;
+  }
+
+  if(framer->end == LOTHAR_FRAMER_SIZE)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_BUFFER_TOO_SMALL);
+
+  if((r = framer->recv(framer->stream, framer->buf + framer->end, LOTHAR_FRAMER_SIZE - framer->end)) <= 0)
+    return failed(r);
+
+  framer->end += r;
+
+  return r;
+}
+
+int lothar_framer_ready(lothar_framer_t const *framer)
+{
+  size_t avail = framer->end - framer->begin;
+
+  return avail >= 2 && avail - 2 >= lothar_nxttohs(framer->buf + framer->begin);
+}
+
+int lothar_framer_full(lothar_framer_t const *framer)
+{
+  return framer->end - framer->begin == LOTHAR_FRAMER_SIZE;
+}
+
+int lothar_framer_pack(lothar_iovec_t const *telegrams, size_t count, uint8_t *out)
+{
+  size_t len = 0;
+  size_t i;
+
+  for(i = 0; i < count; ++i)
+  {
+    if(telegrams[i].len > LOTHAR_MAX_TELEGRAM)
+      LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+    lothar_htonxts(telegrams[i].len, out + len);
+    memcpy(out + len + 2, telegrams[i].data, telegrams[i].len);
+    len += 2 + telegrams[i].len;
+  }
+
+  return len;
+}
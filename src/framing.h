@@ -0,0 +1,46 @@
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include "connection.h"
+
+/* telegrams over a byte stream (bluetooth, tcp), each preceded by its length as a little endian 16 bit value */
+
+// the size of the receive buffer, room for a few replies (a full pipeline of small ones)
+#define LOTHAR_FRAMER_SIZE 512
+
+typedef struct
+{
+  // receive at least one byte and at most len, returns the number of bytes, 0 if the stream was closed, or a negative
+  // number if receiving failed (having raised the error, i.e. LOTHAR_ERROR_TIMEOUT)
+  int (*recv)(void *stream, uint8_t *buf, size_t len);
+  void *stream;
+
+  uint8_t buf[LOTHAR_FRAMER_SIZE];
+  size_t begin; // the first byte not parsed yet
+  size_t end;   // the end of the received data
+} lothar_framer_t;
+
+void lothar_framer_init(lothar_framer_t *framer, int (*recv)(void *stream, uint8_t *buf, size_t len), void *stream);
+
+// read the next telegram, a telegram larger than len is truncated (the rest is discarded)
+// returns the number of bytes stored in data, or a negative error code
+int lothar_framer_read(lothar_framer_t *framer, uint8_t *data, size_t len);
+
+// receive once into the buffer, without waiting for a complete telegram (i.e. when the stream is known to be readable)
+// returns the number of bytes received, or a negative error code, also when the buffer is full
+int lothar_framer_receive(lothar_framer_t *framer);
+
+// (boolean) is a complete telegram buffered, i.e. can lothar_framer_read return it without receiving?
+int lothar_framer_ready(lothar_framer_t const *framer);
+
+// (boolean) is the buffer full, so nothing can be received until a telegram is read?
+int lothar_framer_full(lothar_framer_t const *framer);
+
+// the size of count telegrams of at most LOTHAR_MAX_TELEGRAM bytes, packed by lothar_framer_pack
+#define LOTHAR_FRAMER_PACKED(count) ((count) * (2 + LOTHAR_MAX_TELEGRAM))
+
+// store telegrams in out one after the other, each preceded by its length, as they go over the stream
+// returns the number of bytes stored, or a negative error code if a telegram is too large
+int lothar_framer_pack(lothar_iovec_t const *telegrams, size_t count, uint8_t *out);
+
+#endif
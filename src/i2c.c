@@ -0,0 +1,368 @@
+#include "i2c.h"
+#include "commands.h"
+#include "connection_private.h"
+#include "error_handling.h"
+#include "utils.h"
+#include <string.h>
+
+#define PORTS 4
+#define POLL  1000 // microseconds, the least time between two polls of a port
+
+typedef struct
+{
+  uint8_t txdata[LOTHAR_I2C_MAX];
+  uint8_t txlen;
+  uint8_t rxlen;
+  lothar_i2c_callback callback;
+  void *user;
+} transaction_t;
+
+enum phase
+{
+  IDLE,    // nothing on the bus
+  BUSY,    // written, to be polled at due
+  POLLING  // status and read sent, waiting for the replies
+};
+
+typedef struct
+{
+  // waiting transactions, the first is the one on the bus (if not idle)
+  transaction_t queue[LOTHAR_I2C_QUEUE];
+  size_t first;
+  size_t count;
+
+  enum phase phase;
+  uint64_t written; // when the transaction was written (lothar_time_us())
+  uint64_t polled;  // when it was last polled
+  uint64_t due;     // when to poll next
+  unsigned polls;   // the polls of this transaction so far
+  uint64_t estimate; // the time from the write to the data being ready, as measured
+
+  // the replies to the last poll
+  int status;
+  int read;
+  uint8_t rxdata[LOTHAR_I2C_MAX];
+  uint8_t rxlen;
+} port_t;
+
+struct lothar_i2c_t
+{
+  lothar_connection_t *connection;
+  port_t ports[PORTS];
+  int status; // the first error of a run
+};
+
+lothar_i2c_t *lothar_i2c_open(lothar_connection_t *connection)
+{
+  lothar_i2c_t *i2c;
+
+  if(!connection)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+    return NULL;
+  }
+
+  // the replies to a poll are needed before the next one
+  if(connection->pipelined)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+    return NULL;
+  }
+
+  i2c = (lothar_i2c_t *)lothar_malloc(sizeof(lothar_i2c_t));
+  memset(i2c, 0, sizeof(lothar_i2c_t));
+  i2c->connection = connection;
+
+  return i2c;
+}
+
+int lothar_i2c_close(lothar_i2c_t **i2c)
+{
+  if(!i2c || !(*i2c))
+    return 0;
+
+  free(*i2c);
+  *i2c = NULL;
+
+  return 0;
+}
+
+/* polling
+ *
+ * The callbacks of a poll only store the replies, they are judged when all replies of the round are in. */
+
+static void status_received(lothar_connection_t *connection, int status, enum lothar_input_port port, uint8_t bytesready, void *user)
+{
+  ((port_t *)user)->status = status;
+}
+
+static void read_received(lothar_connection_t *connection, int status, enum lothar_input_port port, uint8_t const *rxdata, uint8_t rxlen, void *user)
+{
+  port_t *p = (port_t *)user;
+
+  p->read = status;
+  if(status >= 0)
+  {
+    p->rxlen = MIN(rxlen, LOTHAR_I2C_MAX);
+    memcpy(p->rxdata, rxdata, p->rxlen);
+  }
+}
+
+static void complete(lothar_i2c_t *i2c, port_t *p, enum lothar_input_port port, int status)
+{
+  transaction_t t = p->queue[p->first];
+
+  p->first = (p->first + 1) % LOTHAR_I2C_QUEUE;
+  --p->count;
+  p->phase = IDLE;
+
+  lothar_first_error(&i2c->status, status);
+
+  // last, it may queue a transaction of its own
+  if(t.callback)
+    t.callback(i2c->connection, status, port, status < 0 ? NULL : p->rxdata, status < 0 ? 0 : p->rxlen, t.user);
+}
+
+static void start(lothar_i2c_t *i2c, port_t *p, enum lothar_input_port port, uint64_t now)
+{
+  transaction_t const *t = p->queue + p->first;
+  int status;
+
+  // nothing was written, so there is nothing to poll for (a busy bus included, the reply would be that of another)
+  if((status = lothar_lswrite(i2c->connection, port, t->txdata, t->txlen, t->rxlen)) < 0)
+  {
+    complete(i2c, p, port, status);
+    return;
+  }
+
+  p->phase = BUSY;
+  p->written = now;
+  p->due = now + p->estimate;
+  p->polls = 0;
+}
+
+static void poll(lothar_i2c_t *i2c, port_t *p, enum lothar_input_port port, uint64_t now)
+{
+  transaction_t const *t = p->queue + p->first;
+  int status;
+
+  p->phase = POLLING;
+  p->polled = now;
+  ++p->polls;
+
+  p->status = 0;
+  p->read = 0;
+  p->rxlen = 0;
+
+  if((status = lothar_lsgetstatus_poll(i2c->connection, port, status_received, p)) < 0)
+    p->status = status;
+  else if(t->rxlen && (status = lothar_lsread_async(i2c->connection, port, read_received, p)) < 0)
+    p->read = status;
+}
+
+// learn from a transaction that is done: a first poll that succeeds may have been later than needed
+static void measure(port_t *p)
+{
+  if(p->polls == 1)
+    p->estimate -= p->estimate / 16;
+  else
+    p->estimate = p->polled - p->written;
+}
+
+static void judge(lothar_i2c_t *i2c, port_t *p, enum lothar_input_port port, uint64_t now)
+{
+  // the port stays busy until the status says the bus is done, the read alone does not tell for a write only
+  if(p->status == -LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS || (p->status >= 0 && p->read == -LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS))
+  {
+    if(now - p->written > (uint64_t)LOTHAR_I2C_TIMEOUT * 1000)
+    {
+      LOTHAR_ERROR(LOTHAR_ERROR_TIMEOUT);
+      complete(i2c, p, port, -lothar_errno);
+    }
+    else
+    {
+      p->phase = BUSY;
+      p->due = now + MAX(p->estimate / 4, POLL);
+    }
+  }
+  else if(p->status < 0)
+    complete(i2c, p, port, p->status);
+  else if(p->read < 0)
+    complete(i2c, p, port, p->read);
+  else
+  {
+    measure(p);
+    complete(i2c, p, port, 0);
+  }
+}
+
+// one cycle: write and poll what is due on every port, and wait for the replies
+static int cycle(lothar_i2c_t *i2c)
+{
+  uint64_t now = lothar_time_us();
+  uint64_t next = 0;
+  int polled = 0;
+  int i;
+
+  for(i = 0; i < PORTS; ++i)
+  {
+    port_t *p = i2c->ports + i;
+
+    if(p->phase == IDLE && p->count)
+      start(i2c, p, (enum lothar_input_port)i, now);
+
+    if(p->phase == BUSY && p->due <= now)
+      poll(i2c, p, (enum lothar_input_port)i, now);
+
+    if(p->phase == POLLING)
+      polled = 1;
+  }
+
+  // nothing due yet, sleep until the first one is
+  if(!polled)
+  {
+    for(i = 0; i < PORTS; ++i)
+    {
+      port_t const *p = i2c->ports + i;
+
+      if(p->phase == BUSY && (!next || p->due < next))
+	next = p->due;
+    }
+
+    if(next > now)
+      return lothar_usleep(next - now);
+  }
+
+  lothar_async_dispatch(i2c->connection, 0);
+
+  now = lothar_time_us();
+  for(i = 0; i < PORTS; ++i)
+    if(i2c->ports[i].phase == POLLING)
+      judge(i2c, i2c->ports + i, (enum lothar_input_port)i, now);
+
+  return 0;
+}
+
+static int busy(lothar_i2c_t const *i2c)
+{
+  int i;
+
+  for(i = 0; i < PORTS; ++i)
+    if(i2c->ports[i].count)
+      return 1;
+
+  return 0;
+}
+
+int lothar_i2c_submit(lothar_i2c_t *i2c,
+		      enum lothar_input_port port,
+		      uint8_t const *txdata,
+		      uint8_t txlen,
+		      uint8_t rxlen,
+		      lothar_i2c_callback callback,
+		      void *user)
+{
+  port_t *p;
+  transaction_t *t;
+
+  if(!i2c)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(port >= PORTS || txlen > LOTHAR_I2C_MAX || rxlen > LOTHAR_I2C_MAX || (txlen && !txdata))
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  p = i2c->ports + port;
+  while(p->count == LOTHAR_I2C_QUEUE)
+    if(cycle(i2c) < 0)
+      return -lothar_errno;
+
+  t = p->queue + (p->first + p->count++) % LOTHAR_I2C_QUEUE;
+  memcpy(t->txdata, txdata, txlen);
+  t->txlen = txlen;
+  t->rxlen = rxlen;
+  t->callback = callback;
+  t->user = user;
+
+  return 0;
+}
+
+int lothar_i2c_run(lothar_i2c_t *i2c)
+{
+  int status;
+
+  if(!i2c)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  while(busy(i2c))
+    if(cycle(i2c) < 0)
+      return -lothar_errno;
+
+  status = i2c->status;
+  i2c->status = 0;
+
+  if(status < 0)
+    LOTHAR_RETURN_ERROR(-status);
+
+  return 0;
+}
+
+typedef struct
+{
+  uint8_t *rxdata;
+  uint8_t rxlen; // the size of rxdata, as asked for
+  int status;
+  int done;
+} transfer_t;
+
+static void transferred(lothar_connection_t *connection, int status, enum lothar_input_port port, uint8_t const *rxdata, uint8_t rxlen, void *user)
+{
+  transfer_t *transfer = (transfer_t *)user;
+
+  // the device may send more than was asked for, but not less
+  if(status >= 0 && rxlen < transfer->rxlen)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+    status = -lothar_errno;
+  }
+
+  transfer->status = status;
+  transfer->done = 1;
+  if(status >= 0 && transfer->rxdata)
+    memcpy(transfer->rxdata, rxdata, transfer->rxlen);
+}
+
+int lothar_i2c_transfer(lothar_i2c_t *i2c,
+			enum lothar_input_port port,
+			uint8_t const *txdata,
+			uint8_t txlen,
+			uint8_t *rxdata,
+			uint8_t rxlen)
+{
+  transfer_t transfer = {rxdata, rxlen, 0, 0};
+
+  if(lothar_i2c_submit(i2c, port, txdata, txlen, rxlen, transferred, &transfer) < 0)
+    return -lothar_errno;
+
+  // the transactions of others may fail, this one is what counts
+  if(lothar_i2c_run(i2c) < 0 && !transfer.done)
+    return -lothar_errno;
+
+  if(transfer.status < 0)
+    LOTHAR_RETURN_ERROR(-transfer.status);
+
+  return 0;
+}
+
+int lothar_i2c_estimate(lothar_i2c_t const *i2c, enum lothar_input_port port, uint64_t *us)
+{
+  if(!i2c)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(port >= PORTS)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(us)
+    *us = i2c->ports[port].estimate;
+
+  return 0;
+}
@@ -0,0 +1,308 @@
+#ifndef LOTHAR_CODEC_H
+#define LOTHAR_CODEC_H
+
+#include "utils.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file codec.h
+ *
+ * The layout of the telegrams of every command, in one place.
+ *
+ * LOTHAR_CODEC_COMMANDS() lists the commands with their opcode, the type byte of their request, and the sizes of the
+ * request and the reply (whole frames: a request starts with the type and the opcode, a reply with 0x02, the opcode and
+ * the status). LOTHAR_CODEC_REQUEST_FIELDS() and LOTHAR_CODEC_REPLY_FIELDS() list the fields of those frames with
+ * their offset from the start of the frame and their kind; all numbers are little endian, as the NXT sends them.
+ *
+ * From these tables come the opcodes (LOTHAR_OPCODE_SETOUTPUTSTATE), the sizes (LOTHAR_REQUEST_SIZE_SETOUTPUTSTATE,
+ * LOTHAR_REPLY_SIZE_GETOUTPUTSTATE), and an accessor per field:
+ *
+ * - lothar_setoutputstate_request_set_power(frame, value) and lothar_setoutputstate_request_power(frame) for the
+ *   requests,
+ * - lothar_getoutputstate_reply_power(frame) and lothar_getoutputstate_reply_set_power(frame, value) for the replies,
+ * - for the byte fields (file names, data), lothar_lsread_reply_rxdata(frame) returns where they start.
+ *
+ * The accessors check nothing, they are what commands.c builds its requests and reads its replies with. The tables can
+ * be expanded with macros of one's own, the C++ command objects in commands.hh are generated that way.
+ */
+
+/// the type byte of a direct command that is answered
+#define LOTHAR_CODEC_REPLY    0x00
+/// the type byte of a direct command that is not answered
+#define LOTHAR_CODEC_NO_REPLY 0x80
+/// the type byte of a system command, which is always answered
+#define LOTHAR_CODEC_SYSTEM   0x01
+
+/// a command that only asks, sending it twice is the same as once
+#define LOTHAR_CODEC_QUERY            0x01
+/// the request carries data of its own size after its fixed part, its size in the table is that of the fixed part
+#define LOTHAR_CODEC_VARIABLE_REQUEST 0x02
+/// the reply carries data of the size asked for after its fixed part, its size in the table is that of the fixed part
+#define LOTHAR_CODEC_VARIABLE_REPLY   0x04
+/// the request names a port (an output or an input) at offset 2
+#define LOTHAR_CODEC_PORT             0x08
+
+/** \brief The commands: X(NAME, opcode, type, request size, reply size, flags)
+ *
+ * The reply size of a direct command that is not answered is that of the reply it would get (when sent with
+ * LOTHAR_CODEC_REPLY instead), just the status.
+ */
+#define LOTHAR_CODEC_COMMANDS(X)								\
+  X(STARTPROGRAM,          0x00, LOTHAR_CODEC_NO_REPLY, 2,  3,  LOTHAR_CODEC_VARIABLE_REQUEST)	\
+  X(STOPPROGRAM,           0x01, LOTHAR_CODEC_NO_REPLY, 2,  3,  0)				\
+  X(PLAYSOUNDFILE,         0x02, LOTHAR_CODEC_NO_REPLY, 3,  3,  LOTHAR_CODEC_VARIABLE_REQUEST)	\
+  X(PLAYTONE,              0x03, LOTHAR_CODEC_NO_REPLY, 6,  3,  0)				\
+  X(SETOUTPUTSTATE,        0x04, LOTHAR_CODEC_NO_REPLY, 12, 3,  LOTHAR_CODEC_PORT)		\
+  X(SETINPUTMODE,          0x05, LOTHAR_CODEC_NO_REPLY, 5,  3,  LOTHAR_CODEC_PORT)		\
+  X(GETOUTPUTSTATE,        0x06, LOTHAR_CODEC_REPLY,    3,  25, LOTHAR_CODEC_QUERY | LOTHAR_CODEC_PORT)	\
+  X(GETINPUTVALUES,        0x07, LOTHAR_CODEC_REPLY,    3,  16, LOTHAR_CODEC_QUERY | LOTHAR_CODEC_PORT)	\
+  X(RESETINPUTSCALEDVALUE, 0x08, LOTHAR_CODEC_NO_REPLY, 3,  3,  LOTHAR_CODEC_PORT)		\
+  X(MESSAGEWRITE,          0x09, LOTHAR_CODEC_NO_REPLY, 4,  3,  LOTHAR_CODEC_VARIABLE_REQUEST)	\
+  X(RESETMOTORPOSITION,    0x0A, LOTHAR_CODEC_NO_REPLY, 4,  3,  LOTHAR_CODEC_PORT)		\
+  X(GETBATTERYLEVEL,       0x0B, LOTHAR_CODEC_REPLY,    2,  5,  LOTHAR_CODEC_QUERY)		\
+  X(STOPSOUNDPLAYBACK,     0x0C, LOTHAR_CODEC_NO_REPLY, 2,  3,  0)				\
+  X(KEEPALIVE,             0x0D, LOTHAR_CODEC_REPLY,    2,  7,  LOTHAR_CODEC_QUERY)		\
+  X(LSGETSTATUS,           0x0E, LOTHAR_CODEC_REPLY,    3,  4,  LOTHAR_CODEC_QUERY | LOTHAR_CODEC_PORT)	\
+  X(LSWRITE,               0x0F, LOTHAR_CODEC_NO_REPLY, 5,  3,  LOTHAR_CODEC_VARIABLE_REQUEST | LOTHAR_CODEC_PORT)	\
+  X(LSREAD,                0x10, LOTHAR_CODEC_REPLY,    3,  20, LOTHAR_CODEC_PORT)		\
+  X(GETCURRENTPROGRAMNAME, 0x11, LOTHAR_CODEC_REPLY,    2,  22, LOTHAR_CODEC_QUERY)		\
+  X(MESSAGEREAD,           0x13, LOTHAR_CODEC_REPLY,    5,  64, 0)				\
+  X(OPENREAD,              0x80, LOTHAR_CODEC_SYSTEM,   22, 8,  0)				\
+  X(OPENWRITE,             0x81, LOTHAR_CODEC_SYSTEM,   26, 4,  0)				\
+  X(READ,                  0x82, LOTHAR_CODEC_SYSTEM,   5,  6,  LOTHAR_CODEC_VARIABLE_REPLY)	\
+  X(WRITE,                 0x83, LOTHAR_CODEC_SYSTEM,   3,  6,  LOTHAR_CODEC_VARIABLE_REQUEST)	\
+  X(CLOSE,                 0x84, LOTHAR_CODEC_SYSTEM,   3,  4,  0)				\
+  X(DELETE,                0x85, LOTHAR_CODEC_SYSTEM,   22, 23, 0)				\
+  X(FINDFIRST,             0x86, LOTHAR_CODEC_SYSTEM,   22, 28, 0)				\
+  X(FINDNEXT,              0x87, LOTHAR_CODEC_SYSTEM,   3,  28, 0)				\
+  X(READIOMAP,             0x94, LOTHAR_CODEC_SYSTEM,   10, 9,  LOTHAR_CODEC_VARIABLE_REPLY)	\
+  X(WRITEIOMAP,            0x95, LOTHAR_CODEC_SYSTEM,   10, 9,  LOTHAR_CODEC_VARIABLE_REQUEST)
+
+/** \brief The fields of the requests: F(command, field, offset, kind)
+ *
+ * The kinds are u8, s8, u16, s16, u32, s32 and bytes (a file name or data, up to the end of the frame unless the
+ * command says otherwise).
+ */
+#define LOTHAR_CODEC_REQUEST_FIELDS(F)				\
+  F(startprogram,          filename,       2,  bytes)	\
+  F(playsoundfile,         loop,           2,  u8)	\
+  F(playsoundfile,         filename,       3,  bytes)	\
+  F(playtone,              frequency,      2,  u16)	\
+  F(playtone,              duration,       4,  u16)	\
+  F(setoutputstate,        port,           2,  u8)	\
+  F(setoutputstate,        power,          3,  s8)	\
+  F(setoutputstate,        motormode,      4,  u8)	\
+  F(setoutputstate,        regulationmode, 5,  u8)	\
+  F(setoutputstate,        turnratio,      6,  s8)	\
+  F(setoutputstate,        runstate,       7,  u8)	\
+  F(setoutputstate,        tacholimit,     8,  u32)	\
+  F(setinputmode,          port,           2,  u8)	\
+  F(setinputmode,          type,           3,  u8)	\
+  F(setinputmode,          mode,           4,  u8)	\
+  F(getoutputstate,        port,           2,  u8)	\
+  F(getinputvalues,        port,           2,  u8)	\
+  F(resetinputscaledvalue, port,           2,  u8)	\
+  F(messagewrite,          inbox,          2,  u8)	\
+  F(messagewrite,          size,           3,  u8)	\
+  F(messagewrite,          data,           4,  bytes)	\
+  F(resetmotorposition,    port,           2,  u8)	\
+  F(resetmotorposition,    relative,       3,  u8)	\
+  F(lsgetstatus,           port,           2,  u8)	\
+  F(lswrite,               port,           2,  u8)	\
+  F(lswrite,               txlen,          3,  u8)	\
+  F(lswrite,               rxlen,          4,  u8)	\
+  F(lswrite,               txdata,         5,  bytes)	\
+  F(lsread,                port,           2,  u8)	\
+  F(messageread,           remoteinbox,    2,  u8)	\
+  F(messageread,           localinbox,     3,  u8)	\
+  F(messageread,           remove,         4,  u8)	\
+  F(openread,              filename,       2,  bytes)	\
+  F(openwrite,             filename,       2,  bytes)	\
+  F(openwrite,             size,           22, u32)	\
+  F(read,                  handle,         2,  u8)	\
+  F(read,                  size,           3,  u16)	\
+  F(write,                 handle,         2,  u8)	\
+  F(write,                 data,           3,  bytes)	\
+  F(close,                 handle,         2,  u8)	\
+  F(delete,                filename,       2,  bytes)	\
+  F(findfirst,             filename,       2,  bytes)	\
+  F(findnext,              handle,         2,  u8)	\
+  F(readiomap,             module,         2,  u32)	\
+  F(readiomap,             offset,         6,  u16)	\
+  F(readiomap,             size,           8,  u16)	\
+  F(writeiomap,            module,         2,  u32)	\
+  F(writeiomap,            offset,         6,  u16)	\
+  F(writeiomap,            size,           8,  u16)	\
+  F(writeiomap,            data,           10, bytes)
+
+/** \brief The fields of the replies: F(command, field, offset, kind), as LOTHAR_CODEC_REQUEST_FIELDS()
+ */
+#define LOTHAR_CODEC_REPLY_FIELDS(F)				\
+  F(getoutputstate,        port,            3,  u8)	\
+  F(getoutputstate,        power,           4,  s8)	\
+  F(getoutputstate,        motormode,       5,  u8)	\
+  F(getoutputstate,        regulationmode,  6,  u8)	\
+  F(getoutputstate,        turnratio,       7,  u8)	\
+  F(getoutputstate,        runstate,        8,  u8)	\
+  F(getoutputstate,        tacholimit,      9,  u32)	\
+  F(getoutputstate,        tachocount,      13, s32)	\
+  F(getoutputstate,        blocktachocount, 17, s32)	\
+  F(getoutputstate,        rotationcount,   21, s32)	\
+  F(getinputvalues,        port,            3,  u8)	\
+  F(getinputvalues,        valid,           4,  u8)	\
+  F(getinputvalues,        calibrated,      5,  u8)	\
+  F(getinputvalues,        type,            6,  u8)	\
+  F(getinputvalues,        mode,            7,  u8)	\
+  F(getinputvalues,        rawvalue,        8,  u16)	\
+  F(getinputvalues,        normvalue,       10, u16)	\
+  F(getinputvalues,        scaledvalue,     12, s16)	\
+  F(getinputvalues,        calibratedvalue, 14, s16)	\
+  F(getbatterylevel,       voltage,         3,  u16)	\
+  F(keepalive,             sleeptime,       3,  u32)	\
+  F(lsgetstatus,           bytesready,      3,  u8)	\
+  F(lsread,                rxlen,           3,  u8)	\
+  F(lsread,                rxdata,          4,  bytes)	\
+  F(getcurrentprogramname, filename,        3,  bytes)	\
+  F(messageread,           inbox,           3,  u8)	\
+  F(messageread,           size,            4,  u8)	\
+  F(messageread,           data,            5,  bytes)	\
+  F(openread,              handle,          3,  u8)	\
+  F(openread,              size,            4,  u32)	\
+  F(openwrite,             handle,          3,  u8)	\
+  F(read,                  handle,          3,  u8)	\
+  F(read,                  size,            4,  u16)	\
+  F(read,                  data,            6,  bytes)	\
+  F(write,                 handle,          3,  u8)	\
+  F(write,                 size,            4,  u16)	\
+  F(close,                 handle,          3,  u8)	\
+  F(delete,                filename,        3,  bytes)	\
+  F(findfirst,             handle,          3,  u8)	\
+  F(findfirst,             filename,        4,  bytes)	\
+  F(findfirst,             size,            24, u32)	\
+  F(findnext,              handle,          3,  u8)	\
+  F(findnext,              filename,        4,  bytes)	\
+  F(findnext,              size,            24, u32)	\
+  F(readiomap,             module,          3,  u32)	\
+  F(readiomap,             size,            7,  u16)	\
+  F(readiomap,             data,            9,  bytes)	\
+  F(writeiomap,            module,          3,  u32)	\
+  F(writeiomap,            size,            7,  u16)
+
+/* the opcodes and the sizes */
+
+#define LOTHAR_CODEC_OPCODE(NAME, opcode, type, request, reply, flags) LOTHAR_OPCODE_##NAME = opcode,
+#define LOTHAR_CODEC_REQUEST_SIZE(NAME, opcode, type, request, reply, flags) LOTHAR_REQUEST_SIZE_##NAME = request,
+#define LOTHAR_CODEC_REPLY_SIZE(NAME, opcode, type, request, reply, flags) LOTHAR_REPLY_SIZE_##NAME = reply,
+
+/** \brief The opcodes of the commands
+ */
+enum lothar_opcode
+{
+  LOTHAR_CODEC_COMMANDS(LOTHAR_CODEC_OPCODE)
+};
+
+/** \brief The sizes of the requests (the fixed part, for those of variable size)
+ */
+enum lothar_request_size
+{
+  LOTHAR_CODEC_COMMANDS(LOTHAR_CODEC_REQUEST_SIZE)
+};
+
+/** \brief The sizes of the replies (the fixed part, for those of variable size)
+ */
+enum lothar_reply_size
+{
+  LOTHAR_CODEC_COMMANDS(LOTHAR_CODEC_REPLY_SIZE)
+};
+
+#undef LOTHAR_CODEC_OPCODE
+#undef LOTHAR_CODEC_REQUEST_SIZE
+#undef LOTHAR_CODEC_REPLY_SIZE
+
+/* the kinds of fields */
+
+typedef uint8_t  lothar_codec_u8_t;
+typedef int8_t   lothar_codec_s8_t;
+typedef uint16_t lothar_codec_u16_t;
+typedef int16_t  lothar_codec_s16_t;
+typedef uint32_t lothar_codec_u32_t;
+typedef int32_t  lothar_codec_s32_t;
+
+static inline uint8_t  lothar_codec_get_u8(uint8_t const *p)  { return p[0]; }
+static inline int8_t   lothar_codec_get_s8(uint8_t const *p)  { return (int8_t)p[0]; }
+static inline uint16_t lothar_codec_get_u16(uint8_t const *p) { return lothar_nxttohs(p); }
+static inline int16_t  lothar_codec_get_s16(uint8_t const *p) { return (int16_t)lothar_nxttohs(p); }
+static inline uint32_t lothar_codec_get_u32(uint8_t const *p) { return lothar_nxttohl(p); }
+static inline int32_t  lothar_codec_get_s32(uint8_t const *p) { return (int32_t)lothar_nxttohl(p); }
+
+static inline void lothar_codec_put_u8(uint8_t *p, uint8_t v)   { p[0] = v; }
+static inline void lothar_codec_put_s8(uint8_t *p, int8_t v)    { p[0] = (uint8_t)v; }
+static inline void lothar_codec_put_u16(uint8_t *p, uint16_t v) { lothar_htonxts(v, p); }
+static inline void lothar_codec_put_s16(uint8_t *p, int16_t v)  { lothar_htonxts((uint16_t)v, p); }
+static inline void lothar_codec_put_u32(uint8_t *p, uint32_t v) { lothar_htonxtl(v, p); }
+static inline void lothar_codec_put_s32(uint8_t *p, int32_t v)  { lothar_htonxtl((uint32_t)v, p); }
+
+/* the accessors, one macro per kind as the byte fields have no value to get or set */
+
+#define LOTHAR_CODEC_ACCESSORS_NUMBER(command, direction, field, offset, kind)					\
+  static inline lothar_codec_##kind##_t lothar_##command##_##direction##_##field(uint8_t const *frame)		\
+  {														\
+    return lothar_codec_get_##kind(frame + offset);								\
+  }														\
+  static inline void lothar_##command##_##direction##_set_##field(uint8_t *frame, lothar_codec_##kind##_t value) \
+  {														\
+    lothar_codec_put_##kind(frame + offset, value);								\
+  }
+
+#define LOTHAR_CODEC_ACCESSORS_u8(command, direction, field, offset)  LOTHAR_CODEC_ACCESSORS_NUMBER(command, direction, field, offset, u8)
+#define LOTHAR_CODEC_ACCESSORS_s8(command, direction, field, offset)  LOTHAR_CODEC_ACCESSORS_NUMBER(command, direction, field, offset, s8)
+#define LOTHAR_CODEC_ACCESSORS_u16(command, direction, field, offset) LOTHAR_CODEC_ACCESSORS_NUMBER(command, direction, field, offset, u16)
+#define LOTHAR_CODEC_ACCESSORS_s16(command, direction, field, offset) LOTHAR_CODEC_ACCESSORS_NUMBER(command, direction, field, offset, s16)
+#define LOTHAR_CODEC_ACCESSORS_u32(command, direction, field, offset) LOTHAR_CODEC_ACCESSORS_NUMBER(command, direction, field, offset, u32)
+#define LOTHAR_CODEC_ACCESSORS_s32(command, direction, field, offset) LOTHAR_CODEC_ACCESSORS_NUMBER(command, direction, field, offset, s32)
+
+// the byte fields of a request are written, those of a reply only read
+typedef uint8_t *lothar_codec_request_bytes_t;
+typedef uint8_t const *lothar_codec_reply_bytes_t;
+
+#define LOTHAR_CODEC_ACCESSORS_bytes(command, direction, field, offset)						\
+  static inline lothar_codec_##direction##_bytes_t lothar_##command##_##direction##_##field(lothar_codec_##direction##_bytes_t frame) \
+  {														\
+    return frame + offset;											\
+  }
+
+#define LOTHAR_CODEC_REQUEST_ACCESSORS(command, field, offset, kind) LOTHAR_CODEC_ACCESSORS_##kind(command, request, field, offset)
+#define LOTHAR_CODEC_REPLY_ACCESSORS(command, field, offset, kind)   LOTHAR_CODEC_ACCESSORS_##kind(command, reply, field, offset)
+
+LOTHAR_CODEC_REQUEST_FIELDS(LOTHAR_CODEC_REQUEST_ACCESSORS)
+LOTHAR_CODEC_REPLY_FIELDS(LOTHAR_CODEC_REPLY_ACCESSORS)
+
+#undef LOTHAR_CODEC_REQUEST_ACCESSORS
+#undef LOTHAR_CODEC_REPLY_ACCESSORS
+
+/** \brief A command as described by the table
+ */
+typedef struct
+{
+  char const *name; ///< the name of the command, NULL for an unknown opcode
+  uint8_t opcode;
+  uint8_t type;     ///< LOTHAR_CODEC_REPLY, LOTHAR_CODEC_NO_REPLY or LOTHAR_CODEC_SYSTEM
+  uint8_t request;  ///< the size of the request
+  uint8_t reply;    ///< the size of the reply
+  uint8_t flags;    ///< LOTHAR_CODEC_QUERY, LOTHAR_CODEC_VARIABLE_REQUEST, LOTHAR_CODEC_VARIABLE_REPLY
+} lothar_codec_command_t;
+
+/** \brief Look up a command by its opcode
+ *
+ * \returns the description of the command, its name is NULL if the opcode is not known (it never returns NULL)
+ */
+lothar_codec_command_t const *lothar_codec_command(uint8_t opcode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_CODEC_H
@@ -19,7 +19,266 @@ extern "C"
  * These return 0 on success and a negative error code on failure (see error_handling.h for the meaning of these errors,
  * the error code is the negative of the lothar_error) if a function takes a non-const pointer as a parameter (other
  * than lothar_connection_t *), it is an output parameter. Pass NULL, if you'r not interested in this output
+ *
+ * A command waits for its reply as long as the connection lets it, see lothar_connection_set_timeout() and
+ * lothar_connection_set_deadline() to bound that.
+ */
+
+/** \brief Start pipelining commands on a connection
+ *
+ * Normally, a command that requires a reply from the brick waits for that reply before returning, costing a full
+ * round trip over the link for every command. In pipelined mode these commands only send their request and return
+ * inmediately, so many requests can be in flight at once. Their replies are matched to the requests in the order they
+ * were sent, and stored in the output parameters by lothar_pipeline_sync() or lothar_pipeline_end().
+ *
+ * This means the output parameters must remain valid until then! At most LOTHAR_MAX_PENDING replies can be
+ * outstanding, sending more requests will first wait for the oldest reply. Calls that return their result right away,
+ * lothar_transact() and the motor and sensor functions of motor.h and sensor.h, still wait for their reply.
+ *
+ * \code
+ * lothar_pipeline_begin(connection);
+ * lothar_getoutputstate(connection, OUTPUT_A, NULL, NULL, NULL, NULL, NULL, NULL, &tacho_a, NULL, NULL);
+ * lothar_getoutputstate(connection, OUTPUT_B, NULL, NULL, NULL, NULL, NULL, NULL, &tacho_b, NULL, NULL);
+ * lothar_getinputvalues(connection, INPUT_1, NULL, NULL, NULL, NULL, NULL, NULL, &value, NULL);
+ * status = lothar_pipeline_end(connection); // tacho_a, tacho_b and value are now filled in
+ * \endcode
+ */
+int lothar_pipeline_begin(lothar_connection_t *connection);
+
+/** \brief Wait for all outstanding replies, but remain in pipelined mode
+ *
+ * \returns 0, or the first error encountered since the last call to lothar_pipeline_sync()
+ */
+int lothar_pipeline_sync(lothar_connection_t *connection);
+
+/** \brief Wait for all outstanding replies, and leave pipelined mode
+ *
+ * \returns 0, or the first error encountered since the last call to lothar_pipeline_sync()
+ */
+int lothar_pipeline_end(lothar_connection_t *connection);
+
+/** \brief The number of requests still waiting for their reply
+ */
+int lothar_pipeline_pending(lothar_connection_t const *connection, size_t *pending);
+
+/** \brief Start combining the commands that do not expect a reply
+ *
+ * Over bluetooth every write is a packet of its own, with a radio slot of its own. From now on, commands that do not
+ * wait for a reply (setoutputstate, setinputmode, playtone and the like) are held back, and written together by the
+ * next lothar_combine_flush(), or by the next command that does expect a reply (they are written before it, so the
+ * brick sees the commands in order). Setting three motors then takes a single packet instead of three. At most
+ * LOTHAR_MAX_BATCH commands are held back, the next one flushes them.
+ *
+ * An error writing held back commands is returned by the command or call that flushed them.
+ *
+ * \code
+ * lothar_combine_begin(connection);
+ * lothar_setoutputstate(connection, OUTPUT_A, 75, ...);
+ * lothar_setoutputstate(connection, OUTPUT_B, 75, ...);
+ * lothar_setoutputstate(connection, OUTPUT_C, 50, ...);
+ * status = lothar_combine_end(connection); // all three go out now
+ * \endcode
+ *
+ * Not available in threaded mode.
  */
+int lothar_combine_begin(lothar_connection_t *connection);
+
+/** \brief Write the commands held back since lothar_combine_begin() or the last flush
+ */
+int lothar_combine_flush(lothar_connection_t *connection);
+
+/** \brief Write the commands held back, and stop combining
+ */
+int lothar_combine_end(lothar_connection_t *connection);
+
+/** \brief Start coalescing the setoutputstate commands that wait to be written
+ *
+ * A control loop that sets the power of a motor every few milliseconds may do so faster than the link delivers. From
+ * now on, a setoutputstate that still waits on the host to be written is replaced by a newer one for the same port
+ * (one for OUTPUT_ALL replaces those for any port), so the brick never gets a stale command, and the latency stays
+ * bounded instead of growing with the backlog.
+ *
+ * Commands wait on the host in threaded mode, in the rings of the I/O thread, and while combining, in the commands
+ * held back. In threaded mode a setoutputstate no longer waits until it is written, an error writing it is returned by
+ * the next lothar_async_dispatch(). A coalesced command is still written before any command submitted after it. While
+ * combining, a command held back before some other command is kept, the newer one may not overtake that command. In
+ * the other modes every command is written right away, and there is nothing to coalesce.
+ */
+int lothar_coalesce_begin(lothar_connection_t *connection);
+
+/** \brief Stop coalescing, a command held by the I/O thread is still written
+ */
+int lothar_coalesce_end(lothar_connection_t *connection);
+
+/** \brief The number of setoutputstate commands for a port that were replaced before being written
+ *
+ * \param port one of OUTPUT_A, OUTPUT_B, OUTPUT_C or OUTPUT_ALL
+ */
+int lothar_coalesce_dropped(lothar_connection_t const *connection, enum lothar_output_port port, size_t *dropped);
+
+/** \brief Give the connection its own I/O thread, so several threads can send commands on it at once
+ *
+ * From then on, commands do not access the connection themselves. They build their request in a slot of a lock-free
+ * submission ring and the I/O thread writes it, and reads the reply. A command that waits for a reply (or for its
+ * request to be written) blocks only the thread that called it, while requests from other threads go out in the
+ * meantime. The replies end up in the output parameters of the thread that sent the request.
+ *
+ * In threaded mode:
+ * - the callbacks of asynchronous commands run on the I/O thread, they cannot send commands themselves.
+ * - lothar_async_dispatch() only waits, the I/O thread delivers the replies by itself.
+ * - pipelining and combining are not available, use asynchronous commands instead.
+ * - never call lothar_connection_read() or lothar_connection_write() directly.
+ *
+ * Requests wait for the I/O thread in a queue per priority, see lothar_set_priority().
+ *
+ * There should be no replies outstanding when starting the I/O thread.
+ */
+int lothar_io_thread_start(lothar_connection_t *connection);
+
+/** \brief Leave threaded mode, after all submitted requests are completed
+ *
+ * No other thread should use the connection while doing so. lothar_connection_close() does this automatically.
+ */
+int lothar_io_thread_stop(lothar_connection_t *connection);
+
+/** \brief The priority classes of requests in threaded mode
+ */
+enum lothar_priority
+{
+  LOTHAR_PRIORITY_NORMAL = 0, ///< queries and everything else
+  LOTHAR_PRIORITY_URGENT,     ///< by default setoutputstate and stopprogram, so stopping a motor does not wait
+  LOTHAR_PRIORITIES           ///< the number of priority classes
+};
+
+/** \brief Set the priority of the requests of a command in threaded mode
+ *
+ * The I/O thread always writes the urgent requests that are queued first, requests of the same priority are written in
+ * the order they were made. A request that expects no reply goes out right away, even if all LOTHAR_MAX_PENDING replies
+ * are outstanding. So under heavy sensor polling, lothar_motor_brake() waits at most for the request being written,
+ * not for the queries queued before it. Requests that were already written are answered first though, the brick
+ * works on them in order.
+ *
+ * Without the I/O thread nothing is queued, every command is written as it is made.
+ *
+ * \param opcode the opcode of the command, i.e. 0x04 for setoutputstate
+ */
+int lothar_set_priority(lothar_connection_t *connection, uint8_t opcode, enum lothar_priority priority);
+
+/** \brief The number of requests of a priority class waiting to be written by the I/O thread
+ */
+int lothar_io_queue_depth(lothar_connection_t const *connection, enum lothar_priority priority, size_t *depth);
+
+/** \brief The state of an output port, as reported by lothar_readoutputstate()
+ */
+typedef struct lothar_outputstate_t
+{
+  enum lothar_output_port port;
+  int8_t power;
+  enum lothar_output_motor_mode motormode;
+  enum lothar_output_regulation_mode regulationmode;
+  uint8_t turnratio;
+  enum lothar_output_runstate runstate;
+  uint32_t tacholimit;
+  int32_t tachocount;
+  int32_t blocktachocount;
+  int32_t rotationcount;
+} lothar_outputstate_t;
+
+/** \brief The values of a sensor, as reported by lothar_readinputvalues()
+ */
+typedef struct lothar_inputvalues_t
+{
+  enum lothar_input_port port;
+  uint8_t valid;
+  uint8_t calibrated;
+  enum lothar_sensor_type type;
+  enum lothar_sensor_mode mode;
+  uint16_t rawvalue;
+  uint16_t normvalue;
+  int16_t scaledvalue;
+  int16_t calibratedvalue;
+} lothar_inputvalues_t;
+
+/* asynchronous commands
+ *
+ * The commands that expect a reply also come in an asynchronous variant (lothar_<command>_async), that only sends the
+ * request and returns. The reply is delivered to the callback later, by lothar_async_dispatch(), or by any other call
+ * on the connection that needs to read past it (replies always arrive in the order the requests were sent).
+ *
+ * Every callback receives the connection, the status (0, or a negative error code, in which case the data arguments are
+ * NULL or 0), the decoded reply and the user pointer given to the command. The data is only valid during the callback.
+ * 
+ * A callback may send new commands, but only asynchronous (or pipelined) ones; a command that waits for its reply
+ * returns -LOTHAR_ERROR_INVALID_ARGUMENT when called from a callback.
+ */
+
+/** \brief Callback for lothar_getoutputstate_async() */
+typedef void (*lothar_getoutputstate_callback)(lothar_connection_t *connection, 
+					       int status, 
+					       lothar_outputstate_t const *state, 
+					       void *user);
+
+/** \brief Callback for lothar_getinputvalues_async() */
+typedef void (*lothar_getinputvalues_callback)(lothar_connection_t *connection, 
+					       int status, 
+					       lothar_inputvalues_t const *values, 
+					       void *user);
+
+/** \brief Callback for lothar_getbatterylevel_async(), batterylevel is in mV */
+typedef void (*lothar_getbatterylevel_callback)(lothar_connection_t *connection, int status, uint16_t batterylevel, void *user);
+
+/** \brief Callback for lothar_keepalive_async() */
+typedef void (*lothar_keepalive_callback)(lothar_connection_t *connection, int status, uint32_t sleeptime, void *user);
+
+/** \brief Callback for lothar_lsgetstatus_async() */
+typedef void (*lothar_lsgetstatus_callback)(lothar_connection_t *connection, 
+					    int status, 
+					    enum lothar_input_port port, 
+					    uint8_t bytesready, 
+					    void *user);
+
+/** \brief Callback for lothar_lsread_async() */
+typedef void (*lothar_lsread_callback)(lothar_connection_t *connection, 
+				       int status, 
+				       enum lothar_input_port port, 
+				       uint8_t const *rxdata, 
+				       uint8_t rxlen, 
+				       void *user);
+
+/** \brief Callback for lothar_getcurrentprogramname_async() */
+typedef void (*lothar_getcurrentprogramname_callback)(lothar_connection_t *connection, 
+						      int status, 
+						      char const *filename, 
+						      void *user);
+
+/** \brief Callback for lothar_messageread_async() */
+typedef void (*lothar_messageread_callback)(lothar_connection_t *connection, 
+					    int status, 
+					    uint8_t localinbox, 
+					    uint8_t const *data, 
+					    uint8_t len, 
+					    void *user);
+
+/** \brief Deliver replies to the callbacks of asynchronous commands
+ *
+ * Reads replies until no more than pending requests are outstanding, so lothar_async_dispatch(connection, 0) waits for
+ * all of them. Use lothar_pipeline_pending() to find out how many there are without blocking.
+ *
+ * \returns 0, or the first error reported to a callback
+ */
+int lothar_async_dispatch(lothar_connection_t *connection, size_t pending);
+
+/** \brief Send a request that was encoded elsewhere, like by the command objects of commands.hh
+ *
+ * The telegram is a whole request of a command in codec.h: its type byte (as in the table), its opcode and its fields. If
+ * the command is answered, this waits for the reply and stores the whole reply frame in reply. It waits in pipelined
+ * mode as well (after the replies to the requests sent before it), so reply can be a local buffer. Commands with
+ * replies of a variable size cannot be sent this way.
+ *
+ * \param reply   where to store the reply, pass NULL to only check its status
+ * \param bufsize the size of reply, at least the reply size of the command
+ */
+int lothar_transact(lothar_connection_t *connection, uint8_t const *telegram, size_t len, uint8_t *reply, size_t bufsize);
 
 /** \brief Start a program with the given name.
  */
@@ -91,6 +350,20 @@ int lothar_getoutputstate(lothar_connection_t *connection,
 			  int32_t *blocktachocount,
 			  int32_t *rotationcount);
 
+/** \brief Inspect a motor, all of its state at once
+ *
+ * The reply is decoded straight into state, so there is nothing to check per field. Like the output parameters of
+ * lothar_getoutputstate(), state must remain valid until the reply is read when pipelining.
+ */
+int lothar_readoutputstate(lothar_connection_t *connection, enum lothar_output_port port, lothar_outputstate_t *state);
+
+/** \brief Asynchronous lothar_getoutputstate()
+ */
+int lothar_getoutputstate_async(lothar_connection_t *connection,
+				enum lothar_output_port port,
+				lothar_getoutputstate_callback callback,
+				void *user);
+
 /** \brief Read a sensor
  *
  * \param port            The input port
@@ -114,6 +387,19 @@ int lothar_getinputvalues(lothar_connection_t *connection,
 			  int16_t *scaledvalue,
 			  int16_t *calibratedvalue);
 
+/** \brief Read a sensor, all of its values at once
+ *
+ * See lothar_readoutputstate().
+ */
+int lothar_readinputvalues(lothar_connection_t *connection, enum lothar_input_port port, lothar_inputvalues_t *values);
+
+/** \brief Asynchronous lothar_getinputvalues()
+ */
+int lothar_getinputvalues_async(lothar_connection_t *connection,
+				enum lothar_input_port port,
+				lothar_getinputvalues_callback callback,
+				void *user);
+
 /** \brief Reset a a scaled value
  */
 int lothar_resetinputscaledvalue(lothar_connection_t *connection, enum lothar_input_port port);
@@ -139,6 +425,10 @@ int lothar_resetmotorposition(lothar_connection_t *connection, enum lothar_outpu
  */
 int lothar_getbatterylevel(lothar_connection_t *connection, uint16_t *batterylevel);
 
+/** \brief Asynchronous lothar_getbatterylevel()
+ */
+int lothar_getbatterylevel_async(lothar_connection_t *connection, lothar_getbatterylevel_callback callback, void *user);
+
 /** \brief Stop sound playback
  */
 int lothar_stopsoundplayback(lothar_connection_t *connection);
@@ -147,12 +437,20 @@ int lothar_stopsoundplayback(lothar_connection_t *connection);
  */
 int lothar_keepalive(lothar_connection_t *connection, uint32_t *sleeptime);
 
+/** \brief Asynchronous lothar_keepalive()
+ */
+int lothar_keepalive_async(lothar_connection_t *connection, lothar_keepalive_callback callback, void *user);
+
 /** \brief Get the number of bytes ready to receive
  *
  * \param bytesready the number of bytes ready
  */
 int lothar_lsgetstatus(lothar_connection_t *connection, enum lothar_input_port port, uint8_t *bytesready);
 
+/** \brief Asynchronous lothar_lsgetstatus()
+ */
+int lothar_lsgetstatus_async(lothar_connection_t *connection, enum lothar_input_port port, lothar_lsgetstatus_callback callback, void *user);
+
 /** \brief Write data to an input port
  */
 int lothar_lswrite(lothar_connection_t *connection, enum lothar_input_port port, uint8_t const *txdata, uint8_t txlen, uint8_t rxlen);
@@ -163,16 +461,37 @@ int lothar_lswrite(lothar_connection_t *connection, enum lothar_input_port port,
  */
 int lothar_lsread(lothar_connection_t *connection, enum lothar_input_port port, uint8_t *rxdata, size_t bufsize, uint8_t *rxlen);
 
+/** \brief Asynchronous lothar_lsread()
+ */
+int lothar_lsread_async(lothar_connection_t *connection, enum lothar_input_port port, lothar_lsread_callback callback, void *user);
+
 /** \brief Get the current program name
  *
  * \param filename This will store the file name.
  */
 int lothar_getcurrentprogramname(lothar_connection_t *connection, char filename[19]);
 
-/** \brief Read a message from an inbox
+/** \brief Asynchronous lothar_getcurrentprogramname()
+ */
+int lothar_getcurrentprogramname_async(lothar_connection_t *connection, lothar_getcurrentprogramname_callback callback, void *user);
+
+/** \brief Read a message from a mailbox
+ *
+ * \param remoteinbox the mailbox on the brick, 0-9 or the response mailboxes 10-19 a program on the brick answers in
+ * \param localinbox  the inbox on the host (0-9) the message is reported for
+ * \param remove      (boolean) take the message out of the mailbox
  */
 int lothar_messageread(lothar_connection_t *connection, uint8_t remoteinbox, uint8_t localinbox, uint8_t remove, uint8_t data[59], uint8_t *len);
 
+/** \brief Asynchronous lothar_messageread()
+ */
+int lothar_messageread_async(lothar_connection_t *connection, 
+			     uint8_t remoteinbox, 
+			     uint8_t localinbox, 
+			     uint8_t remove, 
+			     lothar_messageread_callback callback, 
+			     void *user);
+
 #ifdef __cplusplus
 }
 #endif
@@ -20,6 +20,14 @@ typedef struct lothar_connection_t lothar_connection_t;
 #define USB_PRODUCT_NXT       0x0002  
 /// default bluethooth address
 #define BLUETOOTH_NXT_ADDRESS "NXT"   
+/// the maximum number of replies that can be outstanding on a single connection
+#define LOTHAR_MAX_PENDING    16
+/// the maximum size of a single message (telegram) to or from the brick
+#define LOTHAR_MAX_TELEGRAM   64
+/// the maximum number of buffers that can be passed to lothar_connection_writev
+#define LOTHAR_MAX_IOV        8
+/// the maximum number of telegrams that can be passed to lothar_connection_writebatch
+#define LOTHAR_MAX_BATCH      16
 
 /** \brief open a new connection over usb, given a vendor and product id 
  */
@@ -29,7 +37,27 @@ lothar_connection_t *lothar_connection_open_usb_vid_pid(uint16_t vendor, uint16_
  */
 lothar_connection_t *lothar_connection_open_usb(void);
 
+/** \brief Called for every connection opened by lothar_connection_open_usb_all()
+ *
+ * \param connection the new connection, which is now owned by the callee (close it with lothar_connection_close())
+ * \param serial     the serial number of the brick (its bluetooth address), or its bus address if it has none
+ */
+typedef void (*lothar_connection_found)(lothar_connection_t *connection, char const *serial, void *user);
+
+/** \brief open a connection to every brick attached over usb, given a vendor and product id
+ *
+ * Bricks that are already in use are skipped.
+ *
+ * \returns the number of connections opened, or a negative error code
+ */
+int lothar_connection_open_usb_all(uint16_t vendor, uint16_t product, lothar_connection_found found, void *user);
+
 /** \brief open a new bluetooth connection, by address, i.e. "00:16:53:12:5c:67", or "NXT" 
+ *
+ * Looking up a brick by name takes an inquiry scan of several seconds, so the address that was found is remembered in
+ * the file .lothar-bluetooth in the home directory (or the file named by the environment variable
+ * LOTHAR_BLUETOOTH_CACHE, set it to an empty string to not remember anything). The next time, the brick is tried at
+ * that address first, and the name is only looked up again if that fails.
  */
 lothar_connection_t *lothar_connection_open_bluetooth_address(char const *address);
 
@@ -39,18 +67,41 @@ lothar_connection_t *lothar_connection_open_bluetooth(void);
 
 /** \brief For your convienience, open a new connection by trying whatever works. 
  *
- * This first tries the default bluetooth address, then the default usb vendor/product, and if all fails returns NULL
+ * This tries the default bluetooth address and the default usb vendor/product at the same time. A brick attached
+ * over usb is opened right away, without waiting for bluetooth. Otherwise it returns the bluetooth connection, or NULL
+ * if that failed too.
  */
 lothar_connection_t *lothar_connection_open(void);
 
 
+/** \brief One of the buffers of a scatter/gather write
+ */
+typedef struct
+{
+  uint8_t const *data;
+  size_t len;
+} lothar_iovec_t;
+
 /** \brief A vtable for connections, which provides the ability to create custom connections.
+ *
+ * writev is optional and may be NULL. If provided, it should send all buffers as a single message (as if they were
+ * concatenated and passed to write), and return the total number of bytes written.
+ *
+ * set_timeout is optional and may be NULL. If provided, every following read and write should give up after the
+ * given number of milliseconds (0 for never), with the error LOTHAR_ERROR_TIMEOUT. Without it, a read or write can
+ * block for as long as the connection takes.
+ *
+ * writebatch is optional and may be NULL. If provided, it should send every buffer as a message of its own (as if each
+ * was passed to write), preferably in a single transfer, and return the total number of bytes written.
  */
 typedef struct
 {
   int (*read)(void *private_data, uint8_t *buf, size_t count);
   int (*write)(void *private_data, uint8_t const *buf, size_t count);
   int (*close)(void *private_data);
+  int (*writev)(void *private_data, lothar_iovec_t const *iov, size_t iovcount);
+  int (*set_timeout)(void *private_data, uint32_t ms);
+  int (*writebatch)(void *private_data, lothar_iovec_t const *telegrams, size_t count);
 } lothar_connection_vtable;
 
 /** \brief Custom opener for connections
@@ -67,12 +118,56 @@ lothar_connection_t *lothar_connection_open_custom(lothar_connection_vtable cons
  */
 int lothar_connection_close(lothar_connection_t **connection);
 
+/** \brief Set the timeout of every read and write on a connection
+ *
+ * A read or write that takes longer fails with LOTHAR_ERROR_TIMEOUT. The reply to a request that timed out may still
+ * arrive later, the commands layer skips it. By default there is no timeout.
+ *
+ * \param ms the timeout in milliseconds, 0 for none
+ */
+int lothar_connection_set_timeout(lothar_connection_t *connection, uint32_t ms);
+
+/** \brief Set a deadline for all I/O on a connection
+ *
+ * Until the deadline is cleared, reads and writes give up when it passes (or sooner, when their timeout passes), and
+ * fail right away once it has. So the time a command, or a pipeline of them, can take is bounded:
+ *
+ * \code
+ * lothar_connection_set_deadline(connection, lothar_time_us() + 20000); // 20 ms
+ * status = lothar_getinputvalues(connection, ...);
+ * lothar_connection_set_deadline(connection, 0);
+ * \endcode
+ *
+ * \param deadline the time (as returned by lothar_time_us()) to give up, 0 for none
+ */
+int lothar_connection_set_deadline(lothar_connection_t *connection, uint64_t deadline);
+
 /** \brief Writes data over a connection 
  *
  * \returns 0 on succes, and tries to send all bytes
  */
 int lothar_connection_write(lothar_connection_t *connection, uint8_t const *data, size_t len);
 
+/** \brief Writes a number of buffers over a connection, as a single message
+ *
+ * This is the same as concatenating the buffers and passing them to lothar_connection_write(), but without the
+ * copying (if the connection supports it).
+ *
+ * \param iovcount the number of buffers, at most LOTHAR_MAX_IOV
+ * \returns the total number of bytes written
+ */
+int lothar_connection_writev(lothar_connection_t *connection, lothar_iovec_t const *iov, size_t iovcount);
+
+/** \brief Writes a number of telegrams over a connection, in one go
+ *
+ * This is the same as passing every buffer to lothar_connection_write() in turn, but a connection over a byte stream
+ * (bluetooth, tcp) sends them all at once. See lothar_combine_begin() in commands.h.
+ *
+ * \param count the number of telegrams, at most LOTHAR_MAX_BATCH
+ * \returns the total number of bytes written
+ */
+int lothar_connection_writebatch(lothar_connection_t *connection, lothar_iovec_t const *telegrams, size_t count);
+
 /** \brief Reads data from a connection
  *
  * \returns 0 on success, tries to read all bytes
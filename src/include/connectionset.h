@@ -0,0 +1,86 @@
+#ifndef LOTHAR_CONNECTIONSET_H
+#define LOTHAR_CONNECTIONSET_H
+
+#include "connection.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file connectionset.h
+ *
+ * A set of connections, to drive several bricks from one host. Every connection in the set has a name (for usb
+ * connections, the serial number of the brick), and can be found by index or by name.
+ *
+ * lothar_connectionset_parallel() runs a function on every brick at once, each on a thread of its own, so the round
+ * trips to the bricks overlap instead of adding up.
+ */
+
+/** \brief Opaque connection set
+ */
+struct lothar_connectionset_t;
+typedef struct lothar_connectionset_t lothar_connectionset_t;
+
+/** \brief Create an empty set
+ */
+lothar_connectionset_t *lothar_connectionset_create(void);
+
+/** \brief Create a set of all bricks attached over usb, using the standard vendor and product id of the NXT
+ *
+ * \returns the set (which may be empty), or NULL on failure
+ */
+lothar_connectionset_t *lothar_connectionset_open_usb(void);
+
+/** \brief Create a set of all bricks attached over usb, given a vendor and product id
+ */
+lothar_connectionset_t *lothar_connectionset_open_usb_vid_pid(uint16_t vendor, uint16_t product);
+
+/** \brief Close all connections, and free the set
+ */
+int lothar_connectionset_destroy(lothar_connectionset_t **set);
+
+/** \brief Add a connection to the set, the set takes ownership of it
+ *
+ * \param name the name of the connection, at most 31 characters (may be NULL, to use the index as name)
+ */
+int lothar_connectionset_add(lothar_connectionset_t *set, lothar_connection_t *connection, char const *name);
+
+/** \brief The number of connections in the set
+ */
+size_t lothar_connectionset_size(lothar_connectionset_t const *set);
+
+/** \brief The connection at index, or NULL if there is no such connection
+ */
+lothar_connection_t *lothar_connectionset_get(lothar_connectionset_t *set, size_t index);
+
+/** \brief The name of the connection at index, or NULL if there is no such connection
+ */
+char const *lothar_connectionset_name(lothar_connectionset_t const *set, size_t index);
+
+/** \brief The connection with the given name, or NULL if there is no such connection
+ */
+lothar_connection_t *lothar_connectionset_find(lothar_connectionset_t *set, char const *name);
+
+/** \brief A function to be run on every connection of a set
+ *
+ * \param index the index of the connection in the set
+ * \returns 0 on success, or a negative error code
+ */
+typedef int (*lothar_connectionset_function)(lothar_connection_t *connection, size_t index, void *user);
+
+/** \brief Run function on all connections of the set concurrently, and wait for all of them to finish
+ *
+ * Every connection gets a thread of its own, the function should only use the connection it is given.
+ *
+ * \param status if not NULL, receives the result of the function for every connection (lothar_connectionset_size()
+ *               entries)
+ * \returns 0, or the first error (by index) returned by function
+ */
+int lothar_connectionset_parallel(lothar_connectionset_t *set, lothar_connectionset_function function, void *user, int *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_CONNECTIONSET_H
@@ -0,0 +1,68 @@
+#ifndef LOTHAR_DAEMON_H
+#define LOTHAR_DAEMON_H
+
+#include "connection.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file daemon.h
+ *
+ * Share one brick between processes.
+ *
+ * Only one process can claim the usb interface or bluetooth channel of a brick. A daemon owns the connection instead,
+ * and serves any number of clients over a unix domain socket. Requests of all clients are passed on to the brick, each
+ * client gets the replies to its own requests in order.
+ *
+ * Queries that do not change the state of the brick (getoutputstate, getinputvalues, getbatterylevel, keepalive,
+ * lsgetstatus and getcurrentprogramname) are coalesced: identical queries of different clients that are waiting at
+ * the same time are sent to the brick once, and all of them get the reply. A logger and a dashboard polling the same
+ * sensor cost one round trip, not two.
+ *
+ * Unix domain sockets are not available on windows, there opening either side fails.
+ */
+
+/** \brief the default socket path of the daemon
+ */
+#define LOTHAR_DAEMON_PATH "/tmp/lothar.sock"
+
+/** \brief open a connection to the brick served by a daemon
+ *
+ * \param path the socket of the daemon, i.e. LOTHAR_DAEMON_PATH
+ * \returns the connection, or NULL on failure
+ */
+lothar_connection_t *lothar_connection_open_daemon(char const *path);
+
+/** \brief opaque data structure describing a running daemon
+ */
+typedef struct lothar_daemon_t lothar_daemon_t;
+
+/** \brief Serve a connection to other processes
+ *
+ * A thread is started that accepts clients on the socket at path, and serves all of them. A stale socket file (one
+ * nobody listens on) is replaced, opening fails if another daemon is serving at path already.
+ *
+ * \param brick the connection to serve, which must stay open until the daemon is closed and should not be used by
+ *              anyone else in the meantime
+ * \param path  the socket to listen on
+ * \returns the daemon, or NULL on failure
+ */
+lothar_daemon_t *lothar_daemon_open(lothar_connection_t *brick, char const *path);
+
+/** \brief The number of requests that were answered without a round trip of their own
+ */
+int lothar_daemon_coalesced(lothar_daemon_t const *daemon, size_t *requests);
+
+/** \brief Stop a daemon, and free the data structure
+ *
+ * The clients are disconnected and the socket file is removed. The served connection is not closed.
+ */
+int lothar_daemon_close(lothar_daemon_t **daemon);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_DAEMON_H
@@ -4,6 +4,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "config.h"
 
 #ifdef __cplusplus
@@ -87,6 +88,25 @@ enum lothar_error
   /** error codes that may be received from the brick */
   LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS = 0x20,
   LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY               = 0x40,
+  LOTHAR_ERROR_NO_MORE_HANDLES                   = 0x81,
+  LOTHAR_ERROR_NO_SPACE                          = 0x82,
+  LOTHAR_ERROR_NO_MORE_FILES                     = 0x83,
+  LOTHAR_ERROR_END_OF_FILE_EXPECTED              = 0x84,
+  LOTHAR_ERROR_END_OF_FILE                       = 0x85,
+  LOTHAR_ERROR_NOT_A_LINEAR_FILE                 = 0x86,
+  LOTHAR_ERROR_FILE_NOT_FOUND                    = 0x87,
+  LOTHAR_ERROR_HANDLE_ALREADY_CLOSED             = 0x88,
+  LOTHAR_ERROR_NO_LINEAR_SPACE                   = 0x89,
+  LOTHAR_ERROR_UNDEFINED_ERROR                   = 0x8A,
+  LOTHAR_ERROR_FILE_IS_BUSY                      = 0x8B,
+  LOTHAR_ERROR_NO_WRITE_BUFFERS                  = 0x8C,
+  LOTHAR_ERROR_APPEND_NOT_POSSIBLE               = 0x8D,
+  LOTHAR_ERROR_FILE_IS_FULL                      = 0x8E,
+  LOTHAR_ERROR_FILE_EXISTS                       = 0x8F,
+  LOTHAR_ERROR_MODULE_NOT_FOUND                  = 0x90,
+  LOTHAR_ERROR_OUT_OF_BOUNDARY                   = 0x91,
+  LOTHAR_ERROR_ILLEGAL_FILE_NAME                 = 0x92,
+  LOTHAR_ERROR_ILLEGAL_HANDLE                    = 0x93,
   LOTHAR_ERROR_REQUEST_FAILED                    = 0xBD,
   LOTHAR_ERROR_UNKOWN_COMMAND_OPCODE             = 0xBE,
   LOTHAR_ERROR_INSANE_PACKET                     = 0xBF,
@@ -106,17 +126,59 @@ enum lothar_error
   LOTHAR_ERROR_UNKOWN_ERROR // what happened?
 };
 
+/** \brief Storage class of the error state, every thread has its own
+ */
+#ifdef _MSC_VER
+#define LOTHAR_THREAD_LOCAL __declspec(thread)
+#else
+#define LOTHAR_THREAD_LOCAL __thread
+#endif
+
 /** \brief the global error variable 
  *
- * It is preferred to use a local variable to hold the error.
+ * It is preferred to use a local variable to hold the error. Every thread has its own, so the commands of threads
+ * that each use their own brick do not need a lock to tell their errors apart.
+ */
+extern LOTHAR_THREAD_LOCAL int lothar_errno;
+
+struct lothar_connection_t;
+
+/** \brief The context of the last error raised on a thread
+ */
+typedef struct
+{
+  int error;  ///< as lothar_errno, 0 if none was raised since the last lothar_clear_error()
+  int opcode; ///< the command that failed, -1 if the error was not raised by a command
+  int port;   ///< the port that command was addressed to, -1 if it has none
+  struct lothar_connection_t const *connection; ///< the connection the command was sent on, NULL if none
+  uint64_t time; ///< when the error was raised (lothar_time_us())
+} lothar_error_record_t;
+
+/** \brief Set lothar_errno, and start a new record for it without context
+ */
+void lothar_error_raise(int error);
+
+/** \brief Attribute the last error raised on this thread to a command, if it was not attributed yet
+ *
+ * \param port -1 if the command has none
+ */
+void lothar_error_blame(struct lothar_connection_t const *connection, int opcode, int port);
+
+/** \brief The record of the last error raised on the calling thread
+ *
+ * Unlike lothar_errno, the record says which command failed, on which connection and when.
+ */
+void lothar_error_record(lothar_error_record_t *record);
+
+/** \brief Raise the error of a record on the calling thread, to hand an error over from another thread
  */
-extern int lothar_errno;
+void lothar_error_restore(lothar_error_record_t const *record);
 
 /** \brief clear the global error
  */
 static inline void lothar_clear_error(void)
 {
-  lothar_errno = 0;
+  lothar_error_raise(0);
 }
 
 /** \brief returns the string representation of the error 
@@ -144,7 +206,7 @@ static inline void lothar_perror_global(char const *msg)
 { \
   if(error) \
     LOTHAR_WARN("file %s line %d\n\terror raised: (%d) %s\n", __FILE__, __LINE__, error, lothar_strerror(error)); \
-  lothar_errno = (error < 0 ? -error : error); \
+  lothar_error_raise(error); \
 }
 
 #define LOTHAR_RETURN_ERROR(error) { LOTHAR_ERROR(error); return -error; }
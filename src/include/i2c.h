@@ -0,0 +1,103 @@
+#ifndef LOTHAR_I2C_H
+#define LOTHAR_I2C_H
+
+#include "connection.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file i2c.h
+ *
+ * Transactions with the I2C (lowspeed) devices on the input ports, like the ultrasonic sensor.
+ *
+ * A transaction is an lswrite, then an lsgetstatus and an lsread once the bus is done. The brick does one transaction
+ * per port at a time, so every port has a queue of its own; the transactions of different ports run at the same time,
+ * and their requests share the round trips. The status and read of a transaction are sent together, when the bus
+ * should be done: every port measures how long its transactions take, and polls only again (sooner than that) if the
+ * data was not there yet. A device that is fast enough gets its write, status and read in one burst.
+ */
+
+/// the most bytes a transaction writes or reads
+#define LOTHAR_I2C_MAX     16
+/// the transactions that can wait per port
+#define LOTHAR_I2C_QUEUE   8
+/// how long a transaction may take before it fails with LOTHAR_ERROR_TIMEOUT (in ms)
+#define LOTHAR_I2C_TIMEOUT 1000
+
+/** \brief Callback for a completed transaction, rxdata is only valid during the callback
+ */
+typedef void (*lothar_i2c_callback)(lothar_connection_t *connection,
+				    int status,
+				    enum lothar_input_port port,
+				    uint8_t const *rxdata,
+				    uint8_t rxlen,
+				    void *user);
+
+/** \brief Opaque transaction queues of a connection
+ */
+struct lothar_i2c_t;
+typedef struct lothar_i2c_t lothar_i2c_t;
+
+/** \brief Create the transaction queues for the input ports of a brick
+ *
+ * They do not own the connection, which cannot be in pipelined mode. The ports should be set to a lowspeed sensor type
+ * (lothar_setinputmode()) before use.
+ *
+ * \returns the queues, or NULL on failure
+ */
+lothar_i2c_t *lothar_i2c_open(lothar_connection_t *connection);
+
+/** \brief Free the queues, transactions that did not complete are dropped without calling back
+ */
+int lothar_i2c_close(lothar_i2c_t **i2c);
+
+/** \brief Queue a transaction, it is carried out by lothar_i2c_run()
+ *
+ * If the queue of the port is full, this runs the transactions until there is room.
+ *
+ * \param txdata   what to write, the address of the device, the register and any data for it
+ * \param txlen    the size of txdata, at most LOTHAR_I2C_MAX
+ * \param rxlen    the number of bytes to read back, at most LOTHAR_I2C_MAX. A transaction that reads nothing is done
+ *                 when its status reports no error (after the measured time), as there is no read to wait for
+ * \param callback called when the transaction completes or fails, may be NULL
+ */
+int lothar_i2c_submit(lothar_i2c_t *i2c,
+		      enum lothar_input_port port,
+		      uint8_t const *txdata,
+		      uint8_t txlen,
+		      uint8_t rxlen,
+		      lothar_i2c_callback callback,
+		      void *user);
+
+/** \brief Carry out all queued transactions, on all ports at once
+ *
+ * The callbacks may queue more transactions, those are carried out as well.
+ *
+ * \returns 0, or the first error of any transaction
+ */
+int lothar_i2c_run(lothar_i2c_t *i2c);
+
+/** \brief Queue a transaction and wait for it
+ *
+ * \param rxdata where to store the data read, at least rxlen bytes
+ */
+int lothar_i2c_transfer(lothar_i2c_t *i2c,
+			enum lothar_input_port port,
+			uint8_t const *txdata,
+			uint8_t txlen,
+			uint8_t *rxdata,
+			uint8_t rxlen);
+
+/** \brief How long the transactions on a port are measured to take
+ *
+ * \param us where to store the time from the write to the data being ready, in microseconds
+ */
+int lothar_i2c_estimate(lothar_i2c_t const *i2c, enum lothar_input_port port, uint64_t *us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_I2C_H
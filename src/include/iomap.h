@@ -0,0 +1,103 @@
+#ifndef LOTHAR_IOMAP_H
+#define LOTHAR_IOMAP_H
+
+#include "connection.h"
+#include "utils.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file iomap.h
+ *
+ * The IO maps of the output and input modules: the state of every motor and sensor, as the firmware keeps it.
+ *
+ * Reading the maps takes one request per LOTHAR_MAX_IOMAPREAD bytes (two for the outputs and two for the inputs), all
+ * sent back to back, where getoutputstate and getinputvalues take one request per port. The maps also hold what those
+ * do not report, like the actual speed and the rpm of a motor.
+ */
+
+/// the module id of the output module
+#define LOTHAR_IOMAP_OUTPUT 0x00020001
+/// the module id of the input module
+#define LOTHAR_IOMAP_INPUT  0x00030001
+
+/// the number of output ports in the map of the output module
+#define LOTHAR_IOMAP_OUTPUTS 3
+/// the number of input ports in the map of the input module
+#define LOTHAR_IOMAP_INPUTS  4
+
+/// the size of the part of the output map that describes one port, port n starts at n times this
+#define LOTHAR_IOMAP_OUTPUT_SIZE 32
+/// the size of the part of the input map that describes one port
+#define LOTHAR_IOMAP_INPUT_SIZE  20
+
+/** \brief An output port, as the output module sees it
+ */
+typedef struct
+{
+  int32_t tachocount;      ///< count since the last motor reset
+  int32_t blocktachocount; ///< position relative to the last programmed movement
+  int32_t rotationcount;   ///< position relative to the last reset of the rotation sensor
+  uint32_t tacholimit;
+  int16_t rpm;             ///< the measured speed, in rotations per minute
+  uint8_t flags;           ///< pending updates of the settings
+  enum lothar_output_motor_mode mode;
+  int8_t speed;            ///< the power setting
+  int8_t actualspeed;      ///< the power actually applied by the regulation
+  uint8_t p, i, d;         ///< the parameters of the regulation
+  enum lothar_output_runstate runstate;
+  enum lothar_output_regulation_mode regulationmode;
+  uint8_t overloaded;      ///< (boolean) the motor cannot reach its speed
+  int8_t syncturn;         ///< the turn ratio of synchronized motors
+} lothar_output_iomap_t;
+
+/** \brief An input port, as the input module sees it
+ */
+typedef struct
+{
+  uint16_t customzero;     ///< the offset of a custom sensor
+  uint16_t adraw;          ///< the value of the a/d converter
+  uint16_t raw;            ///< the raw, sensor-dependent, value
+  int16_t value;           ///< the mode-dependent scaled value
+  enum lothar_sensor_type type;
+  enum lothar_sensor_mode mode;
+  uint8_t boolean;         ///< the value as a switch
+  uint8_t digipinsdir;     ///< the direction of the digital pins
+  uint8_t digipinsin;      ///< the state of the digital pins as inputs
+  uint8_t digipinsout;     ///< the state of the digital pins as outputs
+  uint8_t pctfullscale;    ///< the full scale of a custom sensor
+  uint8_t activestatus;    ///< the power a custom sensor gets
+  uint8_t invaliddata;     ///< (boolean) the value is not valid (yet)
+} lothar_input_iomap_t;
+
+/** \brief Decode the part of the output map that describes a port
+ *
+ * \param map LOTHAR_IOMAP_OUTPUT_SIZE bytes, as read from the brick
+ */
+void lothar_output_iomap_decode(uint8_t const *map, lothar_output_iomap_t *output);
+
+/** \brief Decode the part of the input map that describes a port
+ *
+ * \param map LOTHAR_IOMAP_INPUT_SIZE bytes, as read from the brick
+ */
+void lothar_input_iomap_decode(uint8_t const *map, lothar_input_iomap_t *input);
+
+/** \brief Read the state of all output and input ports at once
+ *
+ * All reads are sent before the first reply is read. Like lothar_snapshot(), this also completes the asynchronous
+ * commands that were still outstanding on the connection.
+ *
+ * \param outputs where to store the state of the output ports (A first), or NULL to skip the output map
+ * \param inputs  where to store the state of the input ports (1 first), or NULL to skip the input map
+ */
+int lothar_iomap_read(lothar_connection_t *connection,
+		      lothar_output_iomap_t outputs[LOTHAR_IOMAP_OUTPUTS],
+		      lothar_input_iomap_t inputs[LOTHAR_IOMAP_INPUTS]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_IOMAP_H
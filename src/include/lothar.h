@@ -5,7 +5,20 @@
 #include "error_handling.h"
 #include "utils.h"
 #include "connection.h"
+#include "connectionset.h"
+#include "simulator.h"
+#include "tcp.h"
+#include "daemon.h"
+#include "stats.h"
+#include "record.h"
+#include "codec.h"
 #include "commands.h"
+#include "replies.h"
+#include "snapshot.h"
+#include "system.h"
+#include "iomap.h"
+#include "stream.h"
+#include "i2c.h"
 #include "sensor.h"
 #include "motor.h"
 #include "steering.h"
@@ -0,0 +1,57 @@
+#ifndef LOTHAR_RECORD_H
+#define LOTHAR_RECORD_H
+
+#include "connection.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file record.h
+ *
+ * Record the traffic of a connection to a file, and replay it later without the brick.
+ *
+ * A recorder wraps another connection: everything written to and read from it is passed on, and appended to a capture
+ * file together with a timestamp (in microseconds) and the result of the call. The file is memory-mapped, so recording
+ * costs a copy, not a system call, per message. A replay connection serves the recorded replies (and errors) in the
+ * recorded order, either as fast as they are asked for or paced like the original.
+ *
+ * The capture file is little endian throughout:
+ *
+ * - a 16 byte header: "LREC", the version (32 bits, 1), and the size of the valid part of the file (64 bits)
+ * - records of a 16 byte header and the data: the time since the start of the recording (64 bits), the result of the
+ *   call (32 bits, signed), 'W' or 'R' for a write or read, a reserved byte and the size of the data (16 bits)
+ *
+ * The size in the header is updated after every record, so the file stays readable if the recording process dies.
+ */
+
+/** \brief Record all traffic of connection to a file
+ *
+ * \param connection the connection to record, which is now owned by the recorder (and closed with it)
+ * \param filename   the capture file, which is created or truncated
+ * \returns the recording connection, or NULL on failure (in which case connection is left open)
+ */
+lothar_connection_t *lothar_connection_open_recorder(lothar_connection_t *connection, char const *filename);
+
+/** \brief Replay a capture file
+ *
+ * Every read returns the next recorded read, every write is checked against the next recorded write.
+ *
+ * \param speed 0 to serve the replies as soon as they are asked for, otherwise a reply is held back until its
+ *              recorded time, divided by speed (1.0 for the original pace, 10.0 for ten times as fast)
+ * \returns the connection, or NULL if the file cannot be opened or is not a capture file
+ */
+lothar_connection_t *lothar_connection_open_replay(char const *filename, double speed);
+
+/** \brief The number of writes to a replay connection that differed from the recording
+ *
+ * A difference means the replayed code no longer behaves as recorded, so the replies that follow may not fit.
+ */
+int lothar_replay_diverged(lothar_connection_t *connection, size_t *writes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_RECORD_H
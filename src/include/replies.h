@@ -0,0 +1,155 @@
+#ifndef LOTHAR_REPLIES_H
+#define LOTHAR_REPLIES_H
+
+#include "commands.h"
+#include "codec.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file replies.h
+ *
+ * Read the fields of a reply straight from the received frame.
+ *
+ * A reply is the telegram as read from the brick: 0x02, the opcode, the status byte and the payload. The views below
+ * read a single field from such a frame, without copying or checking anything, so check a frame once with
+ * lothar_outputstate_view() or lothar_inputvalues_view() before reading from it. This is meant for going through
+ * captured traffic (see record.h) in bulk; lothar_outputstate_decode() and lothar_inputvalues_decode() fill in the
+ * whole struct instead, like lothar_readoutputstate() and lothar_readinputvalues() do for a live connection.
+ *
+ * The views are the accessors of codec.h, with the types of lothar_outputstate_t and lothar_inputvalues_t.
+ */
+
+/// the size of a getoutputstate reply
+#define LOTHAR_OUTPUTSTATE_REPLY LOTHAR_REPLY_SIZE_GETOUTPUTSTATE
+/// the size of a getinputvalues reply
+#define LOTHAR_INPUTVALUES_REPLY LOTHAR_REPLY_SIZE_GETINPUTVALUES
+
+/** \brief Check that a frame is a succesful getoutputstate reply
+ *
+ * \returns 0, -LOTHAR_ERROR_NXT_READ_ERROR if it is not a (complete) getoutputstate reply, or the error reported by the
+ * brick in its status byte
+ */
+int lothar_outputstate_view(uint8_t const *reply, size_t len);
+
+static inline enum lothar_output_port lothar_outputstate_view_port(uint8_t const *reply)
+{
+  return (enum lothar_output_port)lothar_getoutputstate_reply_port(reply);
+}
+
+static inline int8_t lothar_outputstate_view_power(uint8_t const *reply)
+{
+  return lothar_getoutputstate_reply_power(reply);
+}
+
+static inline enum lothar_output_motor_mode lothar_outputstate_view_motormode(uint8_t const *reply)
+{
+  return (enum lothar_output_motor_mode)lothar_getoutputstate_reply_motormode(reply);
+}
+
+static inline enum lothar_output_regulation_mode lothar_outputstate_view_regulationmode(uint8_t const *reply)
+{
+  return (enum lothar_output_regulation_mode)lothar_getoutputstate_reply_regulationmode(reply);
+}
+
+static inline uint8_t lothar_outputstate_view_turnratio(uint8_t const *reply)
+{
+  return lothar_getoutputstate_reply_turnratio(reply);
+}
+
+static inline enum lothar_output_runstate lothar_outputstate_view_runstate(uint8_t const *reply)
+{
+  return (enum lothar_output_runstate)lothar_getoutputstate_reply_runstate(reply);
+}
+
+static inline uint32_t lothar_outputstate_view_tacholimit(uint8_t const *reply)
+{
+  return lothar_getoutputstate_reply_tacholimit(reply);
+}
+
+static inline int32_t lothar_outputstate_view_tachocount(uint8_t const *reply)
+{
+  return lothar_getoutputstate_reply_tachocount(reply);
+}
+
+static inline int32_t lothar_outputstate_view_blocktachocount(uint8_t const *reply)
+{
+  return lothar_getoutputstate_reply_blocktachocount(reply);
+}
+
+static inline int32_t lothar_outputstate_view_rotationcount(uint8_t const *reply)
+{
+  return lothar_getoutputstate_reply_rotationcount(reply);
+}
+
+/** \brief Decode a getoutputstate reply
+ *
+ * \returns 0, or the error of lothar_outputstate_view(), in which case state is left alone
+ */
+int lothar_outputstate_decode(uint8_t const *reply, size_t len, lothar_outputstate_t *state);
+
+/** \brief Check that a frame is a succesful getinputvalues reply
+ *
+ * \returns 0, -LOTHAR_ERROR_NXT_READ_ERROR if it is not a (complete) getinputvalues reply, or the error reported by the
+ * brick in its status byte
+ */
+int lothar_inputvalues_view(uint8_t const *reply, size_t len);
+
+static inline enum lothar_input_port lothar_inputvalues_view_port(uint8_t const *reply)
+{
+  return (enum lothar_input_port)lothar_getinputvalues_reply_port(reply);
+}
+
+static inline uint8_t lothar_inputvalues_view_valid(uint8_t const *reply)
+{
+  return lothar_getinputvalues_reply_valid(reply);
+}
+
+static inline uint8_t lothar_inputvalues_view_calibrated(uint8_t const *reply)
+{
+  return lothar_getinputvalues_reply_calibrated(reply);
+}
+
+static inline enum lothar_sensor_type lothar_inputvalues_view_type(uint8_t const *reply)
+{
+  return (enum lothar_sensor_type)lothar_getinputvalues_reply_type(reply);
+}
+
+static inline enum lothar_sensor_mode lothar_inputvalues_view_mode(uint8_t const *reply)
+{
+  return (enum lothar_sensor_mode)lothar_getinputvalues_reply_mode(reply);
+}
+
+static inline uint16_t lothar_inputvalues_view_rawvalue(uint8_t const *reply)
+{
+  return lothar_getinputvalues_reply_rawvalue(reply);
+}
+
+static inline uint16_t lothar_inputvalues_view_normvalue(uint8_t const *reply)
+{
+  return lothar_getinputvalues_reply_normvalue(reply);
+}
+
+static inline int16_t lothar_inputvalues_view_scaledvalue(uint8_t const *reply)
+{
+  return lothar_getinputvalues_reply_scaledvalue(reply);
+}
+
+static inline int16_t lothar_inputvalues_view_calibratedvalue(uint8_t const *reply)
+{
+  return lothar_getinputvalues_reply_calibratedvalue(reply);
+}
+
+/** \brief Decode a getinputvalues reply
+ *
+ * \returns 0, or the error of lothar_inputvalues_view(), in which case values is left alone
+ */
+int lothar_inputvalues_decode(uint8_t const *reply, size_t len, lothar_inputvalues_t *values);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_REPLIES_H
@@ -0,0 +1,106 @@
+#ifndef LOTHAR_SIMULATOR_H
+#define LOTHAR_SIMULATOR_H
+
+#include "connection.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file simulator.h
+ *
+ * A simulated brick, to run (and time) code without an NXT attached. The simulator is an ordinary connection: every
+ * direct command in commands.h is understood, and answered the way the brick would.
+ *
+ * Motors spin up towards their power setting (900 degrees per second at full power) and update their tacho counters
+ * as they go, honoring the tacho limit, brake and coast, ramp up and ramp down. Regulated motors hold their speed,
+ * unregulated ones slow down with the battery voltage. Sensors report the raw value set with
+ * lothar_simulator_set_sensor(), scaled according to their mode. Lowspeed (I2C) ports hold a 256 byte register file,
+ * which is what an ultrasonic sensor looks like. Messages written to a mailbox can be read back from it, as if a
+ * program on the brick echoed them. The system commands in system.h work on a flash of 128 kB that starts out empty,
+ * and the IO maps of the output and input modules can be read (but not written).
+ *
+ * Every reply becomes available a configurable latency after its request was written, so pipelined requests overlap
+ * in time just like they would over a real link.
+ *
+ * By default the simulator follows the wall clock. With a manual clock it only moves forward with
+ * lothar_simulator_advance(), or when a reply is read before it would have arrived (the clock then jumps to its
+ * arrival), which makes the results reproducible.
+ */
+
+/** \brief Open a connection to a new simulated brick
+ */
+lothar_connection_t *lothar_connection_open_simulator(void);
+
+/** \brief Set the round trip time of the simulated link, in microseconds (0 by default)
+ *
+ * \returns 0, or -LOTHAR_ERROR_INVALID_ARGUMENT if connection is not a simulator
+ */
+int lothar_simulator_set_latency(lothar_connection_t *connection, uint32_t us);
+
+/** \brief Switch between following the wall clock (the default) and a manual clock
+ *
+ * The manual clock continues from the current time of the simulator.
+ */
+int lothar_simulator_set_manual_clock(lothar_connection_t *connection, uint8_t manual);
+
+/** \brief Move the manual clock forward
+ *
+ * \returns 0, or -LOTHAR_ERROR_INVALID_ARGUMENT if the clock is not manual
+ */
+int lothar_simulator_advance(lothar_connection_t *connection, uint64_t us);
+
+/** \brief The current time of the simulator, in microseconds since it was opened
+ */
+int lothar_simulator_time(lothar_connection_t *connection, uint64_t *us);
+
+/** \brief The number of requests the simulator has received
+ */
+int lothar_simulator_requests(lothar_connection_t *connection, size_t *requests);
+
+/** \brief Lose the next count requests on the way to the brick, they are written but never answered
+ */
+int lothar_simulator_drop_requests(lothar_connection_t *connection, size_t count);
+
+/** \brief Set the raw value (0-1023) of the sensor on a port
+ *
+ * For a lowspeed port, this sets the distance register (0x42) of an ultrasonic sensor instead.
+ */
+int lothar_simulator_set_sensor(lothar_connection_t *connection, enum lothar_input_port port, uint16_t rawvalue);
+
+/** \brief Fill the registers of the I2C device on a lowspeed port, starting at reg
+ */
+int lothar_simulator_set_registers(lothar_connection_t *connection, enum lothar_input_port port, uint8_t reg, uint8_t const *data, size_t len);
+
+/** \brief Set the time a byte takes on the bus of a lowspeed port (0 by default)
+ *
+ * Until a transaction is done, lothar_lsgetstatus() reports no bytes ready, and lothar_lsread() and the next
+ * lswrite on the port fail with LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS. lothar_lswrite() asks for no reply, so
+ * it does not see that error, the write is just not carried out.
+ *
+ * \param us the time in microseconds, for every byte written and read
+ */
+int lothar_simulator_set_bus_time(lothar_connection_t *connection, uint32_t us);
+
+/** \brief Set the battery voltage, in millivolts (7800 by default)
+ */
+int lothar_simulator_set_battery(lothar_connection_t *connection, uint16_t millivolts);
+
+/** \brief Post a message in a mailbox (0-19), as a program running on the brick would
+ *
+ * \param len at most 59 bytes
+ */
+int lothar_simulator_post_message(lothar_connection_t *connection, uint8_t inbox, uint8_t const *data, size_t len);
+
+/** \brief Take the oldest message from a mailbox (0-19), as a program running on the brick would
+ *
+ * \returns 0, or -LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY if there is none
+ */
+int lothar_simulator_take_message(lothar_connection_t *connection, uint8_t inbox, uint8_t data[59], uint8_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_SIMULATOR_H
@@ -0,0 +1,52 @@
+#ifndef LOTHAR_SNAPSHOT_H
+#define LOTHAR_SNAPSHOT_H
+
+#include "commands.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file snapshot.h
+ *
+ * The state of all motors and sensors of a brick at once.
+ *
+ * A control loop usually starts by reading every motor and sensor it uses, one command (and one round trip) at a time.
+ * A snapshot sends all those queries back to back and collects the replies, so reading the whole brick takes about
+ * as long as reading a single port.
+ */
+
+/// the number of output ports (A to C)
+#define LOTHAR_SNAPSHOT_OUTPUTS 3
+/// the number of input ports (1 to 4)
+#define LOTHAR_SNAPSHOT_INPUTS  4
+
+/** \brief The state of a brick
+ */
+typedef struct
+{
+  uint64_t sent;     ///< when the queries were sent (lothar_time_us())
+  uint64_t received; ///< when the last reply was read, the state is from somewhere in between
+
+  lothar_outputstate_t outputs[LOTHAR_SNAPSHOT_OUTPUTS]; ///< by output port, OUTPUT_A first
+  lothar_inputvalues_t inputs[LOTHAR_SNAPSHOT_INPUTS];   ///< by input port, INPUT_1 first
+  uint16_t battery;                                      ///< in mV, 0 if not asked for
+} lothar_snapshot_t;
+
+/** \brief Take a snapshot of the motors and sensors of a brick
+ *
+ * Queries the state of output ports A to C, the values of input ports 1 to 4 and, if asked for, the battery level in a
+ * single burst. Requests that were already outstanding on the connection are completed as well (in threaded mode,
+ * those of other threads too).
+ *
+ * \param battery (boolean) also read the battery level
+ * \returns 0, or the first error reported for any of the queries
+ */
+int lothar_snapshot(lothar_connection_t *connection, lothar_snapshot_t *snapshot, uint8_t battery);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_SNAPSHOT_H
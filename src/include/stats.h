@@ -0,0 +1,71 @@
+#ifndef LOTHAR_STATS_H
+#define LOTHAR_STATS_H
+
+#include "connection.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file stats.h
+ *
+ * Statistics of the commands sent over a connection, per opcode.
+ *
+ * Every connection counts the requests it writes and the replies it reads, with their sizes, the errors, and a
+ * histogram of the round trip times (from writing a request to having read its reply). Counting takes a few increments
+ * and a clock read per request, without locks, so it is always on. The counters are updated by the thread doing the
+ * I/O (the I/O thread, if the connection has one) and can be read from any thread, a snapshot taken while commands
+ * are in flight may be off by the command being counted.
+ *
+ * The histogram is log-linear: round trip times below 8 microseconds have a bucket each, from there every power of two
+ * is split into 4 buckets of equal width. So a bucket is at most 25% wide, and the last one (from about 29 seconds)
+ * takes everything longer.
+ */
+
+/// the number of buckets of the round trip time histogram
+#define LOTHAR_STATS_BUCKETS 96
+
+/** \brief The statistics of one opcode
+ */
+typedef struct
+{
+  size_t requests;       ///< requests written (or attempted)
+  size_t replies;        ///< replies read, including those reporting an error
+  size_t errors;         ///< failed writes and reads, and replies reporting an error
+  size_t bytes_written;  ///< the size of the requests
+  size_t bytes_read;     ///< the size of the replies
+  uint64_t rtt_total;    ///< the sum of the round trip times of all replies, in microseconds
+  uint32_t rtt[LOTHAR_STATS_BUCKETS]; ///< the number of replies by round trip time, see lothar_stats_bucket()
+} lothar_opcode_stats_t;
+
+/** \brief Get the statistics of an opcode
+ *
+ * \param opcode the opcode (the second byte of a request, i.e. 0x0B for getbatterylevel), or -1 for the totals of all
+ * \param stats  where to store a copy of the statistics
+ */
+int lothar_connection_stats(lothar_connection_t const *connection, int opcode, lothar_opcode_stats_t *stats);
+
+/** \brief The histogram bucket a round trip time of us microseconds is counted in
+ */
+size_t lothar_stats_bucket(uint64_t us);
+
+/** \brief The shortest round trip time (in microseconds) counted in a bucket
+ *
+ * The longest one is lothar_stats_bucket_min(bucket + 1) - 1, except for the last bucket.
+ */
+uint64_t lothar_stats_bucket_min(size_t bucket);
+
+/** \brief Estimate a percentile of the round trip times
+ *
+ * \param p  the fraction of replies, i.e. 0.5 for the median or 0.99
+ * \param us the upper bound of the bucket the percentile falls in, in microseconds
+ * \returns 0, or a negative error code if there are no replies
+ */
+int lothar_stats_percentile(lothar_opcode_stats_t const *stats, double p, uint64_t *us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_STATS_H
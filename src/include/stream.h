@@ -0,0 +1,91 @@
+#ifndef LOTHAR_STREAM_H
+#define LOTHAR_STREAM_H
+
+#include "connection.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file stream.h
+ *
+ * A stream of bytes to and from a program running on the brick, on top of the mailboxes.
+ *
+ * A single lothar_messagewrite() or lothar_messageread() moves at most 59 bytes, and a program on the brick only sees
+ * one message at a time per inbox. A stream cuts the data into numbered chunks of LOTHAR_STREAM_CHUNK bytes and spreads
+ * them over several inboxes, so many chunks are in flight at once. The receiving end acknowledges what it has taken out
+ * of the mailboxes, and the sender never has more than LOTHAR_STREAM_DEPTH unacknowledged chunks in an inbox (a full
+ * mailbox on the brick drops its oldest message).
+ *
+ * Every message is [sequence number (2 bytes)][data][0], chunk n goes to inbox first + n % count. Data to the brick goes
+ * to the inboxes, data from the brick comes from the matching response mailboxes (first + 10 + n % count).
+ * Acknowledgements are [next sequence number expected (2 bytes)][0], to the host in response mailbox control + 10 and to
+ * the brick in inbox control. Sequence numbers count modulo LOTHAR_STREAM_SEQUENCES.
+ *
+ * tools/stream.nxc is the other end of a stream, for an NXC program on the brick.
+ */
+
+/// the most data a chunk holds: a message of 59 bytes, minus the sequence number and the terminating 0
+#define LOTHAR_STREAM_CHUNK 56
+/// the unacknowledged chunks per inbox: the number of messages a mailbox on the brick holds
+#define LOTHAR_STREAM_DEPTH 5
+/// sequence numbers count modulo this, a multiple of every window so a chunk number maps to the same inbox after wrapping
+#define LOTHAR_STREAM_SEQUENCES 12600
+/// the timeout of a stream, if not configured otherwise (in ms)
+#define LOTHAR_STREAM_TIMEOUT 2000
+
+/** \brief The mailboxes a stream uses, the brick should use the same
+ */
+typedef struct
+{
+  uint8_t first;   ///< the first inbox carrying data
+  uint8_t count;   ///< the number of inboxes carrying data, first + count should be at most 10
+  uint8_t control; ///< the inbox the acknowledgements go to, not one of the data inboxes
+  lothar_time_t timeout; ///< how long to wait for the brick before failing with LOTHAR_ERROR_TIMEOUT (in ms), 0 for ever
+} lothar_stream_config_t;
+
+/** \brief Opaque stream
+ */
+struct lothar_stream_t;
+typedef struct lothar_stream_t lothar_stream_t;
+
+/** \brief Open a stream on a connection
+ *
+ * The stream does not own the connection, close the stream first. It cannot be used in pipelined mode.
+ *
+ * \param config the mailboxes to use, or NULL for inboxes 0-8 for data and 9 for acknowledgements
+ * \returns the stream, or NULL on failure
+ */
+lothar_stream_t *lothar_stream_open(lothar_connection_t *connection, lothar_stream_config_t const *config);
+
+/** \brief Close a stream, without waiting for data still underway
+ */
+int lothar_stream_close(lothar_stream_t **stream);
+
+/** \brief Send data to the brick
+ *
+ * The data is sent in chunks right away, this only waits when the brick is a full window behind. The last chunk of a
+ * write is sent even if it is not full, so write large blocks at once.
+ */
+int lothar_stream_write(lothar_stream_t *stream, uint8_t const *data, size_t len);
+
+/** \brief Wait until the brick has received everything written
+ */
+int lothar_stream_flush(lothar_stream_t *stream);
+
+/** \brief Receive data from the brick
+ *
+ * Waits until there is data, and returns what has arrived in order so far.
+ *
+ * \param data    where to store the data
+ * \param bufsize the size of data
+ * \param len     where to store the number of bytes received
+ */
+int lothar_stream_read(lothar_stream_t *stream, uint8_t *data, size_t bufsize, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_STREAM_H
@@ -0,0 +1,188 @@
+#ifndef LOTHAR_SYSTEM_H
+#define LOTHAR_SYSTEM_H
+
+#include "connection.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file system.h
+ *
+ * System commands: the files on the brick, and the IO maps of the firmware modules.
+ *
+ * Like the direct commands in commands.h, these are one-to-one translations of the system commands of the brick, and
+ * follow the same conventions: 0 on success or a negative error code, output parameters may be NULL. They are answered
+ * in order with the direct commands, so they work in pipelined, asynchronous and threaded mode alike.
+ *
+ * File names are at most LOTHAR_MAX_FILENAME characters (15.3 on the brick). A single read or write moves at most
+ * LOTHAR_MAX_FILEREAD or LOTHAR_MAX_FILEWRITE bytes, so files are transferred in chunks; lothar_upload() and
+ * lothar_download() do that for a whole file, with many chunks in flight at once.
+ */
+
+/// the longest file name the brick accepts
+#define LOTHAR_MAX_FILENAME  19
+/// the most data a single lothar_fileread() can return (what fits in a reply)
+#define LOTHAR_MAX_FILEREAD  58
+/// the most data a single lothar_filewrite() can take (what fits in a request)
+#define LOTHAR_MAX_FILEWRITE 61
+/// the most data a single lothar_readiomap() can return
+#define LOTHAR_MAX_IOMAPREAD  55
+/// the most data a single lothar_writeiomap() can take
+#define LOTHAR_MAX_IOMAPWRITE 54
+
+/** \brief Open a file for reading
+ *
+ * \param handle where to store the handle of the file, for lothar_fileread() and lothar_fileclose()
+ * \param size   where to store the size of the file
+ */
+int lothar_openread(lothar_connection_t *connection, char const *filename, uint8_t *handle, uint32_t *size);
+
+/** \brief Create a file and open it for writing
+ *
+ * The size of a file is fixed when it is created, it should be written completely before it is closed. Creating a file
+ * that already exists fails.
+ */
+int lothar_openwrite(lothar_connection_t *connection, char const *filename, uint32_t size, uint8_t *handle);
+
+/** \brief Read from a file
+ *
+ * \param data the buffer to read into, of at least len bytes
+ * \param len  the number of bytes to read, at most LOTHAR_MAX_FILEREAD. Do not read past the end of the file
+ * \param read where to store the number of bytes read
+ */
+int lothar_fileread(lothar_connection_t *connection, uint8_t handle, uint8_t *data, size_t len, size_t *read);
+
+/** \brief Callback for lothar_fileread_async(), data is only valid during the callback */
+typedef void (*lothar_fileread_callback)(lothar_connection_t *connection,
+					 int status,
+					 uint8_t handle,
+					 uint8_t const *data,
+					 size_t len,
+					 void *user);
+
+/** \brief Asynchronous lothar_fileread(), see commands.h for asynchronous commands
+ */
+int lothar_fileread_async(lothar_connection_t *connection, uint8_t handle, size_t len, lothar_fileread_callback callback, void *user);
+
+/** \brief Write to a file
+ *
+ * \param len     the number of bytes to write, at most LOTHAR_MAX_FILEWRITE
+ * \param written where to store the number of bytes written
+ */
+int lothar_filewrite(lothar_connection_t *connection, uint8_t handle, uint8_t const *data, size_t len, size_t *written);
+
+/** \brief Callback for lothar_filewrite_async() */
+typedef void (*lothar_filewrite_callback)(lothar_connection_t *connection,
+					  int status,
+					  uint8_t handle,
+					  size_t written,
+					  void *user);
+
+/** \brief Asynchronous lothar_filewrite()
+ *
+ * The data is copied into the request before this returns.
+ */
+int lothar_filewrite_async(lothar_connection_t *connection,
+			   uint8_t handle,
+			   uint8_t const *data,
+			   size_t len,
+			   lothar_filewrite_callback callback,
+			   void *user);
+
+/** \brief Close a file, or a search started by lothar_findfirst()
+ */
+int lothar_fileclose(lothar_connection_t *connection, uint8_t handle);
+
+/** \brief Delete a file
+ */
+int lothar_filedelete(lothar_connection_t *connection, char const *filename);
+
+/** \brief Find the first file that matches a pattern
+ *
+ * \param pattern  a file name, or a wildcard like "*.rxe" or "*.*"
+ * \param handle   where to store the handle of the search, for lothar_findnext() and lothar_fileclose()
+ * \param filename where to store the name of the file found, at least LOTHAR_MAX_FILENAME + 1 bytes
+ * \param size     where to store the size of the file found
+ * \returns 0, or -LOTHAR_ERROR_FILE_NOT_FOUND if no file matches
+ */
+int lothar_findfirst(lothar_connection_t *connection, char const *pattern, uint8_t *handle, char *filename, uint32_t *size);
+
+/** \brief Find the next file that matches the pattern of lothar_findfirst()
+ *
+ * \returns 0, or -LOTHAR_ERROR_FILE_NOT_FOUND if there are no more
+ */
+int lothar_findnext(lothar_connection_t *connection, uint8_t handle, char *filename, uint32_t *size);
+
+/** \brief Read from the IO map of a firmware module
+ *
+ * The IO map is the state a module shares with the rest of the firmware, see iomap.h for the maps of the output and
+ * input modules.
+ *
+ * \param module the module id, i.e. LOTHAR_IOMAP_OUTPUT
+ * \param offset where to start reading in the map
+ * \param data   the buffer to read into, of at least len bytes
+ * \param len    the number of bytes to read, at most LOTHAR_MAX_IOMAPREAD
+ * \param read   where to store the number of bytes read
+ */
+int lothar_readiomap(lothar_connection_t *connection, uint32_t module, uint16_t offset, uint8_t *data, size_t len, size_t *read);
+
+/** \brief Callback for lothar_readiomap_async(), data is only valid during the callback */
+typedef void (*lothar_readiomap_callback)(lothar_connection_t *connection,
+					  int status,
+					  uint8_t const *data,
+					  size_t len,
+					  void *user);
+
+/** \brief Asynchronous lothar_readiomap()
+ */
+int lothar_readiomap_async(lothar_connection_t *connection,
+			   uint32_t module,
+			   uint16_t offset,
+			   size_t len,
+			   lothar_readiomap_callback callback,
+			   void *user);
+
+/** \brief Write to the IO map of a firmware module
+ *
+ * \param len     the number of bytes to write, at most LOTHAR_MAX_IOMAPWRITE
+ * \param written where to store the number of bytes written
+ */
+int lothar_writeiomap(lothar_connection_t *connection, uint32_t module, uint16_t offset, uint8_t const *data, size_t len, size_t *written);
+
+/** \brief Copy data to a new file on the brick
+ *
+ * The file is written in chunks of LOTHAR_MAX_FILEWRITE bytes, which are all sent before the first reply is read (up to
+ * LOTHAR_MAX_PENDING at a time). An existing file of the same name is replaced. Like lothar_snapshot(), this also
+ * completes the asynchronous commands that were still outstanding on the connection.
+ *
+ * \param filename the name of the file on the brick
+ * \param data     the contents of the file
+ * \param len      the size of data
+ */
+int lothar_upload(lothar_connection_t *connection, char const *filename, uint8_t const *data, size_t len);
+
+/** \brief Copy a local file to the brick
+ *
+ * \param path     the file to copy
+ * \param filename the name of the file on the brick, or NULL for the last part of path
+ */
+int lothar_upload_file(lothar_connection_t *connection, char const *path, char const *filename);
+
+/** \brief Copy a file from the brick
+ *
+ * Like lothar_upload(), the file is read in chunks that are requested all at once.
+ *
+ * \param filename the name of the file on the brick
+ * \param data     where to store the contents of the file
+ * \param bufsize  the size of data, if the file is larger -LOTHAR_ERROR_BUFFER_TOO_SMALL is returned (and len is set)
+ * \param len      where to store the size of the file
+ */
+int lothar_download(lothar_connection_t *connection, char const *filename, uint8_t *data, size_t bufsize, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_SYSTEM_H
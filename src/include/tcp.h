@@ -0,0 +1,61 @@
+#ifndef LOTHAR_TCP_H
+#define LOTHAR_TCP_H
+
+#include "connection.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** \file tcp.h
+ *
+ * Drive a brick attached to another machine over TCP.
+ *
+ * On the wire, every telegram is preceded by its size as a little endian 16 bit value, just like over bluetooth. The
+ * machine the brick is attached to runs a bridge, which passes the requests on to the brick and sends back the replies
+ * (see lothar_bridge_open(), or the lothar-bridge tool for a ready made one).
+ */
+
+/** \brief open a connection to a bridge
+ *
+ * Nagle's algorithm is disabled on the socket, so a request goes out as soon as it is written.
+ *
+ * \param host the host name or address of the bridge
+ * \param port the TCP port the bridge listens on
+ * \returns the connection, or NULL on failure
+ */
+lothar_connection_t *lothar_connection_open_tcp(char const *host, uint16_t port);
+
+/** \brief opaque data structure describing a running bridge
+ */
+typedef struct lothar_bridge_t lothar_bridge_t;
+
+/** \brief Serve a connection to other machines over TCP
+ *
+ * A thread is started that accepts clients on port, one at a time. Requests are passed on to brick as they arrive,
+ * replies are sent back in the same order. Requests that were sent together (i.e. from a pipeline) are all written to
+ * the brick before the first reply is read.
+ *
+ * \param brick the connection to serve, which must stay open until the bridge is closed and should not be used by anyone
+ *              else in the meantime
+ * \param port  the port to listen on, 0 for any free port (see lothar_bridge_port())
+ * \returns the bridge, or NULL on failure
+ */
+lothar_bridge_t *lothar_bridge_open(lothar_connection_t *brick, uint16_t port);
+
+/** \brief The port a bridge listens on
+ */
+int lothar_bridge_port(lothar_bridge_t const *bridge, uint16_t *port);
+
+/** \brief Stop a bridge, and free the data structure
+ *
+ * The served connection is not closed.
+ */
+int lothar_bridge_close(lothar_bridge_t **bridge);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOTHAR_TCP_H
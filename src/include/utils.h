@@ -232,6 +232,16 @@ static inline lothar_time_t lothar_timer(lothar_time_t *timer)
   return timer ? lothar_time() - *timer : lothar_time();
 }
 
+/** \brief sleep for the specified number of microseconds
+ */
+int lothar_usleep(uint64_t us);
+
+/** \brief high resolution timer, returns the number of microseconds since an arbitrary (but fixed) moment
+ *
+ * Unlike lothar_time(), this is monotonic: it does not jump when the system clock is adjusted.
+ */
+uint64_t lothar_time_us(void);
+
 /** \brief I don't want to check the return value of malloc every time, just fail miserably when out of memory (as we
  * probably should)
  */
@@ -0,0 +1,131 @@
+#include "iomap.h"
+#include "system.h"
+#include "commands.h"
+#include "connection_private.h"
+#include "error_handling.h"
+#include <string.h>
+
+#define OUTPUT_MAP (LOTHAR_IOMAP_OUTPUTS * LOTHAR_IOMAP_OUTPUT_SIZE)
+#define INPUT_MAP  (LOTHAR_IOMAP_INPUTS * LOTHAR_IOMAP_INPUT_SIZE)
+
+void lothar_output_iomap_decode(uint8_t const *map, lothar_output_iomap_t *output)
+{
+  output->tachocount      = (int32_t)lothar_nxttohl(map);
+  output->blocktachocount = (int32_t)lothar_nxttohl(map + 4);
+  output->rotationcount   = (int32_t)lothar_nxttohl(map + 8);
+  output->tacholimit      = lothar_nxttohl(map + 12);
+  output->rpm             = (int16_t)lothar_nxttohs(map + 16);
+  output->flags           = map[18];
+  output->mode            = (enum lothar_output_motor_mode)map[19];
+  output->speed           = (int8_t)map[20];
+  output->actualspeed     = (int8_t)map[21];
+  output->p               = map[22];
+  output->i               = map[23];
+  output->d               = map[24];
+  output->runstate        = (enum lothar_output_runstate)map[25];
+  output->regulationmode  = (enum lothar_output_regulation_mode)map[26];
+  output->overloaded      = map[27];
+  output->syncturn        = (int8_t)map[28];
+}
+
+void lothar_input_iomap_decode(uint8_t const *map, lothar_input_iomap_t *input)
+{
+  input->customzero   = lothar_nxttohs(map);
+  input->adraw        = lothar_nxttohs(map + 2);
+  input->raw          = lothar_nxttohs(map + 4);
+  input->value        = (int16_t)lothar_nxttohs(map + 6);
+  input->type         = (enum lothar_sensor_type)map[8];
+  input->mode         = (enum lothar_sensor_mode)map[9];
+  input->boolean      = map[10];
+  input->digipinsdir  = map[11];
+  input->digipinsin   = map[12];
+  input->digipinsout  = map[13];
+  input->pctfullscale = map[14];
+  input->activestatus = map[15];
+  input->invaliddata  = map[16];
+}
+
+/* the maps are read in chunks, the replies are appended in the order they arrive (the order of the requests) */
+
+typedef struct
+{
+  uint8_t data[OUTPUT_MAP + INPUT_MAP];
+  size_t done;
+  int status; // the first error
+} burst_t;
+
+static void chunk(lothar_connection_t *connection, int status, uint8_t const *data, size_t len, void *user)
+{
+  burst_t *burst = (burst_t *)user;
+
+  if(status < 0)
+    lothar_first_error(&burst->status, status);
+  else if(burst->done + len <= sizeof(burst->data))
+  {
+    memcpy(burst->data + burst->done, data, len);
+    burst->done += len;
+  }
+}
+
+static void request_map(lothar_connection_t *connection, burst_t *burst, uint32_t module, size_t size)
+{
+  size_t offset;
+
+  for(offset = 0; offset < size && !burst->status; offset += LOTHAR_MAX_IOMAPREAD)
+    lothar_first_error(&burst->status, lothar_readiomap_async(connection, module, offset, MIN(size - offset, LOTHAR_MAX_IOMAPREAD), chunk, burst));
+}
+
+int lothar_iomap_read(lothar_connection_t *connection,
+		      lothar_output_iomap_t outputs[LOTHAR_IOMAP_OUTPUTS],
+		      lothar_input_iomap_t inputs[LOTHAR_IOMAP_INPUTS])
+{
+  burst_t burst;
+  size_t expected = 0;
+  uint8_t const *map;
+  int i;
+
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  burst.done = 0;
+  burst.status = 0;
+
+  if(outputs)
+  {
+    request_map(connection, &burst, LOTHAR_IOMAP_OUTPUT, OUTPUT_MAP);
+    expected += OUTPUT_MAP;
+  }
+
+  if(inputs)
+  {
+    request_map(connection, &burst, LOTHAR_IOMAP_INPUT, INPUT_MAP);
+    expected += INPUT_MAP;
+  }
+
+  lothar_async_dispatch(connection, 0);
+
+  if(!burst.status && burst.done != expected)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+    burst.status = -lothar_errno;
+  }
+
+  if(burst.status < 0)
+    LOTHAR_RETURN_ERROR(-burst.status);
+
+  map = burst.data;
+
+  if(outputs)
+  {
+    for(i = 0; i < LOTHAR_IOMAP_OUTPUTS; ++i, map += LOTHAR_IOMAP_OUTPUT_SIZE)
+      lothar_output_iomap_decode(map, outputs + i);
+  }
+
+  if(inputs)
+  {
+    for(i = 0; i < LOTHAR_IOMAP_INPUTS; ++i, map += LOTHAR_IOMAP_INPUT_SIZE)
+      lothar_input_iomap_decode(map, inputs + i);
+  }
+
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include "motor.h"
 #include "commands.h"
+#include "replies.h"
+#include "codec.h"
 
 #define IS_VALID(m) { if(!m) { LOTHAR_FAIL("invalid motor\n"); LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);} }
 
@@ -197,25 +199,56 @@ int lothar_motor_reset(lothar_motor_t *motor, uint8_t relative)
   return lothar_resetmotorposition(motor->d_connection, motor->d_port, relative);
 }
 
+// the state of the motor, waited for even when the connection is pipelining (lothar_transact()), as it is needed
+// right away
+static int read_state(lothar_motor_t *motor, lothar_outputstate_t *state)
+{
+  uint8_t request[LOTHAR_REQUEST_SIZE_GETOUTPUTSTATE] = {LOTHAR_CODEC_REPLY, LOTHAR_OPCODE_GETOUTPUTSTATE};
+  uint8_t reply[LOTHAR_REPLY_SIZE_GETOUTPUTSTATE];
+  int status;
+
+  lothar_getoutputstate_request_set_port(request, motor->d_port);
+
+  if((status = lothar_transact(motor->d_connection, request, sizeof(request), reply, sizeof(reply))) < 0 ||
+     (status = lothar_outputstate_decode(reply, sizeof(reply), state)) < 0)
+    return status;
+
+  if(state->port != motor->d_port) // the brick answers for the port it was asked about
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_UNKOWN_ERROR);
+
+  return 0;
+}
+
 int lothar_motor_degrees(lothar_motor_t *motor, int32_t *degrees, uint8_t relative)
 {
+  lothar_outputstate_t state;
+  int status;
+
   IS_VALID(motor);
 
-  return lothar_getoutputstate(motor->d_connection,
-			       motor->d_port,
-			       NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-			       relative ? degrees : NULL,
-			       relative ? NULL : degrees);
+  if((status = read_state(motor, &state)) < 0)
+    return status;
+
+  if(degrees)
+    *degrees = relative ? state.blocktachocount : state.rotationcount;
+
+  return 0;
 }
 
 int lothar_motor_power(lothar_motor_t *motor, int8_t *power)
 {
+  lothar_outputstate_t state;
+  int status;
+
   IS_VALID(motor);
 
-  return lothar_getoutputstate(motor->d_connection,
-			       motor->d_port,
-			       power,
-			       NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+  if((status = read_state(motor, &state)) < 0)
+    return status;
+
+  if(power)
+    *power = state.power;
+
+  return 0;
 }
 
 int lothar_motor_sync(lothar_motor_t *motor1, lothar_motor_t *motor2, uint8_t reset)
@@ -0,0 +1,467 @@
+#include "record.h"
+#include "connection_private.h"
+#include "error_handling.h"
+#include "thread.h"
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define IS_VALID(c) { if(!c) LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED); if(c->vtable != &replay_vtable) LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT); }
+
+#define MAGIC   "LREC"
+#define VERSION 1
+#define HEADER  16
+#define RECORD  16
+#define CHUNK   65536 // the capture file grows by (at least) this much at a time
+
+#define WRITE 'W'
+#define READ  'R'
+
+/* memory mapped files */
+
+typedef struct
+{
+  uint8_t *data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int fd;
+#endif
+} map_t;
+
+#ifdef _WIN32
+
+static int map(map_t *m, int writable)
+{
+  m->data = NULL;
+
+  if(!(m->mapping = CreateFileMapping(m->file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)((uint64_t)m->size >> 32), (DWORD)m->size, NULL)))
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+
+  if(!(m->data = (uint8_t *)MapViewOfFile(m->mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, m->size)))
+  {
+    CloseHandle(m->mapping);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+  }
+
+  return 0;
+}
+
+static void unmap(map_t *m)
+{
+  UnmapViewOfFile(m->data);
+  CloseHandle(m->mapping);
+}
+
+static int map_create(map_t *m, char const *filename, size_t size)
+{
+  if((m->file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+
+  m->size = size;
+  if(map(m, 1) < 0)
+  {
+    CloseHandle(m->file);
+    return -lothar_errno;
+  }
+
+  return 0;
+}
+
+static int map_open(map_t *m, char const *filename)
+{
+  LARGE_INTEGER size;
+
+  if((m->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+
+  if(!GetFileSizeEx(m->file, &size) || size.QuadPart < HEADER)
+  {
+    CloseHandle(m->file);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+  }
+
+  m->size = (size_t)size.QuadPart;
+  if(map(m, 0) < 0)
+  {
+    CloseHandle(m->file);
+    return -lothar_errno;
+  }
+
+  return 0;
+}
+
+static int map_grow(map_t *m, size_t size)
+{
+  unmap(m);
+  m->size = size;
+  return map(m, 1);
+}
+
+// truncate a writable map to size (if not 0) and close it
+static void map_close(map_t *m, size_t size)
+{
+  if(m->data)
+    unmap(m);
+
+  if(size)
+  {
+    LARGE_INTEGER end;
+    end.QuadPart = size;
+    SetFilePointerEx(m->file, end, NULL, FILE_BEGIN);
+    SetEndOfFile(m->file);
+  }
+
+  CloseHandle(m->file);
+}
+
+#else // posix
+
+static int map_create(map_t *m, char const *filename, size_t size)
+{
+  if((m->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+
+  m->size = size;
+  if(ftruncate(m->fd, size) < 0 || (m->data = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0)) == MAP_FAILED)
+  {
+    close(m->fd);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+  }
+
+  return 0;
+}
+
+static int map_open(map_t *m, char const *filename)
+{
+  struct stat st;
+
+  if((m->fd = open(filename, O_RDONLY)) < 0)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+
+  if(fstat(m->fd, &st) < 0 || st.st_size < HEADER)
+  {
+    close(m->fd);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+  }
+
+  m->size = st.st_size;
+  if((m->data = (uint8_t *)mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, m->fd, 0)) == MAP_FAILED)
+  {
+    close(m->fd);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+  }
+
+  return 0;
+}
+
+static int map_grow(map_t *m, size_t size)
+{
+  munmap(m->data, m->size);
+  m->size = size;
+
+  if(ftruncate(m->fd, size) < 0 || (m->data = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0)) == MAP_FAILED)
+  {
+    m->data = NULL;
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+  }
+
+  return 0;
+}
+
+static void map_close(map_t *m, size_t size)
+{
+  if(m->data)
+    munmap(m->data, m->size);
+
+  if(size && ftruncate(m->fd, size) < 0)
+    LOTHAR_WARN("cannot truncate capture file\n");
+
+  close(m->fd);
+}
+
+#endif
+
+static void put64(uint64_t val, uint8_t *buf)
+{
+  lothar_htonxtl((uint32_t)val, buf);
+  lothar_htonxtl((uint32_t)(val >> 32), buf + 4);
+}
+
+static uint64_t get64(uint8_t const *buf)
+{
+  return lothar_nxttohl(buf) | ((uint64_t)lothar_nxttohl(buf + 4) << 32);
+}
+
+/* recording */
+
+typedef struct
+{
+  lothar_connection_t *connection; // the connection being recorded
+  lothar_mutex_t mutex;
+  map_t map;
+  size_t end;     // the end of the last record
+  uint64_t start; // lothar_time_us() at the start of the recording
+  int failed;     // (boolean) the capture file could not grow, recording stopped
+} recorder_t;
+
+static void append(recorder_t *recorder, uint64_t time, uint8_t direction, int status, uint8_t const *data, size_t len)
+{
+  uint8_t *record;
+
+  lothar_mutex_lock(&recorder->mutex);
+
+  if(!recorder->failed && recorder->end + RECORD + len > recorder->map.size)
+  {
+    if(map_grow(&recorder->map, MAX(recorder->map.size * 2, recorder->end + RECORD + len + CHUNK)) < 0)
+    {
+      LOTHAR_WARN("capture file cannot grow, recording stopped\n");
+      recorder->failed = 1;
+    }
+  }
+
+  if(!recorder->failed)
+  {
+    record = recorder->map.data + recorder->end;
+
+    put64(time - recorder->start, record);
+    lothar_htonxtl((uint32_t)status, record + 8);
+    record[12] = direction;
+    record[13] = 0;
+    lothar_htonxts(len, record + 14);
+    memcpy(record + RECORD, data, len);
+
+    recorder->end += RECORD + len;
+    put64(recorder->end, recorder->map.data + 8); // commit
+  }
+
+  lothar_mutex_unlock(&recorder->mutex);
+}
+
+static int recorder_read(void *r, uint8_t *data, size_t len)
+{
+  recorder_t *recorder = (recorder_t *)r;
+  int status = lothar_connection_read(recorder->connection, data, len);
+
+  append(recorder, lothar_time_us(), READ, status < 0 && lothar_errno ? -lothar_errno : status, data, status < 0 ? 0 : status);
+
+  return status;
+}
+
+static int recorder_write(void *r, uint8_t const *data, size_t len)
+{
+  recorder_t *recorder = (recorder_t *)r;
+  uint64_t time = lothar_time_us();
+  int status = lothar_connection_write(recorder->connection, data, len);
+
+  append(recorder, time, WRITE, status < 0 && lothar_errno ? -lothar_errno : status, data, len);
+
+  return status;
+}
+
+static int recorder_close(void *r)
+{
+  recorder_t *recorder = (recorder_t *)r;
+  int status = lothar_connection_close(&recorder->connection);
+
+  map_close(&recorder->map, recorder->end);
+  lothar_mutex_destroy(&recorder->mutex);
+  free(recorder);
+
+  return status;
+}
+
+static int recorder_set_timeout(void *r, uint32_t ms)
+{
+  return lothar_connection_set_timeout(((recorder_t *)r)->connection, ms);
+}
+
+static lothar_connection_vtable const recorder_vtable = {recorder_read, recorder_write, recorder_close, NULL, recorder_set_timeout};
+
+lothar_connection_t *lothar_connection_open_recorder(lothar_connection_t *connection, char const *filename)
+{
+  recorder_t *recorder;
+
+  if(!connection || !filename)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+    return NULL;
+  }
+
+  recorder = (recorder_t *)lothar_malloc(sizeof(recorder_t));
+  memset(recorder, 0, sizeof(recorder_t));
+
+  if(map_create(&recorder->map, filename, CHUNK) < 0)
+  {
+    free(recorder);
+    return NULL;
+  }
+
+  memcpy(recorder->map.data, MAGIC, 4);
+  lothar_htonxtl(VERSION, recorder->map.data + 4);
+  put64(HEADER, recorder->map.data + 8);
+
+  recorder->connection = connection;
+  recorder->end = HEADER;
+  recorder->start = lothar_time_us();
+  lothar_mutex_init(&recorder->mutex);
+
+  return lothar_connection_open_custom(&recorder_vtable, recorder);
+}
+
+/* replay */
+
+typedef struct
+{
+  map_t map;
+  size_t end;
+  size_t reads;  // the offset of the next read record
+  size_t writes; // the offset of the next write record
+  size_t diverged;
+  double speed;
+  uint64_t start;
+} replay_t;
+
+// find the next record in a direction, starting at offset
+static uint8_t const *next(replay_t const *replay, size_t *offset, uint8_t direction)
+{
+  while(*offset + RECORD <= replay->end)
+  {
+    uint8_t const *record = replay->map.data + *offset;
+    size_t len = lothar_nxttohs(record + 14);
+
+    if(*offset + RECORD + len > replay->end) // truncated
+      break;
+
+    *offset += RECORD + len;
+
+    if(record[12] == direction)
+      return record;
+  }
+
+  return NULL;
+}
+
+static int replay_read(void *r, uint8_t *data, size_t len)
+{
+  replay_t *replay = (replay_t *)r;
+  uint8_t const *record = next(replay, &replay->reads, READ);
+  int32_t status;
+  size_t size;
+
+  if(!record) // the recording ends here
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+
+  if(replay->speed > 0)
+  {
+    uint64_t due = replay->start + (uint64_t)(get64(record) / replay->speed);
+    uint64_t now = lothar_time_us();
+
+    if(due > now)
+      lothar_usleep(due - now);
+  }
+
+  status = (int32_t)lothar_nxttohl(record + 8);
+  if(status < 0)
+  {
+    int e = -status;
+    LOTHAR_RETURN_ERROR(e);
+  }
+
+  size = MIN(len, (size_t)lothar_nxttohs(record + 14));
+  memcpy(data, record + RECORD, size);
+
+  return size;
+}
+
+static int replay_write(void *r, uint8_t const *data, size_t len)
+{
+  replay_t *replay = (replay_t *)r;
+  uint8_t const *record = next(replay, &replay->writes, WRITE);
+  int32_t status;
+
+  if(!record)
+  {
+    ++replay->diverged;
+    return len;
+  }
+
+  if(lothar_nxttohs(record + 14) != len || memcmp(record + RECORD, data, len))
+    ++replay->diverged;
+
+  status = (int32_t)lothar_nxttohl(record + 8);
+  if(status < 0)
+  {
+    int e = -status;
+    LOTHAR_RETURN_ERROR(e);
+  }
+
+  return len;
+}
+
+static int replay_close(void *r)
+{
+  replay_t *replay = (replay_t *)r;
+
+  map_close(&replay->map, 0);
+  free(replay);
+
+  return 0;
+}
+
+static lothar_connection_vtable const replay_vtable = {replay_read, replay_write, replay_close, NULL};
+
+lothar_connection_t *lothar_connection_open_replay(char const *filename, double speed)
+{
+  replay_t *replay;
+
+  if(!filename || speed < 0)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+    return NULL;
+  }
+
+  replay = (replay_t *)lothar_malloc(sizeof(replay_t));
+  memset(replay, 0, sizeof(replay_t));
+
+  if(map_open(&replay->map, filename) < 0)
+  {
+    free(replay);
+    return NULL;
+  }
+
+  if(memcmp(replay->map.data, MAGIC, 4) || lothar_nxttohl(replay->map.data + 4) != VERSION)
+  {
+    map_close(&replay->map, 0);
+    free(replay);
+    LOTHAR_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+    return NULL;
+  }
+
+  replay->end = (size_t)MIN(get64(replay->map.data + 8), (uint64_t)replay->map.size);
+  replay->reads = HEADER;
+  replay->writes = HEADER;
+  replay->speed = speed;
+  replay->start = lothar_time_us();
+
+  return lothar_connection_open_custom(&replay_vtable, replay);
+}
+
+int lothar_replay_diverged(lothar_connection_t *connection, size_t *writes)
+{
+  IS_VALID(connection);
+
+  if(writes)
+    *writes = ((replay_t *)connection->connection)->diverged;
+
+  return 0;
+}
@@ -1,5 +1,8 @@
 #include "sensor.h"
 #include "commands.h"
+#include "replies.h"
+#include "codec.h"
+#include "i2c.h"
 
 #define IS_VALID(s) { if(!s) { LOTHAR_FAIL("invalid sensor\n"); LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED); } }
 
@@ -19,27 +22,80 @@ struct lothar_sensor_t
   // callbacks
   int (*d_start)(lothar_sensor_t *sensor);
   int (*d_value)(lothar_sensor_t *sensor, uint8_t *valid, uint16_t *value);
+
+  lothar_i2c_t *d_i2c; // for lowspeed sensors
 };
 
 
+// the values of the sensor, waited for even when the connection is pipelining (lothar_transact()), as they are
+// needed right away
+static int read_values(lothar_sensor_t *sensor, uint8_t *valid, lothar_inputvalues_t *values)
+{
+  uint8_t request[LOTHAR_REQUEST_SIZE_GETINPUTVALUES] = {LOTHAR_CODEC_REPLY, LOTHAR_OPCODE_GETINPUTVALUES};
+  uint8_t reply[LOTHAR_REPLY_SIZE_GETINPUTVALUES];
+  int status;
+
+  lothar_getinputvalues_request_set_port(request, sensor->d_port);
+
+  if((status = lothar_transact(sensor->d_connection, request, sizeof(request), reply, sizeof(reply))) < 0 ||
+     (status = lothar_inputvalues_decode(reply, sizeof(reply), values)) < 0)
+    return status;
+
+  if(values->port != sensor->d_port) // the brick answers for the port it was asked about
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_UNKOWN_ERROR);
+
+  if(valid)
+    *valid = values->valid;
+
+  return 0;
+}
+
+static int value_scaled(lothar_sensor_t *sensor, uint8_t *valid, uint16_t *value)
+{
+  lothar_inputvalues_t values;
+  int status;
+
+  if((status = read_values(sensor, valid, &values)) < 0)
+    return status;
+
+  if(value)
+    *value = (uint16_t)values.scaledvalue;
+
+  return 0;
+}
+
+static int value_normalized(lothar_sensor_t *sensor, uint8_t *valid, uint16_t *value)
+{
+  lothar_inputvalues_t values;
+  int status;
+
+  if((status = read_values(sensor, valid, &values)) < 0)
+    return status;
+
+  if(value)
+    *value = values.normvalue;
+
+  return 0;
+}
+
 static int value_touch(lothar_sensor_t *sensor, uint8_t *valid, uint16_t *value)
 {
-  return lothar_getinputvalues(sensor->d_connection, sensor->d_port, valid, NULL, NULL, NULL, NULL, NULL, (int16_t *)value, NULL);
+  return value_scaled(sensor, valid, value);
 }
 
 static int value_color(lothar_sensor_t *sensor, uint8_t *valid, uint16_t *value)
 {
-  return lothar_getinputvalues(sensor->d_connection, sensor->d_port, valid, NULL, NULL, NULL, NULL, value, NULL, NULL);
+  return value_normalized(sensor, valid, value);
 }
 
 static int value_colorfull(lothar_sensor_t *sensor, uint8_t *valid, uint16_t *value)
 {
-  return lothar_getinputvalues(sensor->d_connection, sensor->d_port, valid, NULL, NULL, NULL, NULL, NULL, (int16_t *)value, NULL);
+  return value_scaled(sensor, valid, value);
 }
 
 static int value_light(lothar_sensor_t *sensor, uint8_t *valid, uint16_t *value)
 {
-  return lothar_getinputvalues(sensor->d_connection, sensor->d_port, valid, NULL, NULL, NULL, NULL, value, NULL, NULL);
+  return value_normalized(sensor, valid, value);
 }
 
 static int value_ultrasound(lothar_sensor_t *sensor, uint8_t *valid, uint16_t *value)
@@ -47,17 +103,14 @@ static int value_ultrasound(lothar_sensor_t *sensor, uint8_t *valid, uint16_t *v
   int status;
   uint8_t v;
 
-  if((status = lothar_lsgetstatus(sensor->d_connection, sensor->d_port, valid)) < 0)
+  // the distance register, read as soon as the bus should be done
+  if((status = lothar_i2c_transfer(sensor->d_i2c, sensor->d_port, (uint8_t const *)"\x02\x42", 2, &v, 1)) < 0)
     return status;
 
-  if(*valid)
-  {
-    if((status = lothar_lsread(sensor->d_connection, sensor->d_port, &v, 1, NULL)) < 0)
-      return status;
+  *valid = 1;
+  if(value)
+    *value = v;
 
-    if(value)
-      *value = v;
-  }
   return 0;
 }
 
@@ -136,6 +189,9 @@ static int start_ultrasound(lothar_sensor_t *sensor)
   if((status = lothar_setinputmode(sensor->d_connection, sensor->d_port, SENSOR_LOWSPEED_9V, SENSOR_MODE_RAWMODE)) < 0)
     return status;
 
+  if(!sensor->d_i2c && !(sensor->d_i2c = lothar_i2c_open(sensor->d_connection)))
+    return -lothar_errno;
+
   sensor->d_type = sensor->d_last;
   sensor->d_min = 0;
   sensor->d_max = 255;
@@ -146,7 +202,7 @@ static int start_ultrasound(lothar_sensor_t *sensor)
 
   for(i = 0; i < 10; ++i)
   {
-    if((status = lothar_sensor_value(sensor, NULL)) != LOTHAR_ERROR_CONNECTION_NOT_CONFIGURED)
+    if((status = lothar_sensor_value(sensor, NULL)) != -LOTHAR_ERROR_CONNECTION_NOT_CONFIGURED)
       return status;
     
     LOTHAR_ERROR(LOTHAR_ERROR_OKAY);
@@ -155,7 +211,7 @@ static int start_ultrasound(lothar_sensor_t *sensor)
       return status;
   }
 
-  if((status = lothar_sensor_value(sensor, NULL)) != LOTHAR_ERROR_CONNECTION_NOT_CONFIGURED)
+  if((status = lothar_sensor_value(sensor, NULL)) != -LOTHAR_ERROR_CONNECTION_NOT_CONFIGURED)
     return status;
   
   LOTHAR_RETURN_ERROR(LOTHAR_ERROR_TIMEOUT);
@@ -182,9 +238,11 @@ lothar_sensor_t *lothar_sensor_open(lothar_connection_t *connection, enum lothar
 
   result->d_connection = connection;
   result->d_port = port;
+  result->d_i2c = NULL;
 
   if(lothar_sensor_reset(result, type))
   {
+    lothar_i2c_close(&result->d_i2c);
     free(result);
     return NULL;
   }
@@ -200,6 +258,7 @@ int lothar_sensor_close(lothar_sensor_t **sensor)
 
   status = lothar_sensor_stop(*sensor);
 
+  lothar_i2c_close(&(*sensor)->d_i2c);
   free(*sensor);
   *sensor = NULL;
 
@@ -296,9 +355,6 @@ int lothar_sensor_value(lothar_sensor_t *sensor, uint16_t *value)
   if(sensor->d_type == SENSOR_NO_SENSOR && (status = sensor->d_start(sensor))) // restart the sensor
     return status;
 
-  if(sensor->d_type == SENSOR_LOWSPEED_9V && (status = lothar_lswrite(sensor->d_connection, sensor->d_port, (uint8_t *)"\x02\x42", 2, 1))) // ultrasound messes up my generic design :(
-    return status;
-
   for(i = 0; i < 10; ++i)
   {
     if((status = sensor->d_value(sensor, &valid, value)) < 0)
@@ -0,0 +1,1354 @@
+#include "simulator.h"
+#include "iomap.h"
+#include "system.h"
+#include "connection_private.h"
+#include "error_handling.h"
+#include "thread.h"
+#include <string.h>
+#include <math.h>
+
+#define IS_VALID(c) { if(!c) LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED); if(c->vtable != &simulator_vtable) LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT); }
+
+#define DIRECT_COMMAND 0x00
+#define SYSTEM_COMMAND 0x01
+#define NO_RESPONSE    0x80
+#define REPLY          0x02
+
+#define MOTORS        3
+#define SENSORS       4
+#define MAILBOXES     20
+#define MAILBOX_DEPTH 5  // like the brick, a full mailbox drops its oldest message
+#define MAX_MESSAGE   59
+#define MAX_REPLIES   64 // replies written but not read yet
+
+#define MAX_SPEED      900.0  // degrees per second, at full power
+#define FULL_BATTERY   9000.0 // millivolts, below this unregulated motors run slower
+#define TAU_REGULATED  0.02   // time constants (in seconds) of the speed of a motor
+#define TAU_FREE       0.1
+#define TAU_BRAKE      0.01
+#define TAU_COAST      0.25
+#define STEP           1000   // microseconds, the time step of the motor simulation
+#define THRESHOLD      460    // raw values below this read as a pressed switch
+#define SLEEP_TIME     600000 // milliseconds, as reported by keepalive
+#define ULTRASONIC     0x42   // the register of an ultrasonic sensor that holds the distance
+#define FILES          64     // the most files the flash holds
+#define HANDLES        16     // files (and searches) open at once
+#define FLASH          (128 * 1024) // the space for files, in bytes
+#define FILENAME       20     // the file name field of a request or reply
+#define MAX_READ       58     // what fits in a read reply
+
+typedef struct
+{
+  // as set by setoutputstate
+  int8_t power;
+  uint8_t mode;
+  uint8_t regulation;
+  int8_t turnratio;
+  uint8_t runstate;
+  uint32_t tacholimit;
+
+  double speed;    // degrees per second
+  double position; // degrees
+
+  // the position at the last reset of each counter
+  double tacho;
+  double block;
+  double rotation;
+} motor_t;
+
+typedef struct
+{
+  uint8_t type;
+  uint8_t mode;
+  uint16_t raw;
+  uint16_t count; // transitions since the last reset, for transition, period count and angle step mode
+
+  // the I2C device on a lowspeed port
+  uint8_t registers[256];
+  uint8_t rx[16];
+  uint8_t rxlen;
+  uint64_t done; // when the transaction on the bus completes
+} sensor_t;
+
+typedef struct
+{
+  uint8_t data[MAX_MESSAGE];
+  uint8_t len;
+} message_t;
+
+typedef struct
+{
+  message_t messages[MAILBOX_DEPTH];
+  size_t first;
+  size_t count;
+} mailbox_t;
+
+typedef struct
+{
+  char name[FILENAME]; // empty if the slot is free
+  uint8_t *data;
+  uint32_t size;
+} file_t;
+
+enum handle_mode {HANDLE_FREE = 0, HANDLE_READ, HANDLE_WRITE, HANDLE_FIND};
+
+typedef struct
+{
+  uint8_t mode; // an enum handle_mode
+  size_t file;      // the file that is read or written, or the next one to look at when finding
+  uint32_t position;
+  char pattern[FILENAME];
+} handle_t;
+
+typedef struct
+{
+  uint64_t ready; // the time it arrives at the host
+  uint8_t data[LOTHAR_MAX_TELEGRAM];
+  size_t len;
+} reply_t;
+
+typedef struct
+{
+  lothar_mutex_t mutex;
+
+  // all times in microseconds since the brick was created
+  uint64_t epoch;   // lothar_time_us() at time 0
+  uint64_t clock;   // the current time, if the clock is manual
+  uint64_t last;    // the time the motors were last updated
+  uint8_t manual;
+  uint32_t latency;
+  uint32_t timeout; // of a read in ms, 0 for none
+  uint32_t bus;     // the time a byte takes on a lowspeed bus
+
+  motor_t motors[MOTORS];
+  sensor_t sensors[SENSORS];
+  mailbox_t mailboxes[MAILBOXES];
+
+  file_t files[FILES];
+  handle_t handles[HANDLES];
+
+  uint16_t battery;
+  char program[20];
+  uint8_t running;
+
+  reply_t replies[MAX_REPLIES];
+  size_t first;
+  size_t count;
+
+  size_t requests;
+  size_t drop;      // the number of requests still to be lost on the way
+} brick_t;
+
+static lothar_connection_vtable const simulator_vtable;
+
+/* time and motors */
+
+static uint64_t now(brick_t const *brick)
+{
+  return brick->manual ? brick->clock : lothar_time_us() - brick->epoch;
+}
+
+static int running(motor_t const *motor)
+{
+  return (motor->mode & MOTOR_MODE_MOTORON) && motor->runstate != RUNSTATE_IDLE;
+}
+
+static double target_speed(brick_t const *brick, motor_t const *motor)
+{
+  double power = motor->power;
+
+  if(!running(motor))
+    return 0.0;
+
+  if(motor->tacholimit && (motor->runstate == RUNSTATE_RAMPUP || motor->runstate == RUNSTATE_RAMPDOWN))
+  {
+    double progress = fabs(motor->position - motor->tacho) / motor->tacholimit;
+    power *= motor->runstate == RUNSTATE_RAMPUP ? MAX(progress, 0.1) : MAX(1.0 - progress, 0.1);
+  }
+
+  if((motor->mode & MOTOR_MODE_REGULATED) && motor->regulation != REGULATION_MODE_IDLE)
+    return power * MAX_SPEED / 100.0;
+
+  return power * MAX_SPEED / 100.0 * MIN(brick->battery / FULL_BATTERY, 1.0);
+}
+
+static double time_constant(motor_t const *motor, double target)
+{
+  int brake = (motor->mode & (MOTOR_MODE_MOTORON | MOTOR_MODE_BRAKE)) == (MOTOR_MODE_MOTORON | MOTOR_MODE_BRAKE);
+
+  if(target == 0.0)
+    return brake ? TAU_BRAKE : (running(motor) ? TAU_FREE : TAU_COAST);
+
+  return (motor->mode & MOTOR_MODE_REGULATED) ? TAU_REGULATED : TAU_FREE;
+}
+
+// advance a motor by dt seconds
+static void step(brick_t const *brick, motor_t *motor, double dt)
+{
+  double target = target_speed(brick, motor);
+
+  motor->speed += (target - motor->speed) * (1.0 - exp(-dt / time_constant(motor, target)));
+  if(target == 0.0 && fabs(motor->speed) < 0.01)
+    motor->speed = 0.0;
+
+  motor->position += motor->speed * dt;
+
+  if(!motor->tacholimit || !running(motor) || fabs(motor->position - motor->tacho) < motor->tacholimit)
+    return;
+
+  // done ramping up, continue at full power
+  if(motor->runstate == RUNSTATE_RAMPUP)
+  {
+    motor->runstate = RUNSTATE_RUNNING;
+    motor->tacholimit = 0;
+    return;
+  }
+
+  // the limit is reached, brake right there (or coast on)
+  motor->runstate = RUNSTATE_IDLE;
+
+  if(motor->mode & MOTOR_MODE_BRAKE)
+  {
+    motor->position = motor->tacho + (motor->power < 0 ? -1.0 : 1.0) * motor->tacholimit;
+    motor->speed = 0.0;
+  }
+}
+
+// bring the motors up to date
+static void run(brick_t *brick, uint64_t time)
+{
+  while(brick->last < time)
+  {
+    uint64_t dt = MIN(time - brick->last, STEP);
+    int moving = 0;
+    int i;
+
+    for(i = 0; i < MOTORS; ++i)
+    {
+      step(brick, brick->motors + i, dt / 1000000.0);
+      moving |= brick->motors[i].speed != 0.0 || running(brick->motors + i);
+    }
+
+    brick->last = moving ? brick->last + dt : time; // nothing will change, skip ahead
+  }
+}
+
+static int32_t count(motor_t const *motor, double origin)
+{
+  return (int32_t)floor(motor->position - origin + 0.5);
+}
+
+/* sensors and mailboxes */
+
+static uint16_t scaled(sensor_t const *sensor)
+{
+  switch(sensor->mode & SENSOR_MODE_MODEMASK)
+  {
+  case SENSOR_MODE_BOOLEANMODE:
+    return sensor->raw < THRESHOLD;
+
+  case SENSOR_MODE_TRANSITIONMODE:
+  case SENSOR_MODE_ANGLESTEPMODE:
+    return sensor->count;
+
+  case SENSOR_MODE_PERIODCOUNTMODE:
+    return sensor->count / 2;
+
+  case SENSOR_MODE_PCTFULLSCALEMODE:
+    return (1023 - MIN(sensor->raw, 1023)) * 100 / 1023;
+
+  default:
+    return sensor->raw;
+  }
+}
+
+static int lowspeed(sensor_t const *sensor)
+{
+  return sensor->type == SENSOR_LOWSPEED || sensor->type == SENSOR_LOWSPEED_9V;
+}
+
+static void post(mailbox_t *mailbox, uint8_t const *data, size_t len)
+{
+  message_t *message;
+
+  if(mailbox->count == MAILBOX_DEPTH)
+  {
+    mailbox->first = (mailbox->first + 1) % MAILBOX_DEPTH;
+    --mailbox->count;
+  }
+
+  message = mailbox->messages + (mailbox->first + mailbox->count++) % MAILBOX_DEPTH;
+  message->len = len;
+  memcpy(message->data, data, len);
+}
+
+/* commands, each gets the parameters of the request, fills in the payload of the reply and returns its status */
+
+static uint8_t startprogram(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  if(len > sizeof(brick->program) || !memchr(request, '\0', len))
+    return LOTHAR_ERROR_ILLEGAL_SIZE;
+
+  strcpy(brick->program, (char const *)request);
+  brick->running = 1;
+  return 0;
+}
+
+static uint8_t stopprogram(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  if(!brick->running)
+    return LOTHAR_ERROR_NO_ACTIVE_PROGRAM;
+
+  brick->running = 0;
+  return 0;
+}
+
+// playsoundfile, playtone and stopsoundplayback, there is nothing to hear
+static uint8_t sound(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  return 0;
+}
+
+static uint8_t setoutputstate(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  int i;
+
+  if(request[0] >= MOTORS && request[0] != OUTPUT_ALL)
+    return LOTHAR_ERROR_OUT_OF_RANGE_VALUES;
+
+  for(i = 0; i < MOTORS; ++i)
+  {
+    motor_t *motor = brick->motors + i;
+
+    if(request[0] != OUTPUT_ALL && request[0] != i)
+      continue;
+
+    motor->power      = (int8_t)request[1];
+    motor->mode       = request[2];
+    motor->regulation = request[3];
+    motor->turnratio  = (int8_t)request[4];
+    motor->runstate   = request[5];
+    motor->tacholimit = lothar_nxttohl(request + 6);
+
+    if(motor->tacholimit) // the limit counts from here
+      motor->tacho = motor->position;
+  }
+
+  return 0;
+}
+
+static uint8_t setinputmode(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  if(request[0] >= SENSORS)
+    return LOTHAR_ERROR_OUT_OF_RANGE_VALUES;
+
+  brick->sensors[request[0]].type = request[1];
+  brick->sensors[request[0]].mode = request[2];
+  return 0;
+}
+
+static uint8_t getoutputstate(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  motor_t const *motor;
+
+  if(request[0] >= MOTORS)
+    return LOTHAR_ERROR_OUT_OF_RANGE_VALUES;
+
+  motor = brick->motors + request[0];
+  reply[0] = request[0];
+  reply[1] = (uint8_t)motor->power;
+  reply[2] = motor->mode;
+  reply[3] = motor->regulation;
+  reply[4] = (uint8_t)motor->turnratio;
+  reply[5] = motor->runstate;
+  lothar_htonxtl(motor->tacholimit, reply + 6);
+  lothar_htonxtl((uint32_t)count(motor, motor->tacho), reply + 10);
+  lothar_htonxtl((uint32_t)count(motor, motor->block), reply + 14);
+  lothar_htonxtl((uint32_t)count(motor, motor->rotation), reply + 18);
+  return 0;
+}
+
+static uint8_t getinputvalues(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  sensor_t const *sensor;
+
+  if(request[0] >= SENSORS)
+    return LOTHAR_ERROR_OUT_OF_RANGE_VALUES;
+
+  sensor = brick->sensors + request[0];
+  reply[0] = request[0];
+  reply[1] = 1; // valid
+  reply[2] = 0; // calibrated
+  reply[3] = sensor->type;
+  reply[4] = sensor->mode;
+  lothar_htonxts(sensor->raw, reply + 5);
+  lothar_htonxts(sensor->raw, reply + 7);
+  lothar_htonxts(scaled(sensor), reply + 9);
+  lothar_htonxts(scaled(sensor), reply + 11);
+  return 0;
+}
+
+static uint8_t resetinputscaledvalue(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  if(request[0] >= SENSORS)
+    return LOTHAR_ERROR_OUT_OF_RANGE_VALUES;
+
+  brick->sensors[request[0]].count = 0;
+  return 0;
+}
+
+static uint8_t messagewrite(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  if(request[0] >= MAILBOXES / 2)
+    return LOTHAR_ERROR_ILLEGAL_MAILBOX_QUEUE;
+
+  if(request[1] > MAX_MESSAGE || request[1] > len - 2)
+    return LOTHAR_ERROR_ILLEGAL_SIZE;
+
+  post(brick->mailboxes + request[0], request + 2, request[1]);
+  return 0;
+}
+
+static uint8_t resetmotorposition(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  motor_t *motor;
+
+  if(request[0] >= MOTORS)
+    return LOTHAR_ERROR_OUT_OF_RANGE_VALUES;
+
+  motor = brick->motors + request[0];
+  if(request[1])
+    motor->block = motor->position;
+  else
+    motor->rotation = motor->position;
+  return 0;
+}
+
+static uint8_t getbatterylevel(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  lothar_htonxts(brick->battery, reply);
+  return 0;
+}
+
+static uint8_t keepalive(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  lothar_htonxtl(SLEEP_TIME, reply);
+  return 0;
+}
+
+static uint8_t lsgetstatus(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  if(request[0] >= SENSORS)
+    return LOTHAR_ERROR_OUT_OF_RANGE_VALUES;
+
+  if(!lowspeed(brick->sensors + request[0]))
+    return LOTHAR_ERROR_CONNECTION_NOT_CONFIGURED;
+
+  if(now(brick) < brick->sensors[request[0]].done)
+    return LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS;
+
+  reply[0] = brick->sensors[request[0]].rxlen;
+  return 0;
+}
+
+// the first byte written is the address of the device, the second the register, the rest goes into the registers
+static uint8_t lswrite(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  sensor_t *sensor;
+  uint8_t txlen = request[1];
+  uint8_t rxlen = request[2];
+  uint8_t reg = 0;
+  int i;
+
+  if(request[0] >= SENSORS)
+    return LOTHAR_ERROR_OUT_OF_RANGE_VALUES;
+
+  sensor = brick->sensors + request[0];
+  if(!lowspeed(sensor))
+    return LOTHAR_ERROR_CONNECTION_NOT_CONFIGURED;
+
+  if(txlen > 16 || rxlen > 16 || txlen > len - 3)
+    return LOTHAR_ERROR_ILLEGAL_SIZE;
+
+  // like the brick, a port does one transaction at a time
+  if(now(brick) < sensor->done)
+    return LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS;
+
+  if(txlen > 1)
+    reg = request[4];
+
+  for(i = 2; i < txlen; ++i)
+    sensor->registers[(uint8_t)(reg + i - 2)] = request[3 + i];
+
+  for(i = 0; i < rxlen; ++i)
+    sensor->rx[i] = sensor->registers[(uint8_t)(reg + i)];
+  sensor->rxlen = rxlen;
+  sensor->done = now(brick) + (uint64_t)(txlen + rxlen) * brick->bus;
+
+  return 0;
+}
+
+static uint8_t lsread(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  sensor_t *sensor;
+
+  if(request[0] >= SENSORS)
+    return LOTHAR_ERROR_OUT_OF_RANGE_VALUES;
+
+  sensor = brick->sensors + request[0];
+  if(!sensor->rxlen || now(brick) < sensor->done)
+    return LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS;
+
+  reply[0] = sensor->rxlen;
+  memcpy(reply + 1, sensor->rx, sensor->rxlen);
+  sensor->rxlen = 0;
+  return 0;
+}
+
+static uint8_t getcurrentprogramname(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  if(!brick->running)
+    return LOTHAR_ERROR_NO_ACTIVE_PROGRAM;
+
+  memcpy(reply, brick->program, 19);
+  return 0;
+}
+
+static uint8_t messageread(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  mailbox_t *mailbox;
+  message_t const *message;
+
+  if(request[0] >= MAILBOXES)
+    return LOTHAR_ERROR_ILLEGAL_MAILBOX_QUEUE;
+
+  mailbox = brick->mailboxes + request[0];
+  if(!mailbox->count)
+    return LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY;
+
+  message = mailbox->messages + mailbox->first;
+  reply[0] = request[1];
+  reply[1] = message->len;
+  memcpy(reply + 2, message->data, message->len);
+
+  if(request[2])
+  {
+    mailbox->first = (mailbox->first + 1) % MAILBOX_DEPTH;
+    --mailbox->count;
+  }
+  return 0;
+}
+
+/* io maps */
+
+#define P_GAIN 96 // the default parameters of the speed regulation of the firmware
+#define I_GAIN 32
+#define D_GAIN 32
+
+// the map of the output module, returns its size
+static size_t output_map(brick_t const *brick, uint8_t *map)
+{
+  size_t i;
+
+  memset(map, 0, LOTHAR_IOMAP_OUTPUTS * LOTHAR_IOMAP_OUTPUT_SIZE);
+
+  for(i = 0; i < MOTORS; ++i, map += LOTHAR_IOMAP_OUTPUT_SIZE)
+  {
+    motor_t const *motor = brick->motors + i;
+
+    lothar_htonxtl((uint32_t)count(motor, motor->tacho), map);
+    lothar_htonxtl((uint32_t)count(motor, motor->block), map + 4);
+    lothar_htonxtl((uint32_t)count(motor, motor->rotation), map + 8);
+    lothar_htonxtl(motor->tacholimit, map + 12);
+    lothar_htonxts((uint16_t)(int16_t)floor(motor->speed / 6.0 + 0.5), map + 16);
+    map[19] = motor->mode;
+    map[20] = (uint8_t)motor->power;
+    map[21] = (uint8_t)(int8_t)floor(motor->speed * 100.0 / MAX_SPEED + 0.5);
+    map[22] = P_GAIN;
+    map[23] = I_GAIN;
+    map[24] = D_GAIN;
+    map[25] = motor->runstate;
+    map[26] = motor->regulation;
+    map[28] = (uint8_t)motor->turnratio;
+  }
+
+  return LOTHAR_IOMAP_OUTPUTS * LOTHAR_IOMAP_OUTPUT_SIZE;
+}
+
+// the map of the input module, returns its size
+static size_t input_map(brick_t const *brick, uint8_t *map)
+{
+  size_t i;
+
+  memset(map, 0, LOTHAR_IOMAP_INPUTS * LOTHAR_IOMAP_INPUT_SIZE);
+
+  for(i = 0; i < SENSORS; ++i, map += LOTHAR_IOMAP_INPUT_SIZE)
+  {
+    sensor_t const *sensor = brick->sensors + i;
+
+    lothar_htonxts(sensor->raw, map + 2);
+    lothar_htonxts(sensor->raw, map + 4);
+    lothar_htonxts(scaled(sensor), map + 6);
+    map[8] = sensor->type;
+    map[9] = sensor->mode;
+    map[10] = sensor->raw < THRESHOLD;
+  }
+
+  return LOTHAR_IOMAP_INPUTS * LOTHAR_IOMAP_INPUT_SIZE;
+}
+
+static uint8_t readiomap(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  uint8_t map[LOTHAR_IOMAP_OUTPUTS * LOTHAR_IOMAP_OUTPUT_SIZE + LOTHAR_IOMAP_INPUTS * LOTHAR_IOMAP_INPUT_SIZE];
+  uint32_t module = lothar_nxttohl(request);
+  size_t offset = lothar_nxttohs(request + 4);
+  size_t n = lothar_nxttohs(request + 6);
+  size_t size;
+
+  memcpy(reply, request, 4);
+
+  if(module == LOTHAR_IOMAP_OUTPUT)
+    size = output_map(brick, map);
+  else if(module == LOTHAR_IOMAP_INPUT)
+    size = input_map(brick, map);
+  else
+    return LOTHAR_ERROR_MODULE_NOT_FOUND;
+
+  if(n > LOTHAR_MAX_IOMAPREAD || offset + n > size)
+    return LOTHAR_ERROR_OUT_OF_BOUNDARY;
+
+  lothar_htonxts(n, reply + 4);
+  memcpy(reply + 6, map + offset, n);
+
+  return 0;
+}
+
+/* files */
+
+// the index of a file, FILES if there is none by that name
+static size_t lookup(brick_t const *brick, char const *name)
+{
+  size_t i;
+
+  for(i = 0; i < FILES; ++i)
+  {
+    if(brick->files[i].name[0] && !strncmp(brick->files[i].name, name, FILENAME))
+      return i;
+  }
+  return FILES;
+}
+
+// (boolean) is a file opened by any handle
+static int busy(brick_t const *brick, size_t file)
+{
+  size_t i;
+
+  for(i = 0; i < HANDLES; ++i)
+  {
+    if((brick->handles[i].mode == HANDLE_READ || brick->handles[i].mode == HANDLE_WRITE) && brick->handles[i].file == file)
+      return 1;
+  }
+  return 0;
+}
+
+// a free handle, HANDLES if there is none
+static size_t open_handle(brick_t *brick, enum handle_mode mode, size_t file)
+{
+  size_t i;
+
+  for(i = 0; i < HANDLES && brick->handles[i].mode != HANDLE_FREE; ++i)
+    ;
+
+  if(i < HANDLES)
+  {
+    memset(brick->handles + i, 0, sizeof(handle_t));
+    brick->handles[i].mode = mode;
+    brick->handles[i].file = file;
+  }
+  return i;
+}
+
+// (boolean) does a part of a file name (the name or the extension) match that of a pattern, which may be "*"
+static int match_part(char const *pattern, size_t plen, char const *name, size_t nlen)
+{
+  return (plen == 1 && pattern[0] == '*') || (plen == nlen && !strncmp(pattern, name, plen));
+}
+
+// (boolean) does a file name match a pattern like "*.*", "*.rxe", "name.*" or just "name.ext"
+static int matches(char const *pattern, char const *name)
+{
+  char const *pdot = strchr(pattern, '.');
+  char const *ndot = strchr(name, '.');
+  size_t plen = pdot ? (size_t)(pdot - pattern) : strlen(pattern);
+  size_t nlen = ndot ? (size_t)(ndot - name) : strlen(name);
+
+  if(!match_part(pattern, plen, name, nlen))
+    return 0;
+
+  if(!pdot || !ndot)
+    return !pdot && !ndot;
+
+  return match_part(pdot + 1, strlen(pdot + 1), ndot + 1, strlen(ndot + 1));
+}
+
+// find the next file of a search, and describe it in the reply
+static uint8_t find(brick_t *brick, handle_t *handle, uint8_t *reply)
+{
+  file_t const *file;
+
+  for(; handle->file < FILES; ++handle->file)
+  {
+    file = brick->files + handle->file;
+
+    if(file->name[0] && matches(handle->pattern, file->name))
+    {
+      memcpy(reply + 1, file->name, FILENAME);
+      lothar_htonxtl(file->size, reply + 1 + FILENAME);
+
+      ++handle->file;
+      return 0;
+    }
+  }
+  return LOTHAR_ERROR_FILE_NOT_FOUND;
+}
+
+static uint8_t openread(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  size_t file = lookup(brick, (char const *)request);
+  size_t handle;
+
+  if(file == FILES)
+    return LOTHAR_ERROR_FILE_NOT_FOUND;
+
+  if(busy(brick, file))
+    return LOTHAR_ERROR_FILE_IS_BUSY;
+
+  if((handle = open_handle(brick, HANDLE_READ, file)) == HANDLES)
+    return LOTHAR_ERROR_NO_MORE_HANDLES;
+
+  reply[0] = handle;
+  lothar_htonxtl(brick->files[file].size, reply + 1);
+  return 0;
+}
+
+static uint8_t openwrite(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  uint32_t size = lothar_nxttohl(request + FILENAME);
+  size_t used = 0;
+  size_t file = FILES;
+  size_t handle;
+  size_t i;
+
+  if(!request[0] || memchr(request, '\0', FILENAME) == NULL)
+    return LOTHAR_ERROR_ILLEGAL_FILE_NAME;
+
+  if(lookup(brick, (char const *)request) != FILES)
+    return LOTHAR_ERROR_FILE_EXISTS;
+
+  for(i = 0; i < FILES; ++i)
+  {
+    if(brick->files[i].name[0])
+      used += brick->files[i].size;
+    else if(file == FILES)
+      file = i;
+  }
+
+  if(file == FILES)
+    return LOTHAR_ERROR_NO_MORE_FILES;
+
+  if(used + size > FLASH)
+    return LOTHAR_ERROR_NO_SPACE;
+
+  if((handle = open_handle(brick, HANDLE_WRITE, file)) == HANDLES)
+    return LOTHAR_ERROR_NO_MORE_HANDLES;
+
+  memcpy(brick->files[file].name, request, FILENAME);
+  brick->files[file].data = (uint8_t *)lothar_malloc(size + 1);
+  brick->files[file].size = size;
+
+  reply[0] = handle;
+  return 0;
+}
+
+// the open handle a request refers to, or NULL
+static handle_t *handle_of(brick_t *brick, uint8_t const *request, enum handle_mode mode)
+{
+  if(request[0] >= HANDLES || brick->handles[request[0]].mode != mode)
+    return NULL;
+
+  return brick->handles + request[0];
+}
+
+static uint8_t fileread(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  handle_t *handle = handle_of(brick, request, HANDLE_READ);
+  file_t const *file;
+  size_t n;
+
+  reply[0] = request[0];
+
+  if(!handle)
+    return LOTHAR_ERROR_ILLEGAL_HANDLE;
+
+  file = brick->files + handle->file;
+  n = MIN(MIN((size_t)lothar_nxttohs(request + 1), MAX_READ), file->size - handle->position);
+
+  if(!n)
+    return LOTHAR_ERROR_END_OF_FILE;
+
+  lothar_htonxts(n, reply + 1);
+  memcpy(reply + 3, file->data + handle->position, n);
+  handle->position += n;
+
+  return 0;
+}
+
+static uint8_t filewrite(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  handle_t *handle = handle_of(brick, request, HANDLE_WRITE);
+  file_t *file;
+  size_t n;
+
+  reply[0] = request[0];
+
+  if(!handle)
+    return LOTHAR_ERROR_ILLEGAL_HANDLE;
+
+  file = brick->files + handle->file;
+  n = MIN(len - 1, file->size - handle->position);
+
+  memcpy(file->data + handle->position, request + 1, n);
+  handle->position += n;
+  lothar_htonxts(n, reply + 1);
+
+  return n < len - 1 ? LOTHAR_ERROR_FILE_IS_FULL : 0;
+}
+
+static uint8_t fileclose(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  reply[0] = request[0];
+
+  if(request[0] >= HANDLES || brick->handles[request[0]].mode == HANDLE_FREE)
+    return LOTHAR_ERROR_HANDLE_ALREADY_CLOSED;
+
+  brick->handles[request[0]].mode = HANDLE_FREE;
+  return 0;
+}
+
+static uint8_t filedelete(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  size_t file = lookup(brick, (char const *)request);
+
+  memcpy(reply, request, FILENAME);
+
+  if(file == FILES)
+    return LOTHAR_ERROR_FILE_NOT_FOUND;
+
+  if(busy(brick, file))
+    return LOTHAR_ERROR_FILE_IS_BUSY;
+
+  free(brick->files[file].data);
+  memset(brick->files + file, 0, sizeof(file_t));
+  return 0;
+}
+
+static uint8_t findfirst(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  size_t handle;
+  uint8_t status;
+
+  if((handle = open_handle(brick, HANDLE_FIND, 0)) == HANDLES)
+    return LOTHAR_ERROR_NO_MORE_HANDLES;
+
+  memcpy(brick->handles[handle].pattern, request, FILENAME);
+  brick->handles[handle].pattern[FILENAME - 1] = '\0';
+
+  // a search that finds nothing is not kept open
+  if((status = find(brick, brick->handles + handle, reply)))
+    brick->handles[handle].mode = HANDLE_FREE;
+
+  reply[0] = handle;
+  return status;
+}
+
+static uint8_t findnext(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply)
+{
+  handle_t *handle = handle_of(brick, request, HANDLE_FIND);
+
+  reply[0] = request[0];
+
+  if(!handle)
+    return LOTHAR_ERROR_ILLEGAL_HANDLE;
+
+  return find(brick, handle, reply);
+}
+
+typedef struct
+{
+  size_t request; // the size of the parameters (at least)
+  size_t reply;   // the size of the reply
+  uint8_t (*handle)(brick_t *brick, uint8_t const *request, size_t len, uint8_t *reply);
+  size_t count;   // if not 0, the reply is longer by the 16 bit value at this offset in the reply
+} command_t;
+
+// by opcode
+static command_t const commands[] =
+{
+  { 1,  3, startprogram },
+  { 0,  3, stopprogram },
+  { 2,  3, sound },
+  { 4,  3, sound },
+  {10,  3, setoutputstate },
+  { 3,  3, setinputmode },
+  { 1, 25, getoutputstate },
+  { 1, 16, getinputvalues },
+  { 1,  3, resetinputscaledvalue },
+  { 2,  3, messagewrite },
+  { 2,  3, resetmotorposition },
+  { 0,  5, getbatterylevel },
+  { 0,  3, sound },
+  { 0,  7, keepalive },
+  { 1,  4, lsgetstatus },
+  { 3,  3, lswrite },
+  { 1, 20, lsread },
+  { 0, 22, getcurrentprogramname },
+  { 0,  3, NULL },
+  { 3, 64, messageread }
+};
+
+// by opcode, from 0x80
+static command_t const system_commands[] =
+{
+  {20,  8, openread },
+  {24,  4, openwrite },
+  { 3,  6, fileread, 4 },
+  { 1,  6, filewrite },
+  { 1,  4, fileclose },
+  {20, 23, filedelete },
+  {20, 28, findfirst },
+  { 1, 28, findnext },
+  { 0,  3, NULL },
+  { 0,  3, NULL },
+  { 0,  3, NULL },
+  { 0,  3, NULL },
+  { 0,  3, NULL },
+  { 0,  3, NULL },
+  { 0,  3, NULL },
+  { 0,  3, NULL },
+  { 0,  3, NULL },
+  { 0,  3, NULL },
+  { 0,  3, NULL },
+  { 0,  3, NULL },
+  { 8,  9, readiomap, 7 }
+};
+
+/* the connection */
+
+static int brick_write(void *b, uint8_t const *data, size_t len)
+{
+  brick_t *brick = (brick_t *)b;
+  command_t const *command = NULL;
+  uint64_t time;
+  reply_t reply;
+
+  if(len < 2 || len > LOTHAR_MAX_TELEGRAM)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_WRITE_ERROR);
+
+  lothar_mutex_lock(&brick->mutex);
+
+  if(brick->drop)
+  {
+    --brick->drop;
+    lothar_mutex_unlock(&brick->mutex);
+    return len;
+  }
+
+  if(!(data[0] & NO_RESPONSE) && brick->count == MAX_REPLIES) // nobody is reading
+  {
+    lothar_mutex_unlock(&brick->mutex);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_WRITE_ERROR);
+  }
+
+  time = now(brick);
+  run(brick, time);
+  ++brick->requests;
+
+  memset(reply.data, 0, sizeof(reply.data));
+  reply.data[0] = REPLY;
+  reply.data[1] = data[1];
+  reply.len = 3;
+
+  if((data[0] & ~NO_RESPONSE) == DIRECT_COMMAND && data[1] < sizeof(commands) / sizeof(commands[0]))
+    command = commands + data[1];
+  else if((data[0] & ~NO_RESPONSE) == SYSTEM_COMMAND && data[1] >= 0x80 &&
+          data[1] - 0x80 < sizeof(system_commands) / sizeof(system_commands[0]))
+    command = system_commands + (data[1] - 0x80);
+
+  if(!command || !command->handle)
+    reply.data[2] = LOTHAR_ERROR_UNKOWN_COMMAND_OPCODE;
+  else
+  {
+    reply.len = command->reply;
+    reply.data[2] = len - 2 < command->request ? LOTHAR_ERROR_INSANE_PACKET : command->handle(brick, data + 2, len - 2, reply.data + 3);
+
+    if(command->count && !reply.data[2])
+      reply.len += lothar_nxttohs(reply.data + command->count);
+  }
+
+  if(!(data[0] & NO_RESPONSE))
+  {
+    // replies arrive in order
+    reply.ready = time + brick->latency;
+    if(brick->count)
+      reply.ready = MAX(reply.ready, brick->replies[(brick->first + brick->count - 1) % MAX_REPLIES].ready);
+
+    brick->replies[(brick->first + brick->count++) % MAX_REPLIES] = reply;
+  }
+
+  lothar_mutex_unlock(&brick->mutex);
+
+  return len;
+}
+
+static int brick_read(void *b, uint8_t *data, size_t len)
+{
+  brick_t *brick = (brick_t *)b;
+  reply_t const *reply;
+  uint64_t time;
+  size_t n;
+
+  lothar_mutex_lock(&brick->mutex);
+
+  if(!brick->count && !brick->timeout) // nothing was asked (or it was lost)
+  {
+    lothar_mutex_unlock(&brick->mutex);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+  }
+
+  reply = brick->count ? brick->replies + brick->first : NULL;
+  time = now(brick);
+
+  // a reply that is later than the timeout stays queued, for the read after this one
+  if(brick->timeout && (!reply || reply->ready > time + (uint64_t)brick->timeout * 1000))
+  {
+    if(brick->manual)
+      brick->clock += (uint64_t)brick->timeout * 1000;
+    else
+    {
+      lothar_mutex_unlock(&brick->mutex);
+      lothar_usleep((uint64_t)brick->timeout * 1000);
+      lothar_mutex_lock(&brick->mutex);
+    }
+
+    lothar_mutex_unlock(&brick->mutex);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_TIMEOUT);
+  }
+
+  // wait for it to arrive
+  if(reply->ready > time && brick->manual)
+    brick->clock = reply->ready;
+  else if(reply->ready > time)
+  {
+    lothar_mutex_unlock(&brick->mutex);
+    lothar_usleep(reply->ready - time);
+    lothar_mutex_lock(&brick->mutex);
+  }
+
+  n = MIN(len, reply->len);
+  memcpy(data, reply->data, n);
+
+  brick->first = (brick->first + 1) % MAX_REPLIES;
+  --brick->count;
+
+  lothar_mutex_unlock(&brick->mutex);
+
+  return n;
+}
+
+static int brick_close(void *b)
+{
+  brick_t *brick = (brick_t *)b;
+  size_t i;
+
+  for(i = 0; i < FILES; ++i)
+    free(brick->files[i].data);
+
+  lothar_mutex_destroy(&brick->mutex);
+  free(brick);
+
+  return 0;
+}
+
+static int brick_set_timeout(void *b, uint32_t ms)
+{
+  brick_t *brick = (brick_t *)b;
+
+  lothar_mutex_lock(&brick->mutex);
+  brick->timeout = ms;
+  lothar_mutex_unlock(&brick->mutex);
+
+  return 0;
+}
+
+static lothar_connection_vtable const simulator_vtable = {brick_read, brick_write, brick_close, NULL, brick_set_timeout};
+
+lothar_connection_t *lothar_connection_open_simulator(void)
+{
+  brick_t *brick = (brick_t *)lothar_malloc(sizeof(brick_t));
+  int i;
+
+  memset(brick, 0, sizeof(brick_t));
+  lothar_mutex_init(&brick->mutex);
+
+  brick->epoch = lothar_time_us();
+  brick->battery = 7800;
+
+  // unconnected analog sensors read as open circuits, lowspeed ports as an ultrasonic sensor
+  for(i = 0; i < SENSORS; ++i)
+  {
+    sensor_t *sensor = brick->sensors + i;
+
+    sensor->raw = 1023;
+    memcpy(sensor->registers, "V1.0", 4);
+    memcpy(sensor->registers + 0x08, "LEGO", 4);
+    memcpy(sensor->registers + 0x10, "Sonar", 5);
+    sensor->registers[ULTRASONIC] = 255;
+  }
+
+  return lothar_connection_open_custom(&simulator_vtable, brick);
+}
+
+/* configuration */
+
+static brick_t *lock(lothar_connection_t *connection)
+{
+  brick_t *brick = (brick_t *)connection->connection;
+
+  lothar_mutex_lock(&brick->mutex);
+  run(brick, now(brick));
+
+  return brick;
+}
+
+static void unlock(brick_t *brick)
+{
+  lothar_mutex_unlock(&brick->mutex);
+}
+
+int lothar_simulator_set_latency(lothar_connection_t *connection, uint32_t us)
+{
+  brick_t *brick;
+
+  IS_VALID(connection);
+
+  brick = lock(connection);
+  brick->latency = us;
+  unlock(brick);
+
+  return 0;
+}
+
+int lothar_simulator_set_manual_clock(lothar_connection_t *connection, uint8_t manual)
+{
+  brick_t *brick;
+
+  IS_VALID(connection);
+
+  brick = lock(connection);
+
+  if(manual && !brick->manual)
+    brick->clock = now(brick);
+  else if(!manual && brick->manual)
+    brick->epoch = lothar_time_us() - brick->clock;
+  brick->manual = manual ? 1 : 0;
+
+  unlock(brick);
+
+  return 0;
+}
+
+int lothar_simulator_advance(lothar_connection_t *connection, uint64_t us)
+{
+  brick_t *brick;
+
+  IS_VALID(connection);
+
+  brick = lock(connection);
+
+  if(!brick->manual)
+  {
+    unlock(brick);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+  }
+
+  brick->clock += us;
+  run(brick, brick->clock);
+
+  unlock(brick);
+
+  return 0;
+}
+
+int lothar_simulator_time(lothar_connection_t *connection, uint64_t *us)
+{
+  brick_t *brick;
+
+  IS_VALID(connection);
+
+  brick = lock(connection);
+  if(us)
+    *us = now(brick);
+  unlock(brick);
+
+  return 0;
+}
+
+int lothar_simulator_requests(lothar_connection_t *connection, size_t *requests)
+{
+  brick_t *brick;
+
+  IS_VALID(connection);
+
+  brick = lock(connection);
+  if(requests)
+    *requests = brick->requests;
+  unlock(brick);
+
+  return 0;
+}
+
+int lothar_simulator_drop_requests(lothar_connection_t *connection, size_t count)
+{
+  brick_t *brick;
+
+  IS_VALID(connection);
+
+  brick = lock(connection);
+  brick->drop = count;
+  unlock(brick);
+
+  return 0;
+}
+
+int lothar_simulator_set_sensor(lothar_connection_t *connection, enum lothar_input_port port, uint16_t rawvalue)
+{
+  brick_t *brick;
+  sensor_t *sensor;
+
+  IS_VALID(connection);
+
+  if(port >= SENSORS)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  brick = lock(connection);
+  sensor = brick->sensors + port;
+
+  if(lowspeed(sensor))
+    sensor->registers[ULTRASONIC] = MIN(rawvalue, 255);
+  else
+  {
+    if((rawvalue < THRESHOLD) != (sensor->raw < THRESHOLD))
+      ++sensor->count;
+    sensor->raw = MIN(rawvalue, 1023);
+  }
+
+  unlock(brick);
+
+  return 0;
+}
+
+int lothar_simulator_set_registers(lothar_connection_t *connection, enum lothar_input_port port, uint8_t reg, uint8_t const *data, size_t len)
+{
+  brick_t *brick;
+  size_t i;
+
+  IS_VALID(connection);
+
+  if(port >= SENSORS || (len && !data) || reg + len > 256)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  brick = lock(connection);
+  for(i = 0; i < len; ++i)
+    brick->sensors[port].registers[reg + i] = data[i];
+  unlock(brick);
+
+  return 0;
+}
+
+int lothar_simulator_set_battery(lothar_connection_t *connection, uint16_t millivolts)
+{
+  brick_t *brick;
+
+  IS_VALID(connection);
+
+  brick = lock(connection);
+  brick->battery = millivolts;
+  unlock(brick);
+
+  return 0;
+}
+
+int lothar_simulator_set_bus_time(lothar_connection_t *connection, uint32_t us)
+{
+  brick_t *brick;
+
+  IS_VALID(connection);
+
+  brick = lock(connection);
+  brick->bus = us;
+  unlock(brick);
+
+  return 0;
+}
+
+int lothar_simulator_post_message(lothar_connection_t *connection, uint8_t inbox, uint8_t const *data, size_t len)
+{
+  brick_t *brick;
+
+  IS_VALID(connection);
+
+  if(inbox >= MAILBOXES || len > MAX_MESSAGE || (len && !data))
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  brick = lock(connection);
+  post(brick->mailboxes + inbox, data, len);
+  unlock(brick);
+
+  return 0;
+}
+
+int lothar_simulator_take_message(lothar_connection_t *connection, uint8_t inbox, uint8_t data[59], uint8_t *len)
+{
+  brick_t *brick;
+  mailbox_t *mailbox;
+  message_t const *message;
+
+  IS_VALID(connection);
+
+  if(inbox >= MAILBOXES)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  brick = lock(connection);
+  mailbox = brick->mailboxes + inbox;
+
+  // polled for, like lothar_messageread() this is not worth a warning
+  if(!mailbox->count)
+  {
+    unlock(brick);
+    lothar_error_raise(LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY);
+    return -LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY;
+  }
+
+  message = mailbox->messages + mailbox->first;
+  if(data)
+    memcpy(data, message->data, message->len);
+  if(len)
+    *len = message->len;
+
+  mailbox->first = (mailbox->first + 1) % MAILBOX_DEPTH;
+  --mailbox->count;
+
+  unlock(brick);
+
+  return 0;
+}
@@ -0,0 +1,78 @@
+#include "snapshot.h"
+#include "connection_private.h"
+#include "error_handling.h"
+#include <string.h>
+
+// where the replies go
+typedef struct
+{
+  lothar_snapshot_t *snapshot;
+  int status; // the first error
+} burst_t;
+
+static void outputstate(lothar_connection_t *connection, int status, lothar_outputstate_t const *state, void *user)
+{
+  burst_t *burst = (burst_t *)user;
+
+  if(status < 0)
+    lothar_first_error(&burst->status, status);
+  else
+    burst->snapshot->outputs[state->port] = *state;
+}
+
+static void inputvalues(lothar_connection_t *connection, int status, lothar_inputvalues_t const *values, void *user)
+{
+  burst_t *burst = (burst_t *)user;
+
+  if(status < 0)
+    lothar_first_error(&burst->status, status);
+  else
+    burst->snapshot->inputs[values->port] = *values;
+}
+
+static void batterylevel(lothar_connection_t *connection, int status, uint16_t level, void *user)
+{
+  burst_t *burst = (burst_t *)user;
+
+  if(status < 0)
+    lothar_first_error(&burst->status, status);
+  else
+    burst->snapshot->battery = level;
+}
+
+int lothar_snapshot(lothar_connection_t *connection, lothar_snapshot_t *snapshot, uint8_t battery)
+{
+  burst_t burst;
+  int i;
+
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(!snapshot)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  memset(snapshot, 0, sizeof(lothar_snapshot_t));
+  burst.snapshot = snapshot;
+  burst.status = 0;
+
+  snapshot->sent = lothar_time_us();
+
+  // all requests go out before the first reply is read
+  for(i = 0; i < LOTHAR_SNAPSHOT_OUTPUTS; ++i)
+    lothar_first_error(&burst.status, lothar_getoutputstate_async(connection, (enum lothar_output_port)(OUTPUT_A + i), outputstate, &burst));
+
+  for(i = 0; i < LOTHAR_SNAPSHOT_INPUTS; ++i)
+    lothar_first_error(&burst.status, lothar_getinputvalues_async(connection, (enum lothar_input_port)(INPUT_1 + i), inputvalues, &burst));
+
+  if(battery)
+    lothar_first_error(&burst.status, lothar_getbatterylevel_async(connection, batterylevel, &burst));
+
+  lothar_async_dispatch(connection, 0);
+
+  snapshot->received = lothar_time_us();
+
+  if(burst.status < 0)
+    LOTHAR_RETURN_ERROR(-burst.status);
+
+  return 0;
+}
@@ -0,0 +1,219 @@
+#include "sockets.h"
+#include "error_handling.h"
+#include "framing.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// a write to a peer that went away should fail, not raise SIGPIPE
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+int lothar_socket_startup(void)
+{
+#ifdef _WIN32
+  static int firstcall = 1;
+  static WSADATA wsadata;
+
+  if(firstcall)
+  {
+    if(WSAStartup(MAKEWORD(2, 2), &wsadata))
+      LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+    firstcall = 0;
+  }
+#endif
+
+  return 0;
+}
+
+// the error for a failed send or recv, LOTHAR_ERROR_TIMEOUT if the timeout of the socket passed
+static int failure(int error)
+{
+#ifdef _WIN32
+  int timed_out = WSAGetLastError() == WSAETIMEDOUT;
+#else
+  int timed_out = errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+
+  return timed_out ? LOTHAR_ERROR_TIMEOUT : error;
+}
+
+int lothar_socket_send(lothar_socket_t sock, uint8_t const *data, size_t len)
+{
+  while(len)
+  {
+    int s = send(sock, (char const *)data, (int)len, SEND_FLAGS);
+    int error;
+
+    if(s <= 0)
+    {
+      error = s < 0 ? failure(LOTHAR_ERROR_NXT_WRITE_ERROR) : LOTHAR_ERROR_NXT_WRITE_ERROR;
+      LOTHAR_RETURN_ERROR(error);
+    }
+
+    data += s;
+    len -= s;
+  }
+
+  return 0;
+}
+
+int lothar_socket_recv(void *stream, uint8_t *buf, size_t len)
+{
+  int r = recv(*(lothar_socket_t *)stream, (char *)buf, (int)len, 0);
+  int error;
+
+  if(r < 0)
+  {
+    error = failure(LOTHAR_ERROR_NXT_READ_ERROR);
+    LOTHAR_RETURN_ERROR(error);
+  }
+
+  return r;
+}
+
+int lothar_socket_set_timeout(lothar_socket_t sock, uint32_t ms)
+{
+#ifdef _WIN32
+  DWORD timeout = ms;
+#else
+  struct timeval timeout;
+
+  timeout.tv_sec = ms / 1000;
+  timeout.tv_usec = (ms % 1000) * 1000;
+#endif
+
+  if(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char const *)&timeout, sizeof(timeout)) < 0 ||
+     setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char const *)&timeout, sizeof(timeout)) < 0)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+
+  return 0;
+}
+
+int lothar_socket_wait(lothar_socket_t sock, int ms)
+{
+  fd_set set;
+  struct timeval timeout;
+  int status;
+
+  FD_ZERO(&set);
+  FD_SET(sock, &set);
+  timeout.tv_sec = ms / 1000;
+  timeout.tv_usec = (ms % 1000) * 1000;
+
+  if((status = select((int)sock + 1, &set, NULL, NULL, &timeout)) < 0)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+
+  return status;
+}
+
+/* the connection */
+
+typedef struct
+{
+  lothar_socket_t sock;
+  lothar_framer_t framer;
+} stream_t;
+
+static int stream_writev(void *connection, lothar_iovec_t const *iov, size_t iovcount)
+{
+  stream_t *stream = (stream_t *)connection;
+  // the size and the telegram are sent as one, so they go out in a single segment
+  uint8_t stackbuf[2 + LOTHAR_MAX_TELEGRAM];
+  uint8_t *buf = stackbuf;
+  size_t len = 0;
+  size_t i;
+  int status;
+
+  for(i = 0; i < iovcount; ++i)
+    len += iov[i].len;
+
+  if(len > 0xffff)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(len + 2 > sizeof(stackbuf))
+    buf = (uint8_t *)lothar_malloc(len + 2);
+
+  lothar_htonxts(len, buf);
+  for(len = 0, i = 0; i < iovcount; ++i)
+  {
+    memcpy(buf + 2 + len, iov[i].data, iov[i].len);
+    len += iov[i].len;
+  }
+
+  status = lothar_socket_send(stream->sock, buf, len + 2);
+
+  if(buf != stackbuf)
+    free(buf);
+
+  return status < 0 ? status : (int)len;
+}
+
+static int stream_write(void *connection, uint8_t const *data, size_t len)
+{
+  lothar_iovec_t iov;
+
+  iov.data = data;
+  iov.len = len;
+
+  return stream_writev(connection, &iov, 1);
+}
+
+// all telegrams in a single send, so they can share a segment
+static int stream_writebatch(void *connection, lothar_iovec_t const *telegrams, size_t count)
+{
+  stream_t *stream = (stream_t *)connection;
+  uint8_t buf[LOTHAR_FRAMER_PACKED(LOTHAR_MAX_BATCH)];
+  int len;
+
+  if((len = lothar_framer_pack(telegrams, count, buf)) < 0)
+    return len;
+
+  if(lothar_socket_send(stream->sock, buf, len) < 0)
+    return -lothar_errno;
+
+  return len - 2 * count;
+}
+
+static int stream_read(void *connection, uint8_t *data, size_t len)
+{
+  return lothar_framer_read(&((stream_t *)connection)->framer, data, len);
+}
+
+static int stream_close(void *connection)
+{
+  stream_t *stream = (stream_t *)connection;
+
+  lothar_socket_close(stream->sock);
+  free(stream);
+
+  return 0;
+}
+
+static int stream_set_timeout(void *connection, uint32_t ms)
+{
+  return lothar_socket_set_timeout(((stream_t *)connection)->sock, ms);
+}
+
+static lothar_connection_vtable stream_vtable =
+{
+  stream_read,
+  stream_write,
+  stream_close,
+  stream_writev,
+  stream_set_timeout,
+  stream_writebatch
+};
+
+lothar_connection_t *lothar_socket_connection(lothar_socket_t sock)
+{
+  stream_t *stream = (stream_t *)lothar_malloc(sizeof(stream_t));
+
+  stream->sock = sock;
+  lothar_framer_init(&stream->framer, lothar_socket_recv, &stream->sock);
+
+  return lothar_connection_open_custom(&stream_vtable, stream);
+}
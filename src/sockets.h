@@ -0,0 +1,56 @@
+#ifndef SOCKETS_H
+#define SOCKETS_H
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#include "connection.h"
+
+/* stream sockets (tcp, unix domain), shared by the transports and servers built on them */
+
+#ifdef _WIN32
+
+typedef SOCKET lothar_socket_t;
+
+#define lothar_socket_close closesocket
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+typedef int lothar_socket_t;
+
+#ifndef INVALID_SOCKET
+#define INVALID_SOCKET -1
+#endif
+
+#define lothar_socket_close close
+
+#endif
+
+// initialize the socket library, where needed (windows), returns 0 or a negative error code
+int lothar_socket_startup(void);
+
+// send all of data, returns 0 or a negative error code
+int lothar_socket_send(lothar_socket_t sock, uint8_t const *data, size_t len);
+
+// receive at least one and at most len bytes, a recv callback for a framer (the stream is a pointer to the socket)
+// returns the number of bytes, 0 if the peer hung up, or a negative error code
+int lothar_socket_recv(void *stream, uint8_t *buf, size_t len);
+
+// give up on a send or recv after ms milliseconds (0 for never), with LOTHAR_ERROR_TIMEOUT
+int lothar_socket_set_timeout(lothar_socket_t sock, uint32_t ms);
+
+// 1 if sock is readable, 0 if it is not after ms milliseconds, or a negative error code
+int lothar_socket_wait(lothar_socket_t sock, int ms);
+
+// a connection on a connected socket, which is closed with it
+// telegrams are preceded by their size as a little endian 16 bit value, like over bluetooth
+lothar_connection_t *lothar_socket_connection(lothar_socket_t sock);
+
+#endif
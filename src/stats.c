@@ -0,0 +1,125 @@
+#include "stats.h"
+#include "connection_private.h"
+#include "error_handling.h"
+#include <string.h>
+
+// the number of buckets below 8 microseconds (one each), and per power of two above
+#define LINEAR 8
+#define SPLIT  4
+
+// the position of the highest bit set in v, v > 0
+static unsigned log2_floor(uint64_t v)
+{
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll(v);
+#else
+  unsigned e = 0;
+
+  while(v >>= 1)
+    ++e;
+
+  return e;
+#endif
+}
+
+size_t lothar_stats_bucket(uint64_t us)
+{
+  unsigned e;
+  size_t bucket;
+
+  if(us < LINEAR)
+    return (size_t)us;
+
+  // the power of two, and which quarter of it
+  e = log2_floor(us);
+  bucket = LINEAR + (e - 3) * SPLIT + (size_t)((us >> (e - 2)) & (SPLIT - 1));
+
+  return bucket < LOTHAR_STATS_BUCKETS ? bucket : LOTHAR_STATS_BUCKETS - 1;
+}
+
+uint64_t lothar_stats_bucket_min(size_t bucket)
+{
+  size_t e;
+
+  if(bucket < LINEAR)
+    return bucket;
+
+  e = 3 + (bucket - LINEAR) / SPLIT;
+
+  return (uint64_t)(SPLIT + (bucket - LINEAR) % SPLIT) << (e - 2);
+}
+
+static void add(lothar_opcode_stats_t *total, lothar_opcode_stats_t const *stats)
+{
+  size_t i;
+
+  total->requests += stats->requests;
+  total->replies += stats->replies;
+  total->errors += stats->errors;
+  total->bytes_written += stats->bytes_written;
+  total->bytes_read += stats->bytes_read;
+  total->rtt_total += stats->rtt_total;
+
+  for(i = 0; i < LOTHAR_STATS_BUCKETS; ++i)
+    total->rtt[i] += stats->rtt[i];
+}
+
+int lothar_connection_stats(lothar_connection_t const *connection, int opcode, lothar_opcode_stats_t *stats)
+{
+  lothar_opcode_stats_t const *s;
+  size_t i;
+
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(!stats || opcode > 0xff)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(opcode < 0)
+  {
+    memset(stats, 0, sizeof(lothar_opcode_stats_t));
+    for(i = 0; i < LOTHAR_STATS_SLOTS; ++i)
+      add(stats, connection->stats + i);
+
+    return 0;
+  }
+
+  if(!(s = lothar_stats_of((lothar_connection_t *)connection, (uint8_t)opcode)))
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  memcpy(stats, s, sizeof(lothar_opcode_stats_t));
+
+  return 0;
+}
+
+int lothar_stats_percentile(lothar_opcode_stats_t const *stats, double p, uint64_t *us)
+{
+  uint64_t count = 0;
+  uint64_t target;
+  double rank;
+  size_t i;
+
+  if(!stats || p < 0 || p > 1)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  for(i = 0; i < LOTHAR_STATS_BUCKETS; ++i)
+    count += stats->rtt[i];
+
+  if(!count)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  // the reply at this rank (from 1) marks the percentile
+  rank = p * count;
+  target = (uint64_t)rank;
+  if(target < rank || !target)
+    ++target;
+
+  for(count = 0, i = 0; i < LOTHAR_STATS_BUCKETS - 1; ++i)
+    if((count += stats->rtt[i]) >= target)
+      break;
+
+  if(us)
+    *us = i < LOTHAR_STATS_BUCKETS - 1 ? lothar_stats_bucket_min(i + 1) - 1 : lothar_stats_bucket_min(i);
+
+  return 0;
+}
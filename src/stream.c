@@ -0,0 +1,375 @@
+#include "stream.h"
+#include "commands.h"
+#include "connection_private.h"
+#include "error_handling.h"
+#include "thread.h"
+#include "utils.h"
+#include <string.h>
+
+#define MESSAGE    59 // the largest message, including the terminating 0
+#define HEADER     2  // the sequence number
+#define MAX_WINDOW (9 * LOTHAR_STREAM_DEPTH) // at most nine inboxes carry data, the tenth the acknowledgements
+
+struct lothar_stream_t
+{
+  lothar_connection_t *connection;
+  lothar_stream_config_t config;
+  uint16_t window; // the chunks in flight, a full mailbox for every inbox
+
+  // to the brick
+  uint16_t sent;  // the next chunk to send
+  uint16_t acked; // the next chunk the brick expects
+
+  // from the brick, chunk n is kept in slot n % window until it is read
+  uint16_t base;     // the oldest chunk not completely read
+  size_t offset;     // the part of it that was read
+  uint16_t reported; // the last acknowledgement sent
+  uint8_t have[MAX_WINDOW];
+  uint8_t lens[MAX_WINDOW];
+  uint8_t chunks[MAX_WINDOW][LOTHAR_STREAM_CHUNK];
+  uint32_t arrived;  // the chunks received, to tell if a poll got any
+
+  int status; // the first error of a poll
+};
+
+// the status of a poll, which starts over for the next
+static int outcome(lothar_stream_t *stream)
+{
+  int status = stream->status;
+
+  stream->status = 0;
+  if(status < 0)
+    LOTHAR_RETURN_ERROR(-status);
+
+  return 0;
+}
+
+// sequence numbers count modulo LOTHAR_STREAM_SEQUENCES
+static uint16_t following(uint16_t sequence)
+{
+  return (sequence + 1) % LOTHAR_STREAM_SEQUENCES;
+}
+
+static uint16_t distance(uint16_t to, uint16_t from)
+{
+  return (to + LOTHAR_STREAM_SEQUENCES - from) % LOTHAR_STREAM_SEQUENCES;
+}
+
+static uint8_t inbox(lothar_stream_t const *stream, uint16_t sequence)
+{
+  return stream->config.first + sequence % stream->config.count;
+}
+
+static int expired(lothar_stream_t const *stream, uint64_t since)
+{
+  return stream->config.timeout && lothar_time_us() - since > stream->config.timeout * 1000;
+}
+
+lothar_stream_t *lothar_stream_open(lothar_connection_t *connection, lothar_stream_config_t const *config)
+{
+  lothar_stream_config_t const standard = {0, 9, 9, LOTHAR_STREAM_TIMEOUT};
+  lothar_stream_t *stream;
+
+  if(!connection)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+    return NULL;
+  }
+
+  if(!config)
+    config = &standard;
+
+  // the replies to a poll are needed before the next one, so it does not go with pipelining
+  if(connection->pipelined ||
+     !config->count ||
+     config->first + config->count > 10 ||
+     config->control > 9 ||
+     (config->control >= config->first && config->control < config->first + config->count))
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+    return NULL;
+  }
+
+  stream = (lothar_stream_t *)lothar_malloc(sizeof(lothar_stream_t));
+  memset(stream, 0, sizeof(lothar_stream_t));
+
+  stream->connection = connection;
+  stream->config = *config;
+  stream->window = config->count * LOTHAR_STREAM_DEPTH;
+
+  return stream;
+}
+
+int lothar_stream_close(lothar_stream_t **stream)
+{
+  if(!stream || !(*stream))
+    return 0;
+
+  free(*stream);
+  *stream = NULL;
+
+  return 0;
+}
+
+/* to the brick
+ *
+ * The brick acknowledges every few chunks, and when it runs out of data. The acknowledgements pile up in its response
+ * mailbox, they are all read in one burst and the newest counts. */
+
+static void acknowledged(lothar_connection_t *connection, int status, uint8_t localinbox, uint8_t const *data, uint8_t len, void *user)
+{
+  lothar_stream_t *stream = (lothar_stream_t *)user;
+  uint16_t next;
+
+  if(status == -LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY)
+    return;
+
+  if(status < 0)
+  {
+    lothar_first_error(&stream->status, status);
+    return;
+  }
+
+  if(len < HEADER)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+    lothar_first_error(&stream->status, -lothar_errno);
+    return;
+  }
+
+  // anything between what we knew and what was sent, an older one that arrives late is ignored
+  next = lothar_nxttohs(data);
+  if(next < LOTHAR_STREAM_SEQUENCES && distance(next, stream->acked) <= distance(stream->sent, stream->acked))
+    stream->acked = next;
+}
+
+static int poll_acknowledgements(lothar_stream_t *stream)
+{
+  int i;
+
+  for(i = 0; i < LOTHAR_STREAM_DEPTH && !stream->status; ++i)
+    lothar_first_error(&stream->status, lothar_messageread_async(stream->connection,
+								 stream->config.control + 10,
+								 stream->config.control,
+								 1,
+								 acknowledged,
+								 stream));
+
+  lothar_async_dispatch(stream->connection, 0);
+
+  return outcome(stream);
+}
+
+// wait until no more than unacked chunks are underway
+static int wait_acknowledged(lothar_stream_t *stream, uint16_t unacked)
+{
+  uint64_t since = lothar_time_us();
+  uint16_t acked = stream->acked;
+
+  while(distance(stream->sent, stream->acked) > unacked)
+  {
+    if(poll_acknowledgements(stream) < 0)
+      return -lothar_errno;
+
+    if(stream->acked != acked)
+    {
+      acked = stream->acked;
+      since = lothar_time_us();
+    }
+    else
+    {
+      if(expired(stream, since))
+	LOTHAR_RETURN_ERROR(LOTHAR_ERROR_TIMEOUT);
+      lothar_thread_yield();
+    }
+  }
+
+  return 0;
+}
+
+int lothar_stream_write(lothar_stream_t *stream, uint8_t const *data, size_t len)
+{
+  uint8_t buf[MESSAGE];
+  size_t offset = 0;
+  size_t size;
+
+  if(!stream)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(!data && len)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  while(offset < len)
+  {
+    if(wait_acknowledged(stream, stream->window - 1) < 0)
+      return -lothar_errno;
+
+    size = MIN(len - offset, LOTHAR_STREAM_CHUNK);
+
+    lothar_htonxts(stream->sent, buf);
+    memcpy(buf + HEADER, data + offset, size);
+    buf[HEADER + size] = 0;
+
+    if(lothar_messagewrite(stream->connection, inbox(stream, stream->sent), buf, HEADER + size + 1) < 0)
+      return -lothar_errno;
+
+    stream->sent = following(stream->sent);
+    offset += size;
+  }
+
+  return 0;
+}
+
+int lothar_stream_flush(lothar_stream_t *stream)
+{
+  if(!stream)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  return wait_acknowledged(stream, 0);
+}
+
+/* from the brick
+ *
+ * Every poll reads the head of each mailbox that can still hold a chunk of the window. A mailbox is first in, first
+ * out, so its head is the oldest chunk of it not yet read; chunks of other mailboxes may overtake it. */
+
+static void received(lothar_connection_t *connection, int status, uint8_t localinbox, uint8_t const *data, uint8_t len, void *user)
+{
+  lothar_stream_t *stream = (lothar_stream_t *)user;
+  uint16_t sequence;
+  size_t slot;
+
+  if(status == -LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY)
+    return;
+
+  if(status < 0)
+  {
+    lothar_first_error(&stream->status, status);
+    return;
+  }
+
+  // the terminating 0 is optional
+  if(len && !data[len - 1])
+    --len;
+
+  sequence = len >= HEADER ? lothar_nxttohs(data) : 0;
+  slot = sequence % stream->window;
+
+  if(len < HEADER ||
+     len - HEADER > LOTHAR_STREAM_CHUNK ||
+     distance(sequence, stream->base) >= stream->window ||
+     inbox(stream, sequence) != localinbox ||
+     stream->have[slot])
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+    lothar_first_error(&stream->status, -lothar_errno);
+    return;
+  }
+
+  memcpy(stream->chunks[slot], data + HEADER, len - HEADER);
+  stream->lens[slot] = len - HEADER;
+  stream->have[slot] = 1;
+  ++stream->arrived;
+}
+
+static int poll_chunks(lothar_stream_t *stream)
+{
+  uint16_t sequence;
+  uint8_t asked[10] = {0};
+  uint8_t box;
+
+  for(sequence = stream->base; distance(sequence, stream->base) < stream->window && !stream->status; sequence = following(sequence))
+  {
+    box = inbox(stream, sequence);
+    if(stream->have[sequence % stream->window] || asked[box])
+      continue;
+
+    asked[box] = 1;
+    lothar_first_error(&stream->status, lothar_messageread_async(stream->connection, box + 10, box, 1, received, stream));
+  }
+
+  lothar_async_dispatch(stream->connection, 0);
+
+  return outcome(stream);
+}
+
+static int acknowledge(lothar_stream_t *stream)
+{
+  uint8_t buf[HEADER + 1];
+
+  lothar_htonxts(stream->base, buf);
+  buf[HEADER] = 0;
+
+  if(lothar_messagewrite(stream->connection, stream->config.control, buf, sizeof(buf)) < 0)
+    return -lothar_errno;
+
+  stream->reported = stream->base;
+  return 0;
+}
+
+int lothar_stream_read(lothar_stream_t *stream, uint8_t *data, size_t bufsize, size_t *len)
+{
+  uint64_t since = lothar_time_us();
+  uint32_t arrived;
+  size_t done = 0;
+  size_t slot;
+  size_t size;
+
+  if(!stream)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(!data && bufsize)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  while(bufsize)
+  {
+    slot = stream->base % stream->window;
+
+    if(stream->have[slot])
+    {
+      size = MIN(bufsize - done, stream->lens[slot] - stream->offset);
+      memcpy(data + done, stream->chunks[slot] + stream->offset, size);
+      done += size;
+      stream->offset += size;
+
+      if(stream->offset == stream->lens[slot])
+      {
+	stream->have[slot] = 0;
+	stream->offset = 0;
+	stream->base = following(stream->base);
+
+	if(distance(stream->base, stream->reported) >= stream->config.count && acknowledge(stream) < 0)
+	  return -lothar_errno;
+      }
+
+      if(done == bufsize)
+	break;
+      continue;
+    }
+
+    // nothing more in order, the brick may be waiting for us
+    if(stream->base != stream->reported && acknowledge(stream) < 0)
+      return -lothar_errno;
+
+    if(done)
+      break;
+
+    arrived = stream->arrived;
+    if(poll_chunks(stream) < 0)
+      return -lothar_errno;
+
+    if(stream->arrived != arrived)
+      since = lothar_time_us();
+    else
+    {
+      if(expired(stream, since))
+	LOTHAR_RETURN_ERROR(LOTHAR_ERROR_TIMEOUT);
+      lothar_thread_yield();
+    }
+  }
+
+  if(len)
+    *len = done;
+
+  return 0;
+}
@@ -0,0 +1,185 @@
+#include "system.h"
+#include "commands.h"
+#include "connection_private.h"
+#include "error_handling.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* whole file transfers
+ *
+ * The chunks of a file are sent as asynchronous reads or writes, so they are all on their way before the first reply
+ * comes back; the commands layer keeps at most LOTHAR_MAX_PENDING of them outstanding. */
+
+typedef struct
+{
+  uint8_t *data; // where a download goes
+  size_t done;   // the bytes transferred so far
+  int status;    // the first error
+} transfer_t;
+
+static void chunk_written(lothar_connection_t *connection, int status, uint8_t handle, size_t len, void *user)
+{
+  transfer_t *transfer = (transfer_t *)user;
+
+  if(status < 0)
+    lothar_first_error(&transfer->status, status);
+  else
+    transfer->done += len;
+}
+
+static void chunk_read(lothar_connection_t *connection, int status, uint8_t handle, uint8_t const *data, size_t len, void *user)
+{
+  transfer_t *transfer = (transfer_t *)user;
+
+  if(status < 0)
+    lothar_first_error(&transfer->status, status);
+  else
+  {
+    memcpy(transfer->data + transfer->done, data, len);
+    transfer->done += len;
+  }
+}
+
+// the commands of a transfer wait for their replies one by one, which they cannot do in pipelined mode
+static int usable(lothar_connection_t *connection)
+{
+  if(!connection)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(connection->pipelined)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  return 0;
+}
+
+int lothar_upload(lothar_connection_t *connection, char const *filename, uint8_t const *data, size_t len)
+{
+  transfer_t transfer = {NULL, 0, 0};
+  uint8_t handle;
+  size_t offset;
+  int status;
+
+  if(usable(connection) < 0)
+    return -lothar_errno;
+
+  if(!data && len)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if((status = lothar_openwrite(connection, filename, len, &handle)) == -LOTHAR_ERROR_FILE_EXISTS)
+  {
+    if((status = lothar_filedelete(connection, filename)) < 0)
+      return status;
+
+    status = lothar_openwrite(connection, filename, len, &handle);
+  }
+
+  if(status < 0)
+    return status;
+
+  for(offset = 0; offset < len && !transfer.status; offset += LOTHAR_MAX_FILEWRITE)
+    lothar_first_error(&transfer.status, lothar_filewrite_async(connection, handle, data + offset, MIN(len - offset, LOTHAR_MAX_FILEWRITE), chunk_written, &transfer));
+
+  lothar_async_dispatch(connection, 0);
+
+  status = lothar_fileclose(connection, handle);
+
+  if(!transfer.status && transfer.done != len)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_WRITE_ERROR);
+    transfer.status = -lothar_errno;
+  }
+
+  if(transfer.status < 0)
+    LOTHAR_RETURN_ERROR(-transfer.status);
+
+  return status;
+}
+
+int lothar_upload_file(lothar_connection_t *connection, char const *path, char const *filename)
+{
+  FILE *file;
+  uint8_t *data;
+  long size;
+  int status;
+
+  if(!path)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  if(!filename)
+  {
+    filename = path;
+    if(strrchr(filename, '/'))
+      filename = strrchr(filename, '/') + 1;
+    if(strrchr(filename, '\\'))
+      filename = strrchr(filename, '\\') + 1;
+  }
+
+  if(!(file = fopen(path, "rb")))
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+
+  if(fseek(file, 0, SEEK_END) < 0 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) < 0)
+  {
+    fclose(file);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+  }
+
+  data = (uint8_t *)lothar_malloc(size + 1);
+
+  if(fread(data, 1, size, file) != (size_t)size)
+  {
+    free(data);
+    fclose(file);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+  }
+  fclose(file);
+
+  status = lothar_upload(connection, filename, data, size);
+
+  free(data);
+
+  return status;
+}
+
+int lothar_download(lothar_connection_t *connection, char const *filename, uint8_t *data, size_t bufsize, size_t *len)
+{
+  transfer_t transfer = {data, 0, 0};
+  uint8_t handle;
+  uint32_t size;
+  size_t offset;
+  int status;
+
+  if(usable(connection) < 0)
+    return -lothar_errno;
+
+  if((status = lothar_openread(connection, filename, &handle, &size)) < 0)
+    return status;
+
+  if(len)
+    *len = size;
+
+  if(size > bufsize || (size && !data))
+  {
+    lothar_fileclose(connection, handle);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_BUFFER_TOO_SMALL);
+  }
+
+  for(offset = 0; offset < size && !transfer.status; offset += LOTHAR_MAX_FILEREAD)
+    lothar_first_error(&transfer.status, lothar_fileread_async(connection, handle, MIN(size - offset, LOTHAR_MAX_FILEREAD), chunk_read, &transfer));
+
+  lothar_async_dispatch(connection, 0);
+
+  status = lothar_fileclose(connection, handle);
+
+  if(!transfer.status && transfer.done != size)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
+    transfer.status = -lothar_errno;
+  }
+
+  if(transfer.status < 0)
+    LOTHAR_RETURN_ERROR(-transfer.status);
+
+  return status;
+}
@@ -0,0 +1,254 @@
+#include "sockets.h"
+#include "tcp.h"
+#include "error_handling.h"
+#include "framing.h"
+#include "thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#endif
+
+#define NO_REPLY 0x80 // the flag in the first byte of a request that asks the brick not to reply
+
+#define POLL_MS 50 // how often the bridge checks whether it should stop
+
+static void nodelay(lothar_socket_t sock)
+{
+  int yes = 1;
+
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char const *)&yes, sizeof(yes));
+}
+
+lothar_connection_t *lothar_connection_open_tcp(char const *host, uint16_t port)
+{
+  struct addrinfo hints;
+  struct addrinfo *addresses;
+  struct addrinfo *a;
+  char service[8];
+  lothar_socket_t sock = INVALID_SOCKET;
+
+  if(!host)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+    return NULL;
+  }
+
+  if(lothar_socket_startup() < 0)
+    return NULL;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  sprintf(service, "%u", (unsigned)port);
+
+  if(getaddrinfo(host, service, &hints, &addresses))
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+    return NULL;
+  }
+
+  // the first address that accepts us
+  for(a = addresses; a && sock == INVALID_SOCKET; a = a->ai_next)
+  {
+    if((sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol)) == INVALID_SOCKET)
+      continue;
+
+    if(connect(sock, a->ai_addr, (int)a->ai_addrlen) < 0)
+    {
+      lothar_socket_close(sock);
+      sock = INVALID_SOCKET;
+    }
+  }
+  freeaddrinfo(addresses);
+
+  if(sock == INVALID_SOCKET)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+    return NULL;
+  }
+
+  nodelay(sock);
+
+  return lothar_socket_connection(sock);
+}
+
+/* the bridge */
+
+struct lothar_bridge_t
+{
+  lothar_connection_t *brick;
+
+  lothar_socket_t listener;
+  uint16_t port;
+
+  lothar_thread_t thread;
+  size_t volatile stopping; // (boolean)
+};
+
+// pass on the next request, and any that came with it, and send back the replies
+static int relay(lothar_bridge_t *bridge, lothar_framer_t *framer, lothar_socket_t client)
+{
+  uint8_t request[LOTHAR_MAX_TELEGRAM];
+  uint8_t reply[2 + LOTHAR_MAX_TELEGRAM];
+  size_t replies = 0;
+  int len;
+
+  // requests that arrived together are written at once, so the brick works on the next while a reply travels back
+  do
+  {
+    if((len = lothar_framer_read(framer, request, sizeof(request))) < 0)
+      return len;
+
+    if(!len)
+      continue;
+
+    if(lothar_connection_write(bridge->brick, request, len) < 0)
+      return -lothar_errno;
+
+    if(!(request[0] & NO_REPLY))
+      ++replies;
+  }
+  while(replies < LOTHAR_MAX_PENDING && lothar_framer_ready(framer));
+
+  while(replies--)
+  {
+    // without a reply the client could no longer tell which reply belongs to which request, so give up on it
+    if((len = lothar_connection_read(bridge->brick, reply + 2, LOTHAR_MAX_TELEGRAM)) < 0)
+      return len;
+
+    lothar_htonxts(len, reply);
+    if(lothar_socket_send(client, reply, len + 2) < 0)
+      return -lothar_errno;
+  }
+
+  return 0;
+}
+
+static void serve(void *data)
+{
+  lothar_bridge_t *bridge = (lothar_bridge_t *)data;
+  lothar_framer_t framer;
+  lothar_socket_t client;
+  int status;
+
+  while(!lothar_atomic_load(&bridge->stopping))
+  {
+    if(lothar_socket_wait(bridge->listener, POLL_MS) <= 0)
+      continue;
+
+    if((client = accept(bridge->listener, NULL, NULL)) == INVALID_SOCKET)
+      continue;
+
+    // a client that stops halfway through a frame, or stops taking replies, is dropped rather than waited for
+    nodelay(client);
+    if(lothar_socket_set_timeout(client, POLL_MS) < 0)
+    {
+      lothar_socket_close(client);
+      continue;
+    }
+    lothar_framer_init(&framer, lothar_socket_recv, &client);
+
+    // one client at a time, until it hangs up
+    while(!lothar_atomic_load(&bridge->stopping))
+    {
+      if(!lothar_framer_ready(&framer) && (status = lothar_socket_wait(client, POLL_MS)) <= 0)
+      {
+        if(status < 0)
+          break;
+        continue;
+      }
+
+      if(relay(bridge, &framer, client) < 0)
+        break;
+    }
+
+    lothar_socket_close(client);
+  }
+}
+
+lothar_bridge_t *lothar_bridge_open(lothar_connection_t *brick, uint16_t port)
+{
+  lothar_bridge_t *bridge;
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  int yes = 1;
+
+  if(!brick)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+    return NULL;
+  }
+
+  if(lothar_socket_startup() < 0)
+    return NULL;
+
+  bridge = (lothar_bridge_t *)lothar_malloc(sizeof(lothar_bridge_t));
+  bridge->brick = brick;
+  bridge->stopping = 0;
+
+  if((bridge->listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+    free(bridge);
+    return NULL;
+  }
+
+  setsockopt(bridge->listener, SOL_SOCKET, SO_REUSEADDR, (char const *)&yes, sizeof(yes));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+
+  if(bind(bridge->listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+     listen(bridge->listener, 1) < 0 ||
+     getsockname(bridge->listener, (struct sockaddr *)&addr, &addrlen) < 0)
+  {
+    LOTHAR_ERROR(LOTHAR_ERROR_OS_ERROR);
+    lothar_socket_close(bridge->listener);
+    free(bridge);
+    return NULL;
+  }
+
+  bridge->port = ntohs(addr.sin_port);
+
+  if(lothar_thread_create(&bridge->thread, serve, bridge) < 0)
+  {
+    lothar_socket_close(bridge->listener);
+    free(bridge);
+    return NULL;
+  }
+
+  return bridge;
+}
+
+int lothar_bridge_port(lothar_bridge_t const *bridge, uint16_t *port)
+{
+  if(!bridge)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  if(port)
+    *port = bridge->port;
+
+  return 0;
+}
+
+int lothar_bridge_close(lothar_bridge_t **bridge)
+{
+  if(!bridge || !*bridge)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_ENTITY_CLOSED);
+
+  lothar_atomic_store(&(*bridge)->stopping, 1);
+  lothar_thread_join(&(*bridge)->thread);
+
+  lothar_socket_close((*bridge)->listener);
+  free(*bridge);
+  *bridge = NULL;
+
+  return 0;
+}
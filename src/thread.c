@@ -0,0 +1,228 @@
+#include "thread.h"
+#include "error_handling.h"
+#include "utils.h"
+#include <stdlib.h>
+
+// the platforms disagree on the signature of a thread function
+typedef struct
+{
+  void (*run)(void *data);
+  void *data;
+} start_t;
+
+#ifdef _WIN32
+
+static DWORD WINAPI start(LPVOID param)
+{
+  start_t s = *(start_t *)param;
+
+  free(param);
+  s.run(s.data);
+
+  return 0;
+}
+
+int lothar_thread_create(lothar_thread_t *thread, void (*run)(void *data), void *data)
+{
+  start_t *s = (start_t *)lothar_malloc(sizeof(start_t));
+
+  s->run = run;
+  s->data = data;
+
+  if(!(*thread = CreateThread(NULL, 0, start, s, 0, NULL)))
+  {
+    free(s);
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+  }
+
+  return 0;
+}
+
+int lothar_thread_join(lothar_thread_t *thread)
+{
+  if(WaitForSingleObject(*thread, INFINITE) != WAIT_OBJECT_0)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+
+  CloseHandle(*thread);
+  return 0;
+}
+
+int lothar_thread_detach(lothar_thread_t *thread)
+{
+  if(!CloseHandle(*thread))
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+
+  return 0;
+}
+
+int lothar_thread_is_self(lothar_thread_t const *thread)
+{
+  return GetThreadId(*thread) == GetCurrentThreadId();
+}
+
+void lothar_thread_yield(void)
+{
+  SwitchToThread();
+}
+
+void lothar_mutex_init(lothar_mutex_t *mutex)
+{
+  InitializeCriticalSection(mutex);
+}
+
+void lothar_mutex_destroy(lothar_mutex_t *mutex)
+{
+  DeleteCriticalSection(mutex);
+}
+
+void lothar_mutex_lock(lothar_mutex_t *mutex)
+{
+  EnterCriticalSection(mutex);
+}
+
+void lothar_mutex_unlock(lothar_mutex_t *mutex)
+{
+  LeaveCriticalSection(mutex);
+}
+
+void lothar_cond_init(lothar_cond_t *cond)
+{
+  InitializeConditionVariable(cond);
+}
+
+void lothar_cond_destroy(lothar_cond_t *cond)
+{
+  // nothing to do
+}
+
+void lothar_cond_wait(lothar_cond_t *cond, lothar_mutex_t *mutex)
+{
+  SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+void lothar_cond_signal(lothar_cond_t *cond)
+{
+  WakeConditionVariable(cond);
+}
+
+void lothar_cond_broadcast(lothar_cond_t *cond)
+{
+  WakeAllConditionVariable(cond);
+}
+
+#else // pthreads
+
+#include <sched.h>
+
+static void *start(void *param)
+{
+  start_t s = *(start_t *)param;
+
+  free(param);
+  s.run(s.data);
+
+  return NULL;
+}
+
+int lothar_thread_create(lothar_thread_t *thread, void (*run)(void *data), void *data)
+{
+  start_t *s = (start_t *)lothar_malloc(sizeof(start_t));
+  int e;
+
+  s->run = run;
+  s->data = data;
+
+  if((e = pthread_create(thread, NULL, start, s)))
+  {
+    free(s);
+    errno = e;
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+  }
+
+  return 0;
+}
+
+int lothar_thread_join(lothar_thread_t *thread)
+{
+  int e;
+
+  if((e = pthread_join(*thread, NULL)))
+  {
+    errno = e;
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+  }
+
+  return 0;
+}
+
+int lothar_thread_detach(lothar_thread_t *thread)
+{
+  int e;
+
+  if((e = pthread_detach(*thread)))
+  {
+    errno = e;
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+  }
+
+  return 0;
+}
+
+int lothar_thread_is_self(lothar_thread_t const *thread)
+{
+  return pthread_equal(*thread, pthread_self());
+}
+
+void lothar_thread_yield(void)
+{
+  sched_yield();
+}
+
+void lothar_mutex_init(lothar_mutex_t *mutex)
+{
+  if(pthread_mutex_init(mutex, NULL))
+    LOTHAR_ERR("cannot create mutex\n");
+}
+
+void lothar_mutex_destroy(lothar_mutex_t *mutex)
+{
+  pthread_mutex_destroy(mutex);
+}
+
+void lothar_mutex_lock(lothar_mutex_t *mutex)
+{
+  pthread_mutex_lock(mutex);
+}
+
+void lothar_mutex_unlock(lothar_mutex_t *mutex)
+{
+  pthread_mutex_unlock(mutex);
+}
+
+void lothar_cond_init(lothar_cond_t *cond)
+{
+  if(pthread_cond_init(cond, NULL))
+    LOTHAR_ERR("cannot create condition variable\n");
+}
+
+void lothar_cond_destroy(lothar_cond_t *cond)
+{
+  pthread_cond_destroy(cond);
+}
+
+void lothar_cond_wait(lothar_cond_t *cond, lothar_mutex_t *mutex)
+{
+  pthread_cond_wait(cond, mutex);
+}
+
+void lothar_cond_signal(lothar_cond_t *cond)
+{
+  pthread_cond_signal(cond);
+}
+
+void lothar_cond_broadcast(lothar_cond_t *cond)
+{
+  pthread_cond_broadcast(cond);
+}
+
+#endif // _WIN32
@@ -0,0 +1,114 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "config.h"
+#include <stddef.h>
+
+/* minimal portable threads, mutexes, condition variables and atomic counters */
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+typedef HANDLE lothar_thread_t;
+typedef CRITICAL_SECTION lothar_mutex_t;
+typedef CONDITION_VARIABLE lothar_cond_t;
+
+#else
+
+#include <pthread.h>
+
+typedef pthread_t lothar_thread_t;
+typedef pthread_mutex_t lothar_mutex_t;
+typedef pthread_cond_t lothar_cond_t;
+
+#endif
+
+/* threads, these return 0 on success, a negative error code on failure */
+
+int lothar_thread_create(lothar_thread_t *thread, void (*run)(void *data), void *data);
+int lothar_thread_join(lothar_thread_t *thread);
+
+// let a thread run on its own, it is cleaned up when it returns and can no longer be joined
+int lothar_thread_detach(lothar_thread_t *thread);
+
+// (boolean) is this the calling thread?
+int lothar_thread_is_self(lothar_thread_t const *thread);
+
+// give up the remainder of the time slice
+void lothar_thread_yield(void);
+
+/* mutexes and condition variables, like lothar_malloc failing to create one is fatal */
+
+void lothar_mutex_init(lothar_mutex_t *mutex);
+void lothar_mutex_destroy(lothar_mutex_t *mutex);
+void lothar_mutex_lock(lothar_mutex_t *mutex);
+void lothar_mutex_unlock(lothar_mutex_t *mutex);
+
+void lothar_cond_init(lothar_cond_t *cond);
+void lothar_cond_destroy(lothar_cond_t *cond);
+void lothar_cond_wait(lothar_cond_t *cond, lothar_mutex_t *mutex);
+void lothar_cond_signal(lothar_cond_t *cond);
+void lothar_cond_broadcast(lothar_cond_t *cond);
+
+/* atomic operations on a size_t, all sequentially consistent */
+
+#ifdef _MSC_VER
+
+#ifdef _WIN64
+#define LOTHAR_INTERLOCKED(op) op##64
+typedef LONG64 volatile lothar_interlocked_t;
+#else
+#define LOTHAR_INTERLOCKED(op) op
+typedef LONG volatile lothar_interlocked_t;
+#endif
+
+static inline size_t lothar_atomic_load(size_t volatile *value)
+{
+  return (size_t)LOTHAR_INTERLOCKED(InterlockedCompareExchange)((lothar_interlocked_t *)value, 0, 0);
+}
+
+static inline void lothar_atomic_store(size_t volatile *value, size_t v)
+{
+  LOTHAR_INTERLOCKED(InterlockedExchange)((lothar_interlocked_t *)value, v);
+}
+
+// returns the new value
+static inline size_t lothar_atomic_add(size_t volatile *value, size_t v)
+{
+  return (size_t)LOTHAR_INTERLOCKED(InterlockedExchangeAdd)((lothar_interlocked_t *)value, v) + v;
+}
+
+// (boolean) if value equals expected, set it to desired
+static inline int lothar_atomic_cas(size_t volatile *value, size_t expected, size_t desired)
+{
+  return (size_t)LOTHAR_INTERLOCKED(InterlockedCompareExchange)((lothar_interlocked_t *)value, desired, expected) == expected;
+}
+
+#else // gcc and compatibles
+
+static inline size_t lothar_atomic_load(size_t volatile *value)
+{
+  return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+static inline void lothar_atomic_store(size_t volatile *value, size_t v)
+{
+  __atomic_store_n(value, v, __ATOMIC_SEQ_CST);
+}
+
+// returns the new value
+static inline size_t lothar_atomic_add(size_t volatile *value, size_t v)
+{
+  return __atomic_add_fetch(value, v, __ATOMIC_SEQ_CST);
+}
+
+// (boolean) if value equals expected, set it to desired
+static inline int lothar_atomic_cas(size_t volatile *value, size_t expected, size_t desired)
+{
+  return __atomic_compare_exchange_n(value, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif // _MSC_VER
+
+#endif
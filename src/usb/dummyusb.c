@@ -12,6 +12,12 @@ void *lothar_usb_new(uint16_t p, uint16_t v)
   return NULL;
 }
 
+int lothar_usb_enumerate(uint16_t v, uint16_t p, void (*f)(void *, char const *, void *), void *u)
+{
+  LOTHAR_ERROR(LOTHAR_ERROR_USB_NOT_AVAILABLE);
+  return -LOTHAR_ERROR_USB_NOT_AVAILABLE;
+}
+
 int lothar_usb_write(void *c, uint8_t const *d, size_t l)
 {
   LOTHAR_ERROR(LOTHAR_ERROR_USB_NOT_AVAILABLE);
@@ -24,6 +30,12 @@ int lothar_usb_read(void *c, uint8_t *d, size_t l)
   return -1;
 }
 
+int lothar_usb_set_timeout(void *c, uint32_t ms)
+{
+  LOTHAR_ERROR(LOTHAR_ERROR_USB_NOT_AVAILABLE);
+  return -1;
+}
+
 int lothar_usb_close(void *c)
 {
   LOTHAR_ERROR(LOTHAR_ERROR_USB_NOT_AVAILABLE);
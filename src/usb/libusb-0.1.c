@@ -5,13 +5,28 @@
 #ifdef HAVE_LIBUSB_0_1
 
 #include <usb.h>
+#include <errno.h>
 
-void *lothar_usb_new(uint16_t vendor, uint16_t product)
+typedef struct
+{
+  usb_dev_handle *handle;
+  int timeout; // of a read or write in ms, 0 for none
+} usb_t;
+
+// take over an open (and claimed) handle
+static usb_t *create(usb_dev_handle *handle)
+{
+  usb_t *usb = (usb_t *)lothar_malloc(sizeof(usb_t));
+
+  usb->handle = handle;
+  usb->timeout = 0;
+
+  return usb;
+}
+
+static void init(void)
 {
-  struct usb_bus *bus;
-  usb_dev_handle *result = NULL;
   static int init = 0;
-  static int interface = 0;
 
   if(!init)
   {
@@ -20,6 +35,14 @@ void *lothar_usb_new(uint16_t vendor, uint16_t product)
     usb_find_devices();
     init = 1;
   }
+}
+
+void *lothar_usb_new(uint16_t vendor, uint16_t product)
+{
+  struct usb_bus *bus;
+  usb_dev_handle *result = NULL;
+
+  init();
 
   for(bus = usb_get_busses(); bus; bus = bus->next)
   {
@@ -37,18 +60,64 @@ void *lothar_usb_new(uint16_t vendor, uint16_t product)
       break;
   }
 
-  if(!result || usb_claim_interface(result, interface++)) // nothing found, or error claiming
+  // every device has its own interfaces, the nxt only has interface 0
+  if(!result || usb_claim_interface(result, 0)) // nothing found, or error claiming
   {
+    if(result)
+      usb_close(result);
     LOTHAR_ERROR(LOTHAR_ERROR_USB_CANNOT_CREATE);
     return NULL;
   }
 
-  return result;  
+  return create(result);
+}
+
+// open every device by vendor and product, found is called with each connection and its serial number (or bus address)
+int lothar_usb_enumerate(uint16_t vendor, uint16_t product, void (*found)(void *connection, char const *serial, void *user), void *user)
+{
+  struct usb_bus *bus;
+  int result = 0;
+
+  init();
+
+  for(bus = usb_get_busses(); bus; bus = bus->next)
+  {
+    struct usb_device *dev = NULL;
+    for(dev = bus->devices; dev; dev = dev->next)
+    {
+      usb_dev_handle *handle;
+      char serial[32];
+
+      if(dev->descriptor.idVendor != vendor || dev->descriptor.idProduct != product)
+	continue;
+
+      if(!(handle = usb_open(dev)))
+	continue;
+
+      if(usb_claim_interface(handle, 0))
+      {
+	usb_close(handle);
+	continue;
+      }
+
+      // the serial number of the nxt is its bluetooth address
+      if(!dev->descriptor.iSerialNumber || usb_get_string_simple(handle, dev->descriptor.iSerialNumber, serial, sizeof(serial)) <= 0)
+	sprintf(serial, "%s:%s", bus->dirname, dev->filename);
+
+      found(create(handle), serial, user);
+      ++result;
+    }
+  }
+
+  return result;
 }
 
 int lothar_usb_write(void *connection, uint8_t const  *data, size_t len)
 {
-  int status = usb_bulk_write((usb_dev_handle *)connection, USB_ENDPOINT_OUT | 1, (char *)data, len, 0);
+  usb_t *usb = (usb_t *)connection;
+  int status = usb_bulk_write(usb->handle, USB_ENDPOINT_OUT | 1, (char *)data, len, usb->timeout);
+  if(status == -ETIMEDOUT)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_TIMEOUT);
   if(status < 0)
     LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_WRITE_ERROR);
   return status;
@@ -56,15 +125,28 @@ int lothar_usb_write(void *connection, uint8_t const  *data, size_t len)
 
 int lothar_usb_read(void *connection, uint8_t *data, size_t len)
 {
-  int status = usb_bulk_read((usb_dev_handle *)connection, USB_ENDPOINT_IN | 2, (char *)data, len, 0);
+  usb_t *usb = (usb_t *)connection;
+  int status = usb_bulk_read(usb->handle, USB_ENDPOINT_IN | 2, (char *)data, len, usb->timeout);
+  if(status == -ETIMEDOUT)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_TIMEOUT);
   if(status < 0)
     LOTHAR_RETURN_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
   return status;
 }
 
+int lothar_usb_set_timeout(void *connection, uint32_t ms)
+{
+  ((usb_t *)connection)->timeout = (int)ms;
+  return 0;
+}
+
 int lothar_usb_close(void *connection)
 {
-  if(usb_close((usb_dev_handle *)connection))
+  usb_t *usb = (usb_t *)connection;
+  int status = usb_close(usb->handle);
+
+  free(usb);
+  if(status)
     LOTHAR_RETURN_ERROR(LOTHAR_ERROR_UNKOWN_ERROR);
   return 0;
 }
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "connection.h"
 
 /* the libusb-1.0 usb backend */
 
@@ -10,57 +11,361 @@
 #include <libusb-1.0/libusb.h>
 #endif
 
-// return the usb connection by vendor and product
-void *lothar_usb_new(uint16_t vendor, uint16_t product)
+#define IN_TRANSFERS  2 // a reply can arrive while the one before it is still being read
+#define OUT_TRANSFERS 8 // requests are queued, not waited for
+
+/* the transfers are asynchronous: there is always an IN transfer waiting for the next reply, and a write returns as
+ * soon as its OUT transfer is submitted. Pipelined requests then go out back to back, and their replies are picked up
+ * without a round trip through the kernel in between.
+ *
+ * There is no event thread, whoever waits for a transfer handles the events of all of them (possibly those of another
+ * connection, libusb takes care of that). */
+typedef struct
 {
-  static int firstcall = 0;
-  static int interface = 0; // number of connected devices
   libusb_device_handle *handle;
-  
+
+  struct libusb_transfer *in[IN_TRANSFERS];
+  uint8_t inbuf[IN_TRANSFERS][LOTHAR_MAX_TELEGRAM];
+  int arrived[IN_TRANSFERS];  // (boolean) the transfer completed, and waits to be read
+  size_t next;                // the transfer the next reply arrives in, they are read in the order they were posted
+
+  struct libusb_transfer *out[OUT_TRANSFERS];
+  uint8_t outbuf[OUT_TRANSFERS][LOTHAR_MAX_TELEGRAM];
+  int busy[OUT_TRANSFERS];    // (boolean) the transfer is in flight
+  int freed;                  // (boolean) an OUT transfer completed since the last time we looked
+  int failed;                 // (boolean) an OUT transfer failed, reported by the next read or write
+
+  uint32_t timeout;           // of a read or write in ms, 0 for none
+} usb_t;
+
+static void init(void)
+{
+  static int firstcall = 0;
+
   if(!firstcall)
   {
     libusb_init(NULL);
     firstcall = 1;
   }
+}
+
+static int index_of(struct libusb_transfer * const *transfers, size_t count, struct libusb_transfer const *transfer)
+{
+  size_t i;
+
+  for(i = 0; i < count && transfers[i] != transfer; ++i)
+    ;
+
+  return i;
+}
+
+static void LIBUSB_CALL in_done(struct libusb_transfer *transfer)
+{
+  usb_t *usb = (usb_t *)transfer->user_data;
+
+  usb->arrived[index_of(usb->in, IN_TRANSFERS, transfer)] = 1;
+}
+
+static void LIBUSB_CALL out_done(struct libusb_transfer *transfer)
+{
+  usb_t *usb = (usb_t *)transfer->user_data;
+
+  if(transfer->status != LIBUSB_TRANSFER_COMPLETED && transfer->status != LIBUSB_TRANSFER_CANCELLED)
+    usb->failed = 1;
+
+  usb->busy[index_of(usb->out, OUT_TRANSFERS, transfer)] = 0;
+  usb->freed = 1;
+}
+
+// post an IN transfer, if that fails it shows up as a failed transfer
+static void post(usb_t *usb, size_t i)
+{
+  usb->arrived[i] = 0;
+
+  if(libusb_submit_transfer(usb->in[i]))
+  {
+    usb->in[i]->status = LIBUSB_TRANSFER_ERROR;
+    usb->arrived[i] = 1;
+  }
+}
+
+// handle events until *completed is set, or until the timeout (if any) passes
+static int wait_for(int *completed, uint64_t deadline)
+{
+  struct timeval tv;
+  uint64_t now;
+
+  if(!deadline)
+  {
+    libusb_handle_events_completed(NULL, completed);
+    return 0;
+  }
+
+  if((now = lothar_time_us()) >= deadline)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_TIMEOUT);
+
+  tv.tv_sec = (deadline - now) / 1000000;
+  tv.tv_usec = (deadline - now) % 1000000;
+  libusb_handle_events_timeout_completed(NULL, &tv, completed);
+
+  return 0;
+}
+
+// when a read or write started now times out
+static uint64_t deadline_of(usb_t const *usb)
+{
+  return usb->timeout ? lothar_time_us() + (uint64_t)usb->timeout * 1000 : 0;
+}
+
+// wait for all OUT transfers to go out
+static void flush(usb_t *usb)
+{
+  size_t i;
+
+  for(i = 0; i < OUT_TRANSFERS; ++i)
+  {
+    for(;;)
+    {
+      usb->freed = 0;
+
+      if(!usb->busy[i])
+        break;
+
+      libusb_handle_events_completed(NULL, &usb->freed);
+    }
+  }
+}
+
+static void destroy(usb_t *usb)
+{
+  size_t i;
+
+  flush(usb);
+
+  for(i = 0; i < IN_TRANSFERS; ++i)
+  {
+    if(!usb->in[i])
+      continue;
+
+    if(!usb->arrived[i] && !libusb_cancel_transfer(usb->in[i]))
+    {
+      while(!usb->arrived[i])
+        libusb_handle_events_completed(NULL, &usb->arrived[i]);
+    }
+
+    libusb_free_transfer(usb->in[i]);
+  }
 
-  handle = libusb_open_device_with_vid_pid(NULL, vendor, product);
+  for(i = 0; i < OUT_TRANSFERS; ++i)
+  {
+    if(usb->out[i])
+      libusb_free_transfer(usb->out[i]);
+  }
+
+  libusb_release_interface(usb->handle, 0);
+  libusb_close(usb->handle);
+  free(usb);
+}
+
+// take over an open handle, NULL on failure (in which case the handle is closed)
+static usb_t *create(libusb_device_handle *handle)
+{
+  usb_t *usb;
+  size_t i;
 
-  if(handle)
-    libusb_claim_interface(handle, interface++);
-  else
+  // every device has its own interfaces, the nxt only has interface 0
+  if(libusb_claim_interface(handle, 0))
+  {
+    libusb_close(handle);
+    return NULL;
+  }
+
+  usb = (usb_t *)lothar_malloc(sizeof(usb_t));
+  memset(usb, 0, sizeof(usb_t));
+  usb->handle = handle;
+
+  for(i = 0; i < IN_TRANSFERS; ++i)
+  {
+    if(!(usb->in[i] = libusb_alloc_transfer(0)))
+    {
+      destroy(usb);
+      return NULL;
+    }
+
+    libusb_fill_bulk_transfer(usb->in[i], handle, LIBUSB_ENDPOINT_IN | 2, usb->inbuf[i], LOTHAR_MAX_TELEGRAM, in_done, usb, 0);
+  }
+
+  for(i = 0; i < OUT_TRANSFERS; ++i)
+  {
+    if(!(usb->out[i] = libusb_alloc_transfer(0)))
+    {
+      destroy(usb);
+      return NULL;
+    }
+
+    libusb_fill_bulk_transfer(usb->out[i], handle, LIBUSB_ENDPOINT_OUT | 1, usb->outbuf[i], 0, out_done, usb, 0);
+  }
+
+  for(i = 0; i < IN_TRANSFERS; ++i)
+    post(usb, i);
+
+  return usb;
+}
+
+// return the usb connection by vendor and product
+void *lothar_usb_new(uint16_t vendor, uint16_t product)
+{
+  libusb_device_handle *handle;
+  usb_t *usb = NULL;
+  
+  init();
+
+  if((handle = libusb_open_device_with_vid_pid(NULL, vendor, product)))
+    usb = create(handle);
+
+  if(!usb)
     LOTHAR_ERROR(LOTHAR_ERROR_USB_CANNOT_CREATE);
 
-  return handle;
+  return usb;
+}
+
+// open every device by vendor and product, found is called with each connection and its serial number (or bus address)
+int lothar_usb_enumerate(uint16_t vendor, uint16_t product, void (*found)(void *connection, char const *serial, void *user), void *user)
+{
+  libusb_device **list;
+  long count;
+  long i;
+  int result = 0;
+
+  init();
+
+  if((count = libusb_get_device_list(NULL, &list)) < 0)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_USB_CANNOT_CREATE);
+
+  for(i = 0; i < count; ++i)
+  {
+    struct libusb_device_descriptor desc;
+    libusb_device_handle *handle;
+    usb_t *usb;
+    char serial[32];
+
+    if(libusb_get_device_descriptor(list[i], &desc) || desc.idVendor != vendor || desc.idProduct != product)
+      continue;
+
+    if(libusb_open(list[i], &handle))
+      continue; // possibly in use by someone else
+
+    // the serial number of the nxt is its bluetooth address, which is as good a name as any
+    if(!desc.iSerialNumber || libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, (unsigned char *)serial, sizeof(serial)) <= 0)
+      sprintf(serial, "%03d:%03d", libusb_get_bus_number(list[i]), libusb_get_device_address(list[i]));
+
+    if(!(usb = create(handle)))
+      continue;
+
+    found(usb, serial, user);
+    ++result;
+  }
+
+  libusb_free_device_list(list, 1);
+
+  return result;
 }
 
 int lothar_usb_write(void *connection, uint8_t const *data, size_t len)
 {
-  int w;
-  if(libusb_bulk_transfer((libusb_device_handle *)connection, LIBUSB_ENDPOINT_OUT | 1, (uint8_t *)data, len, &w, 0))
+  usb_t *usb = (usb_t *)connection;
+  uint64_t deadline = deadline_of(usb);
+  size_t i;
+
+  if(len > LOTHAR_MAX_TELEGRAM)
+    LOTHAR_RETURN_ERROR(LOTHAR_ERROR_INVALID_ARGUMENT);
+
+  // find a free transfer, or wait for one
+  for(;;)
+  {
+    usb->freed = 0;
+
+    for(i = 0; i < OUT_TRANSFERS && usb->busy[i]; ++i)
+      ;
+
+    if(i < OUT_TRANSFERS)
+      break;
+
+    if(wait_for(&usb->freed, deadline) < 0)
+      return -1;
+  }
+
+  if(usb->failed)
   {
+    usb->failed = 0;
     LOTHAR_ERROR(LOTHAR_ERROR_NXT_WRITE_ERROR);
     return -1;
   }
 
-  return w;
+  memcpy(usb->outbuf[i], data, len);
+  usb->out[i]->length = len;
+  usb->out[i]->timeout = usb->timeout;
+  usb->busy[i] = 1;
+
+  if(libusb_submit_transfer(usb->out[i]))
+  {
+    usb->busy[i] = 0;
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_WRITE_ERROR);
+    return -1;
+  }
+
+  return len;
 }
 
 int lothar_usb_read(void *connection, uint8_t *data, size_t len)
 {
+  usb_t *usb = (usb_t *)connection;
+  struct libusb_transfer *transfer = usb->in[usb->next];
+  uint64_t deadline = deadline_of(usb);
   int r;
 
-  if(libusb_bulk_transfer((libusb_device_handle *)connection, LIBUSB_ENDPOINT_IN | 2, data, len, &r, 0))
+  // a request did not go out, its reply will not come
+  if(usb->failed)
   {
+    usb->failed = 0;
+    LOTHAR_ERROR(LOTHAR_ERROR_NXT_WRITE_ERROR);
+    return -1;
+  }
+
+  // on a timeout the transfer stays posted, the late reply is picked up by the next read
+  while(!usb->arrived[usb->next])
+  {
+    if(wait_for(&usb->arrived[usb->next], deadline) < 0)
+      return -1;
+  }
+
+  if(transfer->status != LIBUSB_TRANSFER_COMPLETED)
+  {
+    post(usb, usb->next);
+    usb->next = (usb->next + 1) % IN_TRANSFERS;
     LOTHAR_ERROR(LOTHAR_ERROR_NXT_READ_ERROR);
     return -1;
   }
+
+  r = MIN((size_t)transfer->actual_length, len);
+  memcpy(data, transfer->buffer, r);
+
+  // and wait for the next reply again
+  post(usb, usb->next);
+  usb->next = (usb->next + 1) % IN_TRANSFERS;
   
   return r;
 }
 
+int lothar_usb_set_timeout(void *connection, uint32_t ms)
+{
+  ((usb_t *)connection)->timeout = ms;
+  return 0;
+}
+
 int lothar_usb_close(void *connection)
 {
-  libusb_close((libusb_device_handle *)connection);
+  destroy((usb_t *)connection);
   return 0;
 }
 
@@ -10,6 +10,24 @@ int lothar_msleep(lothar_time_t ms)
   return 0;
 }
 
+int lothar_usleep(uint64_t us)
+{
+  Sleep((DWORD)((us + 999) / 1000)); // no finer granularity to be had
+  return 0;
+}
+
+uint64_t lothar_time_us(void)
+{
+  static LARGE_INTEGER frequency = {0};
+  LARGE_INTEGER now;
+
+  if(!frequency.QuadPart)
+    QueryPerformanceFrequency(&frequency);
+
+  QueryPerformanceCounter(&now);
+  return (uint64_t)(now.QuadPart / frequency.QuadPart) * 1000000 + (uint64_t)(now.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
 // hackish gettimeofday implementation
 static int gettimeofday(struct timeval *tp, void *tzp)
 {
@@ -27,6 +45,7 @@ static int gettimeofday(struct timeval *tp, void *tzp)
 #else // all posix compatible (Linux, BSD, OSX, other unixes)
 
 #include <unistd.h>
+#include <time.h>
 #include <sys/time.h>
 
 int lothar_msleep(lothar_time_t ms)
@@ -39,6 +58,35 @@ int lothar_msleep(lothar_time_t ms)
   return status;
 }
 
+int lothar_usleep(uint64_t us)
+{
+  struct timespec t;
+
+  t.tv_sec = us / 1000000;
+  t.tv_nsec = (us % 1000000) * 1000;
+
+  while(nanosleep(&t, &t) < 0)
+  {
+    if(errno != EINTR)
+      LOTHAR_RETURN_ERROR(LOTHAR_ERROR_OS_ERROR);
+  }
+
+  return 0;
+}
+
+uint64_t lothar_time_us(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#else
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+#endif
+}
+
 #endif
 
 // the difference between now and then, in milliseconds
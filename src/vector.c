@@ -56,7 +56,7 @@ void vector_insert(vector_t *vec, size_t i, void *item)
 
   vector_resize(vec, vec->size + 1);
 
-  for(_i = vec->size; _i > i; --_i)
+  for(_i = vec->size - 1; _i > i; --_i)
     vec->data[_i] = vec->data[_i - 1];
   
   vec->data[i] = item;
@@ -66,7 +66,7 @@ void *vector_remove(vector_t *vec, size_t i)
 {
   void *ret = vec->data[i];
 
-  for(; i < vec->size; ++i)
+  for(; i + 1 < vec->size; ++i)
     vec->data[i] = vec->data[i + 1];
 
   vector_resize(vec, vec->size - 1);
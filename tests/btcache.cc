@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+
+// the cache is internal to the library, it has no public header
+extern "C"
+{
+#include "../src/btcache.h"
+}
+
+using namespace std;
+
+class BtcacheTest : public testing::Test
+{
+protected:
+  string d_dir;
+  string d_path;
+
+  void SetUp()
+  {
+    char dir[] = "/tmp/lothar-btcache-XXXXXX";
+
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    d_dir = dir;
+    d_path = d_dir + "/cache";
+    setenv("LOTHAR_BLUETOOTH_CACHE", d_path.c_str(), 1);
+  }
+
+  void TearDown()
+  {
+    vector<string> entries = files();
+
+    for(size_t i = 0; i < entries.size(); ++i)
+      remove((d_dir + "/" + entries[i]).c_str());
+    rmdir(d_dir.c_str());
+    unsetenv("LOTHAR_BLUETOOTH_CACHE");
+  }
+
+  void write(string const &contents)
+  {
+    ofstream(d_path.c_str()) << contents;
+  }
+
+  vector<string> lines()
+  {
+    ifstream file(d_path.c_str());
+    vector<string> result;
+    string line;
+
+    while(getline(file, line))
+      result.push_back(line);
+    return result;
+  }
+
+  vector<string> files()
+  {
+    vector<string> result;
+    DIR *dir = opendir(d_dir.c_str());
+    struct dirent *entry;
+
+    while(dir && (entry = readdir(dir)))
+      if(entry->d_name[0] != '.')
+        result.push_back(entry->d_name);
+
+    if(dir)
+      closedir(dir);
+    return result;
+  }
+};
+
+TEST_F(BtcacheTest, Path)
+{
+  char path[256];
+
+  EXPECT_STREQ(d_path.c_str(), lothar_btcache_path(path, sizeof(path)));
+  EXPECT_EQ(NULL, lothar_btcache_path(path, 4));
+
+  // an empty path turns the cache off
+  setenv("LOTHAR_BLUETOOTH_CACHE", "", 1);
+  EXPECT_EQ(NULL, lothar_btcache_path(path, sizeof(path)));
+}
+
+TEST_F(BtcacheTest, Lookup)
+{
+  char address[18];
+
+  EXPECT_EQ(-1, lothar_btcache_lookup(d_path.c_str(), "NXT", address));
+
+  // lines that make no sense are skipped, the end of a line may be a windows one
+  write("garbage\n"
+        "00:16:53:12:5C:6\n"
+        "00:16:53:12:5C:67NXT\n"
+        "00:16:53:12:5C:67 my brick\r\n"
+        "00:16:53:AA:BB:CC NXT\n");
+
+  ASSERT_EQ(0, lothar_btcache_lookup(d_path.c_str(), "NXT", address));
+  EXPECT_STREQ("00:16:53:AA:BB:CC", address);
+  ASSERT_EQ(0, lothar_btcache_lookup(d_path.c_str(), "my brick", address));
+  EXPECT_STREQ("00:16:53:12:5C:67", address);
+  EXPECT_EQ(-1, lothar_btcache_lookup(d_path.c_str(), "NX", address));
+  EXPECT_EQ(-1, lothar_btcache_lookup(NULL, "NXT", address));
+}
+
+TEST_F(BtcacheTest, Store)
+{
+  char address[18];
+
+  EXPECT_EQ(0, lothar_btcache_store(d_path.c_str(), "NXT", "00:16:53:00:00:01"));
+  EXPECT_EQ(0, lothar_btcache_store(d_path.c_str(), "other", "00:16:53:00:00:02"));
+  EXPECT_EQ(0, lothar_btcache_store(d_path.c_str(), "NXT", "00:16:53:00:00:03"));
+
+  // the address is replaced, and the newest entry comes first
+  vector<string> const cached = lines();
+  ASSERT_EQ(2u, cached.size());
+  EXPECT_EQ("00:16:53:00:00:03 NXT", cached[0]);
+  EXPECT_EQ("00:16:53:00:00:02 other", cached[1]);
+
+  ASSERT_EQ(0, lothar_btcache_lookup(d_path.c_str(), "NXT", address));
+  EXPECT_STREQ("00:16:53:00:00:03", address);
+
+  // written aside and moved in place, nothing is left behind
+  vector<string> const entries = files();
+  ASSERT_EQ(1u, entries.size());
+  EXPECT_EQ("cache", entries[0]);
+
+  EXPECT_EQ(-1, lothar_btcache_store(d_path.c_str(), "NXT", "00:16:53"));
+  EXPECT_EQ(-1, lothar_btcache_store((d_dir + "/missing/cache").c_str(), "NXT", "00:16:53:00:00:04"));
+}
+
+TEST_F(BtcacheTest, Entries)
+{
+  char address[18];
+  char name[16];
+
+  for(int i = 0; i < 70; ++i)
+  {
+    sprintf(name, "brick %d", i);
+    ASSERT_EQ(0, lothar_btcache_store(d_path.c_str(), name, "00:16:53:00:00:01"));
+  }
+
+  // the oldest are dropped
+  EXPECT_EQ(64u, lines().size());
+  EXPECT_EQ(0, lothar_btcache_lookup(d_path.c_str(), "brick 69", address));
+  EXPECT_EQ(0, lothar_btcache_lookup(d_path.c_str(), "brick 6", address));
+  EXPECT_EQ(-1, lothar_btcache_lookup(d_path.c_str(), "brick 5", address));
+}
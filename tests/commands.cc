@@ -3,6 +3,12 @@
 #include "commands.hh"
 #include "error_handling.hh"
 #include "connectionmock.hh"
+#include "simulator.h"
+#include "replies.h"
+#include "codec.h"
+#include "stats.h"
+#include "motor.h"
+#include "sensor.h"
 
 using namespace std;
 using namespace lothar;
@@ -107,6 +113,17 @@ TEST(CommandsTest, StopProgram)
   stopprogram(mock);
 }
 
+TEST(CommandsTest, WriteFails)
+{
+  ConnectionMock mock;
+
+  // a command without a reply reports a failed write, too
+  EXPECT_CALL(mock, write(_, _)).Times(2).WillRepeatedly(Return(-1));
+  EXPECT_GT(0, lothar_stopprogram(mock));
+  EXPECT_GT(0, lothar_resetmotorposition(mock, OUTPUT_C, 1));
+  lothar_clear_error();
+}
+
 TEST(CommandsTest, PlaySoundFile)
 {
   ConnectionMock mock;
@@ -374,6 +391,68 @@ TEST(CommandsTest, GetInputValues)
   EXPECT_EQ(val, cal);
 }
 
+TEST(CommandsTest, ReadOutputState)
+{
+  ConnectionMock mock;
+
+  uint8_t buf[4];
+  htonxtl(static_cast<uint32_t>(-360), buf); 
+
+  vector<uint8_t> const request = create_request(6, true, string("\x02")); // port (C)
+  vector<uint8_t> const reply   = create_reply(6, string("\x02\x4b\x01\x01\0\x20", 6) + string(4, '\0') + string(buf, buf + 4) + string(8, '\0'));
+
+  mock.expect_write(request);
+  mock.expect_read(reply);
+
+  outputstate state = readoutputstate(mock, OUTPUT_C);
+
+  EXPECT_EQ(OUTPUT_C, state.port);
+  EXPECT_EQ(75, state.power);
+  EXPECT_EQ(RUNSTATE_RUNNING, state.runstate);
+  EXPECT_EQ(-360, state.tachocount);
+  EXPECT_EQ(0, state.rotationcount);
+}
+
+TEST(CommandsTest, ReadInputValuesWrongPort)
+{
+  ConnectionMock mock;
+
+  vector<uint8_t> const request = create_request(7, true, string("\x03")); // INPUT_4
+  vector<uint8_t> const reply   = create_reply(7, string("\x01") + string(12, '\x01')); // but about INPUT_2
+
+  mock.expect_write(request);
+  mock.expect_read(reply);
+
+  EXPECT_THROW(readinputvalues(mock, INPUT_4), Error);
+}
+
+TEST(CommandsTest, ReplyViews)
+{
+  uint8_t buf[2];
+  htonxts(1000, buf);
+
+  vector<uint8_t> const reply = create_reply(7, string("\x03\x01\0\x01\x20", 5) + string(buf, buf + 2) + string(buf, buf + 2) + string("\x01\0\0\0", 4));
+
+  ASSERT_EQ(LOTHAR_INPUTVALUES_REPLY, reply.size());
+  EXPECT_EQ(0, lothar_inputvalues_view(&reply[0], reply.size()));
+  EXPECT_EQ(INPUT_4, lothar_inputvalues_view_port(&reply[0]));
+  EXPECT_EQ(SENSOR_MODE_BOOLEANMODE, lothar_inputvalues_view_mode(&reply[0]));
+  EXPECT_EQ(1000, lothar_inputvalues_view_normvalue(&reply[0]));
+  EXPECT_EQ(1, lothar_inputvalues_view_scaledvalue(&reply[0]));
+
+  inputvalues values;
+  EXPECT_EQ(0, lothar_inputvalues_decode(&reply[0], reply.size(), &values));
+  EXPECT_EQ(SENSOR_SWITCH, values.type);
+  EXPECT_EQ(1000, values.rawvalue);
+
+  // truncated, another command, or an error from the brick
+  EXPECT_EQ(-LOTHAR_ERROR_NXT_READ_ERROR, lothar_inputvalues_view(&reply[0], reply.size() - 1));
+  EXPECT_EQ(-LOTHAR_ERROR_NXT_READ_ERROR, lothar_outputstate_view(&reply[0], reply.size()));
+
+  vector<uint8_t> failed = create_reply(6, string(22, '\0'), '\x20');
+  EXPECT_EQ(-LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS, lothar_outputstate_view(&failed[0], failed.size()));
+}
+
 TEST(CommandsTest, ResetInputScaledValue)
 {
   ConnectionMock mock;
@@ -620,3 +699,403 @@ TEST(CommandsTest, MessageRead)
   EXPECT_EQ(message.size(), len);
   EXPECT_EQ(message, string(data, data + len));
 }
+
+TEST(CommandsTest, Pipeline)
+{
+  ConnectionMock mock;
+
+  uint16_t val = 8000;
+  uint8_t buf[2];
+  htonxts(val, buf);
+
+  vector<uint8_t> const battery_request = create_request(11, true, "");
+  vector<uint8_t> const battery_reply   = create_reply(11, string(buf, buf + 2));
+  vector<uint8_t> const ls_request      = create_request(14, true, "\x01");
+  vector<uint8_t> const ls_reply        = create_reply(14, "\x14");
+
+  {
+    // all requests go out before the first reply is read
+    InSequence s;
+    mock.expect_write(battery_request);
+    mock.expect_write(ls_request);
+    mock.expect_read(battery_reply);
+    mock.expect_read(ls_reply);
+  }
+
+  uint16_t level = 0;
+  uint8_t ls = 0;
+
+  pipeline_begin(mock);
+  getbatterylevel(mock, &level);
+  lsgetstatus(mock, INPUT_2, &ls);
+
+  EXPECT_EQ(2u, pipeline_pending(mock));
+  EXPECT_EQ(0, level);
+  EXPECT_EQ(0, ls);
+
+  pipeline_end(mock);
+
+  EXPECT_EQ(0u, pipeline_pending(mock));
+  EXPECT_EQ(val, level);
+  EXPECT_EQ(20, ls);
+}
+
+TEST(CommandsTest, PipelineResultsWait)
+{
+  lothar_connection_t *connection = lothar_connection_open_simulator();
+  lothar_motor_t *motor = lothar_motor_open(connection, OUTPUT_B);
+  lothar_sensor_t *sensor = lothar_sensor_open(connection, INPUT_1, SENSOR_SWITCH);
+  uint8_t const request[] = {0x00, 0x0b};
+  uint8_t reply[LOTHAR_REPLY_SIZE_GETBATTERYLEVEL];
+  uint16_t voltage = 0;
+  uint16_t value = 0xffff;
+  int8_t power = 0;
+  size_t pending = 1;
+
+  ASSERT_EQ(0, lothar_setoutputstate(connection, OUTPUT_B, 42, MOTOR_MODE_MOTORON, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0));
+  ASSERT_EQ(0, lothar_pipeline_begin(connection));
+  EXPECT_EQ(0, lothar_getbatterylevel(connection, &voltage));
+
+  // these return their result right away, so they wait for it (after the battery level)
+  EXPECT_EQ(0, lothar_motor_power(motor, &power));
+  EXPECT_EQ(42, power);
+  EXPECT_NE(0u, voltage);
+  EXPECT_EQ(0, lothar_sensor_value(sensor, &value));
+  EXPECT_NE(0xffff, value);
+  EXPECT_EQ(0, lothar_transact(connection, request, sizeof(request), reply, sizeof(reply)));
+  EXPECT_EQ(voltage, lothar_getbatterylevel_reply_voltage(reply));
+
+  EXPECT_EQ(0, lothar_pipeline_pending(connection, &pending));
+  EXPECT_EQ(0u, pending);
+  EXPECT_EQ(0, lothar_pipeline_end(connection));
+
+  lothar_sensor_close(&sensor);
+  lothar_motor_close(&motor);
+  lothar_connection_close(&connection);
+}
+
+TEST(CommandsTest, PipelineOutOfOrderReply)
+{
+  ConnectionMock mock;
+
+  vector<uint8_t> const battery_request = create_request(11, true, "");
+  vector<uint8_t> const ls_request      = create_request(14, true, "\x01");
+  vector<uint8_t> const wrong_reply     = create_reply(13, string(2, '\0')); // not a reply to getbatterylevel
+
+  {
+    InSequence s;
+    mock.expect_write(battery_request);
+    mock.expect_write(ls_request);
+    mock.expect_read(wrong_reply);
+  }
+
+  uint16_t level;
+  uint8_t ls;
+
+  pipeline_begin(mock);
+  getbatterylevel(mock, &level);
+  lsgetstatus(mock, INPUT_2, &ls);
+
+  // the second reply is never read, as the replies no longer line up with the requests
+  EXPECT_THROW(pipeline_end(mock), lothar::Error);
+  EXPECT_EQ(0u, pipeline_pending(mock));
+}
+
+namespace
+{
+  struct AsyncResult
+  {
+    vector<int> status;
+    uint16_t level;
+    uint8_t bytesready;
+    lothar_connection_t *connection;
+  };
+
+  void battery_callback(lothar_connection_t *connection, int status, uint16_t batterylevel, void *user)
+  {
+    AsyncResult *result = static_cast<AsyncResult *>(user);
+    result->status.push_back(status);
+    result->level = batterylevel;
+    result->connection = connection;
+  }
+
+  void lsgetstatus_callback(lothar_connection_t *, int status, lothar_input_port, uint8_t bytesready, void *user)
+  {
+    AsyncResult *result = static_cast<AsyncResult *>(user);
+    result->status.push_back(status);
+    result->bytesready = bytesready;
+  }
+
+  // tries to wait for a reply from within a callback
+  void nested_callback(lothar_connection_t *connection, int status, uint16_t, void *user)
+  {
+    AsyncResult *result = static_cast<AsyncResult *>(user);
+    result->status.push_back(status);
+    result->status.push_back(lothar_getbatterylevel(connection, NULL));
+    result->status.push_back(lothar_lsgetstatus_async(connection, INPUT_2, lsgetstatus_callback, user));
+  }
+}
+
+TEST(CommandsTest, Async)
+{
+  ConnectionMock mock;
+
+  uint16_t val = 8000;
+  uint8_t buf[2];
+  htonxts(val, buf);
+
+  vector<uint8_t> const battery_request = create_request(11, true, "");
+  vector<uint8_t> const battery_reply   = create_reply(11, string(buf, buf + 2));
+  vector<uint8_t> const ls_request      = create_request(14, true, "\x01");
+  vector<uint8_t> const ls_reply        = create_reply(14, "\x14");
+
+  {
+    InSequence s;
+    mock.expect_write(battery_request);
+    mock.expect_write(ls_request);
+    mock.expect_read(battery_reply);
+    mock.expect_read(ls_reply);
+  }
+
+  AsyncResult result = AsyncResult();
+
+  getbatterylevel_async(mock, battery_callback, &result);
+  lsgetstatus_async(mock, INPUT_2, lsgetstatus_callback, &result);
+  EXPECT_EQ(2u, pipeline_pending(mock));
+  EXPECT_TRUE(result.status.empty());
+
+  async_dispatch(mock, 1);
+  ASSERT_EQ(1u, result.status.size());
+  EXPECT_EQ(val, result.level);
+  EXPECT_EQ(static_cast<lothar_connection_t *>(mock), result.connection);
+
+  async_dispatch(mock);
+  ASSERT_EQ(2u, result.status.size());
+  EXPECT_EQ(0, result.status[1]);
+  EXPECT_EQ(20, result.bytesready);
+  EXPECT_EQ(0u, pipeline_pending(mock));
+}
+
+TEST(CommandsTest, AsyncErrorReachesAllCallbacks)
+{
+  ConnectionMock mock;
+
+  vector<uint8_t> const battery_request = create_request(11, true, "");
+  vector<uint8_t> const ls_request      = create_request(14, true, "\x01");
+  vector<uint8_t> const wrong_reply     = create_reply(13, string(2, '\0'));
+
+  {
+    InSequence s;
+    mock.expect_write(battery_request);
+    mock.expect_write(ls_request);
+    mock.expect_read(wrong_reply);
+  }
+
+  AsyncResult result = AsyncResult();
+
+  getbatterylevel_async(mock, battery_callback, &result);
+  lsgetstatus_async(mock, INPUT_2, lsgetstatus_callback, &result);
+
+  EXPECT_THROW(async_dispatch(mock), lothar::Error);
+  ASSERT_EQ(2u, result.status.size());
+  EXPECT_EQ(-LOTHAR_ERROR_NXT_READ_ERROR, result.status[0]);
+  EXPECT_EQ(-LOTHAR_ERROR_NXT_READ_ERROR, result.status[1]);
+  EXPECT_EQ(0u, pipeline_pending(mock));
+}
+
+TEST(CommandsTest, AsyncCommandFromCallback)
+{
+  ConnectionMock mock;
+
+  uint8_t buf[2] = {0, 0};
+
+  vector<uint8_t> const battery_request = create_request(11, true, "");
+  vector<uint8_t> const battery_reply   = create_reply(11, string(buf, buf + 2));
+  vector<uint8_t> const ls_request      = create_request(14, true, "\x01");
+  vector<uint8_t> const ls_reply        = create_reply(14, "\x14");
+
+  {
+    InSequence s;
+    mock.expect_write(battery_request);
+    mock.expect_read(battery_reply);
+    mock.expect_write(ls_request);
+    mock.expect_read(ls_reply);
+  }
+
+  AsyncResult result = AsyncResult();
+
+  getbatterylevel_async(mock, nested_callback, &result);
+  async_dispatch(mock);
+
+  ASSERT_EQ(4u, result.status.size());
+  EXPECT_EQ(0, result.status[0]);
+  EXPECT_EQ(-LOTHAR_ERROR_INVALID_ARGUMENT, result.status[1]); // waiting for a reply is not allowed here
+  EXPECT_EQ(0, result.status[2]);
+  EXPECT_EQ(0, result.status[3]);
+  EXPECT_EQ(20, result.bytesready);
+}
+
+TEST(CommandsTest, IoThread)
+{
+  ConnectionMock mock;
+
+  uint16_t val = 8000;
+  uint8_t buf[2];
+  htonxts(val, buf);
+
+  vector<uint8_t> const tone_request    = create_request(3, false, string("\xC8\x00\x64\x00", 4));
+  vector<uint8_t> const battery_request = create_request(11, true, "");
+  vector<uint8_t> const battery_reply   = create_reply(11, string(buf, buf + 2));
+  vector<uint8_t> const ls_request      = create_request(14, true, "\x01");
+  vector<uint8_t> const ls_reply        = create_reply(14, "\x14");
+
+  {
+    InSequence s;
+    mock.expect_write(tone_request);
+    mock.expect_write(battery_request);
+    mock.expect_read(battery_reply);
+    mock.expect_write(ls_request);
+    mock.expect_read(ls_reply);
+  }
+
+  io_thread_start(mock);
+
+  // the commands are carried out by the I/O thread, but look just the same to the caller
+  playtone(mock, 200, 100);
+  EXPECT_EQ(val, getbatterylevel(mock));
+
+  AsyncResult result = AsyncResult();
+  lsgetstatus_async(mock, INPUT_2, lsgetstatus_callback, &result);
+  async_dispatch(mock);
+
+  ASSERT_EQ(1u, result.status.size());
+  EXPECT_EQ(0, result.status[0]);
+  EXPECT_EQ(20, result.bytesready);
+  EXPECT_EQ(0u, pipeline_pending(mock));
+
+  EXPECT_THROW(pipeline_begin(mock), lothar::Error);
+
+  io_thread_stop(mock);
+}
+
+namespace
+{
+  void count_callback(lothar_connection_t *, int status, uint16_t, void *user)
+  {
+    if(status == 0)
+      ++*static_cast<size_t *>(user);
+  }
+}
+
+TEST(CommandsTest, UrgentLane)
+{
+  lothar_connection_t *connection = lothar_connection_open_simulator();
+  size_t const queries = 2 * LOTHAR_MAX_PENDING;
+  size_t replies = 0;
+  size_t depth = 0;
+  size_t requests = 0;
+
+  lothar_simulator_set_latency(connection, 20000);
+  ASSERT_EQ(0, lothar_io_thread_start(connection));
+
+  // more queries than can be in flight, the rest waits in the queue
+  for(size_t i = 0; i < queries; ++i)
+    ASSERT_EQ(0, lothar_getbatterylevel_async(connection, count_callback, &replies));
+  EXPECT_EQ(0, lothar_io_queue_depth(connection, LOTHAR_PRIORITY_NORMAL, &depth));
+  EXPECT_LT(0u, depth);
+
+  // stopping a motor overtakes them (the I/O thread may have written the query after it by the time we look)
+  EXPECT_EQ(0, lothar_setoutputstate(connection, OUTPUT_A, 0, MOTOR_MODE_BRAKE, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0));
+  EXPECT_EQ(0, lothar_simulator_requests(connection, &requests));
+  EXPECT_GE((size_t)LOTHAR_MAX_PENDING + 2, requests);
+
+  EXPECT_EQ(0, lothar_async_dispatch(connection, 0));
+  EXPECT_EQ(queries, replies);
+  EXPECT_EQ(0, lothar_io_queue_depth(connection, LOTHAR_PRIORITY_URGENT, &depth));
+  EXPECT_EQ(0u, depth);
+
+  lothar_connection_close(&connection);
+}
+
+TEST(CommandsTest, CoalesceIoThread)
+{
+  lothar_connection_t *connection = lothar_connection_open_simulator();
+  int const commands = 24; // fewer than fit in the ring
+  size_t replies = 0;
+  size_t dropped = 0;
+  int8_t power = 0;
+
+  lothar_simulator_set_latency(connection, 20000);
+  ASSERT_EQ(0, lothar_io_thread_start(connection));
+  ASSERT_EQ(0, lothar_coalesce_begin(connection));
+
+  // while the I/O thread waits for the reply, the commands for A pile up in the ring
+  ASSERT_EQ(0, lothar_getbatterylevel_async(connection, count_callback, &replies));
+  for(int i = 1; i <= commands; ++i)
+    ASSERT_EQ(0, lothar_setoutputstate(connection, OUTPUT_A, i, MOTOR_MODE_MOTORON, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0));
+
+  // the newest one went out before the query that came after it
+  ASSERT_EQ(0, lothar_getoutputstate(connection, OUTPUT_A, &power, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL));
+  EXPECT_EQ(commands, power);
+  EXPECT_EQ(0, lothar_async_dispatch(connection, 0));
+  EXPECT_EQ(1u, replies);
+
+  EXPECT_EQ(0, lothar_coalesce_dropped(connection, OUTPUT_A, &dropped));
+  EXPECT_LT(0u, dropped);
+
+  lothar_opcode_stats_t stats;
+  EXPECT_EQ(0, lothar_connection_stats(connection, 0x04, &stats));
+  EXPECT_EQ((size_t)commands, stats.requests + dropped);
+
+  lothar_connection_close(&connection);
+}
+
+TEST(CommandsTest, CodecTable)
+{
+  lothar_codec_command_t const *command = lothar_codec_command(LOTHAR_OPCODE_SETOUTPUTSTATE);
+
+  EXPECT_STREQ("SETOUTPUTSTATE", command->name);
+  EXPECT_EQ(LOTHAR_CODEC_NO_REPLY, command->type);
+  EXPECT_EQ(12, command->request);
+  EXPECT_TRUE(lothar_codec_command(0x50)->name == NULL);
+
+  // the views of replies.h read the fields where the table puts them
+  EXPECT_EQ(LOTHAR_OUTPUTSTATE_REPLY, (int)lothar_codec_command(LOTHAR_OPCODE_GETOUTPUTSTATE)->reply);
+  EXPECT_EQ(LOTHAR_INPUTVALUES_REPLY, (int)lothar_codec_command(LOTHAR_OPCODE_GETINPUTVALUES)->reply);
+}
+
+TEST(CommandsTest, CodecObjects)
+{
+  ConnectionMock mock;
+  constexpr auto command = codec::setoutputstate(OUTPUT_B, 120, MOTOR_MODE_MOTORON, REGULATION_MODE_SPEED, 20, RUNSTATE_RAMPUP, 16843009);
+  vector<uint8_t> const request(command.request.begin(), command.request.end());
+
+  static_assert(sizeof(command.request) == LOTHAR_REQUEST_SIZE_SETOUTPUTSTATE, "the request is exactly as large as the table says");
+  EXPECT_EQ(100, lothar_setoutputstate_request_power(command.request.data()));
+  EXPECT_EQ(16843009u, lothar_setoutputstate_request_tacholimit(command.request.data()));
+
+  // the same bytes as the C function
+  mock.expect_write(request);
+  setoutputstate(mock, OUTPUT_B, 120, MOTOR_MODE_MOTORON, REGULATION_MODE_SPEED, 20, RUNSTATE_RAMPUP, 16843009);
+
+  mock.expect_write(request);
+  send(mock, command);
+}
+
+TEST(CommandsTest, CodecTransact)
+{
+  ConnectionMock mock;
+  codec::command<LOTHAR_OPCODE_GETBATTERYLEVEL>::reply_type reply;
+  uint8_t const wrong[] = {LOTHAR_CODEC_REPLY, LOTHAR_OPCODE_SETOUTPUTSTATE, 0};
+  vector<uint8_t> const request = create_request(11, true, "");
+  vector<uint8_t> const response = create_reply(11, "\x40\x1f"); // 8000 mV
+
+  mock.expect_write(request);
+  mock.expect_read(response);
+
+  transact(mock, codec::getbatterylevel(), reply);
+  EXPECT_EQ(8000, lothar_getbatterylevel_reply_voltage(reply.data()));
+
+  // frames that do not match the table are not sent
+  EXPECT_EQ(-LOTHAR_ERROR_INVALID_ARGUMENT, lothar_transact(mock, wrong, sizeof(wrong), NULL, 0));
+}
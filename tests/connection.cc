@@ -0,0 +1,316 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "connection.hh"
+#include "commands.h"
+#include "simulator.h"
+#include "stats.h"
+
+using namespace std;
+using namespace lothar;
+
+namespace
+{
+  // records every call to write, writev and writebatch
+  struct Recorder
+  {
+    vector<vector<uint8_t> > writes;
+    size_t writevs;
+    vector<size_t> batches;
+
+    Recorder() : writevs(0)
+    {}
+  };
+
+  int recorder_read(void *, uint8_t *, size_t)
+  {
+    return -1;
+  }
+
+  int recorder_write(void *r, uint8_t const *data, size_t len)
+  {
+    static_cast<Recorder *>(r)->writes.push_back(vector<uint8_t>(data, data + len));
+    return len;
+  }
+
+  int recorder_close(void *)
+  {
+    return 0;
+  }
+
+  int recorder_writev(void *r, lothar_iovec_t const *iov, size_t iovcount)
+  {
+    Recorder *recorder = static_cast<Recorder *>(r);
+    vector<uint8_t> message;
+
+    for(size_t i = 0; i < iovcount; ++i)
+      message.insert(message.end(), iov[i].data, iov[i].data + iov[i].len);
+
+    ++recorder->writevs;
+    recorder->writes.push_back(message);
+    return message.size();
+  }
+
+  int recorder_writebatch(void *r, lothar_iovec_t const *telegrams, size_t count)
+  {
+    Recorder *recorder = static_cast<Recorder *>(r);
+    int len = 0;
+
+    for(size_t i = 0; i < count; ++i)
+      len += recorder_write(r, telegrams[i].data, telegrams[i].len);
+
+    recorder->batches.push_back(count);
+    return len;
+  }
+
+  lothar_connection_vtable const write_vtable = {recorder_read, recorder_write, recorder_close, NULL};
+  lothar_connection_vtable const writev_vtable = {recorder_read, recorder_write, recorder_close, recorder_writev};
+  lothar_connection_vtable const batch_vtable = {recorder_read, recorder_write, recorder_close, NULL, NULL, recorder_writebatch};
+
+  uint8_t const first[] = {1, 2, 3};
+  uint8_t const second[] = {4, 5};
+}
+
+TEST(ConnectionTest, WritevGathers)
+{
+  Recorder recorder;
+  lothar_connection_t *connection = lothar_connection_open_custom(&write_vtable, &recorder);
+  lothar_iovec_t iov[2] = {{first, sizeof(first)}, {second, sizeof(second)}};
+
+  EXPECT_EQ(5, lothar_connection_writev(connection, iov, 2));
+
+  // without a writev in the vtable, this still results in a single message
+  ASSERT_EQ(1u, recorder.writes.size());
+  EXPECT_EQ(vector<uint8_t>({1, 2, 3, 4, 5}), recorder.writes[0]);
+
+  lothar_connection_close(&connection);
+}
+
+TEST(ConnectionTest, WritevVtable)
+{
+  Recorder recorder;
+  lothar_connection_t *connection = lothar_connection_open_custom(&writev_vtable, &recorder);
+  lothar_iovec_t iov[2] = {{first, sizeof(first)}, {second, sizeof(second)}};
+
+  EXPECT_EQ(5, lothar_connection_writev(connection, iov, 2));
+
+  EXPECT_EQ(1u, recorder.writevs);
+  ASSERT_EQ(1u, recorder.writes.size());
+  EXPECT_EQ(vector<uint8_t>({1, 2, 3, 4, 5}), recorder.writes[0]);
+
+  lothar_connection_close(&connection);
+}
+
+TEST(ConnectionTest, WritevTooManyBuffers)
+{
+  Recorder recorder;
+  lothar_connection_t *connection = lothar_connection_open_custom(&writev_vtable, &recorder);
+  lothar_iovec_t iov[LOTHAR_MAX_IOV + 1];
+
+  for(size_t i = 0; i < LOTHAR_MAX_IOV + 1; ++i)
+  {
+    iov[i].data = first;
+    iov[i].len = sizeof(first);
+  }
+
+  EXPECT_GT(0, lothar_connection_writev(connection, iov, LOTHAR_MAX_IOV + 1));
+  EXPECT_TRUE(recorder.writes.empty());
+
+  lothar_connection_close(&connection);
+}
+
+TEST(ConnectionTest, CommandIsSingleWrite)
+{
+  Recorder recorder;
+  lothar_connection_t *connection = lothar_connection_open_custom(&write_vtable, &recorder);
+
+  EXPECT_EQ(0, lothar_messagewrite(connection, 1, first, sizeof(first)));
+
+  ASSERT_EQ(1u, recorder.writes.size());
+  EXPECT_EQ(vector<uint8_t>({0x80, 0x09, 1, 3, 1, 2, 3}), recorder.writes[0]);
+
+  lothar_connection_close(&connection);
+}
+
+TEST(ConnectionTest, Combine)
+{
+  Recorder recorder;
+  lothar_connection_t *connection = lothar_connection_open_custom(&batch_vtable, &recorder);
+  uint16_t voltage;
+
+  EXPECT_EQ(0, lothar_combine_begin(connection));
+  EXPECT_EQ(0, lothar_playtone(connection, 440, 10));
+  EXPECT_EQ(0, lothar_playtone(connection, 880, 10));
+  EXPECT_EQ(0, lothar_stopsoundplayback(connection));
+  EXPECT_TRUE(recorder.writes.empty());
+
+  // held back commands go out first, together
+  EXPECT_GT(0, lothar_getbatterylevel(connection, &voltage)); // the recorder does not reply
+  lothar_clear_error();
+
+  ASSERT_EQ(1u, recorder.batches.size());
+  EXPECT_EQ(3u, recorder.batches[0]);
+  ASSERT_EQ(4u, recorder.writes.size());
+  EXPECT_EQ(vector<uint8_t>({0x80, 0x0c}), recorder.writes[2]);
+  EXPECT_EQ(vector<uint8_t>({0x00, 0x0b}), recorder.writes[3]);
+
+  EXPECT_EQ(0, lothar_playtone(connection, 440, 10));
+  EXPECT_EQ(0, lothar_combine_end(connection));
+  EXPECT_EQ(2u, recorder.batches.size());
+  EXPECT_EQ(5u, recorder.writes.size());
+
+  // and without combining every command is written by itself
+  EXPECT_EQ(0, lothar_playtone(connection, 440, 10));
+  EXPECT_EQ(2u, recorder.batches.size());
+  EXPECT_EQ(6u, recorder.writes.size());
+
+  lothar_connection_close(&connection);
+}
+
+TEST(ConnectionTest, CombineCoalesce)
+{
+  Recorder recorder;
+  lothar_connection_t *connection = lothar_connection_open_custom(&batch_vtable, &recorder);
+  lothar_opcode_stats_t stats;
+  size_t dropped;
+
+  EXPECT_EQ(0, lothar_combine_begin(connection));
+  EXPECT_EQ(0, lothar_coalesce_begin(connection));
+  EXPECT_EQ(0, lothar_playtone(connection, 440, 10));
+  EXPECT_EQ(0, lothar_setoutputstate(connection, OUTPUT_A, 10, MOTOR_MODE_MOTORON, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0));
+  EXPECT_EQ(0, lothar_setoutputstate(connection, OUTPUT_B, 20, MOTOR_MODE_MOTORON, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0));
+  EXPECT_EQ(0, lothar_setoutputstate(connection, OUTPUT_A, 30, MOTOR_MODE_MOTORON, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0));
+  EXPECT_EQ(0, lothar_combine_flush(connection));
+
+  // the first command for A never goes out
+  ASSERT_EQ(3u, recorder.writes.size());
+  EXPECT_EQ(0x03, recorder.writes[0][1]);
+  EXPECT_EQ(OUTPUT_B, recorder.writes[1][2]);
+  EXPECT_EQ(OUTPUT_A, recorder.writes[2][2]);
+  EXPECT_EQ(30, recorder.writes[2][3]);
+
+  EXPECT_EQ(0, lothar_coalesce_dropped(connection, OUTPUT_A, &dropped));
+  EXPECT_EQ(1u, dropped);
+  EXPECT_EQ(0, lothar_coalesce_dropped(connection, OUTPUT_B, &dropped));
+  EXPECT_EQ(0u, dropped);
+
+  // one for all outputs replaces those for any of them
+  EXPECT_EQ(0, lothar_setoutputstate(connection, OUTPUT_C, 40, MOTOR_MODE_MOTORON, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0));
+  EXPECT_EQ(0, lothar_setoutputstate(connection, OUTPUT_ALL, 0, MOTOR_MODE_BRAKE, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0));
+  EXPECT_EQ(0, lothar_combine_end(connection));
+
+  ASSERT_EQ(4u, recorder.writes.size());
+  EXPECT_EQ(OUTPUT_ALL, recorder.writes[3][2]);
+  EXPECT_EQ(0, lothar_coalesce_dropped(connection, OUTPUT_C, &dropped));
+  EXPECT_EQ(1u, dropped);
+
+  EXPECT_EQ(0, lothar_connection_stats(connection, 0x04, &stats));
+  EXPECT_EQ(3u, stats.requests);
+
+  EXPECT_EQ(-LOTHAR_ERROR_INVALID_ARGUMENT, lothar_coalesce_dropped(connection, (lothar_output_port)5, &dropped));
+  lothar_clear_error();
+
+  EXPECT_EQ(0, lothar_coalesce_end(connection));
+  lothar_connection_close(&connection);
+}
+
+TEST(ConnectionTest, CombineCoalesceInOrder)
+{
+  Recorder recorder;
+  lothar_connection_t *connection = lothar_connection_open_custom(&batch_vtable, &recorder);
+  size_t dropped;
+
+  EXPECT_EQ(0, lothar_combine_begin(connection));
+  EXPECT_EQ(0, lothar_coalesce_begin(connection));
+  EXPECT_EQ(0, lothar_setoutputstate(connection, OUTPUT_A, 10, MOTOR_MODE_MOTORON, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0));
+  EXPECT_EQ(0, lothar_resetmotorposition(connection, OUTPUT_A, 0));
+  EXPECT_EQ(0, lothar_setoutputstate(connection, OUTPUT_A, 30, MOTOR_MODE_MOTORON, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0));
+  EXPECT_EQ(0, lothar_combine_end(connection));
+
+  // a command for A in between keeps the one before it, the order on the wire is the order they were sent in
+  ASSERT_EQ(3u, recorder.writes.size());
+  EXPECT_EQ(10, recorder.writes[0][3]);
+  EXPECT_EQ(0x0a, recorder.writes[1][1]);
+  EXPECT_EQ(30, recorder.writes[2][3]);
+
+  EXPECT_EQ(0, lothar_coalesce_dropped(connection, OUTPUT_A, &dropped));
+  EXPECT_EQ(0u, dropped);
+
+  EXPECT_EQ(0, lothar_coalesce_end(connection));
+  lothar_connection_close(&connection);
+}
+
+TEST(ConnectionTest, CombineWithoutBatch)
+{
+  Recorder recorder;
+  lothar_connection_t *connection = lothar_connection_open_custom(&write_vtable, &recorder);
+
+  EXPECT_EQ(0, lothar_combine_begin(connection));
+  for(int i = 0; i < LOTHAR_MAX_BATCH + 1; ++i)
+    EXPECT_EQ(0, lothar_playtone(connection, 440, 10));
+
+  // the first batch went out when it was full
+  EXPECT_EQ((size_t)LOTHAR_MAX_BATCH, recorder.writes.size());
+
+  // closing writes the rest
+  lothar_connection_close(&connection);
+  EXPECT_EQ((size_t)LOTHAR_MAX_BATCH + 1, recorder.writes.size());
+}
+
+TEST(ConnectionTest, Timeout)
+{
+  lothar_connection_t *connection = lothar_connection_open_simulator();
+  uint16_t voltage;
+  char name[20];
+
+  lothar_simulator_set_latency(connection, 50000);
+  EXPECT_EQ(0, lothar_connection_set_timeout(connection, 10));
+  EXPECT_EQ(-LOTHAR_ERROR_TIMEOUT, lothar_getbatterylevel(connection, &voltage));
+  lothar_clear_error();
+
+  // the late reply to the battery level is skipped, not taken for the program name
+  EXPECT_EQ(0, lothar_connection_set_timeout(connection, 0));
+  EXPECT_EQ(-LOTHAR_ERROR_NO_ACTIVE_PROGRAM, lothar_getcurrentprogramname(connection, name));
+  lothar_clear_error();
+  EXPECT_EQ(0, lothar_getbatterylevel(connection, &voltage));
+
+  lothar_connection_close(&connection);
+}
+
+TEST(ConnectionTest, LostRequest)
+{
+  lothar_connection_t *connection = lothar_connection_open_simulator();
+  uint16_t voltage;
+  uint32_t sleep;
+
+  // a request that never arrives times out, and has no late reply to skip
+  EXPECT_EQ(0, lothar_connection_set_timeout(connection, 10));
+  EXPECT_EQ(0, lothar_simulator_drop_requests(connection, 1));
+  EXPECT_EQ(-LOTHAR_ERROR_TIMEOUT, lothar_getbatterylevel(connection, &voltage));
+  lothar_clear_error();
+
+  EXPECT_EQ(0, lothar_getbatterylevel(connection, &voltage));
+  EXPECT_EQ(7800, voltage);
+  EXPECT_EQ(0, lothar_keepalive(connection, &sleep));
+  EXPECT_EQ(0, lothar_getbatterylevel(connection, &voltage));
+
+  lothar_connection_close(&connection);
+}
+
+TEST(ConnectionTest, Deadline)
+{
+  lothar_connection_t *connection = lothar_connection_open_simulator();
+  uint16_t voltage;
+
+  // a deadline that has passed fails without asking
+  EXPECT_EQ(0, lothar_connection_set_deadline(connection, lothar_time_us() - 1));
+  EXPECT_EQ(-LOTHAR_ERROR_TIMEOUT, lothar_getbatterylevel(connection, &voltage));
+  lothar_clear_error();
+
+  EXPECT_EQ(0, lothar_connection_set_deadline(connection, lothar_time_us() + 1000000));
+  EXPECT_EQ(0, lothar_getbatterylevel(connection, &voltage));
+
+  EXPECT_EQ(0, lothar_connection_set_deadline(connection, 0));
+  EXPECT_EQ(0, lothar_getbatterylevel(connection, &voltage));
+
+  lothar_connection_close(&connection);
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "connectionset.h"
+#include "commands.h"
+
+using namespace std;
+
+namespace
+{
+  // a brick that answers every getbatterylevel with its own voltage
+  struct Brick
+  {
+    uint16_t voltage;
+    bool requested;
+    bool closed;
+
+    Brick(uint16_t v = 0) : voltage(v), requested(false), closed(false)
+    {}
+  };
+
+  int brick_read(void *b, uint8_t *data, size_t len)
+  {
+    Brick *brick = static_cast<Brick *>(b);
+
+    if(!brick->requested || len < 5)
+      return -1;
+
+    brick->requested = false;
+    data[0] = 0x02;
+    data[1] = 0x0B;
+    data[2] = 0;
+    lothar_htonxts(brick->voltage, data + 3);
+    return 5;
+  }
+
+  int brick_write(void *b, uint8_t const *data, size_t len)
+  {
+    static_cast<Brick *>(b)->requested = len == 2 && data[1] == 0x0B;
+    return len;
+  }
+
+  int brick_close(void *b)
+  {
+    static_cast<Brick *>(b)->closed = true;
+    return 0;
+  }
+
+  lothar_connection_vtable const brick_vtable = {brick_read, brick_write, brick_close, NULL};
+
+  int read_voltage(lothar_connection_t *connection, size_t index, void *user)
+  {
+    return lothar_getbatterylevel(connection, static_cast<uint16_t *>(user) + index);
+  }
+}
+
+TEST(ConnectionSetTest, Names)
+{
+  Brick bricks[2];
+  lothar_connectionset_t *set = lothar_connectionset_create();
+
+  EXPECT_EQ(0, lothar_connectionset_add(set, lothar_connection_open_custom(&brick_vtable, bricks), "left"));
+  EXPECT_EQ(0, lothar_connectionset_add(set, lothar_connection_open_custom(&brick_vtable, bricks + 1), NULL));
+  EXPECT_EQ(-LOTHAR_ERROR_INVALID_ARGUMENT, lothar_connectionset_add(set, NULL, "none"));
+
+  ASSERT_EQ(2u, lothar_connectionset_size(set));
+  EXPECT_STREQ("left", lothar_connectionset_name(set, 0));
+  EXPECT_STREQ("1", lothar_connectionset_name(set, 1));
+  EXPECT_EQ(NULL, lothar_connectionset_name(set, 2));
+
+  EXPECT_EQ(lothar_connectionset_get(set, 0), lothar_connectionset_find(set, "left"));
+  EXPECT_EQ(lothar_connectionset_get(set, 1), lothar_connectionset_find(set, "1"));
+  EXPECT_EQ(NULL, lothar_connectionset_find(set, "right"));
+
+  EXPECT_EQ(0, lothar_connectionset_destroy(&set));
+  EXPECT_EQ(NULL, set);
+  EXPECT_TRUE(bricks[0].closed);
+  EXPECT_TRUE(bricks[1].closed);
+}
+
+TEST(ConnectionSetTest, Parallel)
+{
+  Brick bricks[4] = {Brick(7000), Brick(7100), Brick(7200), Brick(7300)};
+  lothar_connectionset_t *set = lothar_connectionset_create();
+
+  for(size_t i = 0; i < 4; ++i)
+    lothar_connectionset_add(set, lothar_connection_open_custom(&brick_vtable, bricks + i), NULL);
+
+  uint16_t voltages[4] = {0, 0, 0, 0};
+  int status[4] = {1, 1, 1, 1};
+
+  EXPECT_EQ(0, lothar_connectionset_parallel(set, read_voltage, voltages, status));
+
+  for(size_t i = 0; i < 4; ++i)
+  {
+    EXPECT_EQ(bricks[i].voltage, voltages[i]);
+    EXPECT_EQ(0, status[i]);
+  }
+
+  lothar_connectionset_destroy(&set);
+}
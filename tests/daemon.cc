@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include "daemon.h"
+#include "simulator.h"
+#include "commands.h"
+
+using namespace std;
+
+class DaemonTest : public testing::Test
+{
+protected:
+  lothar_connection_t *simulator;
+  lothar_daemon_t *daemon;
+  lothar_connection_t *clients[3];
+
+  void SetUp()
+  {
+    simulator = lothar_connection_open_simulator();
+    daemon = lothar_daemon_open(simulator, "lothar_daemon_test.sock");
+    ASSERT_TRUE(daemon != NULL);
+
+    for(int i = 0; i < 3; ++i)
+    {
+      clients[i] = lothar_connection_open_daemon("lothar_daemon_test.sock");
+      ASSERT_TRUE(clients[i] != NULL);
+    }
+  }
+
+  void TearDown()
+  {
+    for(int i = 0; i < 3; ++i)
+      lothar_connection_close(clients + i);
+    lothar_daemon_close(&daemon);
+    lothar_connection_close(&simulator);
+  }
+};
+
+TEST_F(DaemonTest, Shared)
+{
+  uint8_t data[59];
+  uint8_t len = 0;
+  uint16_t voltage = 0;
+
+  // one client sends a message, another reads it
+  EXPECT_EQ(0, lothar_messagewrite(clients[0], 3, (uint8_t const *)"hi", 3));
+  EXPECT_EQ(0, lothar_messageread(clients[1], 3, 0, 1, data, &len));
+  EXPECT_EQ(3, len);
+  EXPECT_STREQ("hi", (char const *)data);
+  EXPECT_EQ(-LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY, lothar_messageread(clients[2], 3, 0, 1, data, &len));
+
+  EXPECT_EQ(0, lothar_getbatterylevel(clients[2], &voltage));
+  EXPECT_EQ(7800, voltage);
+
+  // only one daemon per socket
+  EXPECT_EQ(NULL, lothar_daemon_open(simulator, "lothar_daemon_test.sock"));
+}
+
+TEST_F(DaemonTest, Coalesce)
+{
+  uint8_t valid = 0;
+  uint16_t voltage[2] = {0, 0};
+  size_t requests = 0;
+  size_t coalesced = 0;
+
+  lothar_simulator_set_latency(simulator, 30000);
+
+  // keep the daemon busy, so the queries of the other clients arrive while it waits
+  EXPECT_EQ(0, lothar_pipeline_begin(clients[0]));
+  EXPECT_EQ(0, lothar_getinputvalues(clients[0], INPUT_1, &valid, NULL, NULL, NULL, NULL, NULL, NULL, NULL));
+  lothar_usleep(10000);
+
+  for(int i = 1; i < 3; ++i)
+  {
+    EXPECT_EQ(0, lothar_pipeline_begin(clients[i]));
+    EXPECT_EQ(0, lothar_getbatterylevel(clients[i], voltage + i - 1));
+  }
+
+  for(int i = 0; i < 3; ++i)
+    EXPECT_EQ(0, lothar_pipeline_end(clients[i]));
+
+  EXPECT_EQ(1, valid);
+  EXPECT_EQ(7800, voltage[0]);
+  EXPECT_EQ(7800, voltage[1]);
+
+  EXPECT_EQ(0, lothar_simulator_requests(simulator, &requests));
+  EXPECT_EQ(2u, requests);
+  EXPECT_EQ(0, lothar_daemon_coalesced(daemon, &coalesced));
+  EXPECT_EQ(1u, coalesced);
+}
+
+TEST_F(DaemonTest, NoDaemon)
+{
+  EXPECT_EQ(NULL, lothar_connection_open_daemon("no such socket"));
+  EXPECT_EQ(NULL, lothar_daemon_open(NULL, "lothar_daemon_test.sock"));
+}
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
+#include <thread>
 #include "error_handling.hh"
+#include "commands.h"
+#include "simulator.h"
 
 using namespace std;
 using namespace lothar;
@@ -29,3 +32,57 @@ TEST(ErrorHandlingTest, ThrowError)
   error = LOTHAR_ERROR_OKAY;
   EXPECT_NO_THROW(check_return(error)) << "check_return() throws an error on okay";
 }
+
+TEST(ErrorHandlingTest, ThreadLocal)
+{
+  lothar_clear_error();
+
+  std::thread other([]() { lothar_error_raise(LOTHAR_ERROR_TIMEOUT); });
+  other.join();
+
+  EXPECT_EQ(LOTHAR_ERROR_OKAY, lothar_errno);
+}
+
+TEST(ErrorHandlingTest, Record)
+{
+  lothar_connection_t *connection = lothar_connection_open_simulator();
+  lothar_error_record_t record;
+  uint8_t bytesready;
+
+  lothar_clear_error();
+  lothar_error_record(&record);
+  EXPECT_EQ(0, record.error);
+  EXPECT_EQ(-1, record.opcode);
+
+  // the port is no lowspeed sensor
+  for(int threaded = 0; threaded < 2; ++threaded)
+  {
+    uint64_t before = lothar_time_us();
+
+    if(threaded)
+    {
+      ASSERT_EQ(0, lothar_io_thread_start(connection));
+    }
+
+    EXPECT_EQ(-LOTHAR_ERROR_CONNECTION_NOT_CONFIGURED, lothar_lsgetstatus(connection, INPUT_3, &bytesready));
+
+    lothar_error_record(&record);
+    EXPECT_EQ(LOTHAR_ERROR_CONNECTION_NOT_CONFIGURED, record.error);
+    EXPECT_EQ(0x0e, record.opcode);
+    EXPECT_EQ(INPUT_3, record.port);
+    EXPECT_EQ(connection, record.connection);
+    EXPECT_LE(before, record.time);
+    lothar_clear_error();
+  }
+
+  // an error of no command has no context
+  EXPECT_EQ(-LOTHAR_ERROR_ENTITY_CLOSED, lothar_getbatterylevel(NULL, NULL));
+  lothar_error_record(&record);
+  EXPECT_EQ(LOTHAR_ERROR_ENTITY_CLOSED, record.error);
+  EXPECT_EQ(-1, record.opcode);
+  EXPECT_EQ(-1, record.port);
+  EXPECT_EQ(NULL, record.connection);
+  lothar_clear_error();
+
+  lothar_connection_close(&connection);
+}
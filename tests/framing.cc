@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "error_handling.h"
+
+// the framer is internal to the library, it has no public header
+extern "C"
+{
+#include "../src/framing.h"
+}
+
+using namespace std;
+
+namespace
+{
+  // a stream that delivers its data in pieces of at most piece bytes, and can fail once along the way
+  struct Stream
+  {
+    string data;
+    size_t pos;
+    size_t piece;
+    size_t fail; // fail the receive that would deliver the byte at this position, npos for never
+
+    Stream(string const &d, size_t p) : data(d), pos(0), piece(p), fail(string::npos)
+    {}
+  };
+
+  int stream_recv(void *s, uint8_t *buf, size_t len)
+  {
+    Stream *stream = static_cast<Stream *>(s);
+    size_t n = min(min(len, stream->piece), stream->data.size() - stream->pos);
+
+    if(stream->pos == stream->fail)
+    {
+      stream->fail = string::npos;
+      lothar_error_raise(LOTHAR_ERROR_TIMEOUT);
+      return -1;
+    }
+
+    if(stream->fail != string::npos && stream->pos < stream->fail)
+      n = min(n, stream->fail - stream->pos);
+
+    memcpy(buf, stream->data.data() + stream->pos, n);
+    stream->pos += n;
+    return n;
+  }
+
+  string frame(string const &telegram)
+  {
+    string result(2, '\0');
+
+    result[0] = telegram.size() & 0xff;
+    result[1] = telegram.size() >> 8;
+    return result + telegram;
+  }
+
+  string read(lothar_framer_t *framer, size_t len = LOTHAR_MAX_TELEGRAM)
+  {
+    vector<uint8_t> data(len);
+    int n = lothar_framer_read(framer, data.data(), len);
+
+    return n < 0 ? string() : string(data.begin(), data.begin() + n);
+  }
+}
+
+TEST(FramingTest, Pieces)
+{
+  Stream stream(frame("abc") + frame("defgh"), 1);
+  lothar_framer_t framer;
+
+  lothar_framer_init(&framer, stream_recv, &stream);
+
+  EXPECT_EQ("abc", read(&framer));
+  EXPECT_EQ("defgh", read(&framer));
+}
+
+TEST(FramingTest, FailAndResume)
+{
+  Stream stream(frame("abcdef") + frame("gh"), 3);
+  lothar_framer_t framer;
+  uint8_t data[LOTHAR_MAX_TELEGRAM];
+
+  // halfway through the first frame
+  stream.fail = 5;
+  lothar_framer_init(&framer, stream_recv, &stream);
+
+  EXPECT_EQ(-LOTHAR_ERROR_TIMEOUT, lothar_framer_read(&framer, data, sizeof(data)));
+  lothar_clear_error();
+
+  // nothing was consumed, the frame is read whole when the rest arrives
+  EXPECT_EQ("abcdef", read(&framer));
+  EXPECT_EQ("gh", read(&framer));
+}
+
+TEST(FramingTest, LargerThanBuffer)
+{
+  string const large(LOTHAR_FRAMER_SIZE + 100, 'x');
+  Stream stream(frame(large) + frame("next"), 64);
+  lothar_framer_t framer;
+
+  lothar_framer_init(&framer, stream_recv, &stream);
+
+  // what fits is copied, the rest is skipped
+  EXPECT_EQ(string(10, 'x'), read(&framer, 10));
+  EXPECT_EQ("next", read(&framer));
+}
+
+TEST(FramingTest, Ready)
+{
+  Stream stream(frame("abc"), 4);
+  lothar_framer_t framer;
+
+  lothar_framer_init(&framer, stream_recv, &stream);
+  EXPECT_FALSE(lothar_framer_ready(&framer));
+
+  EXPECT_EQ(4, lothar_framer_receive(&framer));
+  EXPECT_FALSE(lothar_framer_ready(&framer));
+
+  EXPECT_EQ(1, lothar_framer_receive(&framer));
+  EXPECT_TRUE(lothar_framer_ready(&framer));
+  EXPECT_EQ("abc", read(&framer));
+}
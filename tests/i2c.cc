@@ -0,0 +1,194 @@
+#include <gtest/gtest.h>
+#include "i2c.h"
+#include "commands.h"
+#include "simulator.h"
+#include "stats.h"
+#include "connectionmock.hh"
+
+namespace
+{
+  class I2CTest : public testing::Test
+  {
+  protected:
+    lothar_connection_t *d_brick;
+    lothar_i2c_t *d_i2c;
+
+    void SetUp()
+    {
+      d_brick = lothar_connection_open_simulator();
+      d_i2c = lothar_i2c_open(d_brick);
+
+      for(int port = INPUT_1; port <= INPUT_4; ++port)
+      {
+	uint8_t const registers[] = {uint8_t(port), uint8_t(port + 10), uint8_t(port + 20), uint8_t(port + 30)};
+
+	lothar_setinputmode(d_brick, (lothar_input_port)port, SENSOR_LOWSPEED_9V, SENSOR_MODE_RAWMODE);
+	lothar_simulator_set_registers(d_brick, (lothar_input_port)port, 0x42, registers, sizeof(registers));
+      }
+    }
+
+    void TearDown()
+    {
+      lothar_i2c_close(&d_i2c);
+      lothar_connection_close(&d_brick);
+    }
+
+    size_t requests(uint8_t opcode)
+    {
+      lothar_opcode_stats_t stats;
+      lothar_connection_stats(d_brick, opcode, &stats);
+      return stats.requests;
+    }
+  };
+
+  struct Results
+  {
+    int count[4];
+    int errors;
+  };
+
+  // a write that finds the bus in use by someone else
+  int busy(uint8_t const *, size_t)
+  {
+    lothar_error_raise(LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS);
+    return -1;
+  }
+
+  void check(lothar_connection_t *, int status, lothar_input_port port, uint8_t const *rxdata, uint8_t rxlen, void *user)
+  {
+    Results *results = static_cast<Results *>(user);
+
+    if(status < 0 || rxlen != 4 || rxdata[0] != port || rxdata[3] != port + 30)
+      ++results->errors;
+    else
+      ++results->count[port];
+  }
+}
+
+TEST_F(I2CTest, Transfer)
+{
+  uint8_t distance[2];
+
+  // a fast device: the write, the status and the read go out together
+  ASSERT_EQ(0, lothar_i2c_transfer(d_i2c, INPUT_2, (uint8_t const *)"\x02\x42", 2, distance, 2));
+  EXPECT_EQ(INPUT_2, distance[0]);
+  EXPECT_EQ(INPUT_2 + 10, distance[1]);
+
+  EXPECT_EQ(1u, requests(0x0f));
+  EXPECT_EQ(1u, requests(0x0e));
+  EXPECT_EQ(1u, requests(0x10));
+
+  lothar_setinputmode(d_brick, INPUT_3, SENSOR_SWITCH, SENSOR_MODE_BOOLEANMODE);
+  EXPECT_EQ(-LOTHAR_ERROR_CONNECTION_NOT_CONFIGURED, lothar_i2c_transfer(d_i2c, INPUT_3, (uint8_t const *)"\x02\x42", 2, distance, 1));
+}
+
+TEST(I2CMockTest, TransferReplySize)
+{
+  uint8_t const lswrite[]     = {0x80, 0x0f, 0x00, 0x02, 0x02, 0x02, 0x42};
+  uint8_t const lsgetstatus[] = {0x00, 0x0e, 0x00};
+  uint8_t const lsread[]      = {0x00, 0x10, 0x00};
+  uint8_t const ready[]       = {0x02, 0x0e, 0x00, 0x02};
+  uint8_t reply[20]           = {0x02, 0x10, 0x00, 0x04, 1, 2, 3, 4};
+  uint8_t rxdata[3]           = {0, 0, 0xff};
+
+  std::vector<uint8_t> const write(lswrite, lswrite + sizeof(lswrite));
+  std::vector<uint8_t> const status(lsgetstatus, lsgetstatus + sizeof(lsgetstatus));
+  std::vector<uint8_t> const read(lsread, lsread + sizeof(lsread));
+  std::vector<uint8_t> const bytesready(ready, ready + sizeof(ready));
+
+  // a device that sends more than was asked for fills only the buffer
+  {
+    lothar::ConnectionMock mock;
+    std::vector<uint8_t> const longer(reply, reply + sizeof(reply));
+    lothar_i2c_t *i2c = lothar_i2c_open(mock);
+
+    mock.expect_write(write);
+    mock.expect_write(status);
+    mock.expect_write(read);
+    mock.expect_read(bytesready);
+    mock.expect_read(longer);
+
+    EXPECT_EQ(0, lothar_i2c_transfer(i2c, INPUT_1, lswrite + 5, 2, rxdata, 2));
+    EXPECT_EQ(1, rxdata[0]);
+    EXPECT_EQ(2, rxdata[1]);
+    EXPECT_EQ(0xff, rxdata[2]);
+
+    lothar_i2c_close(&i2c);
+  }
+
+  // one that sends less fails the transfer
+  reply[3] = 1;
+  {
+    lothar::ConnectionMock mock;
+    std::vector<uint8_t> const shorter(reply, reply + sizeof(reply));
+    lothar_i2c_t *i2c = lothar_i2c_open(mock);
+
+    mock.expect_write(write);
+    mock.expect_write(status);
+    mock.expect_write(read);
+    mock.expect_read(bytesready);
+    mock.expect_read(shorter);
+
+    EXPECT_EQ(-LOTHAR_ERROR_NXT_READ_ERROR, lothar_i2c_transfer(i2c, INPUT_1, lswrite + 5, 2, rxdata, 2));
+    lothar_clear_error();
+
+    lothar_i2c_close(&i2c);
+  }
+}
+
+TEST(I2CMockTest, WriteFails)
+{
+  lothar::ConnectionMock mock;
+  lothar_i2c_t *i2c = lothar_i2c_open(mock);
+  uint8_t rxdata[2];
+
+  // the transaction fails at once, the bus is not polled as if it was written
+  EXPECT_CALL(mock, write(testing::_, testing::_)).Times(1).WillOnce(testing::Invoke(busy));
+  EXPECT_EQ(-LOTHAR_ERROR_PENDING_COMMUNICATION_IN_PROGRESS,
+            lothar_i2c_transfer(i2c, INPUT_1, (uint8_t const *)"\x02\x42", 2, rxdata, 2));
+  lothar_clear_error();
+
+  lothar_i2c_close(&i2c);
+}
+
+TEST_F(I2CTest, WriteOnly)
+{
+  // 2 bytes at 2 ms: nothing to read, the port is busy until the status says the bus is done
+  lothar_simulator_set_bus_time(d_brick, 2000);
+
+  uint64_t start = lothar_time_us();
+  ASSERT_EQ(0, lothar_i2c_transfer(d_i2c, INPUT_1, (uint8_t const *)"\x02\x42", 2, NULL, 0));
+  EXPECT_GE(lothar_time_us() - start, 4000u);
+}
+
+TEST_F(I2CTest, AllPortsAdaptive)
+{
+  Results results = {{0, 0, 0, 0}, 0};
+  int const transactions = 10;
+  uint64_t estimate;
+
+  // 6 bytes at 500 us, 3 ms per transaction
+  lothar_simulator_set_bus_time(d_brick, 500);
+
+  for(int i = 0; i < transactions; ++i)
+    for(int port = INPUT_1; port <= INPUT_4; ++port)
+      ASSERT_EQ(0, lothar_i2c_submit(d_i2c, (lothar_input_port)port, (uint8_t const *)"\x02\x42", 2, 4, check, &results));
+
+  uint64_t start = lothar_time_us();
+  ASSERT_EQ(0, lothar_i2c_run(d_i2c));
+  uint64_t elapsed = lothar_time_us() - start;
+
+  EXPECT_EQ(0, results.errors);
+  for(int port = INPUT_1; port <= INPUT_4; ++port)
+    EXPECT_EQ(transactions, results.count[port]);
+
+  // the ports run side by side (one after the other would take 120 ms)
+  EXPECT_LT(elapsed, 80000u);
+
+  // once measured, most transactions take a single poll
+  EXPECT_LT(requests(0x10), 4u * transactions * 2);
+
+  ASSERT_EQ(0, lothar_i2c_estimate(d_i2c, INPUT_1, &estimate));
+  EXPECT_GE(estimate, 2000u);
+  EXPECT_LT(estimate, 10000u);
+}
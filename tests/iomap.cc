@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "iomap.h"
+#include "system.h"
+#include "commands.h"
+#include "simulator.h"
+#include "stats.h"
+#include "connectionmock.hh"
+
+using namespace std;
+using namespace lothar;
+
+TEST(IOMapTest, MatchesDirectCommands)
+{
+  lothar_connection_t *brick = lothar_connection_open_simulator();
+  lothar_output_iomap_t outputs[LOTHAR_IOMAP_OUTPUTS];
+  lothar_input_iomap_t inputs[LOTHAR_IOMAP_INPUTS];
+  lothar_outputstate_t state;
+  lothar_inputvalues_t values;
+  lothar_opcode_stats_t reads;
+
+  lothar_simulator_set_manual_clock(brick, 1);
+  lothar_simulator_set_sensor(brick, INPUT_3, 200);
+  lothar_setinputmode(brick, INPUT_3, SENSOR_SWITCH, SENSOR_MODE_BOOLEANMODE);
+  lothar_setoutputstate(brick, OUTPUT_B, 50, MOTOR_MODE_MOTORON, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0);
+  lothar_simulator_advance(brick, 1000000);
+
+  ASSERT_EQ(0, lothar_iomap_read(brick, outputs, inputs));
+  ASSERT_EQ(0, lothar_readoutputstate(brick, OUTPUT_B, &state));
+  ASSERT_EQ(0, lothar_readinputvalues(brick, INPUT_3, &values));
+
+  EXPECT_EQ(state.tachocount, outputs[OUTPUT_B].tachocount);
+  EXPECT_EQ(state.rotationcount, outputs[OUTPUT_B].rotationcount);
+  EXPECT_EQ(50, outputs[OUTPUT_B].speed);
+  EXPECT_GT(outputs[OUTPUT_B].rpm, 0);
+  EXPECT_EQ(RUNSTATE_RUNNING, outputs[OUTPUT_B].runstate);
+  EXPECT_EQ(0, outputs[OUTPUT_A].tachocount);
+
+  EXPECT_EQ(SENSOR_SWITCH, inputs[INPUT_3].type);
+  EXPECT_EQ(200, inputs[INPUT_3].raw);
+  EXPECT_EQ(values.scaledvalue, inputs[INPUT_3].value);
+  EXPECT_EQ(1, inputs[INPUT_3].boolean);
+
+  // two chunks per map
+  lothar_connection_stats(brick, 0x94, &reads);
+  EXPECT_EQ(4u, reads.requests);
+
+  lothar_connection_close(&brick);
+}
+
+TEST(IOMapTest, OutOfBounds)
+{
+  lothar_connection_t *brick = lothar_connection_open_simulator();
+  uint8_t data[LOTHAR_MAX_IOMAPREAD];
+
+  EXPECT_EQ(-LOTHAR_ERROR_OUT_OF_BOUNDARY, lothar_readiomap(brick, LOTHAR_IOMAP_INPUT, 70, data, 20, NULL));
+  EXPECT_EQ(-LOTHAR_ERROR_MODULE_NOT_FOUND, lothar_readiomap(brick, 0x00010001, 0, data, 4, NULL));
+  EXPECT_EQ(-LOTHAR_ERROR_INVALID_ARGUMENT, lothar_readiomap(brick, LOTHAR_IOMAP_INPUT, 0, data, LOTHAR_MAX_IOMAPREAD + 1, NULL));
+
+  lothar_connection_close(&brick);
+}
+
+TEST(IOMapTest, Write)
+{
+  ConnectionMock mock;
+  uint8_t const mode = SENSOR_MODE_BOOLEANMODE;
+  size_t written = 0;
+
+  vector<uint8_t> const request = {0x01, 0x95, 0x01, 0x00, 0x03, 0x00, 0x1d, 0x00, 0x01, 0x00, mode}; // input 2, mode
+  vector<uint8_t> const reply   = {0x02, 0x95, 0x00, 0x01, 0x00, 0x03, 0x00, 0x01, 0x00};
+
+  mock.expect_write(request);
+  mock.expect_read(reply);
+
+  EXPECT_EQ(0, lothar_writeiomap(mock, LOTHAR_IOMAP_INPUT, LOTHAR_IOMAP_INPUT_SIZE + 9, &mode, 1, &written));
+  EXPECT_EQ(1u, written);
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include "record.h"
+#include "simulator.h"
+#include "commands.h"
+
+using namespace std;
+
+namespace
+{
+  char const *capture = "lothar_record_test.lrec";
+
+  // a session against the simulator, to be replayed
+  void session(lothar_connection_t *connection, uint16_t *voltage, uint8_t *data, uint8_t *len, int *empty)
+  {
+    EXPECT_EQ(0, lothar_getbatterylevel(connection, voltage));
+    EXPECT_EQ(0, lothar_messagewrite(connection, 1, (uint8_t const *)"ping", 5));
+    EXPECT_EQ(0, lothar_messageread(connection, 1, 0, 1, data, len));
+    *empty = lothar_messageread(connection, 1, 0, 1, data, NULL);
+  }
+}
+
+TEST(RecordTest, RecordReplay)
+{
+  uint16_t voltage = 0;
+  uint8_t data[59];
+  uint8_t len = 0;
+  int empty = 0;
+  size_t diverged = 1;
+
+  lothar_connection_t *simulator = lothar_connection_open_simulator();
+  lothar_simulator_set_battery(simulator, 7123);
+  lothar_simulator_set_latency(simulator, 1000);
+
+  lothar_connection_t *recorder = lothar_connection_open_recorder(simulator, capture);
+  ASSERT_TRUE(recorder != NULL);
+
+  session(recorder, &voltage, data, &len, &empty);
+  EXPECT_EQ(7123, voltage);
+  EXPECT_EQ(-LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY, empty);
+  EXPECT_EQ(0, lothar_connection_close(&recorder));
+
+  // without the brick, as fast as possible
+  lothar_connection_t *replay = lothar_connection_open_replay(capture, 0);
+  ASSERT_TRUE(replay != NULL);
+
+  voltage = 0;
+  len = 0;
+  empty = 0;
+  session(replay, &voltage, data, &len, &empty);
+
+  EXPECT_EQ(7123, voltage);
+  EXPECT_EQ(5, len);
+  EXPECT_STREQ("ping", (char const *)data);
+  EXPECT_EQ(-LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY, empty);
+
+  EXPECT_EQ(0, lothar_replay_diverged(replay, &diverged));
+  EXPECT_EQ(0u, diverged);
+
+  // past the end of the recording
+  EXPECT_EQ(-LOTHAR_ERROR_NXT_READ_ERROR, lothar_getbatterylevel(replay, &voltage));
+  EXPECT_EQ(0, lothar_replay_diverged(replay, &diverged));
+  EXPECT_EQ(1u, diverged);
+
+  lothar_connection_close(&replay);
+  remove(capture);
+}
+
+TEST(RecordTest, NotACapture)
+{
+  FILE *f = fopen(capture, "wb");
+  fputs("this is not a capture file", f);
+  fclose(f);
+
+  EXPECT_EQ(NULL, lothar_connection_open_replay(capture, 0));
+  EXPECT_EQ(NULL, lothar_connection_open_replay("no such file", 0));
+
+  remove(capture);
+}
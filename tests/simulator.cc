@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "simulator.h"
+#include "commands.h"
+#include "motor.h"
+
+using namespace std;
+
+class SimulatorTest : public testing::Test
+{
+protected:
+  lothar_connection_t *connection;
+
+  void SetUp()
+  {
+    connection = lothar_connection_open_simulator();
+    lothar_simulator_set_manual_clock(connection, 1);
+  }
+
+  void TearDown()
+  {
+    lothar_connection_close(&connection);
+  }
+
+  void advance(uint64_t ms)
+  {
+    ASSERT_EQ(0, lothar_simulator_advance(connection, ms * 1000));
+  }
+};
+
+TEST_F(SimulatorTest, Turn)
+{
+  lothar_motor_t *motor = lothar_motor_open(connection, OUTPUT_B);
+  enum lothar_output_runstate runstate;
+  int32_t degrees = 0;
+
+  EXPECT_EQ(0, lothar_motor_turn(motor, 50, 360));
+  advance(100);
+
+  EXPECT_EQ(0, lothar_motor_degrees(motor, &degrees, 0));
+  EXPECT_GT(degrees, 0);
+  EXPECT_LT(degrees, 360);
+
+  advance(2000);
+
+  EXPECT_EQ(0, lothar_motor_degrees(motor, &degrees, 0));
+  EXPECT_EQ(360, degrees);
+  EXPECT_EQ(0, lothar_getoutputstate(connection, OUTPUT_B, NULL, NULL, NULL, NULL, &runstate, NULL, NULL, NULL, NULL));
+  EXPECT_EQ(RUNSTATE_IDLE, runstate);
+
+  // backwards, relative to where we are now
+  EXPECT_EQ(0, lothar_motor_reset(motor, 1));
+  EXPECT_EQ(0, lothar_motor_turn(motor, -100, 90));
+  advance(1000);
+
+  EXPECT_EQ(0, lothar_motor_degrees(motor, &degrees, 1));
+  EXPECT_EQ(-90, degrees);
+  EXPECT_EQ(0, lothar_motor_degrees(motor, &degrees, 0));
+  EXPECT_EQ(270, degrees);
+
+  lothar_motor_close(&motor);
+}
+
+TEST_F(SimulatorTest, Regulation)
+{
+  int32_t regulated = 0;
+  int32_t unregulated = 0;
+
+  lothar_simulator_set_battery(connection, 6000);
+
+  EXPECT_EQ(0, lothar_setoutputstate(connection, OUTPUT_A, 100, (enum lothar_output_motor_mode)(MOTOR_MODE_MOTORON | MOTOR_MODE_REGULATED), REGULATION_MODE_SPEED, 0, RUNSTATE_RUNNING, 0));
+  EXPECT_EQ(0, lothar_setoutputstate(connection, OUTPUT_C, 100, MOTOR_MODE_MOTORON, REGULATION_MODE_IDLE, 0, RUNSTATE_RUNNING, 0));
+  advance(1000);
+
+  EXPECT_EQ(0, lothar_getoutputstate(connection, OUTPUT_A, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &regulated));
+  EXPECT_EQ(0, lothar_getoutputstate(connection, OUTPUT_C, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &unregulated));
+
+  // a regulated motor holds its speed on a weak battery
+  EXPECT_NEAR(900, regulated, 30);
+  EXPECT_LT(unregulated, regulated * 3 / 4);
+}
+
+TEST_F(SimulatorTest, Sensors)
+{
+  uint8_t valid = 0;
+  int16_t scaled = -1;
+  uint16_t raw = 0;
+
+  EXPECT_EQ(0, lothar_setinputmode(connection, INPUT_1, SENSOR_SWITCH, SENSOR_MODE_BOOLEANMODE));
+  EXPECT_EQ(0, lothar_getinputvalues(connection, INPUT_1, &valid, NULL, NULL, NULL, &raw, NULL, &scaled, NULL));
+  EXPECT_EQ(1, valid);
+  EXPECT_EQ(1023, raw);
+  EXPECT_EQ(0, scaled);
+
+  EXPECT_EQ(0, lothar_simulator_set_sensor(connection, INPUT_1, 100));
+  EXPECT_EQ(0, lothar_getinputvalues(connection, INPUT_1, NULL, NULL, NULL, NULL, &raw, NULL, &scaled, NULL));
+  EXPECT_EQ(100, raw);
+  EXPECT_EQ(1, scaled);
+
+  // count the presses
+  EXPECT_EQ(0, lothar_setinputmode(connection, INPUT_1, SENSOR_SWITCH, SENSOR_MODE_PERIODCOUNTMODE));
+  EXPECT_EQ(0, lothar_resetinputscaledvalue(connection, INPUT_1));
+  for(int i = 0; i < 3; ++i)
+  {
+    lothar_simulator_set_sensor(connection, INPUT_1, 1023);
+    lothar_simulator_set_sensor(connection, INPUT_1, 100);
+  }
+  EXPECT_EQ(0, lothar_getinputvalues(connection, INPUT_1, NULL, NULL, NULL, NULL, NULL, NULL, &scaled, NULL));
+  EXPECT_EQ(3, scaled);
+
+  EXPECT_EQ(-LOTHAR_ERROR_OUT_OF_RANGE_VALUES, lothar_getinputvalues(connection, (enum lothar_input_port)4, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL));
+}
+
+TEST_F(SimulatorTest, Ultrasonic)
+{
+  uint8_t ready = 0;
+  uint8_t distance = 0;
+
+  EXPECT_EQ(-LOTHAR_ERROR_CONNECTION_NOT_CONFIGURED, lothar_lsgetstatus(connection, INPUT_4, &ready));
+
+  EXPECT_EQ(0, lothar_setinputmode(connection, INPUT_4, SENSOR_LOWSPEED_9V, SENSOR_MODE_RAWMODE));
+  EXPECT_EQ(0, lothar_simulator_set_sensor(connection, INPUT_4, 42));
+  EXPECT_EQ(0, lothar_lswrite(connection, INPUT_4, (uint8_t *)"\x02\x42", 2, 1));
+  EXPECT_EQ(0, lothar_lsgetstatus(connection, INPUT_4, &ready));
+  EXPECT_EQ(1, ready);
+  EXPECT_EQ(0, lothar_lsread(connection, INPUT_4, &distance, 1, NULL));
+  EXPECT_EQ(42, distance);
+}
+
+TEST_F(SimulatorTest, Messages)
+{
+  uint8_t data[59];
+  uint8_t len = 0;
+  char name[20];
+
+  EXPECT_EQ(-LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY, lothar_messageread(connection, 10, 0, 1, data, &len));
+
+  EXPECT_EQ(0, lothar_simulator_post_message(connection, 10, (uint8_t const *)"hello", 6));
+  EXPECT_EQ(0, lothar_messageread(connection, 10, 0, 1, data, &len));
+  EXPECT_EQ(6, len);
+  EXPECT_STREQ("hello", (char const *)data);
+
+  EXPECT_EQ(0, lothar_messagewrite(connection, 1, (uint8_t const *)"echo", 5));
+  EXPECT_EQ(0, lothar_messageread(connection, 1, 0, 1, data, &len));
+  EXPECT_STREQ("echo", (char const *)data);
+
+  EXPECT_EQ(-LOTHAR_ERROR_NO_ACTIVE_PROGRAM, lothar_getcurrentprogramname(connection, name));
+  EXPECT_EQ(0, lothar_startprogram(connection, "test.rxe"));
+  EXPECT_EQ(0, lothar_getcurrentprogramname(connection, name));
+  EXPECT_STREQ("test.rxe", name);
+}
+
+TEST_F(SimulatorTest, Latency)
+{
+  uint64_t start = 0;
+  uint64_t end = 0;
+  uint16_t voltage[4] = {0, 0, 0, 0};
+  size_t requests = 0;
+
+  lothar_simulator_set_latency(connection, 10000);
+
+  // one round trip for each request
+  lothar_simulator_time(connection, &start);
+  for(int i = 0; i < 4; ++i)
+    EXPECT_EQ(0, lothar_getbatterylevel(connection, voltage + i));
+  lothar_simulator_time(connection, &end);
+
+  EXPECT_EQ(40000u, end - start);
+  EXPECT_EQ(7800, voltage[3]);
+
+  // one round trip for all of them
+  start = end;
+  EXPECT_EQ(0, lothar_pipeline_begin(connection));
+  for(int i = 0; i < 4; ++i)
+    EXPECT_EQ(0, lothar_getbatterylevel(connection, voltage + i));
+  EXPECT_EQ(0, lothar_pipeline_end(connection));
+  lothar_simulator_time(connection, &end);
+
+  EXPECT_EQ(10000u, end - start);
+  EXPECT_EQ(0, lothar_simulator_requests(connection, &requests));
+  EXPECT_EQ(8u, requests);
+}
+
+TEST_F(SimulatorTest, NotASimulator)
+{
+  EXPECT_EQ(-LOTHAR_ERROR_ENTITY_CLOSED, lothar_simulator_set_latency(NULL, 0));
+}
@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+#include "snapshot.h"
+#include "simulator.h"
+#include "motor.h"
+
+using namespace std;
+
+TEST(SnapshotTest, Brick)
+{
+  lothar_connection_t *connection = lothar_connection_open_simulator();
+  lothar_motor_t *motor = lothar_motor_open(connection, OUTPUT_C);
+  lothar_snapshot_t snapshot;
+  size_t before = 0;
+  size_t after = 0;
+
+  lothar_simulator_set_manual_clock(connection, 1);
+  lothar_simulator_set_sensor(connection, INPUT_3, 512);
+  lothar_simulator_set_battery(connection, 7321);
+  EXPECT_EQ(0, lothar_setinputmode(connection, INPUT_3, SENSOR_SWITCH, SENSOR_MODE_RAWMODE));
+  EXPECT_EQ(0, lothar_motor_turn(motor, 50, 360));
+  lothar_simulator_advance(connection, 100000);
+
+  EXPECT_EQ(0, lothar_simulator_requests(connection, &before));
+  EXPECT_EQ(0, lothar_snapshot(connection, &snapshot, 1));
+  EXPECT_EQ(0, lothar_simulator_requests(connection, &after));
+  EXPECT_EQ(8u, after - before);
+
+  for(int i = 0; i < LOTHAR_SNAPSHOT_OUTPUTS; ++i)
+    EXPECT_EQ(OUTPUT_A + i, snapshot.outputs[i].port);
+  for(int i = 0; i < LOTHAR_SNAPSHOT_INPUTS; ++i)
+    EXPECT_EQ(INPUT_1 + i, snapshot.inputs[i].port);
+
+  EXPECT_EQ(0, snapshot.outputs[OUTPUT_A].tachocount);
+  EXPECT_GT(snapshot.outputs[OUTPUT_C].tachocount, 0);
+  EXPECT_EQ(512, snapshot.inputs[INPUT_3].rawvalue);
+  EXPECT_EQ(SENSOR_SWITCH, snapshot.inputs[INPUT_3].type);
+  EXPECT_EQ(7321, snapshot.battery);
+  EXPECT_LE(snapshot.sent, snapshot.received);
+
+  lothar_motor_close(&motor);
+  lothar_connection_close(&connection);
+}
+
+TEST(SnapshotTest, OneRoundTrip)
+{
+  lothar_connection_t *connection = lothar_connection_open_simulator();
+  lothar_snapshot_t snapshot;
+
+  // the queries do not wait for each others replies
+  lothar_simulator_set_latency(connection, 20000);
+  EXPECT_EQ(0, lothar_snapshot(connection, &snapshot, 0));
+  EXPECT_LT(snapshot.received - snapshot.sent, 3 * 20000u);
+  EXPECT_EQ(0, snapshot.battery);
+
+  EXPECT_EQ(0, lothar_io_thread_start(connection));
+  EXPECT_EQ(0, lothar_snapshot(connection, &snapshot, 0));
+  EXPECT_LT(snapshot.received - snapshot.sent, 3 * 20000u);
+
+  lothar_connection_close(&connection);
+}
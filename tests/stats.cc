@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#include "stats.h"
+#include "simulator.h"
+#include "commands.h"
+
+using namespace std;
+
+TEST(StatsTest, Buckets)
+{
+  for(uint64_t us = 0; us < 8; ++us)
+    EXPECT_EQ(us, lothar_stats_bucket(us));
+
+  // every value falls within the bounds of its bucket, which are at most 25% apart
+  for(uint64_t us = 8; us < 20000000; us = us * 9 / 8 + 1)
+  {
+    size_t bucket = lothar_stats_bucket(us);
+
+    EXPECT_LE(lothar_stats_bucket_min(bucket), us);
+    EXPECT_GT(lothar_stats_bucket_min(bucket + 1), us);
+    EXPECT_LE(lothar_stats_bucket_min(bucket + 1) - lothar_stats_bucket_min(bucket), lothar_stats_bucket_min(bucket) / 4 + 1);
+  }
+
+  EXPECT_EQ((size_t)LOTHAR_STATS_BUCKETS - 1, lothar_stats_bucket(UINT64_MAX));
+}
+
+TEST(StatsTest, Connection)
+{
+  lothar_connection_t *connection = lothar_connection_open_simulator();
+  lothar_opcode_stats_t stats;
+  uint16_t voltage;
+  uint8_t data[59];
+  uint64_t median = 0;
+
+  lothar_simulator_set_latency(connection, 2000);
+
+  for(int i = 0; i < 4; ++i)
+    EXPECT_EQ(0, lothar_getbatterylevel(connection, &voltage));
+  EXPECT_EQ(0, lothar_playtone(connection, 440, 10));
+  EXPECT_EQ(-LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY, lothar_messageread(connection, 1, 0, 1, data, NULL));
+
+  EXPECT_EQ(0, lothar_connection_stats(connection, 0x0B, &stats));
+  EXPECT_EQ(4u, stats.requests);
+  EXPECT_EQ(4u, stats.replies);
+  EXPECT_EQ(0u, stats.errors);
+  EXPECT_EQ(8u, stats.bytes_written);
+  EXPECT_EQ(20u, stats.bytes_read);
+  EXPECT_GE(stats.rtt_total, 8000u);
+
+  // the median round trip takes at least the latency of the link
+  EXPECT_EQ(0, lothar_stats_percentile(&stats, 0.5, &median));
+  EXPECT_GE(median, 2000u);
+
+  EXPECT_EQ(0, lothar_connection_stats(connection, 0x13, &stats));
+  EXPECT_EQ(1u, stats.replies);
+  EXPECT_EQ(1u, stats.errors);
+
+  EXPECT_EQ(0, lothar_connection_stats(connection, -1, &stats));
+  EXPECT_EQ(6u, stats.requests);
+  EXPECT_EQ(5u, stats.replies);
+  EXPECT_EQ(1u, stats.errors);
+
+  // nothing sent
+  EXPECT_EQ(0, lothar_connection_stats(connection, 0x06, &stats));
+  EXPECT_EQ(-LOTHAR_ERROR_INVALID_ARGUMENT, lothar_stats_percentile(&stats, 0.5, &median));
+  EXPECT_EQ(-LOTHAR_ERROR_INVALID_ARGUMENT, lothar_connection_stats(connection, 0x50, &stats));
+
+  lothar_connection_close(&connection);
+}
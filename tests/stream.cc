@@ -0,0 +1,188 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "stream.h"
+#include "simulator.h"
+#include "stats.h"
+
+using namespace std;
+
+namespace
+{
+  // the program on the brick, like tools/stream.nxc
+  class Program
+  {
+    lothar_connection_t *d_brick;
+    lothar_stream_config_t d_config;
+    uint16_t d_in, d_reported, d_out, d_acked;
+
+    uint16_t window() const
+    {
+      return d_config.count * LOTHAR_STREAM_DEPTH;
+    }
+
+    static uint16_t distance(uint16_t to, uint16_t from)
+    {
+      return (to + LOTHAR_STREAM_SEQUENCES - from) % LOTHAR_STREAM_SEQUENCES;
+    }
+
+    void send(uint8_t queue, uint16_t sequence, uint8_t const *data, size_t len)
+    {
+      vector<uint8_t> message = {uint8_t(sequence & 0xff), uint8_t(sequence >> 8)};
+
+      message.insert(message.end(), data, data + len);
+      message.push_back(0);
+      lothar_simulator_post_message(d_brick, queue + 10, &message[0], message.size());
+    }
+
+  public:
+    Program(lothar_connection_t *brick, lothar_stream_config_t const &config)
+      : d_brick(brick), d_config(config), d_in(0), d_reported(0), d_out(0), d_acked(0)
+    {}
+
+    void ack()
+    {
+      send(d_config.control, d_in, NULL, 0);
+      d_reported = d_in;
+    }
+
+    vector<uint8_t> read()
+    {
+      uint8_t buf[59], len;
+
+      while(lothar_simulator_take_message(d_brick, d_config.first + d_in % d_config.count, buf, &len) < 0)
+      {
+	if(d_reported != d_in)
+	  ack();
+	this_thread::yield();
+      }
+
+      EXPECT_EQ(d_in, buf[0] | buf[1] << 8);
+
+      d_in = (d_in + 1) % LOTHAR_STREAM_SEQUENCES;
+      if(distance(d_in, d_reported) >= d_config.count)
+	ack();
+
+      return vector<uint8_t>(buf + 2, buf + len - 1);
+    }
+
+    void write(uint8_t const *data, size_t len)
+    {
+      uint8_t buf[59], size;
+
+      while(distance(d_out, d_acked) >= window())
+      {
+	while(lothar_simulator_take_message(d_brick, d_config.control, buf, &size) == 0)
+	  d_acked = buf[0] | buf[1] << 8;
+	this_thread::yield();
+      }
+
+      send(d_config.first + d_out % d_config.count, d_out, data, len);
+      d_out = (d_out + 1) % LOTHAR_STREAM_SEQUENCES;
+    }
+  };
+
+  vector<uint8_t> contents(size_t len)
+  {
+    vector<uint8_t> result(len);
+
+    for(size_t i = 0; i < len; ++i)
+      result[i] = i * 13 + 5;
+
+    return result;
+  }
+}
+
+TEST(StreamTest, ToBrick)
+{
+  lothar_connection_t *brick = lothar_connection_open_simulator();
+  lothar_stream_config_t const config = {0, 9, 9, 2000};
+  lothar_stream_t *stream = lothar_stream_open(brick, NULL);
+  vector<uint8_t> const data = contents(200 * LOTHAR_STREAM_CHUNK + 17);
+  vector<uint8_t> received;
+  lothar_opcode_stats_t writes;
+
+  ASSERT_TRUE(stream != NULL);
+
+  thread program([&]()
+		 {
+		   Program nxc(brick, config);
+
+		   while(received.size() < data.size())
+		   {
+		     vector<uint8_t> chunk = nxc.read();
+		     received.insert(received.end(), chunk.begin(), chunk.end());
+		   }
+		   nxc.ack();
+		 });
+
+  EXPECT_EQ(0, lothar_stream_write(stream, &data[0], data.size()));
+  EXPECT_EQ(0, lothar_stream_flush(stream));
+  program.join();
+
+  EXPECT_EQ(data, received);
+
+  // full chunks, the rest in one more
+  lothar_connection_stats(brick, 0x09, &writes);
+  EXPECT_EQ(201u, writes.requests);
+
+  lothar_stream_close(&stream);
+  lothar_connection_close(&brick);
+}
+
+TEST(StreamTest, FromBrick)
+{
+  lothar_connection_t *brick = lothar_connection_open_simulator();
+  lothar_stream_config_t const config = {2, 3, 0, 2000};
+  lothar_stream_t *stream = lothar_stream_open(brick, &config);
+  vector<uint8_t> const data = contents(100 * 40);
+  vector<uint8_t> received;
+  uint8_t buf[100];
+  size_t len;
+
+  ASSERT_TRUE(stream != NULL);
+
+  // chunks of 40 read 100 at a time, which splits them
+  thread program([&]()
+		 {
+		   Program nxc(brick, config);
+
+		   for(size_t offset = 0; offset < data.size(); offset += 40)
+		     nxc.write(&data[offset], 40);
+		 });
+
+  while(received.size() < data.size())
+  {
+    ASSERT_EQ(0, lothar_stream_read(stream, buf, sizeof(buf), &len));
+    ASSERT_GT(len, 0u);
+    received.insert(received.end(), buf, buf + len);
+  }
+  program.join();
+
+  EXPECT_EQ(data, received);
+
+  lothar_stream_close(&stream);
+  lothar_connection_close(&brick);
+}
+
+TEST(StreamTest, Errors)
+{
+  lothar_connection_t *brick = lothar_connection_open_simulator();
+  lothar_stream_config_t const overlap = {0, 4, 3, 50};
+  lothar_stream_config_t const quick = {0, 4, 4, 50};
+  lothar_stream_t *stream;
+  uint8_t buf[LOTHAR_STREAM_CHUNK] = {0};
+  size_t len;
+
+  EXPECT_TRUE(lothar_stream_open(brick, &overlap) == NULL);
+
+  // nobody on the other end
+  stream = lothar_stream_open(brick, &quick);
+  ASSERT_TRUE(stream != NULL);
+  EXPECT_EQ(-LOTHAR_ERROR_TIMEOUT, lothar_stream_read(stream, buf, sizeof(buf), &len));
+  EXPECT_EQ(0, lothar_stream_write(stream, buf, sizeof(buf)));
+  EXPECT_EQ(-LOTHAR_ERROR_TIMEOUT, lothar_stream_flush(stream));
+
+  lothar_stream_close(&stream);
+  lothar_connection_close(&brick);
+}
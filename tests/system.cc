@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "system.h"
+#include "commands.h"
+#include "simulator.h"
+#include "stats.h"
+
+using namespace std;
+
+namespace
+{
+  class SystemTest : public testing::Test
+  {
+  protected:
+    lothar_connection_t *d_brick;
+
+    void SetUp()
+    {
+      d_brick = lothar_connection_open_simulator();
+      lothar_simulator_set_manual_clock(d_brick, 1);
+      lothar_simulator_set_latency(d_brick, 1000);
+    }
+
+    void TearDown()
+    {
+      lothar_connection_close(&d_brick);
+    }
+
+    uint64_t time()
+    {
+      uint64_t us;
+      lothar_simulator_time(d_brick, &us);
+      return us;
+    }
+  };
+
+  vector<uint8_t> contents(size_t len)
+  {
+    vector<uint8_t> result(len);
+
+    for(size_t i = 0; i < len; ++i)
+      result[i] = i * 7 + 3;
+
+    return result;
+  }
+}
+
+TEST_F(SystemTest, Commands)
+{
+  uint8_t const data[] = "hello";
+  uint8_t handle, buf[8];
+  uint32_t size;
+  size_t len;
+  char name[LOTHAR_MAX_FILENAME + 1];
+
+  ASSERT_EQ(0, lothar_openwrite(d_brick, "hello.txt", 5, &handle));
+  EXPECT_EQ(0, lothar_filewrite(d_brick, handle, data, 5, &len));
+  EXPECT_EQ(5u, len);
+  EXPECT_EQ(0, lothar_fileclose(d_brick, handle));
+
+  EXPECT_EQ(-LOTHAR_ERROR_FILE_EXISTS, lothar_openwrite(d_brick, "hello.txt", 5, &handle));
+
+  ASSERT_EQ(0, lothar_openread(d_brick, "hello.txt", &handle, &size));
+  EXPECT_EQ(5u, size);
+  EXPECT_EQ(0, lothar_fileread(d_brick, handle, buf, 5, &len));
+  EXPECT_EQ(5u, len);
+  EXPECT_EQ(0, memcmp(buf, data, 5));
+  EXPECT_EQ(0, lothar_fileclose(d_brick, handle));
+
+  ASSERT_EQ(0, lothar_findfirst(d_brick, "*.txt", &handle, name, &size));
+  EXPECT_STREQ("hello.txt", name);
+  EXPECT_EQ(-LOTHAR_ERROR_FILE_NOT_FOUND, lothar_findnext(d_brick, handle, name, &size));
+  EXPECT_EQ(0, lothar_fileclose(d_brick, handle));
+
+  EXPECT_EQ(0, lothar_filedelete(d_brick, "hello.txt"));
+  EXPECT_EQ(-LOTHAR_ERROR_FILE_NOT_FOUND, lothar_openread(d_brick, "hello.txt", &handle, &size));
+  EXPECT_EQ(-LOTHAR_ERROR_FILENAME_TOO_LONG, lothar_filedelete(d_brick, "a_much_too_long_name.rxe"));
+}
+
+TEST_F(SystemTest, UploadDownload)
+{
+  vector<uint8_t> const data = contents(1000);
+  vector<uint8_t> back(2000);
+  size_t len;
+
+  ASSERT_EQ(0, lothar_upload(d_brick, "program.rxe", &data[0], data.size()));
+  ASSERT_EQ(0, lothar_download(d_brick, "program.rxe", &back[0], back.size(), &len));
+  ASSERT_EQ(data.size(), len);
+  EXPECT_TRUE(equal(data.begin(), data.end(), back.begin()));
+
+  // replacing it
+  ASSERT_EQ(0, lothar_upload(d_brick, "program.rxe", &data[0], 100));
+  EXPECT_EQ(-LOTHAR_ERROR_BUFFER_TOO_SMALL, lothar_download(d_brick, "program.rxe", &back[0], 50, &len));
+  EXPECT_EQ(100u, len);
+
+  EXPECT_EQ(-LOTHAR_ERROR_FILE_NOT_FOUND, lothar_download(d_brick, "missing.rso", &back[0], back.size(), &len));
+}
+
+TEST_F(SystemTest, ChunksInFlight)
+{
+  vector<uint8_t> const data = contents(40 * LOTHAR_MAX_FILEWRITE);
+  lothar_opcode_stats_t writes;
+  uint64_t start = time();
+
+  ASSERT_EQ(0, lothar_upload(d_brick, "sound.rso", &data[0], data.size()));
+
+  // maximal chunks, and many of them per round trip (open, the writes and close, at 1 ms each if they went one by one)
+  lothar_connection_stats(d_brick, 0x83, &writes);
+  EXPECT_EQ(40u, writes.requests);
+  EXPECT_LT(time() - start, 10000u);
+}
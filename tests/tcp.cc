@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include "tcp.h"
+#include "simulator.h"
+#include "commands.h"
+#include "utils.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std;
+
+class TCPTest : public testing::Test
+{
+protected:
+  lothar_connection_t *simulator;
+  lothar_bridge_t *bridge;
+  lothar_connection_t *connection;
+
+  void SetUp()
+  {
+    uint16_t port = 0;
+
+    simulator = lothar_connection_open_simulator();
+    bridge = lothar_bridge_open(simulator, 0);
+    ASSERT_TRUE(bridge != NULL);
+    ASSERT_EQ(0, lothar_bridge_port(bridge, &port));
+
+    connection = lothar_connection_open_tcp("127.0.0.1", port);
+    ASSERT_TRUE(connection != NULL);
+  }
+
+  void TearDown()
+  {
+    lothar_connection_close(&connection);
+    if(bridge)
+      lothar_bridge_close(&bridge);
+    lothar_connection_close(&simulator);
+  }
+};
+
+TEST_F(TCPTest, Commands)
+{
+  uint16_t voltage = 0;
+  uint8_t data[59];
+  uint8_t len = 0;
+
+  lothar_simulator_set_battery(simulator, 7321);
+
+  EXPECT_EQ(0, lothar_getbatterylevel(connection, &voltage));
+  EXPECT_EQ(7321, voltage);
+
+  // a command without a reply, and an error
+  EXPECT_EQ(0, lothar_playtone(connection, 440, 100));
+  EXPECT_EQ(-LOTHAR_ERROR_MAILBOX_QUEUE_EMPTY, lothar_messageread(connection, 2, 0, 1, data, &len));
+
+  EXPECT_EQ(0, lothar_messagewrite(connection, 2, (uint8_t const *)"tcp", 4));
+  EXPECT_EQ(0, lothar_messageread(connection, 2, 0, 1, data, &len));
+  EXPECT_EQ(4, len);
+  EXPECT_STREQ("tcp", (char const *)data);
+}
+
+TEST_F(TCPTest, Pipeline)
+{
+  uint16_t voltage[LOTHAR_MAX_PENDING];
+  size_t requests = 0;
+
+  EXPECT_EQ(0, lothar_pipeline_begin(connection));
+  for(int i = 0; i < LOTHAR_MAX_PENDING; ++i)
+  {
+    voltage[i] = 0;
+    EXPECT_EQ(0, lothar_getbatterylevel(connection, voltage + i));
+  }
+  EXPECT_EQ(0, lothar_pipeline_end(connection));
+
+  for(int i = 0; i < LOTHAR_MAX_PENDING; ++i)
+    EXPECT_EQ(7800, voltage[i]);
+
+  EXPECT_EQ(0, lothar_simulator_requests(simulator, &requests));
+  EXPECT_EQ((size_t)LOTHAR_MAX_PENDING, requests);
+}
+
+TEST_F(TCPTest, Combine)
+{
+  uint8_t data[59];
+  uint8_t len = 0;
+
+  // the messages travel in one segment, and are passed on to the brick one by one, in order
+  EXPECT_EQ(0, lothar_combine_begin(connection));
+  EXPECT_EQ(0, lothar_messagewrite(connection, 3, (uint8_t const *)"one", 4));
+  EXPECT_EQ(0, lothar_messagewrite(connection, 3, (uint8_t const *)"two", 4));
+  EXPECT_EQ(0, lothar_messagewrite(connection, 3, (uint8_t const *)"six", 4));
+  EXPECT_EQ(0, lothar_combine_end(connection));
+
+  EXPECT_EQ(0, lothar_messageread(connection, 3, 0, 1, data, &len));
+  EXPECT_STREQ("one", (char const *)data);
+  EXPECT_EQ(0, lothar_messageread(connection, 3, 0, 1, data, &len));
+  EXPECT_STREQ("two", (char const *)data);
+  EXPECT_EQ(0, lothar_messageread(connection, 3, 0, 1, data, &len));
+  EXPECT_STREQ("six", (char const *)data);
+}
+
+TEST_F(TCPTest, PartialFrame)
+{
+  struct sockaddr_in addr;
+  uint16_t port = 0;
+  int sock;
+
+  // the bridge serves one client at a time
+  ASSERT_EQ(0, lothar_bridge_port(bridge, &port));
+  lothar_connection_close(&connection);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_port = htons(port);
+
+  // the size of a telegram, and only half of it
+  ASSERT_LE(0, sock = socket(AF_INET, SOCK_STREAM, 0));
+  ASSERT_EQ(0, connect(sock, (struct sockaddr *)&addr, sizeof(addr)));
+  EXPECT_EQ(3, send(sock, "\x04\x00\x00", 3, 0));
+  lothar_usleep(100000);
+
+  // the bridge does not wait for the rest
+  EXPECT_EQ(0, lothar_bridge_close(&bridge));
+
+  close(sock);
+}
+
+TEST_F(TCPTest, NoBridge)
+{
+  EXPECT_EQ(NULL, lothar_connection_open_tcp("127.0.0.1", 1));
+  EXPECT_EQ(NULL, lothar_bridge_open(NULL, 0));
+}
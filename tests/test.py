@@ -18,37 +18,8 @@ def dumpbinary(buf):
             i = 0
     sys.stderr.write('\n')
 
-class Foon:
-    def __init__(self, host = 'nerdfoon', port = 3001):
-        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
-
-        self.sock.connect((host, port))
-
-    def write(self, buf):
-        try:
-            sizebuf = struct.pack('<H', len(buf))
-            self.sock.sendall(sizebuf + buf)
-            return len(buf)
-        except Exception, e:
-            print e
-            return -1
-        
-    def read(self, n):
-        try:
-            sizebuf = self.sock.recv(2)
-            size = struct.unpack('<H', sizebuf)[0]
-            buf = self.sock.recv(size)
-            return buf
-        except Exception, e:
-            print e
-            return ''
-    
-    def close(self):
-        self.sock.close()
-        return 0
-    
-#foon = Foon()
+# a brick on another machine, served by lothar-bridge
+#c = connection(host = 'nerdfoon', port = 3001)
 c = connection(usb = True)
 
 print c.getbatterylevel()
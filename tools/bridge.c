@@ -0,0 +1,43 @@
+#include "lothar.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* lothar-bridge [port [bluetooth address]]
+ *
+ * Serve the brick attached to this machine over TCP, to lothar_connection_open_tcp() on another one. The brick is
+ * found over usb (or bluetooth) unless an address is given.
+ */
+
+int main(int argc, char **argv)
+{
+  lothar_connection_t *brick;
+  lothar_bridge_t *bridge;
+  uint16_t port = argc > 1 ? (uint16_t)atoi(argv[1]) : 3001;
+
+  if(argc > 2)
+    brick = lothar_connection_open_bluetooth_address(argv[2]);
+  else
+    brick = lothar_connection_open();
+
+  if(!brick)
+  {
+    fprintf(stderr, "no brick found: %s\n", lothar_strerror(lothar_errno));
+    return 1;
+  }
+
+  if(!(bridge = lothar_bridge_open(brick, port)))
+  {
+    fprintf(stderr, "cannot listen on port %u: %s\n", (unsigned)port, lothar_strerror(lothar_errno));
+    lothar_connection_close(&brick);
+    return 1;
+  }
+
+  lothar_bridge_port(bridge, &port);
+  printf("serving on port %u\n", (unsigned)port);
+
+  // until killed
+  for(;;)
+    lothar_usleep(1000000);
+
+  return 0;
+}
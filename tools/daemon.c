@@ -0,0 +1,41 @@
+#include "lothar.h"
+#include <stdio.h>
+
+/* lothar-daemon [socket [bluetooth address]]
+ *
+ * Share the brick attached to this machine between processes, which connect with lothar_connection_open_daemon(). The
+ * brick is found over usb (or bluetooth) unless an address is given.
+ */
+
+int main(int argc, char **argv)
+{
+  lothar_connection_t *brick;
+  lothar_daemon_t *daemon;
+  char const *path = argc > 1 ? argv[1] : LOTHAR_DAEMON_PATH;
+
+  if(argc > 2)
+    brick = lothar_connection_open_bluetooth_address(argv[2]);
+  else
+    brick = lothar_connection_open();
+
+  if(!brick)
+  {
+    fprintf(stderr, "no brick found: %s\n", lothar_strerror(lothar_errno));
+    return 1;
+  }
+
+  if(!(daemon = lothar_daemon_open(brick, path)))
+  {
+    fprintf(stderr, "cannot serve on %s: %s\n", path, lothar_strerror(lothar_errno));
+    lothar_connection_close(&brick);
+    return 1;
+  }
+
+  printf("serving on %s\n", path);
+
+  // until killed
+  for(;;)
+    lothar_usleep(1000000);
+
+  return 0;
+}
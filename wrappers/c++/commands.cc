@@ -14,21 +14,23 @@ void lothar::getinputvalues(Connection &connection,
                             int16_t *scaledvalue,
                             int16_t *calibratedvalue)
 {
-  uint8_t validu;
-  uint8_t calibratedu;
-  check_return(lothar_getinputvalues(connection,
-                                     port,
-                                     valid ? &validu : NULL,
-                                     calibrated ? & calibratedu : NULL,
-                                     type,
-                                     mode,
-                                     rawvalue,
-                                     normvalue,
-                                     scaledvalue,
-                                     calibratedvalue));
+  // valid and calibrated are translated here, so this cannot wait for the end of a pipeline
+  inputvalues values = readinputvalues(connection, port);
 
   if(valid)
-    *valid = validu;
+    *valid = values.valid;
   if(calibrated)
-    *calibrated = calibratedu;
+    *calibrated = values.calibrated;
+  if(type)
+    *type = values.type;
+  if(mode)
+    *mode = values.mode;
+  if(rawvalue)
+    *rawvalue = values.rawvalue;
+  if(normvalue)
+    *normvalue = values.normvalue;
+  if(scaledvalue)
+    *scaledvalue = values.scaledvalue;
+  if(calibratedvalue)
+    *calibratedvalue = values.calibratedvalue;
 }
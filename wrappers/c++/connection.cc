@@ -1,4 +1,8 @@
 #include "connection.hh"
+#include "commands.h"
+#include "simulator.h"
+#include "tcp.h"
+#include "daemon.h"
 
 using namespace std;
 using namespace lothar;
@@ -26,6 +30,12 @@ ConnectionPtr Connection::create_connection()
   return result;
 }
 
+void Connection::set_timeout(uint32_t ms)
+{
+  if(lothar_connection_set_timeout(get_connection(), ms) < 0)
+    throw Error(lothar_errno);
+}
+
 USBConnection::USBConnection()
 {
   lothar_connection_t *connection = lothar_connection_open_usb();
@@ -62,6 +72,29 @@ BluetoothConnection::BluetoothConnection(char const *address)
     set_connection(connection);
 }
 
+TCPConnection::TCPConnection(char const *host, uint16_t port)
+{
+  lothar_connection_t *connection = lothar_connection_open_tcp(host, port);
+  if(!connection)
+    throw Error(lothar_errno);
+  else
+    set_connection(connection);
+}
+
+DaemonConnection::DaemonConnection(char const *path)
+{
+  lothar_connection_t *connection = lothar_connection_open_daemon(path);
+  if(!connection)
+    throw Error(lothar_errno);
+  else
+    set_connection(connection);
+}
+
+SimulatorConnection::SimulatorConnection()
+{
+  set_connection(lothar_connection_open_simulator());
+}
+
 namespace 
 {
   int read_cb(void *_connection, uint8_t *data, size_t len)
@@ -87,7 +120,8 @@ lothar_connection_vtable CustomConnection::s_vtable =
 {
   read_cb,
   write_cb,
-  close_cb
+  close_cb,
+  NULL
 };
 
 CustomConnection::CustomConnection()
@@ -106,6 +140,7 @@ CustomConnection::~CustomConnection()
   // this is of course hacky, we depend on assumptions about lothar_connection_close, and a derived
   // class may forget to clean up itself.
 
+  lothar_io_thread_stop(get_connection());
   free(get_connection());
   set_connection(NULL);
 }
@@ -2,9 +2,16 @@
 #define LOTHAR_COMMANDS_HH
 
 #include "commands.h"
+#include "codec.h"
+#include "replies.h"
 #include "connection.hh"
 #include "utils.hh"
 
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define LOTHAR_HAVE_CODEC
+#include <array>
+#endif
+
 /** \file commands.hh
  *
  * These are just redeclarations of the functions in commands.h in the lothar namespace
@@ -23,6 +30,136 @@
 namespace lothar
 {
 
+  /** \brief Start pipelining commands on a connection
+   *
+   * See lothar_pipeline_begin(), the output parameters of commands are only filled in by pipeline_sync() or
+   * pipeline_end(), so they must remain valid until then.
+   *
+   * The calls that return their result (like getbatterylevel(connection)), readoutputstate(), readinputvalues() and
+   * getinputvalues() still wait for their reply, see query().
+   */
+  inline void pipeline_begin(Connection &connection)
+  {
+    check_return(lothar_pipeline_begin(connection));
+  }
+
+  /** \brief Wait for all outstanding replies, but remain in pipelined mode
+   */
+  inline void pipeline_sync(Connection &connection)
+  {
+    check_return(lothar_pipeline_sync(connection));
+  }
+
+  /** \brief Wait for all outstanding replies, and leave pipelined mode
+   */
+  inline void pipeline_end(Connection &connection)
+  {
+    check_return(lothar_pipeline_end(connection));
+  }
+
+  /** \brief The number of requests still waiting for their reply
+   */
+  inline size_t pipeline_pending(Connection const &connection)
+  {
+    size_t result;
+    check_return(lothar_pipeline_pending(connection, &result));
+    return result;
+  }
+
+  /** \brief Give the connection its own I/O thread, so several threads can send commands on it at once
+   *
+   * See lothar_io_thread_start()
+   */
+  inline void io_thread_start(Connection &connection)
+  {
+    check_return(lothar_io_thread_start(connection));
+  }
+
+  /** \brief Leave threaded mode, after all submitted requests are completed
+   */
+  inline void io_thread_stop(Connection &connection)
+  {
+    check_return(lothar_io_thread_stop(connection));
+  }
+
+  /** \brief The state of an output port, see getoutputstate_async() */
+  typedef lothar_outputstate_t outputstate;
+
+  /** \brief The values of a sensor, see getinputvalues_async() */
+  typedef lothar_inputvalues_t inputvalues;
+
+  /** \brief Deliver replies to the callbacks of asynchronous commands, until at most pending requests are outstanding
+   *
+   * See lothar_async_dispatch(), this throws the first error reported to a callback.
+   */
+  inline void async_dispatch(Connection &connection, size_t pending = 0)
+  {
+    check_return(lothar_async_dispatch(connection, pending));
+  }
+
+  /** \brief Asynchronous getoutputstate(), see lothar_getoutputstate_async()
+   *
+   * The callback is invoked from a C context, it should not throw.
+   */
+  inline void getoutputstate_async(Connection &connection, output_port port, lothar_getoutputstate_callback callback, void *user)
+  {
+    check_return(lothar_getoutputstate_async(connection, port, callback, user));
+  }
+
+  /** \brief Asynchronous getinputvalues()
+   */
+  inline void getinputvalues_async(Connection &connection, input_port port, lothar_getinputvalues_callback callback, void *user)
+  {
+    check_return(lothar_getinputvalues_async(connection, port, callback, user));
+  }
+
+  /** \brief Asynchronous getbatterylevel()
+   */
+  inline void getbatterylevel_async(Connection &connection, lothar_getbatterylevel_callback callback, void *user)
+  {
+    check_return(lothar_getbatterylevel_async(connection, callback, user));
+  }
+
+  /** \brief Asynchronous keepalive()
+   */
+  inline void keepalive_async(Connection &connection, lothar_keepalive_callback callback, void *user)
+  {
+    check_return(lothar_keepalive_async(connection, callback, user));
+  }
+
+  /** \brief Asynchronous lsgetstatus()
+   */
+  inline void lsgetstatus_async(Connection &connection, input_port port, lothar_lsgetstatus_callback callback, void *user)
+  {
+    check_return(lothar_lsgetstatus_async(connection, port, callback, user));
+  }
+
+  /** \brief Asynchronous lsread()
+   */
+  inline void lsread_async(Connection &connection, input_port port, lothar_lsread_callback callback, void *user)
+  {
+    check_return(lothar_lsread_async(connection, port, callback, user));
+  }
+
+  /** \brief Asynchronous getcurrentprogramname()
+   */
+  inline void getcurrentprogramname_async(Connection &connection, lothar_getcurrentprogramname_callback callback, void *user)
+  {
+    check_return(lothar_getcurrentprogramname_async(connection, callback, user));
+  }
+
+  /** \brief Asynchronous messageread()
+   */
+  inline void messageread_async(Connection &connection, 
+                                uint8_t remoteinbox, 
+                                uint8_t localinbox, 
+                                uint8_t remove, 
+                                lothar_messageread_callback callback, 
+                                void *user)
+  {
+    check_return(lothar_messageread_async(connection, remoteinbox, localinbox, remove, callback, user));
+  }
+
   /** \brief Start a program with the given name.
    */
   inline void startprogram(Connection &connection, char const *filename)
@@ -102,6 +239,20 @@ namespace lothar
                                      sensormode));
   }
 
+  /** \brief Send a query and wait for its reply, even when pipelining (see lothar_transact())
+   *
+   * For the calls that return their result, or translate it after the call, which cannot leave that to the end of the
+   * pipeline.
+   *
+   * \param port  the port field of the request, or -1 if the command has none
+   * \param reply at least the reply size of the command
+   */
+  inline void query(Connection &connection, uint8_t opcode, int port, uint8_t *reply, size_t size)
+  {
+    uint8_t const request[] = {LOTHAR_CODEC_REPLY, opcode, uint8_t(port)};
+    check_return(lothar_transact(connection, request, port < 0 ? 2 : 3, reply, size));
+  }
+
   /** \brief Inspect a motor
    *
    * This returns the arguments that were given by lothar_setoutputstate as input, in addition:
@@ -134,6 +285,20 @@ namespace lothar
                                        rotationcount));
   }
 
+  /** \brief Inspect a motor, all of its state at once, see lothar_readoutputstate()
+   */
+  inline outputstate readoutputstate(Connection &connection, output_port port)
+  {
+    uint8_t reply[LOTHAR_REPLY_SIZE_GETOUTPUTSTATE];
+    outputstate state;
+
+    query(connection, LOTHAR_OPCODE_GETOUTPUTSTATE, port, reply, sizeof(reply));
+    check_return(lothar_outputstate_decode(reply, sizeof(reply), &state));
+    if(state.port != port) // the brick answers for the port it was asked about
+      throw Error(LOTHAR_ERROR_UNKOWN_ERROR);
+    return state;
+  }
+
   /** \brief Read a sensor
    *
    * \param port            The input port
@@ -157,6 +322,20 @@ namespace lothar
                       int16_t *scaledvalue = NULL,
                       int16_t *calibratedvalue = NULL);
 
+  /** \brief Read a sensor, all of its values at once, see lothar_readinputvalues()
+   */
+  inline inputvalues readinputvalues(Connection &connection, input_port port)
+  {
+    uint8_t reply[LOTHAR_REPLY_SIZE_GETINPUTVALUES];
+    inputvalues values;
+
+    query(connection, LOTHAR_OPCODE_GETINPUTVALUES, port, reply, sizeof(reply));
+    check_return(lothar_inputvalues_decode(reply, sizeof(reply), &values));
+    if(values.port != port) // the brick answers for the port it was asked about
+      throw Error(LOTHAR_ERROR_UNKOWN_ERROR);
+    return values;
+  }
+
   /** \brief Reset a a scaled value
    */
   inline void resetinputscaledvalue(Connection &connection, input_port port)
@@ -198,9 +377,10 @@ namespace lothar
    */
   inline uint16_t getbatterylevel(Connection &connection)
   {
-    uint16_t result;
-    getbatterylevel(connection, &result);
-    return result;
+    uint8_t reply[LOTHAR_REPLY_SIZE_GETBATTERYLEVEL];
+
+    query(connection, LOTHAR_OPCODE_GETBATTERYLEVEL, -1, reply, sizeof(reply));
+    return lothar_getbatterylevel_reply_voltage(reply);
   }
 
   /** \brief Stop sound playback
@@ -219,9 +399,10 @@ namespace lothar
 
   inline uint32_t keepalive(Connection &connection)
   {
-    uint32_t result;
-    keepalive(connection, &result);
-    return result;
+    uint8_t reply[LOTHAR_REPLY_SIZE_KEEPALIVE];
+
+    query(connection, LOTHAR_OPCODE_KEEPALIVE, -1, reply, sizeof(reply));
+    return lothar_keepalive_reply_sleeptime(reply);
   }
 
   /** \brief Get the number of bytes ready to receive
@@ -272,6 +453,211 @@ namespace lothar
   {
     check_return(lothar_messageread(connection, remoteinbox, localinbox, remove, data, len));
   }
+
+#ifdef LOTHAR_HAVE_CODEC
+
+  /** \brief Commands as values, generated from the table in codec.h
+   *
+   * A command object holds the whole request of a command, in a std::array of exactly the size the table gives it. The
+   * objects are constexpr, a command built from constants is encoded at compile time, and building one that does not
+   * fill its request does not compile; so there is nothing left to check at run time. Send them with send() or
+   * transact(), read the replies with the accessors of codec.h.
+   *
+   * \code
+   * constexpr auto brake = lothar::codec::setoutputstate(OUTPUT_A, 0, MOTOR_MODE_BRAKE, REGULATION_MODE_IDLE, 0,
+   *                                                      RUNSTATE_RUNNING, 0);
+   * lothar::send(connection, brake);
+   * \endcode
+   *
+   * Only the commands of a fixed size have objects.
+   */
+  namespace codec
+  {
+    /** \brief What the table says about a command
+     */
+    template <uint8_t Opcode>
+    struct traits;
+
+#define LOTHAR_CODEC_TRAITS(NAME, opcode, type_, request, reply, flags_)	\
+    template <>								\
+    struct traits<opcode>						\
+    {									\
+      static constexpr uint8_t type = type_;				\
+      static constexpr size_t request_size = request;			\
+      static constexpr size_t reply_size = reply;			\
+      static constexpr unsigned flags = flags_;				\
+    };
+
+    LOTHAR_CODEC_COMMANDS(LOTHAR_CODEC_TRAITS)
+
+#undef LOTHAR_CODEC_TRAITS
+
+    /** \brief The request of a command, ready to be sent
+     */
+    template <uint8_t Opcode>
+    struct command
+    {
+      static_assert(!(traits<Opcode>::flags & LOTHAR_CODEC_VARIABLE_REQUEST), "only the commands of a fixed size are objects");
+
+      typedef std::array<uint8_t, traits<Opcode>::request_size> request_type;
+      typedef std::array<uint8_t, traits<Opcode>::reply_size> reply_type;
+
+      request_type request;
+    };
+
+    /** \brief Encode a command from the bytes of its fields, the type and the opcode come from the table
+     */
+    template <uint8_t Opcode, typename... Bytes>
+    constexpr command<Opcode> encode(Bytes... bytes)
+    {
+      static_assert(sizeof...(Bytes) + 2 == traits<Opcode>::request_size, "the fields do not fill the request");
+      return command<Opcode>{{{traits<Opcode>::type, Opcode, static_cast<uint8_t>(bytes)...}}};
+    }
+
+    /** \brief Byte n (counting from the least significant) of a value, the NXT sends the least significant first
+     */
+    constexpr uint8_t byte(uint32_t value, unsigned n)
+    {
+      return static_cast<uint8_t>(value >> (8 * n));
+    }
+
+    constexpr int clamp(int value, int min, int max)
+    {
+      return value < min ? min : (value > max ? max : value);
+    }
+
+    /** \brief See lothar::stopprogram() */
+    constexpr command<LOTHAR_OPCODE_STOPPROGRAM> stopprogram()
+    {
+      return encode<LOTHAR_OPCODE_STOPPROGRAM>();
+    }
+
+    /** \brief See lothar::playtone(), the frequency is clamped to 200-14000 Hz like there */
+    constexpr command<LOTHAR_OPCODE_PLAYTONE> playtone(uint16_t frequency, uint16_t duration)
+    {
+      return encode<LOTHAR_OPCODE_PLAYTONE>(byte(clamp(frequency, 200, 14000), 0),
+					    byte(clamp(frequency, 200, 14000), 1),
+					    byte(duration, 0),
+					    byte(duration, 1));
+    }
+
+    /** \brief See lothar::setoutputstate(), power and turnratio are clamped to -100-100 like there */
+    constexpr command<LOTHAR_OPCODE_SETOUTPUTSTATE> setoutputstate(output_port port,
+								  int8_t power,
+								  output_motor_mode motormode,
+								  output_regulation_mode regulationmode,
+								  int8_t turnratio,
+								  output_runstate runstate,
+								  uint32_t tacholimit)
+    {
+      return encode<LOTHAR_OPCODE_SETOUTPUTSTATE>(port,
+						  clamp(power, -100, 100),
+						  motormode,
+						  regulationmode,
+						  clamp(turnratio, -100, 100),
+						  runstate,
+						  byte(tacholimit, 0),
+						  byte(tacholimit, 1),
+						  byte(tacholimit, 2),
+						  byte(tacholimit, 3));
+    }
+
+    /** \brief See lothar::setinputmode() */
+    constexpr command<LOTHAR_OPCODE_SETINPUTMODE> setinputmode(input_port port, sensor_type sensortype, sensor_mode sensormode)
+    {
+      return encode<LOTHAR_OPCODE_SETINPUTMODE>(port, sensortype, sensormode);
+    }
+
+    /** \brief See lothar::getoutputstate() */
+    constexpr command<LOTHAR_OPCODE_GETOUTPUTSTATE> getoutputstate(output_port port)
+    {
+      return encode<LOTHAR_OPCODE_GETOUTPUTSTATE>(port);
+    }
+
+    /** \brief See lothar::getinputvalues() */
+    constexpr command<LOTHAR_OPCODE_GETINPUTVALUES> getinputvalues(input_port port)
+    {
+      return encode<LOTHAR_OPCODE_GETINPUTVALUES>(port);
+    }
+
+    /** \brief See lothar::resetinputscaledvalue() */
+    constexpr command<LOTHAR_OPCODE_RESETINPUTSCALEDVALUE> resetinputscaledvalue(input_port port)
+    {
+      return encode<LOTHAR_OPCODE_RESETINPUTSCALEDVALUE>(port);
+    }
+
+    /** \brief See lothar::resetmotorposition() */
+    constexpr command<LOTHAR_OPCODE_RESETMOTORPOSITION> resetmotorposition(output_port port, bool relative)
+    {
+      return encode<LOTHAR_OPCODE_RESETMOTORPOSITION>(port, relative ? 1 : 0);
+    }
+
+    /** \brief See lothar::getbatterylevel() */
+    constexpr command<LOTHAR_OPCODE_GETBATTERYLEVEL> getbatterylevel()
+    {
+      return encode<LOTHAR_OPCODE_GETBATTERYLEVEL>();
+    }
+
+    /** \brief See lothar::stopsoundplayback() */
+    constexpr command<LOTHAR_OPCODE_STOPSOUNDPLAYBACK> stopsoundplayback()
+    {
+      return encode<LOTHAR_OPCODE_STOPSOUNDPLAYBACK>();
+    }
+
+    /** \brief See lothar::keepalive() */
+    constexpr command<LOTHAR_OPCODE_KEEPALIVE> keepalive()
+    {
+      return encode<LOTHAR_OPCODE_KEEPALIVE>();
+    }
+
+    /** \brief See lothar::lsgetstatus() */
+    constexpr command<LOTHAR_OPCODE_LSGETSTATUS> lsgetstatus(input_port port)
+    {
+      return encode<LOTHAR_OPCODE_LSGETSTATUS>(port);
+    }
+
+    /** \brief See lothar::lsread() */
+    constexpr command<LOTHAR_OPCODE_LSREAD> lsread(input_port port)
+    {
+      return encode<LOTHAR_OPCODE_LSREAD>(port);
+    }
+
+    /** \brief See lothar::getcurrentprogramname() */
+    constexpr command<LOTHAR_OPCODE_GETCURRENTPROGRAMNAME> getcurrentprogramname()
+    {
+      return encode<LOTHAR_OPCODE_GETCURRENTPROGRAMNAME>();
+    }
+
+    /** \brief See lothar::messageread() */
+    constexpr command<LOTHAR_OPCODE_MESSAGEREAD> messageread(uint8_t remoteinbox, uint8_t localinbox, bool remove)
+    {
+      return encode<LOTHAR_OPCODE_MESSAGEREAD>(remoteinbox, localinbox, remove ? 1 : 0);
+    }
+  }
+
+  /** \brief Send a command object that is not answered, see lothar_transact()
+   */
+  template <uint8_t Opcode>
+  inline void send(Connection &connection, codec::command<Opcode> const &command)
+  {
+    static_assert(codec::traits<Opcode>::type == LOTHAR_CODEC_NO_REPLY, "this command is answered, use transact()");
+    check_return(lothar_transact(connection, command.request.data(), command.request.size(), NULL, 0));
+  }
+
+  /** \brief Send a command object and wait for its reply, see lothar_transact()
+   *
+   * This waits for the reply even while pipelining (after the replies to the requests sent before it).
+   */
+  template <uint8_t Opcode>
+  inline void transact(Connection &connection,
+		       codec::command<Opcode> const &command,
+		       typename codec::command<Opcode>::reply_type &reply)
+  {
+    static_assert(codec::traits<Opcode>::type != LOTHAR_CODEC_NO_REPLY, "this command is not answered, use send()");
+    check_return(lothar_transact(connection, command.request.data(), command.request.size(), reply.data(), reply.size()));
+  }
+
+#endif // LOTHAR_HAVE_CODEC
 }
 
 #endif // LOTHAR_COMMANDS_HH
@@ -2,6 +2,7 @@
 #define LOTHAR_CONNECTION_HH
 
 #include "connection.h"
+#include "daemon.h"
 #include "utils.hh"
 
 namespace lothar
@@ -56,6 +57,12 @@ namespace lothar
       return get_connection();
     }
 
+    /** \brief Give up on a read or write that takes longer than ms milliseconds, 0 to wait forever
+     *
+     * \throws Error on failure
+     */
+    void set_timeout(uint32_t ms);
+
     /** \brief Try to automatically open a connection.
      *
      * \returns A pointer to a bluetooth connection if possible, if not a pointer to a usb connection if possible. NULL if everything fails.
@@ -117,6 +124,59 @@ namespace lothar
     }
   };
 
+  /** \brief Connection to a brick on another machine, through a bridge (see tcp.h)
+   */
+  class TCPConnection : public Connection
+  {
+  protected:
+    TCPConnection(char const *host, uint16_t port);
+  public:
+    /** \brief Open a connection to the bridge at host:port
+     *
+     * \throws Error if the connection failed.
+     */
+    static ConnectionPtr create(char const *host, uint16_t port)
+    {
+      return ConnectionPtr(new TCPConnection(host, port));
+    }
+  };
+
+  /** \brief Connection to a brick shared by a daemon (see daemon.h)
+   */
+  class DaemonConnection : public Connection
+  {
+  protected:
+    DaemonConnection(char const *path);
+  public:
+    /** \brief Open a connection to the daemon listening on path
+     *
+     * \throws Error if the connection failed.
+     */
+    static ConnectionPtr create(char const *path = LOTHAR_DAEMON_PATH)
+    {
+      return ConnectionPtr(new DaemonConnection(path));
+    }
+  };
+
+  /** \brief Connection to a simulated brick
+   *
+   * Configure the simulator with the lothar_simulator_* functions of simulator.h, a SimulatorConnection converts to the
+   * lothar_connection_t they take.
+   */
+  class SimulatorConnection : public Connection
+  {
+  protected:
+    SimulatorConnection();
+
+  public:
+    /** \brief Open a connection to a new simulated brick
+     */
+    static ConnectionPtr create()
+    {
+      return ConnectionPtr(new SimulatorConnection);
+    }
+  };
+
   /** \brief Interface class to create your own custom connections
    */
   class CustomConnection : public Connection
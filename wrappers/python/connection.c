@@ -104,16 +104,21 @@ static int connection_init(connection_t *self, PyObject *args, PyObject *kwds)
 {
   PyObject *do_bt = NULL;
   PyObject *do_usb = NULL;
+  PyObject *do_simulator = NULL;
 
   char const *address = BLUETOOTH_NXT_ADDRESS;
   unsigned vid = USB_VENDOR_LEGO;
   unsigned pid = USB_PRODUCT_NXT;
 
+  char const *host = NULL;
+  unsigned port = 0;
+  char const *daemon = NULL;
+
   PyObject *custom = NULL;
 
-  static char *kwlist[] = {"bluetooth", "usb", "address", "vid", "pid", "custom", NULL};
+  static char *kwlist[] = {"bluetooth", "usb", "address", "vid", "pid", "custom", "simulator", "host", "port", "daemon", NULL};
 
-  if(!PyArg_ParseTupleAndKeywords(args, kwds, "|OOsIIO", kwlist, &do_bt, &do_usb, &address, &vid, &pid, &custom))
+  if(!PyArg_ParseTupleAndKeywords(args, kwds, "|OOsIIOOsIs", kwlist, &do_bt, &do_usb, &address, &vid, &pid, &custom, &do_simulator, &host, &port, &daemon))
     return -1;
 
   self->d_connection = NULL;
@@ -130,6 +135,21 @@ static int connection_init(connection_t *self, PyObject *args, PyObject *kwds)
     LOTHAR_INFO("attemping bluetooth connection to %s\n", address);
     self->d_connection = lothar_connection_open_bluetooth_address(address);
   }  
+  else if(do_simulator && PyObject_IsTrue(do_simulator))
+  {
+    LOTHAR_INFO("opening simulator\n");
+    self->d_connection = lothar_connection_open_simulator();
+  }
+  else if(host)
+  {
+    LOTHAR_INFO("attempting tcp connection to %s:%u\n", host, port);
+    self->d_connection = lothar_connection_open_tcp(host, (uint16_t)port);
+  }
+  else if(daemon)
+  {
+    LOTHAR_INFO("attempting connection to the daemon at %s\n", daemon);
+    self->d_connection = lothar_connection_open_daemon(daemon);
+  }
   else if(custom)
   {
     LOTHAR_INFO("attempting custom connection\n");
@@ -224,6 +244,17 @@ static PyObject *connection_read(connection_t *self, PyObject *arg)
   return result;
 }
 
+static PyObject *connection_settimeout(connection_t *self, PyObject *arg)
+{
+  if(!PyInt_Check(arg))
+  {
+    PyErr_BadArgument();
+    return NULL;
+  }
+
+  return pylothar_check_return(lothar_connection_set_timeout(self->d_connection, PyInt_AsUnsignedLongMask(arg)));
+}
+
 /* the direct commands */
 
 static PyObject *connection_startprogram(connection_t *self, PyObject *arg)
@@ -537,6 +568,7 @@ static PyMethodDef connection_methods[] =
 {
   {"write", (PyCFunction)connection_write, METH_O, ""},
   {"read",  (PyCFunction)connection_read,  METH_O, ""},
+  {"settimeout", (PyCFunction)connection_settimeout, METH_O, ""},
 
   {"startprogram",          (PyCFunction)connection_startprogram,          METH_O,                       ""},
   {"stopprogram",           (PyCFunction)connection_stopprogram,           METH_NOARGS,                  ""},